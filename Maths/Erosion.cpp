@@ -0,0 +1,364 @@
+#include "pch.h"
+#include "Maths/Erosion.h"
+#include <chrono>
+
+namespace DXE {
+
+	namespace {
+
+		// Deterministic per tile droplet stream
+		struct ErosionRandom {
+			uint64_t State;
+
+			explicit ErosionRandom(uint64_t seed) : State(seed * 0x9E3779B97F4A7C15ull + 0xD1B54A32D192ED03ull) {}
+
+			uint32_t Next() {
+				State = State * 6364136223846793005ull + 1442695040888963407ull;
+				uint32_t xorshifted = static_cast<uint32_t>(((State >> 18u) ^ State) >> 27u);
+				uint32_t rot = static_cast<uint32_t>(State >> 59u);
+				return (xorshifted >> rot) | (xorshifted << ((32u - rot) & 31u));
+			}
+			// [0, 1)
+			float NextFloat() { return (Next() >> 8) * (1.f / 16777216.f); }
+		};
+
+		struct ErosionRegion {
+			int X0, Y0, X1, Y1; // [X0, X1) x [Y0, Y1)
+		};
+
+		// Square brush rows padded to a multiple of 4 so the SIMD loop has no tail
+		struct ErosionBrush {
+			int Radius = 0;
+			int Stride = 0; // padded row width
+			std::vector<float> Weights; // (2 * Radius + 1) rows of Stride
+
+			explicit ErosionBrush(int radius) : Radius(radius) {
+				int side = 2 * radius + 1;
+				Stride = (side + 3) & ~3;
+				Weights.assign(static_cast<size_t>(side) * Stride, 0.f);
+
+				float sum = 0.f;
+				for (int y = 0; y < side; ++y) {
+					for (int x = 0; x < side; ++x) {
+						float dx = static_cast<float>(x - radius);
+						float dy = static_cast<float>(y - radius);
+						float w = (std::max)(0.f, 1.f - sqrtf(dx * dx + dy * dy) / (radius + 1.f));
+						Weights[x + Stride * y] = w;
+						sum += w;
+					}
+				}
+				for (float& w : Weights) w /= sum;
+			}
+		};
+
+		struct ErosionField {
+			float* Heights;
+			int Width;
+			int Height;
+
+			float& At(int x, int y) const { return Heights[x + static_cast<size_t>(Width) * y]; }
+
+			// Bilinear height and gradient, (x, y) has to be at least one texel inside the right and bottom edge
+			float Sample(float x, float y, float& gx, float& gy) const {
+				int ix = static_cast<int>(x);
+				int iy = static_cast<int>(y);
+				float u = x - ix;
+				float v = y - iy;
+				const float* row = Heights + ix + static_cast<size_t>(Width) * iy;
+				float h00 = row[0];
+				float h10 = row[1];
+				float h01 = row[Width];
+				float h11 = row[Width + 1];
+				gx = (h10 - h00) * (1.f - v) + (h11 - h01) * v;
+				gy = (h01 - h00) * (1.f - u) + (h11 - h10) * u;
+				return h00 * (1.f - u) * (1.f - v) + h10 * u * (1.f - v) + h01 * (1.f - u) * v + h11 * u * v;
+			}
+		};
+
+		// Removes amount around (nodeX, nodeY) spread by the brush weights, returns what was actually removed
+		float ErodeBrush(const ErosionField& field, const ErosionRegion& region, const ErosionBrush& brush, int nodeX, int nodeY, float amount) {
+			const int r = brush.Radius;
+			const int side = 2 * r + 1;
+			const bool inside = nodeX - r >= region.X0 && nodeX - r + brush.Stride <= region.X1 && nodeY - r >= region.Y0 && nodeY + r < region.Y1;
+
+			if (inside) {
+				const __m128 amount4 = _mm_set1_ps(amount);
+				for (int y = 0; y < side; ++y) {
+					float* row = &field.At(nodeX - r, nodeY - r + y);
+					const float* weights = &brush.Weights[static_cast<size_t>(brush.Stride) * y];
+					for (int x = 0; x < brush.Stride; x += 4) {
+						__m128 h = _mm_loadu_ps(row + x);
+						_mm_storeu_ps(row + x, _mm_sub_ps(h, _mm_mul_ps(_mm_loadu_ps(weights + x), amount4)));
+					}
+				}
+				return amount;
+			}
+
+			// near the region edge, cells outside are skipped
+			float removed = 0.f;
+			for (int y = 0; y < side; ++y) {
+				int py = nodeY - r + y;
+				if (py < region.Y0 || py >= region.Y1) continue;
+				for (int x = 0; x < side; ++x) {
+					int px = nodeX - r + x;
+					if (px < region.X0 || px >= region.X1) continue;
+					float weighted = brush.Weights[x + static_cast<size_t>(brush.Stride) * y] * amount;
+					field.At(px, py) -= weighted;
+					removed += weighted;
+				}
+			}
+			return removed;
+		}
+
+		void Deposit(const ErosionField& field, float x, float y, float amount) {
+			int nodeX = static_cast<int>(x);
+			int nodeY = static_cast<int>(y);
+			float u = x - nodeX;
+			float v = y - nodeY;
+			field.At(nodeX, nodeY) += amount * (1.f - u) * (1.f - v);
+			field.At(nodeX + 1, nodeY) += amount * u * (1.f - v);
+			field.At(nodeX, nodeY + 1) += amount * (1.f - u) * v;
+			field.At(nodeX + 1, nodeY + 1) += amount * u * v;
+		}
+
+		// Runs count droplets starting inside owned, they may read and write anywhere in region.
+		// Returns the number of droplets stopped by the region edge.
+		uint64_t RunDroplets(const ErosionField& field, const ErosionRegion& owned, const ErosionRegion& region, const ErosionBrush& brush,
+			const HydraulicErosionSettings& s, uint64_t count, ErosionRandom& random) {
+			uint64_t clipped = 0;
+			// bilinear sampling reads one texel right and down
+			const float maxX = static_cast<float>(region.X1 - 1);
+			const float maxY = static_cast<float>(region.Y1 - 1);
+			const float minX = static_cast<float>(region.X0);
+			const float minY = static_cast<float>(region.Y0);
+
+			for (uint64_t d = 0; d < count; ++d) {
+				float posX = owned.X0 + random.NextFloat() * (owned.X1 - owned.X0);
+				float posY = owned.Y0 + random.NextFloat() * (owned.Y1 - owned.Y0);
+				posX = (std::min)(posX, std::nextafter(maxX, minX));
+				posY = (std::min)(posY, std::nextafter(maxY, minY));
+
+				float dirX = 0.f, dirY = 0.f;
+				float speed = s.InitialSpeed;
+				float water = s.InitialWater;
+				float sediment = 0.f;
+
+				for (int life = 0; life < s.MaxLifetime; ++life) {
+					int nodeX = static_cast<int>(posX);
+					int nodeY = static_cast<int>(posY);
+					float lastX = posX;
+					float lastY = posY;
+
+					float gx, gy;
+					float h = field.Sample(posX, posY, gx, gy);
+
+					dirX = dirX * s.Inertia - gx * (1.f - s.Inertia);
+					dirY = dirY * s.Inertia - gy * (1.f - s.Inertia);
+					float length = sqrtf(dirX * dirX + dirY * dirY);
+					if (length <= 1e-12f) break;
+					dirX /= length;
+					dirY /= length;
+					posX += dirX;
+					posY += dirY;
+
+					if (posX < minX || posY < minY || posX >= maxX || posY >= maxY) {
+						++clipped;
+						posX = lastX;
+						posY = lastY;
+						break;
+					}
+
+					float ngx, ngy;
+					float deltaHeight = field.Sample(posX, posY, ngx, ngy) - h;
+					float capacity = (std::max)(-deltaHeight * speed * water * s.SedimentCapacity, s.MinSedimentCapacity);
+
+					if (sediment > capacity || deltaHeight > 0.f) {
+						// uphill fills the pit it came from, otherwise drop part of the surplus
+						float deposit = deltaHeight > 0.f ? (std::min)(deltaHeight, sediment) : (sediment - capacity) * s.DepositSpeed;
+						sediment -= deposit;
+						Deposit(field, lastX, lastY, deposit);
+					}
+					else {
+						float erode = (std::min)((capacity - sediment) * s.ErodeSpeed, -deltaHeight);
+						sediment += ErodeBrush(field, region, brush, nodeX, nodeY, erode);
+					}
+
+					speed = sqrtf((std::max)(0.f, speed * speed - deltaHeight * s.Gravity));
+					water *= 1.f - s.EvaporateSpeed;
+				}
+				// whatever the droplet still carries settles where it stopped, so the pass keeps its mass
+				Deposit(field, posX, posY, sediment);
+			}
+			return clipped;
+		}
+
+		double SecondsSince(std::chrono::steady_clock::time_point start) {
+			return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		}
+	}
+
+	int Erosion::HaloWidth(const HydraulicErosionSettings& settings) {
+		// a droplet moves one texel per step, its brush reaches Radius further plus the SIMD row padding
+		int brushStride = ((2 * settings.Radius + 1) + 3) & ~3;
+		return settings.MaxLifetime + settings.Radius + brushStride + 2;
+	}
+
+	ErosionStats Erosion::Erode(float* heights, int width, int height, const ErosionSettings& settings, ThreadPool& pool) {
+		ErosionStats stats;
+		if (!heights || width < 2 || height < 2) return stats;
+
+		if (settings.Hydraulic.Enabled) {
+			auto start = std::chrono::steady_clock::now();
+			Hydraulic(heights, width, height, settings, pool, stats);
+			stats.HydraulicSeconds = SecondsSince(start);
+		}
+		if (settings.Thermal.Enabled) {
+			auto start = std::chrono::steady_clock::now();
+			Thermal(heights, width, height, settings.Thermal, pool);
+			stats.ThermalSeconds = SecondsSince(start);
+		}
+		return stats;
+	}
+
+	void Erosion::Hydraulic(float* heights, int width, int height, const ErosionSettings& settings, ThreadPool& pool, ErosionStats& stats) {
+		const HydraulicErosionSettings& s = settings.Hydraulic;
+		if (s.MaxLifetime <= 0 || s.DropletsPerTexel <= 0.f) return;
+
+		const int halo = HaloWidth(s);
+		// tiles of one phase are a tile apart, two halos have to fit in that gap
+		const int tileSize = (std::max)(settings.TileSize, 2 * halo);
+		const int tilesX = (width + tileSize - 1) / tileSize;
+		const int tilesY = (height + tileSize - 1) / tileSize;
+		const int passes = (std::max)(1, s.Passes);
+
+		stats.Tiles = tilesX * tilesY;
+		stats.Halo = halo;
+
+		ErosionField field{ heights, width, height };
+		ErosionBrush brush((std::max)(0, s.Radius));
+		std::vector<uint64_t> clipped(static_cast<size_t>(tilesX) * tilesY, 0);
+
+		for (int pass = 0; pass < passes; ++pass) {
+			for (int phase = 0; phase < 4; ++phase) {
+				std::vector<int> tiles;
+				for (int ty = phase >> 1; ty < tilesY; ty += 2) {
+					for (int tx = phase & 1; tx < tilesX; tx += 2) tiles.push_back(tx + tilesX * ty);
+				}
+
+				pool.ParallelFor(static_cast<int>(tiles.size()), 1, [&](int begin, int end) {
+					for (int i = begin; i < end; ++i) {
+						int tile = tiles[i];
+						int tx = tile % tilesX;
+						int ty = tile / tilesX;
+
+						ErosionRegion owned{ tx * tileSize, ty * tileSize, (std::min)(width, (tx + 1) * tileSize), (std::min)(height, (ty + 1) * tileSize) };
+						ErosionRegion region{ (std::max)(0, owned.X0 - halo), (std::max)(0, owned.Y0 - halo), (std::min)(width, owned.X1 + halo), (std::min)(height, owned.Y1 + halo) };
+
+						// droplet count per pass from the owned area so edge tiles get their share
+						double area = static_cast<double>(owned.X1 - owned.X0) * (owned.Y1 - owned.Y0);
+						uint64_t count = static_cast<uint64_t>(area * s.DropletsPerTexel * (pass + 1) / passes) - static_cast<uint64_t>(area * s.DropletsPerTexel * pass / passes);
+
+						ErosionRandom random((static_cast<uint64_t>(settings.Seed) << 32) ^ DXM::Squirrel2D(tile, pass, settings.Seed));
+						clipped[tile] += RunDroplets(field, owned, region, brush, s, count, random);
+					}
+				});
+			}
+		}
+
+		for (int t = 0; t < tilesX * tilesY; ++t) {
+			int tx = t % tilesX;
+			int ty = t / tilesX;
+			double area = static_cast<double>((std::min)(width, (tx + 1) * tileSize) - tx * tileSize) * ((std::min)(height, (ty + 1) * tileSize) - ty * tileSize);
+			stats.Droplets += static_cast<uint64_t>(area * s.DropletsPerTexel);
+			stats.DropletsClipped += clipped[t];
+		}
+	}
+
+	void Erosion::Thermal(float* heights, int width, int height, const ThermalErosionSettings& settings, ThreadPool& pool) {
+		if (settings.Iterations <= 0) return;
+
+		const float rate = std::clamp(settings.Rate, 0.f, 0.25f);
+		const float talus = (std::max)(0.f, settings.Talus);
+		const size_t count = static_cast<size_t>(width) * height;
+		std::vector<float> scratch(count);
+		float* src = heights;
+		float* dst = scratch.data();
+
+		// flow from a to a neighbour b is rate * the height difference beyond the talus, symmetric so mass is kept.
+		// Missing neighbours at the border read the texel itself, which never flows.
+		auto flow = [talus](float d) { return (std::max)(d - talus, 0.f) + (std::min)(d + talus, 0.f); };
+
+		for (int iteration = 0; iteration < settings.Iterations; ++iteration) {
+			pool.ParallelFor(height, 32, [&](int begin, int end) {
+				const __m128 talus4 = _mm_set1_ps(talus);
+				const __m128 negTalus4 = _mm_set1_ps(-talus);
+				const __m128 rate4 = _mm_set1_ps(rate);
+				const __m128 zero = _mm_setzero_ps();
+
+				for (int y = begin; y < end; ++y) {
+					const float* row = src + static_cast<size_t>(width) * y;
+					const float* up = src + static_cast<size_t>(width) * (y > 0 ? y - 1 : y);
+					const float* down = src + static_cast<size_t>(width) * (y + 1 < height ? y + 1 : y);
+					float* out = dst + static_cast<size_t>(width) * y;
+
+					auto scalar = [&](int x) {
+						float h = row[x];
+						float left = row[x > 0 ? x - 1 : x];
+						float right = row[x + 1 < width ? x + 1 : x];
+						out[x] = h - rate * (flow(h - left) + flow(h - right) + flow(h - up[x]) + flow(h - down[x]));
+					};
+
+					scalar(0);
+					int x = 1;
+					for (; x + 4 < width; x += 4) {
+						__m128 h = _mm_loadu_ps(row + x);
+						__m128 sum = zero;
+						const __m128 neighbours[4] = { _mm_loadu_ps(row + x - 1), _mm_loadu_ps(row + x + 1), _mm_loadu_ps(up + x), _mm_loadu_ps(down + x) };
+						for (const __m128& n : neighbours) {
+							__m128 d = _mm_sub_ps(h, n);
+							sum = _mm_add_ps(sum, _mm_add_ps(_mm_max_ps(_mm_sub_ps(d, talus4), zero), _mm_min_ps(_mm_sub_ps(d, negTalus4), zero)));
+						}
+						_mm_storeu_ps(out + x, _mm_sub_ps(h, _mm_mul_ps(rate4, sum)));
+					}
+					for (; x < width; ++x) scalar(x);
+				}
+			});
+			std::swap(src, dst);
+		}
+
+		if (src != heights) std::copy(src, src + count, heights);
+	}
+
+	ErosionStats Erosion::Benchmark(int size, unsigned threadCount, uint32_t seed) {
+		size = (std::max)(size, 2);
+		const size_t count = static_cast<size_t>(size) * size;
+		std::vector<float> heights(count);
+		std::vector<float> xs(count), ys(count);
+		for (size_t i = 0; i < count; ++i) {
+			xs[i] = static_cast<float>(i % size) / size;
+			ys[i] = static_cast<float>(i / size) / size;
+		}
+
+		DXM::NoiseFractal fractal;
+		fractal.Octaves = 6;
+		fractal.Frequency = 4.f;
+		fractal.Seed = seed;
+		DXM::NoiseBatch<2> batch;
+		batch.Coords[0] = xs.data();
+		batch.Coords[1] = ys.data();
+		batch.Values = heights.data();
+		batch.Count = static_cast<int>(count);
+		DXM::FBmBatch<2>(batch, fractal);
+		// texel spacing is 1, give the terrain about fifty texels of relief
+		for (float& h : heights) h *= size * 0.05f;
+
+		ThreadPool pool(threadCount);
+		ErosionSettings settings;
+		settings.Seed = seed;
+		ErosionStats stats = Erosion::Erode(heights.data(), size, size, settings, pool);
+
+		DXE_INFO("Erosion benchmark ", size, "x", size, " on ", pool.ThreadCount(), " threads: hydraulic ", stats.HydraulicSeconds,
+			"s (", stats.Droplets, " droplets, ", stats.DropletsClipped, " clipped), thermal ", stats.ThermalSeconds, "s");
+		return stats;
+	}
+}
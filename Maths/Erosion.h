@@ -0,0 +1,114 @@
+#pragma once
+#include "DXE.h"
+#include "Maths.h"
+#include "ThreadPool.h"
+#include <vector>
+
+namespace DXE
+{
+	// Droplet simulation, every droplet follows the gradient, picks up sediment while it speeds up
+	// downhill and drops it when it slows down or fills up. Units are the heightfield's own, one texel apart.
+	struct HydraulicErosionSettings {
+		bool Enabled = true;
+		float DropletsPerTexel = 1.f; // over all passes
+		int Passes = 4;               // more passes mix droplets across tile borders more often
+		int MaxLifetime = 30;         // steps, a step moves one texel
+		int Radius = 3;               // erosion brush radius in texels
+		float Inertia = 0.05f;
+		float SedimentCapacity = 4.f;
+		float MinSedimentCapacity = 0.01f;
+		float ErodeSpeed = 0.3f;
+		float DepositSpeed = 0.3f;
+		float EvaporateSpeed = 0.01f;
+		float Gravity = 4.f;
+		float InitialWater = 1.f;
+		float InitialSpeed = 1.f;
+	};
+
+	// Slope relaxation, material above the talus height difference slides to the 4 neighbours
+	struct ThermalErosionSettings {
+		bool Enabled = true;
+		int Iterations = 50;
+		float Talus = 0.01f; // stable height difference between neighbouring texels
+		float Rate = 0.25f;  // fraction of the excess moved per iteration, clamped to 0.25 to stay stable
+	};
+
+	struct ErosionSettings {
+		uint32_t Seed = 0;
+		HydraulicErosionSettings Hydraulic;
+		ThermalErosionSettings Thermal;
+		int TileSize = 128; // hydraulic work unit, raised to twice the halo when smaller
+	};
+
+	struct ErosionStats {
+		uint64_t Droplets = 0;
+		uint64_t DropletsClipped = 0; // stopped at the edge of their tile's halo or the heightfield
+		int Tiles = 0;
+		int Halo = 0;
+		double HydraulicSeconds = 0.0;
+		double ThermalSeconds = 0.0;
+	};
+
+	// Erodes a heightfield in place on a ThreadPool, the result only depends on the settings and seed.
+	// Hydraulic tiles own a square of droplet start points and may write into a halo around it wide enough
+	// for any droplet's whole path. Tiles run in four checkerboard phases, so tiles running together never
+	// share a texel and every phase sees the previous one's edits across the borders.
+	class DXE_API Erosion {
+	public:
+		static ErosionStats Erode(float* heights, int width, int height, const ErosionSettings& settings, ThreadPool& pool);
+		static void Hydraulic(float* heights, int width, int height, const ErosionSettings& settings, ThreadPool& pool, ErosionStats& stats);
+		static void Thermal(float* heights, int width, int height, const ThermalErosionSettings& settings, ThreadPool& pool);
+
+		// Halo width the hydraulic pass uses for these settings
+		static int HaloWidth(const HydraulicErosionSettings& settings);
+
+		// Erodes the x channel of tilesX * tilesY neighbouring NoiseMaps (row major, shared edge samples) as one
+		// heightfield. A non zero derivativeScale rewrites y and z as central differences per texel times the scale.
+		template<int N>
+		static ErosionStats ErodeNoiseMaps(DXM::NoiseMap<N>* const* maps, int tilesX, int tilesY, const ErosionSettings& settings,
+			ThreadPool& pool, float derivativeScale = 0.f) {
+			const int width = tilesX * (N - 1) + 1;
+			const int height = tilesY * (N - 1) + 1;
+			std::vector<float> heights(static_cast<size_t>(width) * height);
+			for (int t = 0; t < tilesX * tilesY; ++t) {
+				const DXM::NoiseMap<N>& map = *maps[t];
+				int ox = (t % tilesX) * (N - 1);
+				int oy = (t / tilesX) * (N - 1);
+				for (int y = 0; y < N; ++y) {
+					for (int x = 0; x < N; ++x) {
+						heights[(ox + x) + static_cast<size_t>(width) * (oy + y)] = map.GetVector(x, y).x;
+					}
+				}
+			}
+
+			ErosionStats stats = Erode(heights.data(), width, height, settings, pool);
+
+			pool.ParallelFor(tilesX * tilesY, 1, [&](int begin, int end) {
+				for (int t = begin; t < end; ++t) {
+					DXM::NoiseMap<N>& map = *maps[t];
+					int ox = (t % tilesX) * (N - 1);
+					int oy = (t / tilesX) * (N - 1);
+					for (int y = 0; y < N; ++y) {
+						int gy = oy + y;
+						for (int x = 0; x < N; ++x) {
+							int gx = ox + x;
+							DXM::Vector4 value = map.GetVector(x, y);
+							value.x = heights[gx + static_cast<size_t>(width) * gy];
+							if (derivativeScale != 0.f) {
+								int x0 = (std::max)(gx - 1, 0), x1 = (std::min)(gx + 1, width - 1);
+								int y0 = (std::max)(gy - 1, 0), y1 = (std::min)(gy + 1, height - 1);
+								value.y = (heights[x1 + static_cast<size_t>(width) * gy] - heights[x0 + static_cast<size_t>(width) * gy]) / (x1 - x0) * derivativeScale;
+								value.z = (heights[gx + static_cast<size_t>(width) * y1] - heights[gx + static_cast<size_t>(width) * y0]) / (y1 - y0) * derivativeScale;
+							}
+							map.SetVector(x, y, value);
+						}
+					}
+				}
+			});
+			return stats;
+		}
+
+		// Erodes a size x size fBm heightfield with default settings and logs the timings
+		static ErosionStats Benchmark(int size = 1024, unsigned threadCount = 0, uint32_t seed = 0);
+	};
+}
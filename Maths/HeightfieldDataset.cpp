@@ -0,0 +1,487 @@
+#include "pch.h"
+#include "Maths/HeightfieldDataset.h"
+#include <fstream>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace DXE {
+
+	namespace {
+
+		int StorageBytes(DXM::NoiseStorage storage) {
+			return storage == DXM::NoiseStorage::Float32 ? 4 : 2;
+		}
+
+		float HalfToFloat(uint16_t half) {
+			return _mm_cvtss_f32(DXM::NoiseHalfToFloat4(_mm_cvtsi32_si128(half)));
+		}
+
+		uint16_t FloatToHalf(float value) {
+			return static_cast<uint16_t>(_mm_cvtsi128_si32(DXM::NoiseFloatToHalf4(_mm_set1_ps(value))));
+		}
+
+		uint32_t ReadWord(const uint8_t* data, int wordBytes, size_t i) {
+			if (wordBytes == 4) {
+				uint32_t word;
+				memcpy(&word, data + 4 * i, 4);
+				return word;
+			}
+			uint16_t word;
+			memcpy(&word, data + 2 * i, 2);
+			return word;
+		}
+
+		void WriteWord(uint8_t* data, int wordBytes, size_t i, uint32_t word) {
+			if (wordBytes == 4) memcpy(data + 4 * i, &word, 4);
+			else {
+				uint16_t half = static_cast<uint16_t>(word);
+				memcpy(data + 2 * i, &half, 2);
+			}
+		}
+
+		// left + up - upleft, the plane through the three decoded neighbours
+		uint32_t PredictWord(const uint8_t* words, int wordBytes, int side, int x, int y) {
+			size_t i = x + static_cast<size_t>(side) * y;
+			if (x > 0 && y > 0) return ReadWord(words, wordBytes, i - 1) + ReadWord(words, wordBytes, i - side) - ReadWord(words, wordBytes, i - side - 1);
+			if (x > 0) return ReadWord(words, wordBytes, i - 1);
+			if (y > 0) return ReadWord(words, wordBytes, i - side);
+			return 0;
+		}
+
+		void EncodeDelta(const uint8_t* raw, int side, int wordBytes, std::vector<uint8_t>& out) {
+			const uint32_t mask = wordBytes == 4 ? 0xFFFFFFFFu : 0xFFFFu;
+			const int shift = 32 - 8 * wordBytes;
+			out.clear();
+			for (int y = 0; y < side; ++y) {
+				for (int x = 0; x < side; ++x) {
+					uint32_t word = ReadWord(raw, wordBytes, x + static_cast<size_t>(side) * y);
+					uint32_t residual = (word - PredictWord(raw, wordBytes, side, x, y)) & mask;
+					int32_t signedResidual = static_cast<int32_t>(residual << shift) >> shift;
+					uint32_t zigzag = (static_cast<uint32_t>(signedResidual) << 1) ^ static_cast<uint32_t>(signedResidual >> 31);
+					while (zigzag >= 0x80) {
+						out.push_back(static_cast<uint8_t>(zigzag | 0x80));
+						zigzag >>= 7;
+					}
+					out.push_back(static_cast<uint8_t>(zigzag));
+				}
+			}
+		}
+
+		bool DecodeDelta(const uint8_t* data, size_t bytes, int side, int wordBytes, std::vector<uint8_t>& raw) {
+			const uint32_t mask = wordBytes == 4 ? 0xFFFFFFFFu : 0xFFFFu;
+			const uint8_t* end = data + bytes;
+			raw.resize(static_cast<size_t>(side) * side * wordBytes);
+			for (int y = 0; y < side; ++y) {
+				for (int x = 0; x < side; ++x) {
+					uint32_t zigzag = 0;
+					for (int bit = 0;; bit += 7) {
+						if (data == end || bit > 28) return false;
+						uint8_t byte = *data++;
+						zigzag |= static_cast<uint32_t>(byte & 0x7F) << bit;
+						if (!(byte & 0x80)) break;
+					}
+					uint32_t residual = (zigzag >> 1) ^ (0u - (zigzag & 1u));
+					WriteWord(raw.data(), wordBytes, x + static_cast<size_t>(side) * y, (PredictWord(raw.data(), wordBytes, side, x, y) + residual) & mask);
+				}
+			}
+			return data == end;
+		}
+
+		// Packs side x side floats into the stored format and appends the tile to out
+		bool WriteTile(std::ofstream& out, const float* samples, int side, const HeightfieldDatasetSettings& settings, std::vector<HeightfieldTileEntry>& entries) {
+			const size_t count = static_cast<size_t>(side) * side;
+			const int wordBytes = StorageBytes(settings.Storage);
+			std::vector<uint8_t> raw(count * wordBytes);
+
+			HeightfieldTileEntry entry;
+			switch (settings.Storage) {
+			case DXM::NoiseStorage::Float32:
+				memcpy(raw.data(), samples, count * 4);
+				break;
+			case DXM::NoiseStorage::Float16:
+				for (size_t i = 0; i < count; ++i) WriteWord(raw.data(), 2, i, FloatToHalf(samples[i]));
+				break;
+			case DXM::NoiseStorage::UNorm16: {
+				auto [minIt, maxIt] = std::minmax_element(samples, samples + count);
+				entry.RangeMin = *minIt;
+				entry.RangeScale = (*maxIt - *minIt) / 65535.f;
+				float inverse = entry.RangeScale > 0.f ? 1.f / entry.RangeScale : 0.f;
+				for (size_t i = 0; i < count; ++i) {
+					WriteWord(raw.data(), 2, i, static_cast<uint32_t>(std::clamp((samples[i] - entry.RangeMin) * inverse + 0.5f, 0.f, 65535.f)));
+				}
+				break;
+			}
+			}
+
+			const std::vector<uint8_t>* payload = &raw;
+			std::vector<uint8_t> compressed;
+			if (settings.Compress) {
+				EncodeDelta(raw.data(), side, wordBytes, compressed);
+				if (compressed.size() < raw.size()) {
+					payload = &compressed;
+					entry.Compression = HeightfieldCompression::Delta;
+				}
+			}
+
+			entry.Offset = static_cast<uint64_t>(out.tellp());
+			entry.Bytes = static_cast<uint32_t>(payload->size());
+			out.write(reinterpret_cast<const char*>(payload->data()), payload->size());
+			entries.push_back(entry);
+			return out.good();
+		}
+
+		// Writes every tile of one level, the 2x2 box filtered rows of the next level go to next when given
+		bool WriteLevel(std::ofstream& out, int width, int height, const HeightfieldDataset::RowSource& source, const HeightfieldDatasetSettings& settings,
+			std::vector<HeightfieldTileEntry>& entries, std::ofstream* next) {
+			const int T = settings.TileSize;
+			const int side = T + 1;
+			const int tilesX = (std::max)(1, (width - 1 + T - 1) / T);
+			const int tilesY = (std::max)(1, (height - 1 + T - 1) / T);
+			const int nextWidth = (width + 1) / 2;
+
+			std::vector<float> band(static_cast<size_t>(side) * width);
+			std::vector<float> pending(width);
+			std::vector<float> downsampled(nextWidth);
+			std::vector<float> tile(static_cast<size_t>(side) * side);
+
+			auto emitNext = [&](const float* a, const float* b) {
+				for (int i = 0; i < nextWidth; ++i) {
+					int x0 = 2 * i;
+					int x1 = (std::min)(x0 + 1, width - 1);
+					downsampled[i] = 0.25f * (a[x0] + a[x1] + b[x0] + b[x1]);
+				}
+				next->write(reinterpret_cast<const char*>(downsampled.data()), nextWidth * sizeof(float));
+			};
+			auto pull = [&](int y, float* row) {
+				source(y, row);
+				if (!next) return;
+				if (y % 2 == 0) std::copy(row, row + width, pending.begin());
+				else emitNext(pending.data(), row);
+			};
+
+			pull(0, band.data());
+			int pulled = 0;
+			for (int ty = 0; ty < tilesY; ++ty) {
+				for (int r = 1; r < side; ++r) {
+					float* row = &band[static_cast<size_t>(width) * r];
+					int y = ty * T + r;
+					if (y < height && y > pulled) {
+						pull(y, row);
+						pulled = y;
+					}
+					else {
+						// past the bottom edge, repeat the last row
+						std::copy(row - width, row, row);
+					}
+				}
+
+				for (int tx = 0; tx < tilesX; ++tx) {
+					for (int r = 0; r < side; ++r) {
+						const float* row = &band[static_cast<size_t>(width) * r];
+						for (int c = 0; c < side; ++c) {
+							tile[c + static_cast<size_t>(side) * r] = row[(std::min)(tx * T + c, width - 1)];
+						}
+					}
+					if (!WriteTile(out, tile.data(), side, settings, entries)) return false;
+				}
+
+				// the bottom row is the next band's top row
+				std::copy(band.end() - width, band.end(), band.begin());
+			}
+
+			if (next && height % 2 == 1) emitNext(pending.data(), pending.data());
+			return !next || next->good();
+		}
+	}
+
+	HeightfieldDataset::~HeightfieldDataset() {
+		Close();
+	}
+
+	bool HeightfieldDataset::Write(const std::filesystem::path& path, const float* heights, int width, int height, const HeightfieldDatasetSettings& settings) {
+		if (!heights) return false;
+		return Write(path, width, height, [heights, width](int y, float* row) {
+			std::copy(heights + static_cast<size_t>(width) * y, heights + static_cast<size_t>(width) * (y + 1), row);
+		}, settings);
+	}
+
+	bool HeightfieldDataset::Write(const std::filesystem::path& path, int width, int height, const RowSource& source, const HeightfieldDatasetSettings& inSettings) {
+		if (width < 2 || height < 2 || !source) return false;
+		HeightfieldDatasetSettings settings = inSettings;
+		settings.TileSize = (std::max)(1, settings.TileSize);
+
+		std::ofstream out(path, std::ios::binary | std::ios::trunc);
+		if (!out) {
+			DXE_ERROR("HeightfieldDataset: can't create ", path.string());
+			return false;
+		}
+
+		HeightfieldDatasetHeader header;
+		header.Width = width;
+		header.Height = height;
+		header.TileSize = settings.TileSize;
+		header.Storage = settings.Storage;
+		header.SampleSpacing = settings.SampleSpacing;
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+		std::vector<HeightfieldTileEntry> entries;
+		const std::filesystem::path temps[2] = { path.string() + ".level0.tmp", path.string() + ".level1.tmp" };
+		std::unique_ptr<std::ifstream> input;
+		RowSource levelSource = source;
+		int levelWidth = width;
+		int levelHeight = height;
+		bool ok = true;
+
+		for (int level = 0; ok; ++level) {
+			int nextWidth = (levelWidth + 1) / 2;
+			int nextHeight = (levelHeight + 1) / 2;
+			bool last = (levelWidth <= settings.TileSize + 1 && levelHeight <= settings.TileSize + 1)
+				|| (settings.MaxLevels > 0 && level + 1 >= settings.MaxLevels)
+				|| nextWidth < 2 || nextHeight < 2;
+
+			// level n reads the file level n - 1 wrote, so two alternating files are enough
+			std::ofstream next;
+			if (!last) {
+				next.open(temps[level & 1], std::ios::binary | std::ios::trunc);
+				ok = next.good();
+			}
+			ok = ok && WriteLevel(out, levelWidth, levelHeight, levelSource, settings, entries, last ? nullptr : &next);
+			++header.LevelCount;
+			if (last || !ok) break;
+
+			next.close();
+			input = std::make_unique<std::ifstream>(temps[level & 1], std::ios::binary);
+			levelSource = [stream = input.get(), nextWidth](int y, float* row) {
+				stream->seekg(static_cast<std::streamoff>(y) * nextWidth * sizeof(float));
+				stream->read(reinterpret_cast<char*>(row), nextWidth * sizeof(float));
+			};
+			levelWidth = nextWidth;
+			levelHeight = nextHeight;
+		}
+		input.reset();
+
+		if (ok) {
+			// 8 byte aligned so the index can be read in place from the mapping
+			static const char zeros[8] = {};
+			out.write(zeros, (8 - static_cast<uint64_t>(out.tellp()) % 8) % 8);
+			header.TileIndexOffset = static_cast<uint64_t>(out.tellp());
+			header.TileCount = static_cast<uint32_t>(entries.size());
+			out.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(HeightfieldTileEntry));
+			out.seekp(0);
+			out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			ok = out.good();
+		}
+		out.close();
+
+		std::error_code ec;
+		for (auto& temp : temps) std::filesystem::remove(temp, ec);
+		if (!ok) {
+			DXE_ERROR("HeightfieldDataset: writing ", path.string(), " failed");
+			std::filesystem::remove(path, ec);
+		}
+		return ok;
+	}
+
+	bool HeightfieldDataset::Open(const std::filesystem::path& path, size_t cacheBytes) {
+		Close();
+
+#ifdef _WIN32
+		HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, nullptr);
+		if (file == INVALID_HANDLE_VALUE) return false;
+		LARGE_INTEGER size;
+		HANDLE mapping = GetFileSizeEx(file, &size) ? CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+		const void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+		if (!view) {
+			if (mapping) CloseHandle(mapping);
+			CloseHandle(file);
+			return false;
+		}
+		m_File = file;
+		m_Mapping = mapping;
+		m_ViewSize = static_cast<size_t>(size.QuadPart);
+#else
+		int file = open(path.c_str(), O_RDONLY);
+		if (file < 0) return false;
+		struct stat info;
+		void* view = fstat(file, &info) == 0 && info.st_size > 0 ? mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, file, 0) : MAP_FAILED;
+		close(file);
+		if (view == MAP_FAILED) return false;
+		madvise(view, info.st_size, MADV_RANDOM);
+		m_ViewSize = static_cast<size_t>(info.st_size);
+#endif
+		m_View = static_cast<const uint8_t*>(view);
+		m_CacheCapacity = cacheBytes;
+
+		bool valid = m_ViewSize >= sizeof(HeightfieldDatasetHeader);
+		if (valid) {
+			memcpy(&m_Header, m_View, sizeof(m_Header));
+			valid = memcmp(m_Header.Magic, "DXHF", 4) == 0 && m_Header.Version == 1 && m_Header.Width >= 2 && m_Header.Height >= 2
+				&& m_Header.TileSize > 0 && m_Header.LevelCount > 0 && m_Header.TileIndexOffset % 8 == 0
+				&& static_cast<uint8_t>(m_Header.Storage) <= static_cast<uint8_t>(DXM::NoiseStorage::UNorm16)
+				&& m_Header.TileIndexOffset + static_cast<uint64_t>(m_Header.TileCount) * sizeof(HeightfieldTileEntry) <= m_ViewSize;
+		}
+
+		uint32_t tileCount = 0;
+		int width = static_cast<int>(m_Header.Width);
+		int height = static_cast<int>(m_Header.Height);
+		const int T = static_cast<int>(m_Header.TileSize);
+		for (uint32_t level = 0; valid && level < m_Header.LevelCount; ++level) {
+			Level info{ width, height, (std::max)(1, (width - 1 + T - 1) / T), (std::max)(1, (height - 1 + T - 1) / T), tileCount };
+			m_Levels.push_back(info);
+			tileCount += info.TilesX * info.TilesY;
+			width = (width + 1) / 2;
+			height = (height + 1) / 2;
+		}
+		valid = valid && tileCount == m_Header.TileCount;
+
+		if (valid) {
+			m_Tiles = reinterpret_cast<const HeightfieldTileEntry*>(m_View + m_Header.TileIndexOffset);
+			// GetTile reads uncompressed tiles straight from the mapping, so they must hold every sample
+			const uint64_t side = static_cast<uint64_t>(m_Header.TileSize) + 1;
+			const uint64_t rawBytes = side * side * StorageBytes(m_Header.Storage);
+			for (uint32_t i = 0; valid && i < tileCount; ++i) {
+				const HeightfieldTileEntry& tile = m_Tiles[i];
+				valid = tile.Offset <= m_Header.TileIndexOffset && tile.Bytes <= m_Header.TileIndexOffset - tile.Offset
+					&& (tile.Compression == HeightfieldCompression::Delta || (tile.Compression == HeightfieldCompression::None && tile.Bytes == rawBytes));
+			}
+		}
+		if (!valid) {
+			DXE_ERROR("HeightfieldDataset: ", path.string(), " is not a valid dataset");
+			Close();
+			return false;
+		}
+		return true;
+	}
+
+	void HeightfieldDataset::Close() {
+		if (m_View) {
+#ifdef _WIN32
+			UnmapViewOfFile(m_View);
+			CloseHandle(static_cast<HANDLE>(m_Mapping));
+			CloseHandle(static_cast<HANDLE>(m_File));
+#else
+			munmap(const_cast<uint8_t*>(m_View), m_ViewSize);
+#endif
+		}
+		m_View = nullptr;
+		m_ViewSize = 0;
+		m_File = nullptr;
+		m_Mapping = nullptr;
+		m_Tiles = nullptr;
+		m_Levels.clear();
+		m_Header = HeightfieldDatasetHeader();
+
+		std::lock_guard<std::mutex> lock(m_CacheMutex);
+		m_Cache.clear();
+		m_CacheOrder.clear();
+		m_CacheBytes = 0;
+	}
+
+	size_t HeightfieldDataset::CachedBytes() const {
+		std::lock_guard<std::mutex> lock(m_CacheMutex);
+		return m_CacheBytes;
+	}
+
+	HeightfieldDataset::TileRef HeightfieldDataset::GetTile(uint32_t index) const {
+		TileRef tile;
+		tile.Entry = &m_Tiles[index];
+		if (tile.Entry->Compression == HeightfieldCompression::None) {
+			tile.Data = m_View + tile.Entry->Offset;
+			return tile;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(m_CacheMutex);
+			auto it = m_Cache.find(index);
+			if (it != m_Cache.end()) {
+				m_CacheOrder.splice(m_CacheOrder.begin(), m_CacheOrder, it->second.Order);
+				tile.Decoded = it->second.Data;
+				tile.Data = tile.Decoded->data();
+				return tile;
+			}
+		}
+
+		// decode outside the lock, two threads missing the same tile both decode and one insert wins
+		auto decoded = std::make_shared<std::vector<uint8_t>>();
+		const int side = static_cast<int>(m_Header.TileSize) + 1;
+		if (!DecodeDelta(m_View + tile.Entry->Offset, tile.Entry->Bytes, side, StorageBytes(m_Header.Storage), *decoded)) {
+			DXE_ERROR("HeightfieldDataset: tile ", index, " is corrupt");
+			decoded->assign(static_cast<size_t>(side) * side * StorageBytes(m_Header.Storage), 0);
+		}
+
+		std::lock_guard<std::mutex> lock(m_CacheMutex);
+		auto it = m_Cache.find(index);
+		if (it == m_Cache.end()) {
+			m_CacheOrder.push_front(index);
+			it = m_Cache.emplace(index, CachedTile{ std::move(decoded), m_CacheOrder.begin() }).first;
+			m_CacheBytes += it->second.Data->size();
+			// the tile just added always stays
+			while (m_CacheBytes > m_CacheCapacity && m_CacheOrder.size() > 1) {
+				auto oldest = m_Cache.find(m_CacheOrder.back());
+				m_CacheBytes -= oldest->second.Data->size();
+				m_Cache.erase(oldest);
+				m_CacheOrder.pop_back();
+			}
+		}
+		tile.Decoded = it->second.Data;
+		tile.Data = tile.Decoded->data();
+		return tile;
+	}
+
+	float HeightfieldDataset::Load(const TileRef& tile, int index) const {
+		switch (m_Header.Storage) {
+		case DXM::NoiseStorage::Float32: {
+			float value;
+			memcpy(&value, tile.Data + 4 * static_cast<size_t>(index), 4);
+			return value;
+		}
+		case DXM::NoiseStorage::Float16:
+			return HalfToFloat(static_cast<uint16_t>(ReadWord(tile.Data, 2, index)));
+		case DXM::NoiseStorage::UNorm16:
+			return tile.Entry->RangeMin + ReadWord(tile.Data, 2, index) * tile.Entry->RangeScale;
+		}
+		return 0.f;
+	}
+
+	DXM::Vector4 HeightfieldDataset::SampleLevel(float fx, float fy, int level) const {
+		if (!m_View) return DXM::Vector4(0.f, 0.f, 0.f, 0.f);
+
+		level = std::clamp(level, 0, LevelCount() - 1);
+		const Level& info = m_Levels[level];
+		const int T = TileSize();
+		const float scale = 1.f / static_cast<float>(1 << level);
+
+		float lx = std::clamp(fx * scale, 0.f, static_cast<float>(info.Width - 1));
+		float ly = std::clamp(fy * scale, 0.f, static_cast<float>(info.Height - 1));
+		int tx = (std::min)(static_cast<int>(lx) / T, info.TilesX - 1);
+		int ty = (std::min)(static_cast<int>(ly) / T, info.TilesY - 1);
+
+		// tiles carry their right and bottom border, so the 2x2 footprint is always inside one tile
+		float localX = lx - tx * T;
+		float localY = ly - ty * T;
+		int x0 = (std::min)(static_cast<int>(localX), T - 1);
+		int y0 = (std::min)(static_cast<int>(localY), T - 1);
+		float sx = localX - x0;
+		float sy = localY - y0;
+
+		TileRef tile = GetTile(info.FirstTile + tx + info.TilesX * ty);
+		const int side = T + 1;
+		int i = x0 + side * y0;
+		float h00 = Load(tile, i);
+		float h10 = Load(tile, i + 1);
+		float h01 = Load(tile, i + side);
+		float h11 = Load(tile, i + side + 1);
+
+		float top = h00 + (h10 - h00) * sx;
+		float bottom = h01 + (h11 - h01) * sx;
+		float dx = ((h10 - h00) * (1.f - sy) + (h11 - h01) * sy) * scale;
+		float dy = (bottom - top) * scale;
+		return DXM::Vector4(top + (bottom - top) * sy, dx, dy, 0.f);
+	}
+}
@@ -0,0 +1,131 @@
+#pragma once
+#include "DXE.h"
+#include "Maths.h"
+#include <filesystem>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace DXE
+{
+	// On disk layout, little endian:
+	//   HeightfieldDatasetHeader
+	//   tile data, each tile (TileSize + 1)^2 samples so bilinear sampling never crosses into a neighbour
+	//   HeightfieldTileEntry[TileCount] at TileIndexOffset, level major then row major
+	// Level 0 is the full resolution, every further level halves both sides.
+	struct HeightfieldDatasetHeader {
+		char Magic[4] = { 'D', 'X', 'H', 'F' };
+		uint32_t Version = 1;
+		uint32_t Width = 0;  // level 0 samples
+		uint32_t Height = 0;
+		uint32_t TileSize = 0; // sample intervals per tile side
+		uint32_t LevelCount = 0;
+		DXM::NoiseStorage Storage = DXM::NoiseStorage::Float32;
+		uint8_t Padding[3] = {};
+		uint32_t TileCount = 0;
+		uint64_t TileIndexOffset = 0;
+		float SampleSpacing = 1.f; // world distance between level 0 samples, informational
+		uint32_t Reserved[5] = {};
+	};
+	static_assert(sizeof(HeightfieldDatasetHeader) == 64, "HeightfieldDatasetHeader is part of the file format");
+
+	enum class HeightfieldCompression : uint8_t {
+		None,
+		Delta // gradient predicted residuals, zigzag varint coded
+	};
+
+	struct HeightfieldTileEntry {
+		uint64_t Offset = 0;
+		uint32_t Bytes = 0;
+		HeightfieldCompression Compression = HeightfieldCompression::None;
+		uint8_t Padding[3] = {};
+		float RangeMin = 0.f;   // UNorm16 only
+		float RangeScale = 0.f;
+	};
+	static_assert(sizeof(HeightfieldTileEntry) == 24, "HeightfieldTileEntry is part of the file format");
+
+	struct HeightfieldDatasetSettings {
+		int TileSize = 256;
+		DXM::NoiseStorage Storage = DXM::NoiseStorage::UNorm16; // UNorm16 ranges are per tile
+		bool Compress = true; // tiles that don't shrink are stored raw
+		int MaxLevels = 0;    // 0 keeps halving until one tile covers the level
+		float SampleSpacing = 1.f;
+	};
+
+	// Read only view of a dataset file. Open() maps the file and only reads the header, tiles page in
+	// when sampled. Compressed tiles are decoded into an LRU cache bounded by cacheBytes, so resident
+	// memory follows the working set. Sample()/NormalisedSample() match NoiseMap: x is the height,
+	// y and z the height gradient per level 0 sample. Safe to sample from several threads.
+	class DXE_API HeightfieldDataset {
+	public:
+		using RowSource = std::function<void(int y, float* row)>; // fills the width samples of row y
+
+		HeightfieldDataset() = default;
+		~HeightfieldDataset();
+
+		HeightfieldDataset(const HeightfieldDataset&) = delete;
+		HeightfieldDataset& operator=(const HeightfieldDataset&) = delete;
+
+		// Rows are pulled once in order, lower levels go through a temporary file next to path,
+		// so sources far larger than memory can be converted
+		static bool Write(const std::filesystem::path& path, int width, int height, const RowSource& source, const HeightfieldDatasetSettings& settings = {});
+		static bool Write(const std::filesystem::path& path, const float* heights, int width, int height, const HeightfieldDatasetSettings& settings = {});
+
+		bool Open(const std::filesystem::path& path, size_t cacheBytes = 64 << 20);
+		void Close();
+		bool IsOpen() const { return m_View != nullptr; }
+
+		// fx, fy in level 0 samples, clamped to the dataset
+		DXM::Vector4 Sample(float fx, float fy) const { return SampleLevel(fx, fy, 0); }
+		DXM::Vector4 NormalisedSample(float fx, float fy) const { return Sample(fx * (Width() - 1.f), fy * (Height() - 1.f)); }
+		DXM::Vector4 SampleLevel(float fx, float fy, int level) const;
+
+		int Width() const { return static_cast<int>(m_Header.Width); }
+		int Height() const { return static_cast<int>(m_Header.Height); }
+		int LevelCount() const { return static_cast<int>(m_Header.LevelCount); }
+		int TileSize() const { return static_cast<int>(m_Header.TileSize); }
+		const HeightfieldDatasetHeader& Header() const { return m_Header; }
+		size_t MappedBytes() const { return m_ViewSize; }
+		size_t CachedBytes() const;
+
+	private:
+		struct Level {
+			int Width;
+			int Height;
+			int TilesX;
+			int TilesY;
+			uint32_t FirstTile;
+		};
+
+		struct TileRef {
+			const uint8_t* Data = nullptr;
+			std::shared_ptr<const std::vector<uint8_t>> Decoded; // keeps a cached tile alive while in use
+			const HeightfieldTileEntry* Entry = nullptr;
+		};
+
+		TileRef GetTile(uint32_t index) const;
+		float Load(const TileRef& tile, int index) const;
+
+		HeightfieldDatasetHeader m_Header;
+		std::vector<Level> m_Levels;
+		const HeightfieldTileEntry* m_Tiles = nullptr;
+
+		const uint8_t* m_View = nullptr;
+		size_t m_ViewSize = 0;
+		void* m_File = nullptr;
+		void* m_Mapping = nullptr;
+
+		size_t m_CacheCapacity = 0;
+		mutable std::mutex m_CacheMutex;
+		mutable size_t m_CacheBytes = 0;
+		mutable std::list<uint32_t> m_CacheOrder; // most recent first
+		struct CachedTile {
+			std::shared_ptr<const std::vector<uint8_t>> Data;
+			std::list<uint32_t>::iterator Order;
+		};
+		mutable std::unordered_map<uint32_t, CachedTile> m_Cache;
+	};
+}
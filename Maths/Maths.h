@@ -2,7 +2,9 @@
 #include "DXE.h"
 #include "SimpleMath.h"
 #include "Noise.h"
+#include "PackedNoiseMap.h"
 #include <immintrin.h>
+#include <algorithm>
 #include <cstdint>
 #include <iostream>
 #include <cmath>
@@ -149,6 +151,34 @@ namespace DirectX::SimpleMath {
         return DXM::Matrix::CreatePerspectiveFieldOfView(fovY, aspect, nearZ, farZ);
     }
 
+    // Largest scale along the basis axes, for scaling a bounding radius into world space
+    inline float MaxAxisScale(const DXM::Matrix& world) {
+        return sqrtf((std::max)({
+            world._11 * world._11 + world._12 * world._12 + world._13 * world._13,
+            world._21 * world._21 + world._22 * world._22 + world._23 * world._23,
+            world._31 * world._31 + world._32 * world._32 + world._33 * world._33 }));
+    }
+
+    // Spreads the low 10 bits of v to every third bit
+    inline uint32_t MortonSpread(uint32_t v) {
+        v &= 0x3FF;
+        v = (v | (v << 16)) & 0x030000FF;
+        v = (v | (v << 8)) & 0x0300F00F;
+        v = (v | (v << 4)) & 0x030C30C3;
+        v = (v | (v << 2)) & 0x09249249;
+        return v;
+    }
+    // 30 bit Morton code of a cell, each coordinate 0..1023
+    inline uint32_t MortonCode(uint32_t x, uint32_t y, uint32_t z) {
+        return MortonSpread(x) | (MortonSpread(y) << 1) | (MortonSpread(z) << 2);
+    }
+
+    // 64 bit FNV-1a, one step per value rather than per byte, for change signatures
+    struct Fnv1a {
+        uint64_t Hash = 1469598103934665603ull;
+        void Mix(uint64_t value) { Hash = (Hash ^ value) * 1099511628211ull; }
+    };
+
 }
 
 
@@ -1,8 +1,12 @@
 #pragma once
 #include "SimpleMath.h"
 #include <algorithm>
+#include <chrono>
 #include <cmath> 
 #include <memory>
+#include <vector>
+#include <type_traits>
+#include <immintrin.h>
 
 namespace DirectX::SimpleMath {
 
@@ -63,6 +67,28 @@ namespace DirectX::SimpleMath {
 		return Squirrel1D(x + mangled, seed);
 	}
 
+	// Hashed lattice value in [0, 1] at an integer corner
+	inline float LatticeValue(int x, int y, uint32_t seed = 0) {
+		static const int scalar = 16777215; // 2^24 - 1
+		static const float inv_scalar = 1.f / 16777215.f; // 2^24 - 1
+		return (Squirrel2D(x, y, seed) & scalar) * inv_scalar;
+	}
+
+	// Bilinear smoothstep blend of the four lattice corners.
+	// Shared by the per-sample and per-tile paths so both give identical results.
+	inline float SmoothNoiseBlend(float n0, float n1, float n2, float n3, float Sx, float Sy) {
+		auto f0 = (1.f - Sx) * n0 + Sx * n1;
+		auto f1 = (1.f - Sx) * n2 + Sx * n3;
+		return (1.f - Sy) * f0 + Sy * f1;
+	}
+	inline Vector3 SmoothNoiseBlendD1(float n0, float n1, float n2, float n3, float Sx, float Sy, float dSx, float dSy) {
+		// normal vector = (-dP/dx, -dp/dy, 1)
+		float g0 = SmoothNoiseBlend(n0, n1, n2, n3, Sx, Sy);
+		float ddx = dSx * (-n0 + n1 + (n0 - n1 - n2 + n3) * Sy);
+		float ddy = dSy * (-n0 + n2 + (n0 - n1 - n2 + n3) * Sx);
+		return Vector3(g0, ddx, ddy);
+	}
+
 	inline float SmoothNoise(float x, float y, uint32_t seed = 0) {
 		// Returns smoothly intepolated value noise
 		auto x_floor = floor(x);
@@ -70,22 +96,15 @@ namespace DirectX::SimpleMath {
 		auto y_floor = floor(y);
 		auto y_frac = y - y_floor;
 
-		static const int scalar = 16777215; // 2^24 - 1
-		static const float inv_scalar = 1.f / 16777215.f; // 2^24 - 1
-
-		float n0 = (Squirrel2D(x_floor, y_floor, seed) & scalar) * inv_scalar;
-		float n1 = (Squirrel2D(x_floor + 1, y_floor, seed) & scalar) * inv_scalar;
-		float n2 = (Squirrel2D(x_floor, y_floor + 1, seed) & scalar) * inv_scalar;
-		float n3 = (Squirrel2D(x_floor + 1, y_floor + 1, seed) & scalar) * inv_scalar;
+		int x0 = static_cast<int>(x_floor);
+		int y0 = static_cast<int>(y_floor);
 
-		float Sx = SmoothStep(x_frac);
-		float Sy = SmoothStep(y_frac);
+		float n0 = LatticeValue(x0, y0, seed);
+		float n1 = LatticeValue(x0 + 1, y0, seed);
+		float n2 = LatticeValue(x0, y0 + 1, seed);
+		float n3 = LatticeValue(x0 + 1, y0 + 1, seed);
 
-		auto f0 = (1.f - Sx) * n0 + Sx * n1;
-		auto f1 = (1.f - Sx) * n2 + Sx * n3;
-		float g0 = (1.f - Sy) * f0 + Sy * f1;
-
-		return g0;
+		return SmoothNoiseBlend(n0, n1, n2, n3, SmoothStep(x_frac), SmoothStep(y_frac));
 	}
 
 
@@ -96,30 +115,219 @@ namespace DirectX::SimpleMath {
 		auto y_floor = floor(y);
 		auto y_frac = y - y_floor;
 
-		static const int scalar = 16777215; // 2^24 - 1
-		static const float inv_scalar = 1.f / 16777215.f; // 2^24 - 1
+		int x0 = static_cast<int>(x_floor);
+		int y0 = static_cast<int>(y_floor);
 
-		float n0 = (Squirrel2D(x_floor, y_floor, seed) & scalar) * inv_scalar;
-		float n1 = (Squirrel2D(x_floor + 1, y_floor, seed) & scalar) * inv_scalar;
-		float n2 = (Squirrel2D(x_floor, y_floor + 1, seed) & scalar) * inv_scalar;
-		float n3 = (Squirrel2D(x_floor + 1, y_floor + 1, seed) & scalar) * inv_scalar;
+		float n0 = LatticeValue(x0, y0, seed);
+		float n1 = LatticeValue(x0 + 1, y0, seed);
+		float n2 = LatticeValue(x0, y0 + 1, seed);
+		float n3 = LatticeValue(x0 + 1, y0 + 1, seed);
 
-		// normal vector = (-dP/dx, -dp/dy, 1)
-		float Sx = SmoothStep(x_frac);
-		float Sy = SmoothStep(y_frac);
+		return SmoothNoiseBlendD1(n0, n1, n2, n3,
+			SmoothStep(x_frac), SmoothStep(y_frac),
+			SmoothStepD1(x_frac), SmoothStepD1(y_frac));
+	}
 
-		auto f0 = (1.f - Sx) * n0 + Sx * n1;
-		auto f1 = (1.f - Sx) * n2 + Sx * n3;
-		float g0 = (1.f - Sy) * f0 + Sy * f1;
+	// One octave of value noise evaluated over a whole tile.
+	// Texels in a tile share lattice corners, so the hashes covering the tile are computed once
+	// in Build() and each texel only does the smoothstep blend. Matches SmoothNoise/SmoothNoiseD1.
+	// At frequencies above one cell per texel the lattice would hold more corners than the tile has
+	// texels, most never read, so Build() skips it and each sample hashes its own four corners.
+	template <int N>
+	struct NoiseTileOctave {
+		int CellX[N];
+		int CellY[N];
+		float SX[N];
+		float SY[N];
+		float DSX[N];
+		float DSY[N];
 
-		float ddx = SmoothStepD1(x_frac) * (-n0 + n1 + (n0 - n1 - n2 + n3) * Sy);
-		float ddy = SmoothStepD1(y_frac) * (-n0 + n2 + (n0 - n1 - n2 + n3) * Sx);
+		int MinX = 0;
+		int MinY = 0;
+		int Width = 0;
+		int Height = 0;
+		uint32_t Seed = 0;
+		std::vector<float> Lattice; // empty when the samples hash their corners
 
-		return Vector3(g0, ddx, ddy);
+		// xs / ys are the per column / per row sample coordinates, already scaled by frequency
+		void Build(const float* xs, const float* ys, uint32_t seed) {
+			BuildAxis(xs, CellX, SX, DSX, MinX, Width);
+			BuildAxis(ys, CellY, SY, DSY, MinY, Height);
+			Seed = seed;
+
+			if (static_cast<int64_t>(Width) * Height > static_cast<int64_t>(N) * N) {
+				Lattice.clear();
+				return;
+			}
+			Lattice.resize(static_cast<size_t>(Width) * Height);
+			for (int j = 0; j < Height; ++j) {
+				for (int i = 0; i < Width; ++i) {
+					Lattice[i + Width * j] = LatticeValue(MinX + i, MinY + j, seed);
+				}
+			}
+		}
+
+		float Sample(int x, int y) const {
+			float n[4];
+			Corners(x, y, n);
+			return SmoothNoiseBlend(n[0], n[1], n[2], n[3], SX[x], SY[y]);
+		}
+		Vector3 SampleD1(int x, int y) const {
+			float n[4];
+			Corners(x, y, n);
+			return SmoothNoiseBlendD1(n[0], n[1], n[2], n[3], SX[x], SY[y], DSX[x], DSY[y]);
+		}
+
+	private:
+		void Corners(int x, int y, float* n) const {
+			if (Lattice.empty()) {
+				int cx = MinX + CellX[x];
+				int cy = MinY + CellY[y];
+				n[0] = LatticeValue(cx, cy, Seed);
+				n[1] = LatticeValue(cx + 1, cy, Seed);
+				n[2] = LatticeValue(cx, cy + 1, Seed);
+				n[3] = LatticeValue(cx + 1, cy + 1, Seed);
+				return;
+			}
+			const float* l = &Lattice[CellX[x] + Width * CellY[y]];
+			n[0] = l[0];
+			n[1] = l[1];
+			n[2] = l[Width];
+			n[3] = l[Width + 1];
+		}
+
+		// Stores each coordinate's cell relative to the lattice origin, plus its smoothstep weights
+		static void BuildAxis(const float* coords, int* cells, float* s, float* ds, int& minCell, int& count) {
+			int maxCell = static_cast<int>(floor(coords[0]));
+			minCell = maxCell;
+			for (int i = 0; i < N; ++i) {
+				auto c_floor = floor(coords[i]);
+				auto c_frac = coords[i] - c_floor;
+				cells[i] = static_cast<int>(c_floor);
+				s[i] = SmoothStep(c_frac);
+				ds[i] = SmoothStepD1(c_frac);
+				minCell = Min(minCell, cells[i]);
+				maxCell = (std::max)(maxCell, cells[i]);
+			}
+			for (int i = 0; i < N; ++i) {
+				cells[i] -= minCell;
+			}
+			count = maxCell - minCell + 2;
+		}
+	};
+
+	// Lazy NoiseMap arithmetic.
+	// Operators on maps build a small expression tree instead of a new map; assigning the
+	// expression to a NoiseMap evaluates it in one SIMD pass straight into the destination,
+	// so `a * 0.5f + b * c` makes no temporary tiles and reads each source once.
+	// Expressions hold references to their maps, don't keep them (e.g. in `auto`) past the statement.
+	struct NoiseOperandTag {};
+
+	template <typename T>
+	concept NoiseOperand = std::is_base_of_v<NoiseOperandTag, std::remove_cvref_t<T>>;
+
+	template <int N> struct NoiseMap;
+
+	template <int N>
+	struct NoiseMapTerm : NoiseOperandTag {
+		static constexpr int Size = N;
+		const Vector4* Data;
+		XMVECTOR Eval(int i) const { return XMLoadFloat4(&Data[i]); }
+	};
+
+	template <typename L, typename R, typename Op>
+	struct NoiseBinaryExpr : NoiseOperandTag {
+		static_assert(L::Size == R::Size, "NoiseMap sizes must match");
+		static constexpr int Size = L::Size;
+		L Left;
+		R Right;
+		XMVECTOR Eval(int i) const { return Op::Apply(Left.Eval(i), Right.Eval(i)); }
+	};
+
+	template <typename E>
+	struct NoiseScaleExpr : NoiseOperandTag {
+		static constexpr int Size = E::Size;
+		E Inner;
+		float Scalar;
+		XMVECTOR Eval(int i) const { return XMVectorScale(Inner.Eval(i), Scalar); }
+	};
+
+	struct NoiseAddOp { static XMVECTOR Apply(FXMVECTOR a, FXMVECTOR b) { return XMVectorAdd(a, b); } };
+	struct NoiseSubtractOp { static XMVECTOR Apply(FXMVECTOR a, FXMVECTOR b) { return XMVectorSubtract(a, b); } };
+	struct NoiseMultiplyOp { static XMVECTOR Apply(FXMVECTOR a, FXMVECTOR b) { return XMVectorMultiply(a, b); } };
+
+	// Maps are referenced by pointer, expressions are small and stored by value
+	template <int N>
+	NoiseMapTerm<N> AsNoiseTerm(const NoiseMap<N>& map) { return NoiseMapTerm<N>{ {}, map.Map.get() }; }
+	template <NoiseOperand E>
+	const E& AsNoiseTerm(const E& expr) { return expr; }
+
+	template <typename Op, typename L, typename R>
+	auto MakeNoiseBinary(const L& left, const R& right) {
+		using LT = std::remove_cvref_t<decltype(AsNoiseTerm(left))>;
+		using RT = std::remove_cvref_t<decltype(AsNoiseTerm(right))>;
+		return NoiseBinaryExpr<LT, RT, Op>{ {}, AsNoiseTerm(left), AsNoiseTerm(right) };
+	}
+
+	template <NoiseOperand L, NoiseOperand R>
+	auto operator+(const L& left, const R& right) { return MakeNoiseBinary<NoiseAddOp>(left, right); }
+	template <NoiseOperand L, NoiseOperand R>
+	auto operator-(const L& left, const R& right) { return MakeNoiseBinary<NoiseSubtractOp>(left, right); }
+	template <NoiseOperand L, NoiseOperand R>
+	auto operator*(const L& left, const R& right) { return MakeNoiseBinary<NoiseMultiplyOp>(left, right); }
+
+	template <NoiseOperand E>
+	auto operator*(const E& expr, float scalar) {
+		using ET = std::remove_cvref_t<decltype(AsNoiseTerm(expr))>;
+		return NoiseScaleExpr<ET>{ {}, AsNoiseTerm(expr), scalar };
+	}
+	template <NoiseOperand E>
+	auto operator*(float scalar, const E& expr) { return expr * scalar; }
+
+	// Corner texel indices and bilinear weights for 4 samples, same clamp/floor as NoiseMap::Sample()
+	struct NoiseSampleQuad {
+		alignas(16) int Index[4][4]; // [corner][lane]: (x0,y0) (x1,y0) (x0,y1) (x1,y1)
+		__m128 SX;
+		__m128 SY;
+	};
+	template <int N>
+	inline void PrepareNoiseSampleQuad(const float* fx, const float* fy, float scale, NoiseSampleQuad& quad) {
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 one = _mm_set1_ps(1.f);
+		const __m128 maxCoord = _mm_set1_ps(static_cast<float>(N - 1));
+		const __m128 width = _mm_set1_ps(static_cast<float>(N));
+
+		__m128 x = _mm_mul_ps(_mm_loadu_ps(fx), _mm_set1_ps(scale));
+		__m128 y = _mm_mul_ps(_mm_loadu_ps(fy), _mm_set1_ps(scale));
+		x = _mm_min_ps(_mm_max_ps(x, zero), maxCoord);
+		y = _mm_min_ps(_mm_max_ps(y, zero), maxCoord);
+
+		// coordinates are non-negative so truncation is floor, index math stays exact in float
+		__m128 x0 = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+		__m128 y0 = _mm_cvtepi32_ps(_mm_cvttps_epi32(y));
+		__m128 x1 = _mm_min_ps(_mm_add_ps(x0, one), maxCoord);
+		__m128 y1 = _mm_min_ps(_mm_add_ps(y0, one), maxCoord);
+		quad.SX = _mm_sub_ps(x, x0);
+		quad.SY = _mm_sub_ps(y, y0);
+
+		__m128 row0 = _mm_mul_ps(y0, width);
+		__m128 row1 = _mm_mul_ps(y1, width);
+		_mm_store_si128(reinterpret_cast<__m128i*>(quad.Index[0]), _mm_cvttps_epi32(_mm_add_ps(x0, row0)));
+		_mm_store_si128(reinterpret_cast<__m128i*>(quad.Index[1]), _mm_cvttps_epi32(_mm_add_ps(x1, row0)));
+		_mm_store_si128(reinterpret_cast<__m128i*>(quad.Index[2]), _mm_cvttps_epi32(_mm_add_ps(x0, row1)));
+		_mm_store_si128(reinterpret_cast<__m128i*>(quad.Index[3]), _mm_cvttps_epi32(_mm_add_ps(x1, row1)));
 	}
 
+	struct NoiseExprStats {
+		int Size = 0;
+		int Iterations = 0;
+		double FusedSeconds = 0.0;     // per evaluation
+		double TemporarySeconds = 0.0; // per evaluation
+		float MaxDifference = 0.f;
+	};
+
 	template <int N>
-	struct NoiseMap {
+	struct NoiseMap : NoiseOperandTag {
 		static_assert(N > 1, "NoiseMap size must be greater than 1");
 
 		NoiseMap() : Map(std::make_unique<Vector4[]>(N* N)) {}
@@ -141,62 +349,129 @@ namespace DirectX::SimpleMath {
 			Map[x + N * y] = vec4;
 		}
 
-		// Operator overloading  return new map
-		NoiseMap<N> operator+(const NoiseMap<N>& other) const {
-			NoiseMap<N> result = *this;
-			for (int i = 0; i < N * N; ++i) {
-				result.Map[i] += other.Map[i];
-			}
-			return result;
+		// Deep copy, the map owns its texels
+		NoiseMap(const NoiseMap<N>& other) : NoiseMap() { *this = other; }
+		NoiseMap(NoiseMap<N>&&) noexcept = default;
+		NoiseMap<N>& operator=(const NoiseMap<N>& other) {
+			if (this == &other) return *this;
+			Seed = other.Seed;
+			X = other.X;
+			Y = other.Y;
+			Scale = other.Scale;
+			Frequency = other.Frequency;
+			std::copy(other.Map.get(), other.Map.get() + N * N, Map.get());
+			return *this;
 		}
-		NoiseMap<N> operator-(const NoiseMap<N>& other) const {
-			NoiseMap<N> result = *this;
-			for (int i = 0; i < N * N; ++i) {
-				result.Map[i] -= other.Map[i];
-			}
-			return result;
+		NoiseMap<N>& operator=(NoiseMap<N>&&) noexcept = default;
+
+		// Build from a lazy expression, e.g. NoiseMap<N> r = a * 0.5f + b * c;
+		template <NoiseOperand E>
+		NoiseMap(const E& expr) : NoiseMap() { Evaluate(expr); }
+		template <NoiseOperand E>
+		NoiseMap<N>& operator=(const E& expr) {
+			Evaluate(expr);
+			return *this;
 		}
-		NoiseMap<N> operator*(const NoiseMap<N>& other) const {
-			NoiseMap<N> result = *this;
+
+		// Compound assignment writes in place, aliasing this map in the expression is fine
+		template <NoiseOperand E>
+		NoiseMap<N>& operator+=(const E& expr) { Evaluate(*this + expr); return *this; }
+		template <NoiseOperand E>
+		NoiseMap<N>& operator-=(const E& expr) { Evaluate(*this - expr); return *this; }
+		template <NoiseOperand E>
+		NoiseMap<N>& operator*=(const E& expr) { Evaluate(*this * expr); return *this; }
+		NoiseMap<N>& operator*=(float scalar) { Evaluate(*this * scalar); return *this; }
+
+		// Single fused pass over every texel
+		template <NoiseOperand E>
+		void Evaluate(const E& expr) {
+			const auto& term = AsNoiseTerm(expr);
+			static_assert(std::remove_cvref_t<decltype(term)>::Size == N, "NoiseMap sizes must match");
+			Vector4* out = Map.get();
 			for (int i = 0; i < N * N; ++i) {
-				result.Map[i] *= other.Map[i];
+				XMStoreFloat4(&out[i], term.Eval(i));
 			}
-			return result;
 		}
-		NoiseMap<N> operator*(float scalar) const {
-			NoiseMap<N> result = *this;
-			for (int i = 0; i < N * N; ++i) {
-				result.Map[i] *= scalar;
+
+		// Times `a * 0.5f + b * c - d` evaluated in one fused pass against one map allocated per operator,
+		// and checks both give the same texels, e.g. NoiseMap<512>::Benchmark(). This header has no logger, the caller
+		// reports the stats.
+		static NoiseExprStats Benchmark(int iterations = 16) {
+			using Clock = std::chrono::steady_clock;
+			iterations = (std::max)(iterations, 1);
+			NoiseMap<N> a, b, c, d;
+			NoiseMap<N>* inputs[4] = { &a, &b, &c, &d };
+			for (int m = 0; m < 4; ++m) {
+				for (int i = 0; i < N * N; ++i) {
+					const int x = i % N, y = i / N;
+					inputs[m]->Map[i] = Vector4(LatticeValue(x, y, 4 * m), LatticeValue(x, y, 4 * m + 1),
+						LatticeValue(x, y, 4 * m + 2), LatticeValue(x, y, 4 * m + 3));
+				}
 			}
-			return result;
-		}
 
-		// Optionally: compound assignment operators for efficiency
-		NoiseMap<N>& operator+=(const NoiseMap<N>& other) {
+			NoiseMap<N> fused;
+			auto start = Clock::now();
+			for (int it = 0; it < iterations; ++it) {
+				fused = a * 0.5f + b * c - d;
+			}
+			const double fusedSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+			// the eager version: every operator result is a new map
+			NoiseMap<N> temporary;
+			start = Clock::now();
+			for (int it = 0; it < iterations; ++it) {
+				NoiseMap<N> scaled = a * 0.5f;
+				NoiseMap<N> product = b * c;
+				NoiseMap<N> sum = scaled + product;
+				temporary = sum - d;
+			}
+			const double temporarySeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+			NoiseExprStats stats;
+			stats.Size = N;
+			stats.Iterations = iterations;
+			stats.FusedSeconds = fusedSeconds / iterations;
+			stats.TemporarySeconds = temporarySeconds / iterations;
 			for (int i = 0; i < N * N; ++i) {
-				Map[i] += other.Map[i];
+				const Vector4 diff = fused.Map[i] - temporary.Map[i];
+				stats.MaxDifference = (std::max)(stats.MaxDifference, (std::max)((std::max)(fabsf(diff.x), fabsf(diff.y)), (std::max)(fabsf(diff.z), fabsf(diff.w))));
 			}
-			return *this;
+			return stats;
 		}
 
 		// Noise generation
 		void GenerateNoiseMap_Spectrum() {
 			float ds = 1.f / (N - 1.f);
-			for (int y = 0; y < N; ++y) {
-				for (int x = 0; x < N; ++x) {
-					float dx = 2.f * x * ds - 1.f;
-					float dy = 2.f * y * ds - 1.f;
-
-					float cx = X + dx / (2.f);
-					float cy = Y + dy / (2.f);
+			float cx[N];
+			float cy[N];
+			for (int i = 0; i < N; ++i) {
+				float d = 2.f * i * ds - 1.f;
+				cx[i] = X + d / (2.f);
+				cy[i] = Y + d / (2.f);
+				cx[i] *= Frequency * Scale;
+				cy[i] *= Frequency * Scale;
+			}
 
-					cx *= Frequency*Scale;
-					cy *= Frequency*Scale;
+			// one lattice per octave, shared by every texel in the tile
+			const float frequencies[4] = { 0.001f, 0.125f, 1.0f, 8.0f };
+			const int seeds[4] = { Seed - 61, Seed + 5, Seed - 1, Seed + 1 };
+			auto octaves = std::make_unique<NoiseTileOctave<N>[]>(4);
+			float xs[N];
+			float ys[N];
+			for (int o = 0; o < 4; ++o) {
+				for (int i = 0; i < N; ++i) {
+					xs[i] = frequencies[o] * cx[i];
+					ys[i] = frequencies[o] * cy[i];
+				}
+				octaves[o].Build(xs, ys, seeds[o]);
+			}
 
-					float n0 = SmoothNoise(0.001f * cx, 0.001f * cy, Seed - 61);
-					float n1 = SmoothNoise(0.125f * cx, 0.125f * cy, Seed + 5);
-					float n2 = SmoothNoise(1.0f * cx, 1.0f * cy, Seed - 1);
-					float n3 = SmoothNoise(8.0f * cx, 8.0f * cy, Seed + 1);
+			for (int y = 0; y < N; ++y) {
+				for (int x = 0; x < N; ++x) {
+					float n0 = octaves[0].Sample(x, y);
+					float n1 = octaves[1].Sample(x, y);
+					float n2 = octaves[2].Sample(x, y);
+					float n3 = octaves[3].Sample(x, y);
 
 					SetVector(x, y, Vector4(n0, n1, n2, n3));
 				}
@@ -210,16 +485,19 @@ namespace DirectX::SimpleMath {
 			Seed = seed;
 
 			float ds = 1.f / (N - 1.f);
+			float xs[N];
+			float ys[N];
+			for (int i = 0; i < N; ++i) {
+				float d = 2.f * i * ds - 1.f;
+				xs[i] = 0.125f * (X + d / 2.f);
+				ys[i] = 0.125f * (Y + d / 2.f);
+			}
+
+			auto octave = std::make_unique<NoiseTileOctave<N>>();
+			octave->Build(xs, ys, Seed - 61);
 			for (int y = 0; y < N; ++y) {
 				for (int x = 0; x < N; ++x) {
-					float dx = 2.f * x * ds - 1.f;
-					float dy = 2.f * y * ds - 1.f;
-
-					float cx = X + dx / 2.f;
-					float cy = Y + dy / 2.f;
-
-					Vector3 noise = SmoothNoiseD1(0.125f * cx, 0.125f * cy, Seed - 61);
-
+					Vector3 noise = octave->SampleD1(x, y);
 					SetVector(x, y, Vector4(noise.x, noise.y, noise.z, 0.f));
 				}
 			}
@@ -252,6 +530,676 @@ namespace DirectX::SimpleMath {
 		Vector4 NormalisedSample(float fx, float fy) const {
 			return Sample(fx * (N - 1.f), fy * (N - 1.f));
 		}
+
+		// Batched Sample(): fx / fy in texel space, results written as separate channel arrays.
+		// Null outputs are skipped. Matches Sample() exactly, four samples per SSE pass.
+		void SampleBatch(const float* fx, const float* fy, int count, float* outX, float* outY = nullptr, float* outZ = nullptr, float* outW = nullptr) const {
+			SampleBatchScaled(fx, fy, count, 1.f, outX, outY, outZ, outW);
+		}
+		void NormalisedSampleBatch(const float* fx, const float* fy, int count, float* outX, float* outY = nullptr, float* outZ = nullptr, float* outW = nullptr) const {
+			SampleBatchScaled(fx, fy, count, N - 1.f, outX, outY, outZ, outW);
+		}
+
+		// Single channel (0 = x .. 3 = w) fast path, only that channel's texels are read
+		void SampleChannelBatch(int channel, const float* fx, const float* fy, int count, float* out) const {
+			SampleChannelBatchScaled(channel, fx, fy, count, 1.f, out);
+		}
+		void NormalisedSampleChannelBatch(int channel, const float* fx, const float* fy, int count, float* out) const {
+			SampleChannelBatchScaled(channel, fx, fy, count, N - 1.f, out);
+		}
+
+	private:
+		void SampleBatchScaled(const float* fx, const float* fy, int count, float scale, float* outX, float* outY, float* outZ, float* outW) const {
+			const float* texels = &Map[0].x;
+			int i = 0;
+			for (; i + 4 <= count; i += 4) {
+				NoiseSampleQuad quad;
+				PrepareNoiseSampleQuad<N>(fx + i, fy + i, scale, quad);
+				alignas(16) float sx[4];
+				alignas(16) float sy[4];
+				_mm_store_ps(sx, quad.SX);
+				_mm_store_ps(sy, quad.SY);
+
+				// each texel is one aligned 16 byte load, blend per lane then transpose to channels
+				__m128 result[4];
+				for (int l = 0; l < 4; ++l) {
+					__m128 A = _mm_loadu_ps(texels + 4 * quad.Index[0][l]);
+					__m128 B = _mm_loadu_ps(texels + 4 * quad.Index[1][l]);
+					__m128 C = _mm_loadu_ps(texels + 4 * quad.Index[2][l]);
+					__m128 D = _mm_loadu_ps(texels + 4 * quad.Index[3][l]);
+					__m128 wx = _mm_set1_ps(sx[l]);
+					__m128 wy = _mm_set1_ps(sy[l]);
+					__m128 AB = _mm_add_ps(A, _mm_mul_ps(_mm_sub_ps(B, A), wx));
+					__m128 CD = _mm_add_ps(C, _mm_mul_ps(_mm_sub_ps(D, C), wx));
+					result[l] = _mm_add_ps(AB, _mm_mul_ps(_mm_sub_ps(CD, AB), wy));
+				}
+				_MM_TRANSPOSE4_PS(result[0], result[1], result[2], result[3]);
+				if (outX) _mm_storeu_ps(outX + i, result[0]);
+				if (outY) _mm_storeu_ps(outY + i, result[1]);
+				if (outZ) _mm_storeu_ps(outZ + i, result[2]);
+				if (outW) _mm_storeu_ps(outW + i, result[3]);
+			}
+			for (; i < count; ++i) {
+				Vector4 s = Sample(fx[i] * scale, fy[i] * scale);
+				if (outX) outX[i] = s.x;
+				if (outY) outY[i] = s.y;
+				if (outZ) outZ[i] = s.z;
+				if (outW) outW[i] = s.w;
+			}
+		}
+
+		void SampleChannelBatchScaled(int channel, const float* fx, const float* fy, int count, float scale, float* out) const {
+			const float* texels = &Map[0].x + channel;
+			int i = 0;
+			for (; i + 4 <= count; i += 4) {
+				NoiseSampleQuad quad;
+				PrepareNoiseSampleQuad<N>(fx + i, fy + i, scale, quad);
+
+				__m128 corners[4];
+				for (int c = 0; c < 4; ++c) {
+#if defined(__AVX2__)
+					corners[c] = _mm_i32gather_ps(texels, _mm_slli_epi32(_mm_load_si128(reinterpret_cast<const __m128i*>(quad.Index[c])), 2), 4);
+#else
+					const int* index = quad.Index[c];
+					corners[c] = _mm_setr_ps(texels[4 * index[0]], texels[4 * index[1]], texels[4 * index[2]], texels[4 * index[3]]);
+#endif
+				}
+				__m128 AB = _mm_add_ps(corners[0], _mm_mul_ps(_mm_sub_ps(corners[1], corners[0]), quad.SX));
+				__m128 CD = _mm_add_ps(corners[2], _mm_mul_ps(_mm_sub_ps(corners[3], corners[2]), quad.SX));
+				_mm_storeu_ps(out + i, _mm_add_ps(AB, _mm_mul_ps(_mm_sub_ps(CD, AB), quad.SY)));
+			}
+			for (; i < count; ++i) {
+				Vector4 s = Sample(fx[i] * scale, fy[i] * scale);
+				out[i] = (&s.x)[channel];
+			}
+		}
+	};
+
+	// Simplex and gradient noise (2D / 3D / 4D) with analytic derivatives.
+	// The kernels are written once against a small lane interface and instantiated for float
+	// (single samples) and NoiseLanes (4 samples per SSE register, used by the batch functions),
+	// so batched and per-sample results agree. Output is roughly in [-1, 1].
+
+	struct NoiseLanes {
+		__m128 v;
+		NoiseLanes() = default;
+		NoiseLanes(__m128 x) : v(x) {}
+		NoiseLanes(float f) : v(_mm_set1_ps(f)) {}
+	};
+	struct NoiseLanesI {
+		__m128i v;
+		NoiseLanesI() = default;
+		NoiseLanesI(__m128i x) : v(x) {}
+		NoiseLanesI(uint32_t u) : v(_mm_set1_epi32(static_cast<int>(u))) {}
+	};
+	struct NoiseMask { __m128 v; };
+
+	inline NoiseLanes operator+(NoiseLanes a, NoiseLanes b) { return _mm_add_ps(a.v, b.v); }
+	inline NoiseLanes operator-(NoiseLanes a, NoiseLanes b) { return _mm_sub_ps(a.v, b.v); }
+	inline NoiseLanes operator*(NoiseLanes a, NoiseLanes b) { return _mm_mul_ps(a.v, b.v); }
+	inline NoiseMask operator>(NoiseLanes a, NoiseLanes b) { return { _mm_cmpgt_ps(a.v, b.v) }; }
+	inline NoiseMask operator>=(NoiseLanes a, NoiseLanes b) { return { _mm_cmpge_ps(a.v, b.v) }; }
+
+	inline NoiseLanesI operator+(NoiseLanesI a, NoiseLanesI b) { return _mm_add_epi32(a.v, b.v); }
+	inline NoiseLanesI operator^(NoiseLanesI a, NoiseLanesI b) { return _mm_xor_si128(a.v, b.v); }
+	inline NoiseLanesI operator&(NoiseLanesI a, NoiseLanesI b) { return _mm_and_si128(a.v, b.v); }
+	inline NoiseLanesI operator>>(NoiseLanesI a, int n) { return _mm_srli_epi32(a.v, n); }
+	inline NoiseLanesI operator<<(NoiseLanesI a, int n) { return _mm_slli_epi32(a.v, n); }
+	inline NoiseLanesI operator*(NoiseLanesI a, NoiseLanesI b) {
+#if defined(__SSE4_1__) || defined(__AVX__)
+		return _mm_mullo_epi32(a.v, b.v);
+#else
+		// SSE2 low 32-bit multiply
+		__m128i even = _mm_mul_epu32(a.v, b.v);
+		__m128i odd = _mm_mul_epu32(_mm_srli_epi64(a.v, 32), _mm_srli_epi64(b.v, 32));
+		return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+#endif
+	}
+
+	template <typename T> struct NoiseIntOf { using Type = uint32_t; };
+	template <> struct NoiseIntOf<NoiseLanes> { using Type = NoiseLanesI; };
+
+	inline float NoiseSelect(bool m, float a, float b) { return m ? a : b; }
+	inline NoiseLanes NoiseSelect(NoiseMask m, NoiseLanes a, NoiseLanes b) {
+		return _mm_or_ps(_mm_and_ps(m.v, a.v), _mm_andnot_ps(m.v, b.v));
+	}
+	inline float NoiseFloor(float a) { return floorf(a); }
+	inline NoiseLanes NoiseFloor(NoiseLanes a) {
+		__m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(a.v));
+		return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, a.v), _mm_set1_ps(1.f)));
+	}
+	inline float NoiseMax0(float a) { return a > 0.f ? a : 0.f; }
+	inline NoiseLanes NoiseMax0(NoiseLanes a) { return _mm_max_ps(a.v, _mm_setzero_ps()); }
+	inline float NoiseAbs(float a) { return fabsf(a); }
+	inline NoiseLanes NoiseAbs(NoiseLanes a) { return _mm_andnot_ps(_mm_set1_ps(-0.f), a.v); }
+	inline float NoiseSign(float a) { return a < 0.f ? -1.f : 1.f; }
+	inline NoiseLanes NoiseSign(NoiseLanes a) { return _mm_or_ps(_mm_and_ps(_mm_set1_ps(-0.f), a.v), _mm_set1_ps(1.f)); }
+	// integral float -> int
+	inline uint32_t NoiseToInt(float a) { return static_cast<uint32_t>(static_cast<int>(a)); }
+	inline NoiseLanesI NoiseToInt(NoiseLanes a) { return _mm_cvttps_epi32(a.v); }
+	inline float NoiseToFloat(uint32_t a) { return static_cast<float>(static_cast<int>(a)); }
+	inline NoiseLanes NoiseToFloat(NoiseLanesI a) { return _mm_cvtepi32_ps(a.v); }
+
+	// Squirrel1D mangling applied to one combined lattice coordinate
+	template <typename I>
+	inline I NoiseLatticeHash(const I* cell, int dimensions, uint32_t seed) {
+		static constexpr uint32_t Primes[4] = { 1, 198491317, 6542989, 357239 };
+		I h = cell[0];
+		for (int d = 1; d < dimensions; ++d) {
+			h = h + cell[d] * I(Primes[d]);
+		}
+		h = h * I(3039394381u);
+		h = h + I(seed);
+		h = h ^ (h >> 8);
+		h = h + I(1759714724u);
+		h = h ^ (h << 8);
+		h = h * I(458671337u);
+		h = h ^ (h >> 8);
+		return h;
+	}
+
+	// Gradient component d in [-1, 1] from byte d of the hash
+	template <typename T, typename I>
+	inline T NoiseGradient(I hash, int d) {
+		return NoiseToFloat((hash >> (8 * d)) & I(255u)) * (2.f / 255.f) - 1.f;
+	}
+
+	template <int D> struct SimplexConstants;
+	// F = (sqrt(D+1) - 1) / D, G = (1 - 1 / sqrt(D+1)) / D
+	template <> struct SimplexConstants<2> { static constexpr float F = 0.36602540378f; static constexpr float G = 0.21132486540f; static constexpr float Scale = 75.f; };
+	template <> struct SimplexConstants<3> { static constexpr float F = 0.33333333333f; static constexpr float G = 0.16666666667f; static constexpr float Scale = 68.f; };
+	template <> struct SimplexConstants<4> { static constexpr float F = 0.30901699437f; static constexpr float G = 0.13819660113f; static constexpr float Scale = 62.f; };
+
+	template <int D> struct GradientConstants;
+	template <> struct GradientConstants<2> { static constexpr float Scale = 1.35f; };
+	template <> struct GradientConstants<3> { static constexpr float Scale = 1.33f; };
+	template <> struct GradientConstants<4> { static constexpr float Scale = 1.2f; };
+
+	// Simplex noise, radius^2 of 0.5 keeps every corner's contribution zero at the simplex edge
+	// so the noise and its derivative are continuous in all dimensions.
+	template <int D, typename T>
+	T SimplexKernel(const T(&p)[D], uint32_t seed, T* derivative) {
+		using I = typename NoiseIntOf<T>::Type;
+		constexpr float F = SimplexConstants<D>::F;
+		constexpr float G = SimplexConstants<D>::G;
+
+		// skew into the simplex grid and find the containing cell
+		T skew = p[0];
+		for (int d = 1; d < D; ++d) skew = skew + p[d];
+		skew = skew * F;
+
+		T cell[D];
+		T unskew = 0.f;
+		for (int d = 0; d < D; ++d) {
+			cell[d] = NoiseFloor(p[d] + skew);
+			unskew = unskew + cell[d];
+		}
+		unskew = unskew * G;
+
+		T x0[D];
+		I cellInt[D];
+		for (int d = 0; d < D; ++d) {
+			x0[d] = p[d] - (cell[d] - unskew);
+			cellInt[d] = NoiseToInt(cell[d]);
+		}
+
+		// rank of each axis picks the traversal order through the simplex corners
+		T rank[D];
+		for (int d = 0; d < D; ++d) rank[d] = 0.f;
+		for (int j = 0; j < D; ++j) {
+			for (int k = j + 1; k < D; ++k) {
+				auto greater = x0[j] > x0[k];
+				rank[j] = rank[j] + NoiseSelect(greater, T(1.f), T(0.f));
+				rank[k] = rank[k] + NoiseSelect(greater, T(0.f), T(1.f));
+			}
+		}
+
+		T value = 0.f;
+		if (derivative) {
+			for (int d = 0; d < D; ++d) derivative[d] = 0.f;
+		}
+		for (int c = 0; c <= D; ++c) {
+			T xc[D];
+			I corner[D];
+			T falloff = 0.5f;
+			for (int d = 0; d < D; ++d) {
+				T offset = (c == 0) ? T(0.f) : (c == D) ? T(1.f) : NoiseSelect(rank[d] >= T(static_cast<float>(D - c)), T(1.f), T(0.f));
+				xc[d] = x0[d] - offset + T(c * G);
+				corner[d] = cellInt[d] + NoiseToInt(offset);
+				falloff = falloff - xc[d] * xc[d];
+			}
+			falloff = NoiseMax0(falloff);
+
+			I hash = NoiseLatticeHash(corner, D, seed);
+			T gradient[D];
+			T dot = 0.f;
+			for (int d = 0; d < D; ++d) {
+				gradient[d] = NoiseGradient<T>(hash, d);
+				dot = dot + gradient[d] * xc[d];
+			}
+
+			T t2 = falloff * falloff;
+			T t4 = t2 * t2;
+			value = value + t4 * dot;
+			if (derivative) {
+				// d/dx [t^4 (g.x)] = t^4 g - 8 t^3 (g.x) x
+				T scaled = t2 * falloff * dot * 8.f;
+				for (int d = 0; d < D; ++d) {
+					derivative[d] = derivative[d] + t4 * gradient[d] - scaled * xc[d];
+				}
+			}
+		}
+
+		constexpr float scale = SimplexConstants<D>::Scale;
+		if (derivative) {
+			for (int d = 0; d < D; ++d) derivative[d] = derivative[d] * scale;
+		}
+		return value * scale;
+	}
+
+	// Classic gradient (Perlin style) noise with a quintic fade over the 2^D cell corners
+	template <int D, typename T>
+	T GradientKernel(const T(&p)[D], uint32_t seed, T* derivative) {
+		using I = typename NoiseIntOf<T>::Type;
+
+		T frac[D];
+		T fade[D];
+		T fadeD1[D];
+		I cellInt[D];
+		for (int d = 0; d < D; ++d) {
+			T cell = NoiseFloor(p[d]);
+			T f = p[d] - cell;
+			frac[d] = f;
+			fade[d] = f * f * f * (f * (f * 6.f - 15.f) + 10.f);
+			fadeD1[d] = f * f * 30.f * (f * (f - 2.f) + 1.f);
+			cellInt[d] = NoiseToInt(cell);
+		}
+
+		T value = 0.f;
+		if (derivative) {
+			for (int d = 0; d < D; ++d) derivative[d] = 0.f;
+		}
+		for (int c = 0; c < (1 << D); ++c) {
+			I corner[D];
+			T weights[D];
+			T xc[D];
+			T weight = 1.f;
+			for (int d = 0; d < D; ++d) {
+				bool upper = (c >> d) & 1;
+				corner[d] = upper ? cellInt[d] + I(1u) : cellInt[d];
+				xc[d] = upper ? frac[d] - 1.f : frac[d];
+				weights[d] = upper ? fade[d] : T(1.f) - fade[d];
+				weight = weight * weights[d];
+			}
+
+			I hash = NoiseLatticeHash(corner, D, seed);
+			T gradient[D];
+			T dot = 0.f;
+			for (int d = 0; d < D; ++d) {
+				gradient[d] = NoiseGradient<T>(hash, d);
+				dot = dot + gradient[d] * xc[d];
+			}
+			value = value + weight * dot;
+
+			if (derivative) {
+				for (int j = 0; j < D; ++j) {
+					T dWeight = ((c >> j) & 1) ? fadeD1[j] : T(0.f) - fadeD1[j];
+					for (int k = 0; k < D; ++k) {
+						if (k != j) dWeight = dWeight * weights[k];
+					}
+					derivative[j] = derivative[j] + weight * gradient[j] + dot * dWeight;
+				}
+			}
+		}
+
+		constexpr float scale = GradientConstants<D>::Scale;
+		if (derivative) {
+			for (int d = 0; d < D; ++d) derivative[d] = derivative[d] * scale;
+		}
+		return value * scale;
+	}
+
+	enum class NoiseBasis {
+		Simplex,
+		Gradient
+	};
+
+	template <NoiseBasis Basis, int D, typename T>
+	inline T NoiseKernel(const T(&p)[D], uint32_t seed, T* derivative) {
+		if constexpr (Basis == NoiseBasis::Simplex) return SimplexKernel<D>(p, seed, derivative);
+		else return GradientKernel<D>(p, seed, derivative);
+	}
+
+	// Single samples
+	inline float SimplexNoise2D(float x, float y, uint32_t seed = 0) {
+		float p[2] = { x, y };
+		return SimplexKernel<2>(p, seed, (float*)nullptr);
+	}
+	inline Vector3 SimplexNoise2DD1(float x, float y, uint32_t seed = 0) {
+		float p[2] = { x, y };
+		float d[2];
+		float n = SimplexKernel<2>(p, seed, d);
+		return Vector3(n, d[0], d[1]);
+	}
+	inline float SimplexNoise3D(float x, float y, float z, uint32_t seed = 0) {
+		float p[3] = { x, y, z };
+		return SimplexKernel<3>(p, seed, (float*)nullptr);
+	}
+	inline Vector4 SimplexNoise3DD1(float x, float y, float z, uint32_t seed = 0) {
+		float p[3] = { x, y, z };
+		float d[3];
+		float n = SimplexKernel<3>(p, seed, d);
+		return Vector4(n, d[0], d[1], d[2]);
+	}
+	inline float SimplexNoise4D(float x, float y, float z, float w, uint32_t seed = 0) {
+		float p[4] = { x, y, z, w };
+		return SimplexKernel<4>(p, seed, (float*)nullptr);
+	}
+	inline float SimplexNoise4DD1(float x, float y, float z, float w, Vector4& derivative, uint32_t seed = 0) {
+		float p[4] = { x, y, z, w };
+		float d[4];
+		float n = SimplexKernel<4>(p, seed, d);
+		derivative = Vector4(d[0], d[1], d[2], d[3]);
+		return n;
+	}
+
+	inline float GradientNoise2D(float x, float y, uint32_t seed = 0) {
+		float p[2] = { x, y };
+		return GradientKernel<2>(p, seed, (float*)nullptr);
+	}
+	inline Vector3 GradientNoise2DD1(float x, float y, uint32_t seed = 0) {
+		float p[2] = { x, y };
+		float d[2];
+		float n = GradientKernel<2>(p, seed, d);
+		return Vector3(n, d[0], d[1]);
+	}
+	inline float GradientNoise3D(float x, float y, float z, uint32_t seed = 0) {
+		float p[3] = { x, y, z };
+		return GradientKernel<3>(p, seed, (float*)nullptr);
+	}
+	inline Vector4 GradientNoise3DD1(float x, float y, float z, uint32_t seed = 0) {
+		float p[3] = { x, y, z };
+		float d[3];
+		float n = GradientKernel<3>(p, seed, d);
+		return Vector4(n, d[0], d[1], d[2]);
+	}
+	inline float GradientNoise4D(float x, float y, float z, float w, uint32_t seed = 0) {
+		float p[4] = { x, y, z, w };
+		return GradientKernel<4>(p, seed, (float*)nullptr);
+	}
+	inline float GradientNoise4DD1(float x, float y, float z, float w, Vector4& derivative, uint32_t seed = 0) {
+		float p[4] = { x, y, z, w };
+		float d[4];
+		float n = GradientKernel<4>(p, seed, d);
+		derivative = Vector4(d[0], d[1], d[2], d[3]);
+		return n;
+	}
+
+	// Samples per second of the per-sample float kernels against the batch lane kernels
+	struct NoiseBatchStats {
+		int Dimensions = 0;
+		int Samples = 0;
+		double ScalarNoise = 0.0;
+		double LaneNoise = 0.0;
+		double ScalarFBm = 0.0;
+		double LaneFBm = 0.0;
+		double ScalarRidged = 0.0;
+		double LaneRidged = 0.0;
+		float MaxDifference = 0.f; // largest gap between the scalar and lane results
+	};
+
+	// Structure of arrays batch: Count positions in, Count values (and optionally derivatives) out.
+	// Outputs must not alias the coordinate arrays.
+	template <int D>
+	struct NoiseBatch {
+		const float* Coords[D] = {};
+		float* Values = nullptr;
+		float* Derivatives[D] = {}; // all or none
+		int Count = 0;
+
+		// Evaluates count random positions with the scalar kernels and with NoiseBatchEval / FBmBatch /
+		// RidgedBatch, e.g. NoiseBatch<3>::Benchmark(). This header has no logger, the caller reports the stats.
+		static NoiseBatchStats Benchmark(int count = 1 << 18, NoiseBasis basis = NoiseBasis::Simplex, uint32_t seed = 0);
+	};
+
+	template <NoiseBasis Basis, int D>
+	void NoiseBatchEval(const NoiseBatch<D>& batch, uint32_t seed) {
+		const bool wantDerivative = batch.Derivatives[0] != nullptr;
+		int i = 0;
+		for (; i + 4 <= batch.Count; i += 4) {
+			NoiseLanes p[D];
+			NoiseLanes derivative[D];
+			for (int d = 0; d < D; ++d) p[d] = _mm_loadu_ps(batch.Coords[d] + i);
+
+			NoiseLanes n = NoiseKernel<Basis, D>(p, seed, wantDerivative ? derivative : nullptr);
+			_mm_storeu_ps(batch.Values + i, n.v);
+			if (wantDerivative) {
+				for (int d = 0; d < D; ++d) _mm_storeu_ps(batch.Derivatives[d] + i, derivative[d].v);
+			}
+		}
+		for (; i < batch.Count; ++i) {
+			float p[D];
+			float derivative[D];
+			for (int d = 0; d < D; ++d) p[d] = batch.Coords[d][i];
+
+			batch.Values[i] = NoiseKernel<Basis, D>(p, seed, wantDerivative ? derivative : nullptr);
+			if (wantDerivative) {
+				for (int d = 0; d < D; ++d) batch.Derivatives[d][i] = derivative[d];
+			}
+		}
+	}
+	template <int D>
+	void NoiseBatchEval(NoiseBasis basis, const NoiseBatch<D>& batch, uint32_t seed) {
+		if (basis == NoiseBasis::Simplex) NoiseBatchEval<NoiseBasis::Simplex>(batch, seed);
+		else NoiseBatchEval<NoiseBasis::Gradient>(batch, seed);
+	}
+
+	template <int D>
+	void SimplexNoiseBatch(const NoiseBatch<D>& batch, uint32_t seed = 0) { NoiseBatchEval<NoiseBasis::Simplex>(batch, seed); }
+	template <int D>
+	void GradientNoiseBatch(const NoiseBatch<D>& batch, uint32_t seed = 0) { NoiseBatchEval<NoiseBasis::Gradient>(batch, seed); }
+
+	struct NoiseFractal {
+		NoiseBasis Basis = NoiseBasis::Simplex;
+		int Octaves = 4;
+		float Frequency = 1.f;
+		float Lacunarity = 2.f;
+		float Gain = 0.5f;
+		uint32_t Seed = 0;
 	};
 
+	// Sums octaves of the batch noise, a block at a time so the scratch stays in L1.
+	// Ridged folds each octave as (1 - |n|)^2. Output is normalised by the total amplitude.
+	template <int D, bool Ridged>
+	void FractalBatchEval(const NoiseBatch<D>& batch, const NoiseFractal& fractal) {
+		constexpr int Block = 256;
+		float coords[D][Block];
+		float values[Block];
+		float derivatives[D][Block];
+		const bool wantDerivative = batch.Derivatives[0] != nullptr;
+
+		float amplitudeSum = 0.f;
+		float amplitude = 1.f;
+		for (int o = 0; o < fractal.Octaves; ++o) {
+			amplitudeSum += amplitude;
+			amplitude *= fractal.Gain;
+		}
+		const float norm = amplitudeSum > 0.f ? 1.f / amplitudeSum : 0.f;
+
+		for (int start = 0; start < batch.Count; start += Block) {
+			const int count = Min(Block, batch.Count - start);
+
+			NoiseBatch<D> octaveBatch;
+			octaveBatch.Values = values;
+			octaveBatch.Count = count;
+			for (int d = 0; d < D; ++d) {
+				octaveBatch.Coords[d] = coords[d];
+				if (wantDerivative) octaveBatch.Derivatives[d] = derivatives[d];
+			}
+
+			float* out = batch.Values + start;
+			for (int i = 0; i < count; ++i) out[i] = 0.f;
+			if (wantDerivative) {
+				for (int d = 0; d < D; ++d) {
+					for (int i = 0; i < count; ++i) batch.Derivatives[d][start + i] = 0.f;
+				}
+			}
+
+			float frequency = fractal.Frequency;
+			amplitude = norm;
+			for (int o = 0; o < fractal.Octaves; ++o) {
+				for (int d = 0; d < D; ++d) {
+					const float* in = batch.Coords[d] + start;
+					for (int i = 0; i < count; ++i) coords[d][i] = in[i] * frequency;
+				}
+				NoiseBatchEval<D>(fractal.Basis, octaveBatch, fractal.Seed + o * 1013u);
+
+				if constexpr (Ridged) {
+					for (int i = 0; i < count; ++i) {
+						float folded = 1.f - fabsf(values[i]);
+						out[i] += amplitude * folded * folded;
+						if (wantDerivative) {
+							float slope = -2.f * folded * NoiseSign(values[i]) * amplitude * frequency;
+							for (int d = 0; d < D; ++d) batch.Derivatives[d][start + i] += slope * derivatives[d][i];
+						}
+					}
+				}
+				else {
+					for (int i = 0; i < count; ++i) out[i] += amplitude * values[i];
+					if (wantDerivative) {
+						for (int d = 0; d < D; ++d) {
+							for (int i = 0; i < count; ++i) batch.Derivatives[d][start + i] += amplitude * frequency * derivatives[d][i];
+						}
+					}
+				}
+				frequency *= fractal.Lacunarity;
+				amplitude *= fractal.Gain;
+			}
+		}
+	}
+
+	template <int D>
+	void FBmBatch(const NoiseBatch<D>& batch, const NoiseFractal& fractal) { FractalBatchEval<D, false>(batch, fractal); }
+	template <int D>
+	void RidgedBatch(const NoiseBatch<D>& batch, const NoiseFractal& fractal) { FractalBatchEval<D, true>(batch, fractal); }
+
+	template <int D>
+	NoiseBatchStats NoiseBatch<D>::Benchmark(int count, NoiseBasis basis, uint32_t seed) {
+		using Clock = std::chrono::steady_clock;
+		count = (std::max)(count, 4);
+		std::vector<float> coords[D];
+		for (int d = 0; d < D; ++d) {
+			coords[d].resize(count);
+			for (int i = 0; i < count; ++i) coords[d][i] = 64.f * LatticeValue(i, d, seed) - 32.f;
+		}
+		std::vector<float> scalar(count);
+		std::vector<float> lanes(count);
+		NoiseBatch<D> batch;
+		for (int d = 0; d < D; ++d) batch.Coords[d] = coords[d].data();
+		batch.Values = lanes.data();
+		batch.Count = count;
+
+		NoiseFractal fractal;
+		fractal.Basis = basis;
+		fractal.Seed = seed;
+
+		NoiseBatchStats stats;
+		stats.Dimensions = D;
+		stats.Samples = count;
+		auto samplesPerSecond = [count](Clock::time_point start) {
+			const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+			return seconds > 0.0 ? count / seconds : 0.0;
+		};
+		auto compare = [&]() {
+			for (int i = 0; i < count; ++i) stats.MaxDifference = (std::max)(stats.MaxDifference, fabsf(scalar[i] - lanes[i]));
+		};
+		// the float kernels one sample at a time, octaves summed the way FractalBatchEval does
+		auto scalarFractal = [&](bool ridged) {
+			float amplitudeSum = 0.f;
+			float amplitude = 1.f;
+			for (int o = 0; o < fractal.Octaves; ++o) {
+				amplitudeSum += amplitude;
+				amplitude *= fractal.Gain;
+			}
+			for (int i = 0; i < count; ++i) {
+				float frequency = fractal.Frequency;
+				amplitude = 1.f / amplitudeSum;
+				float sum = 0.f;
+				for (int o = 0; o < fractal.Octaves; ++o) {
+					float p[D];
+					for (int d = 0; d < D; ++d) p[d] = coords[d][i] * frequency;
+					const uint32_t octaveSeed = fractal.Seed + o * 1013u;
+					float n = basis == NoiseBasis::Simplex ? NoiseKernel<NoiseBasis::Simplex, D>(p, octaveSeed, (float*)nullptr)
+						: NoiseKernel<NoiseBasis::Gradient, D>(p, octaveSeed, (float*)nullptr);
+					if (ridged) {
+						float folded = 1.f - fabsf(n);
+						sum += amplitude * folded * folded;
+					}
+					else {
+						sum += amplitude * n;
+					}
+					frequency *= fractal.Lacunarity;
+					amplitude *= fractal.Gain;
+				}
+				scalar[i] = sum;
+			}
+		};
+
+		auto start = Clock::now();
+		for (int i = 0; i < count; ++i) {
+			float p[D];
+			for (int d = 0; d < D; ++d) p[d] = coords[d][i];
+			scalar[i] = basis == NoiseBasis::Simplex ? NoiseKernel<NoiseBasis::Simplex, D>(p, seed, (float*)nullptr)
+				: NoiseKernel<NoiseBasis::Gradient, D>(p, seed, (float*)nullptr);
+		}
+		stats.ScalarNoise = samplesPerSecond(start);
+		start = Clock::now();
+		NoiseBatchEval<D>(basis, batch, seed);
+		stats.LaneNoise = samplesPerSecond(start);
+		compare();
+
+		start = Clock::now();
+		scalarFractal(false);
+		stats.ScalarFBm = samplesPerSecond(start);
+		start = Clock::now();
+		FBmBatch<D>(batch, fractal);
+		stats.LaneFBm = samplesPerSecond(start);
+		compare();
+
+		start = Clock::now();
+		scalarFractal(true);
+		stats.ScalarRidged = samplesPerSecond(start);
+		start = Clock::now();
+		RidgedBatch<D>(batch, fractal);
+		stats.LaneRidged = samplesPerSecond(start);
+		compare();
+		return stats;
+	}
+
+	// Offsets each position by amplitude * fBm, one decorrelated fBm per axis.
+	// warped may alias coords for an in-place warp.
+	template <int D>
+	void DomainWarpBatch(const float* const* coords, float* const* warped, int count, float amplitude, const NoiseFractal& fractal) {
+		constexpr int Block = 256;
+		float offsets[D][Block];
+		for (int start = 0; start < count; start += Block) {
+			const int blockCount = Min(Block, count - start);
+			for (int axis = 0; axis < D; ++axis) {
+				NoiseBatch<D> batch;
+				for (int d = 0; d < D; ++d) batch.Coords[d] = coords[d] + start;
+				batch.Values = offsets[axis];
+				batch.Count = blockCount;
+
+				NoiseFractal axisFractal = fractal;
+				axisFractal.Seed = fractal.Seed + 7919u * (axis + 1);
+				FBmBatch<D>(batch, axisFractal);
+			}
+			for (int d = 0; d < D; ++d) {
+				for (int i = 0; i < blockCount; ++i) {
+					warped[d][start + i] = coords[d][start + i] + amplitude * offsets[d][i];
+				}
+			}
+		}
+	}
+
 }
\ No newline at end of file
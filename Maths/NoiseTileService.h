@@ -0,0 +1,328 @@
+#pragma once
+#include "Maths.h"
+#include "ThreadPool.h"
+#include <future>
+#include <list>
+#include <unordered_map>
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+namespace DXE
+{
+	enum class NoiseGenerator : uint8_t {
+		Spectrum,
+		HeightDXDYMask
+	};
+
+	struct NoiseTileKey {
+		int X = 0;
+		int Y = 0;
+		int Seed = 0;
+		NoiseGenerator Generator = NoiseGenerator::HeightDXDYMask;
+		int Size = 0;
+
+		bool operator==(const NoiseTileKey& other) const = default;
+	};
+
+	struct NoiseTileKeyHash {
+		size_t operator()(const NoiseTileKey& key) const {
+			uint32_t salt = static_cast<uint32_t>(key.Seed) ^ (static_cast<uint32_t>(key.Generator) << 24) ^ (static_cast<uint32_t>(key.Size) << 12);
+			return DXM::Squirrel2D(key.X, key.Y, salt);
+		}
+	};
+
+	struct NoiseTileStats {
+		uint64_t Hits = 0;
+		uint64_t Misses = 0;
+		uint64_t Coalesced = 0;
+		uint64_t Generated = 0;
+		uint64_t Evictions = 0;
+		uint64_t SpillWrites = 0;
+		uint64_t SpillReads = 0;
+		uint64_t SpillDeletes = 0; // least recently used spill files removed to stay within maxSpillBytes
+	};
+
+	// Generates NoiseMap tiles on worker threads and keeps finished tiles in an LRU cache.
+	// Requests for a tile that is already being generated share the same job.
+	// Evicted tiles are written to the spill directory (if set) and read back instead of regenerating. The spill
+	// files are kept within maxSpillBytes, least recently used first out, and removed when the service is destroyed.
+	// Tiles are stored packed in the given format, a half or unorm16 format fits 2-8x more tiles in maxBytes.
+	template <int N>
+	class NoiseTileService {
+	public:
+		using Tile = std::shared_ptr<const DXM::PackedNoiseMap<N>>;
+		using Callback = std::function<void(const Tile&)>;
+
+		NoiseTileService(size_t maxBytes, unsigned threadCount = 0, const std::filesystem::path& spillDirectory = {}, DXM::NoiseMapFormat format = {},
+			size_t maxSpillBytes = size_t(1) << 30)
+			: m_Format(format),
+			m_TileBytes(DXM::PackedNoiseMap<N>::ByteSize(format)),
+			m_Capacity((std::max)(size_t(1), maxBytes / m_TileBytes)),
+			m_SpillCapacity((std::max)(size_t(1), maxSpillBytes / SpillFileBytes(m_TileBytes))),
+			m_SpillDirectory(spillDirectory),
+			m_Pool(std::make_unique<ThreadPool>(threadCount)) {
+			if (!m_SpillDirectory.empty()) {
+				std::error_code ec;
+				std::filesystem::create_directories(m_SpillDirectory, ec);
+				if (ec) m_SpillDirectory.clear();
+			}
+		}
+		~NoiseTileService() {
+			m_Stopping = true;
+			m_Pool.reset(); // joins workers, queued jobs resolve with nullptr
+			for (const NoiseTileKey& key : m_SpillLru) {
+				std::error_code ec;
+				std::filesystem::remove(SpillPath(key), ec);
+			}
+		}
+
+		NoiseTileService(const NoiseTileService&) = delete;
+		NoiseTileService& operator=(const NoiseTileService&) = delete;
+
+		// Future resolves on a worker thread; cached tiles return an already-ready future
+		std::shared_future<Tile> Request(int x, int y, int seed, NoiseGenerator generator) {
+			NoiseTileKey key{ x, y, seed, generator, N };
+			std::lock_guard<std::mutex> lock(m_Mutex);
+
+			if (Tile tile = FindCachedLocked(key)) {
+				std::promise<Tile> ready;
+				ready.set_value(tile);
+				return ready.get_future().share();
+			}
+			return StartLocked(key).Future;
+		}
+
+		// Callback runs on the worker that finished the tile, or immediately on this thread if cached
+		void Request(int x, int y, int seed, NoiseGenerator generator, Callback callback) {
+			NoiseTileKey key{ x, y, seed, generator, N };
+			Tile cached;
+			{
+				std::lock_guard<std::mutex> lock(m_Mutex);
+				cached = FindCachedLocked(key);
+				if (!cached) {
+					StartLocked(key).Callbacks.push_back(std::move(callback));
+					return;
+				}
+			}
+			callback(cached);
+		}
+
+		// Cached tile or nullptr, never starts generation
+		Tile TryGet(int x, int y, int seed, NoiseGenerator generator) {
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			return FindCachedLocked(NoiseTileKey{ x, y, seed, generator, N });
+		}
+
+		void WaitIdle() { m_Pool->WaitIdle(); }
+
+		void Clear() {
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_Cache.clear();
+			m_Lru.clear();
+		}
+
+		NoiseTileStats GetStats() {
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			return m_Stats;
+		}
+		size_t GetCachedCount() {
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			return m_Cache.size();
+		}
+		size_t GetCapacity() const { return m_Capacity; }
+		size_t GetTileBytes() const { return m_TileBytes; }
+		DXM::NoiseMapFormat GetFormat() const { return m_Format; }
+
+	private:
+		struct PendingTile {
+			std::promise<Tile> Promise;
+			std::shared_future<Tile> Future;
+			std::vector<Callback> Callbacks;
+		};
+		struct CachedTile {
+			Tile Map;
+			typename std::list<NoiseTileKey>::iterator LruPosition;
+		};
+
+		Tile FindCachedLocked(const NoiseTileKey& key) {
+			auto it = m_Cache.find(key);
+			if (it == m_Cache.end()) return nullptr;
+			m_Lru.splice(m_Lru.begin(), m_Lru, it->second.LruPosition);
+			++m_Stats.Hits;
+			return it->second.Map;
+		}
+
+		PendingTile& StartLocked(const NoiseTileKey& key) {
+			auto it = m_InFlight.find(key);
+			if (it != m_InFlight.end()) {
+				++m_Stats.Coalesced;
+				return it->second;
+			}
+			++m_Stats.Misses;
+			PendingTile& pending = m_InFlight[key];
+			pending.Future = pending.Promise.get_future().share();
+			m_Pool->Submit([this, key]() { Build(key); });
+			return pending;
+		}
+
+		void Build(const NoiseTileKey& key) {
+			Tile tile;
+			if (!m_Stopping) {
+				tile = LoadSpilled(key);
+				if (!tile) tile = Generate(key);
+			}
+
+			std::vector<std::pair<NoiseTileKey, Tile>> evicted;
+			PendingTile pending;
+			{
+				std::lock_guard<std::mutex> lock(m_Mutex);
+				if (tile) InsertLocked(key, tile, evicted);
+				auto node = m_InFlight.extract(key);
+				pending = std::move(node.mapped());
+			}
+
+			// file writes and user callbacks happen outside the lock
+			for (auto& [evictedKey, evictedTile] : evicted) {
+				Spill(evictedKey, *evictedTile);
+			}
+			pending.Promise.set_value(tile);
+			for (auto& callback : pending.Callbacks) {
+				callback(tile);
+			}
+		}
+
+		void InsertLocked(const NoiseTileKey& key, const Tile& tile, std::vector<std::pair<NoiseTileKey, Tile>>& evicted) {
+			m_Lru.push_front(key);
+			m_Cache[key] = CachedTile{ tile, m_Lru.begin() };
+
+			while (m_Cache.size() > m_Capacity) {
+				const NoiseTileKey& oldest = m_Lru.back();
+				auto it = m_Cache.find(oldest);
+				if (!m_SpillDirectory.empty()) evicted.emplace_back(oldest, it->second.Map);
+				m_Cache.erase(it);
+				m_Lru.pop_back();
+				++m_Stats.Evictions;
+			}
+		}
+
+		Tile Generate(const NoiseTileKey& key) {
+			auto map = std::make_unique<DXM::NoiseMap<N>>();
+			switch (key.Generator) {
+			case NoiseGenerator::Spectrum:
+				map->X = key.X;
+				map->Y = key.Y;
+				map->Seed = key.Seed;
+				map->GenerateNoiseMap_Spectrum();
+				break;
+			case NoiseGenerator::HeightDXDYMask:
+				map->GenerateNoiseMap_HeightDXDYMask(DXM::Vector2(static_cast<float>(key.X), static_cast<float>(key.Y)), key.Seed);
+				break;
+			}
+			auto packed = std::make_shared<DXM::PackedNoiseMap<N>>(*map, m_Format);
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			++m_Stats.Generated;
+			return packed;
+		}
+
+		// Spill files are the key and format followed by the packed texels
+		static size_t SpillFileBytes(size_t tileBytes) {
+			return sizeof(NoiseTileKey) + sizeof(DXM::NoiseMapFormat) + 2 * sizeof(DXM::Vector4) + tileBytes;
+		}
+		std::filesystem::path SpillPath(const NoiseTileKey& key) const {
+			std::string name = "noise_" + std::to_string(static_cast<int>(key.Generator)) + "_" + std::to_string(key.Size)
+				+ "_" + std::to_string(key.Seed) + "_" + std::to_string(key.X) + "_" + std::to_string(key.Y) + ".tile";
+			return m_SpillDirectory / name;
+		}
+
+		void Spill(const NoiseTileKey& key, const DXM::PackedNoiseMap<N>& map) {
+			{
+				std::ofstream file(SpillPath(key), std::ios::binary | std::ios::trunc);
+				if (!file) return;
+				DXM::Vector4 range[2] = { map.GetRangeMin(), map.GetRangeScale() };
+				file.write(reinterpret_cast<const char*>(&key), sizeof(NoiseTileKey));
+				file.write(reinterpret_cast<const char*>(&m_Format), sizeof(DXM::NoiseMapFormat));
+				file.write(reinterpret_cast<const char*>(range), sizeof(range));
+				file.write(reinterpret_cast<const char*>(map.Data()), m_TileBytes);
+			}
+
+			std::vector<std::filesystem::path> expired;
+			{
+				std::lock_guard<std::mutex> lock(m_Mutex);
+				++m_Stats.SpillWrites;
+				auto it = m_Spilled.find(key);
+				if (it != m_Spilled.end()) {
+					m_SpillLru.splice(m_SpillLru.begin(), m_SpillLru, it->second);
+				}
+				else {
+					m_SpillLru.push_front(key);
+					m_Spilled[key] = m_SpillLru.begin();
+				}
+				while (m_Spilled.size() > m_SpillCapacity) {
+					expired.push_back(SpillPath(m_SpillLru.back()));
+					m_Spilled.erase(m_SpillLru.back());
+					m_SpillLru.pop_back();
+					++m_Stats.SpillDeletes;
+				}
+			}
+			// a failed remove leaves an untracked file that is never read again
+			for (const auto& path : expired) {
+				std::error_code ec;
+				std::filesystem::remove(path, ec);
+			}
+		}
+
+		Tile LoadSpilled(const NoiseTileKey& key) {
+			if (m_SpillDirectory.empty()) return nullptr;
+			{
+				// Only files this service wrote and still keeps, older runs may have left others behind
+				std::lock_guard<std::mutex> lock(m_Mutex);
+				auto it = m_Spilled.find(key);
+				if (it == m_Spilled.end()) return nullptr;
+				m_SpillLru.splice(m_SpillLru.begin(), m_SpillLru, it->second);
+			}
+			std::ifstream file(SpillPath(key), std::ios::binary);
+			if (!file) return nullptr;
+
+			NoiseTileKey stored;
+			DXM::NoiseMapFormat format;
+			file.read(reinterpret_cast<char*>(&stored), sizeof(NoiseTileKey));
+			file.read(reinterpret_cast<char*>(&format), sizeof(DXM::NoiseMapFormat));
+			if (!file || !(stored == key) || !(format == m_Format)) return nullptr;
+
+			DXM::Vector4 range[2];
+			std::vector<uint8_t> texels(m_TileBytes);
+			file.read(reinterpret_cast<char*>(range), sizeof(range));
+			file.read(reinterpret_cast<char*>(texels.data()), m_TileBytes);
+			if (!file) return nullptr;
+
+			auto map = std::make_shared<DXM::PackedNoiseMap<N>>();
+			map->Assign(format, range[0], range[1], texels.data());
+			map->X = key.X;
+			map->Y = key.Y;
+			map->Seed = key.Seed;
+
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			++m_Stats.SpillReads;
+			return map;
+		}
+
+		DXM::NoiseMapFormat m_Format;
+		size_t m_TileBytes;
+		size_t m_Capacity;
+		size_t m_SpillCapacity; // in files
+		std::filesystem::path m_SpillDirectory;
+
+		std::mutex m_Mutex;
+		std::unordered_map<NoiseTileKey, CachedTile, NoiseTileKeyHash> m_Cache;
+		std::list<NoiseTileKey> m_Lru;
+		std::unordered_map<NoiseTileKey, typename std::list<NoiseTileKey>::iterator, NoiseTileKeyHash> m_Spilled;
+		std::list<NoiseTileKey> m_SpillLru;
+		std::unordered_map<NoiseTileKey, PendingTile, NoiseTileKeyHash> m_InFlight;
+		NoiseTileStats m_Stats;
+		std::atomic<bool> m_Stopping = false;
+
+		// declared last so workers are joined before the cache they write into is destroyed
+		std::unique_ptr<ThreadPool> m_Pool;
+	};
+}
@@ -0,0 +1,394 @@
+#pragma once
+#include "Noise.h"
+#include <cstring>
+#include <cfloat>
+
+namespace DirectX::SimpleMath {
+
+	// Storage for a baked NoiseMap. 16 bit formats are 2-8x smaller than Vector4 texels and
+	// map straight onto a DXGI format, so the packed bytes can be uploaded without repacking.
+	enum class NoiseStorage : uint8_t {
+		Float32,
+		Float16,
+		UNorm16 // remapped per channel from the [min, max] of the packed map
+	};
+
+	struct NoiseMapFormat {
+		NoiseStorage Storage = NoiseStorage::Float32;
+		int Channels = 4; // 1..4, taken from x, y, z, w in order
+
+		bool operator==(const NoiseMapFormat& other) const = default;
+	};
+
+	// 4 halves in the low 64 bits <-> 4 floats, round to nearest even
+	inline __m128 NoiseHalfToFloat4(__m128i halves) {
+#if defined(__F16C__) || defined(__AVX2__)
+		return _mm_cvtph_ps(halves);
+#else
+		const __m128i h = _mm_unpacklo_epi16(halves, _mm_setzero_si128());
+		const __m128i expMant = _mm_and_si128(h, _mm_set1_epi32(0x7fff));
+		const __m128i sign = _mm_slli_epi32(_mm_xor_si128(h, expMant), 16);
+
+		// rebias the exponent with a multiply, this also normalises denormals
+		__m128 scaled = _mm_mul_ps(_mm_castsi128_ps(_mm_slli_epi32(expMant, 13)), _mm_castsi128_ps(_mm_set1_epi32((254 - 15) << 23)));
+		const __m128i infNan = _mm_cmpgt_epi32(expMant, _mm_set1_epi32(0x7bff));
+		scaled = _mm_or_ps(scaled, _mm_and_ps(_mm_castsi128_ps(infNan), _mm_castsi128_ps(_mm_set1_epi32(255 << 23))));
+		return _mm_or_ps(scaled, _mm_castsi128_ps(sign));
+#endif
+	}
+
+	inline __m128i NoiseFloatToHalf4(__m128 value) {
+#if defined(__F16C__) || defined(__AVX2__)
+		return _mm_cvtps_ph(value, _MM_FROUND_TO_NEAREST_INT);
+#else
+		const __m128 justSign = _mm_and_ps(value, _mm_set1_ps(-0.f));
+		const __m128 absValue = _mm_xor_ps(value, justSign);
+		const __m128i absBits = _mm_castps_si128(absValue);
+
+		const __m128i isNan = _mm_castps_si128(_mm_cmpunord_ps(absValue, absValue));
+		const __m128i isRegular = _mm_cmpgt_epi32(_mm_set1_epi32((127 + 16) << 23), absBits);
+		const __m128i special = _mm_or_si128(_mm_and_si128(isNan, _mm_set1_epi32(0x200)), _mm_set1_epi32(0x7c00));
+
+		// results below the smallest normal half round through a float add
+		const __m128i subnormalMagic = _mm_set1_epi32(((127 - 15) + (23 - 10) + 1) << 23);
+		const __m128i isSubnormal = _mm_cmpgt_epi32(_mm_set1_epi32((127 - 14) << 23), absBits);
+		const __m128i subnormal = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(absValue, _mm_castsi128_ps(subnormalMagic))), subnormalMagic);
+
+		// normal results rebias and round to nearest even on the dropped mantissa bits
+		const __m128i mantissaOdd = _mm_srai_epi32(_mm_slli_epi32(absBits, 31 - 13), 31);
+		__m128i normal = _mm_add_epi32(absBits, _mm_set1_epi32(0xfff - ((127 - 15) << 23)));
+		normal = _mm_srli_epi32(_mm_sub_epi32(normal, mantissaOdd), 13);
+
+		__m128i result = _mm_or_si128(_mm_and_si128(isSubnormal, subnormal), _mm_andnot_si128(isSubnormal, normal));
+		result = _mm_or_si128(_mm_and_si128(isRegular, result), _mm_andnot_si128(isRegular, special));
+
+		// sign lands in bit 15 and sign extends, so the saturating pack keeps the bits as they are
+		result = _mm_or_si128(result, _mm_srai_epi32(_mm_castps_si128(justSign), 16));
+		return _mm_packs_epi32(result, result);
+#endif
+	}
+
+	// NoiseMap texels in a reduced precision format. Reads as a NoiseOperand, so packed maps
+	// can feed NoiseMap expressions directly and every conversion runs one texel per SSE op.
+	template <int N>
+	struct PackedNoiseMap : NoiseOperandTag {
+		static_assert(N > 1, "PackedNoiseMap size must be greater than 1");
+		static constexpr int Size = N;
+
+		int Seed = 0;
+		int X = 0;
+		int Y = 0;
+
+		PackedNoiseMap() = default;
+		PackedNoiseMap(const NoiseMap<N>& map, NoiseMapFormat format) { Pack(map, format); }
+
+		PackedNoiseMap(const PackedNoiseMap<N>& other) { *this = other; }
+		PackedNoiseMap(PackedNoiseMap<N>&&) noexcept = default;
+		PackedNoiseMap<N>& operator=(const PackedNoiseMap<N>& other) {
+			if (this == &other) return *this;
+			Seed = other.Seed;
+			X = other.X;
+			Y = other.Y;
+			SetFormat(other.m_Format);
+			m_RangeMin = other.m_RangeMin;
+			m_RangeScale = other.m_RangeScale;
+			if (other.m_Data) std::memcpy(m_Data.get(), other.m_Data.get(), ByteSize());
+			return *this;
+		}
+		PackedNoiseMap<N>& operator=(PackedNoiseMap<N>&&) noexcept = default;
+
+		void Pack(const NoiseMap<N>& map, NoiseMapFormat format) {
+			Seed = map.Seed;
+			X = map.X;
+			Y = map.Y;
+			PackTerm(AsNoiseTerm(map), format);
+		}
+		// Bakes an expression, e.g. packed.Pack(a * 0.5f + b, format). The expression must not read this map.
+		template <NoiseOperand E>
+		void Pack(const E& expr, NoiseMapFormat format) {
+			PackTerm(AsNoiseTerm(expr), format);
+		}
+
+		// Channels that aren't stored unpack as 0
+		void Unpack(NoiseMap<N>& map) const {
+			map.Evaluate(*this);
+			map.Seed = Seed;
+			map.X = X;
+			map.Y = Y;
+		}
+
+		XMVECTOR Eval(int i) const { return DecodeTexel(m_Data.get() + static_cast<size_t>(i) * m_TexelBytes); }
+
+		Vector4 GetVector(int x, int y) const {
+			Vector4 result;
+			XMStoreFloat4(&result, Eval(x + N * y));
+			return result;
+		}
+
+		// Same clamp and bilinear blend as NoiseMap::Sample()
+		Vector4 Sample(float fx, float fy) const {
+			fx = std::clamp(fx, 0.0f, static_cast<float>(N - 1));
+			fy = std::clamp(fy, 0.0f, static_cast<float>(N - 1));
+
+			int x0 = static_cast<int>(floorf(fx));
+			int y0 = static_cast<int>(floorf(fy));
+			int x1 = Min(x0 + 1, (N - 1));
+			int y1 = Min(y0 + 1, (N - 1));
+
+			__m128 result = Blend(Eval(x0 + N * y0), Eval(x1 + N * y0), Eval(x0 + N * y1), Eval(x1 + N * y1),
+				_mm_set1_ps(fx - x0), _mm_set1_ps(fy - y0));
+			Vector4 out;
+			XMStoreFloat4(&out, result);
+			return out;
+		}
+		Vector4 NormalisedSample(float fx, float fy) const {
+			return Sample(fx * (N - 1.f), fy * (N - 1.f));
+		}
+
+		// Batched Sample(), see NoiseMap::SampleBatch
+		void SampleBatch(const float* fx, const float* fy, int count, float* outX, float* outY = nullptr, float* outZ = nullptr, float* outW = nullptr) const {
+			SampleBatchScaled(fx, fy, count, 1.f, outX, outY, outZ, outW);
+		}
+		void NormalisedSampleBatch(const float* fx, const float* fy, int count, float* outX, float* outY = nullptr, float* outZ = nullptr, float* outW = nullptr) const {
+			SampleBatchScaled(fx, fy, count, N - 1.f, outX, outY, outZ, outW);
+		}
+		void SampleChannelBatch(int channel, const float* fx, const float* fy, int count, float* out) const {
+			SampleChannelBatchScaled(channel, fx, fy, count, 1.f, out);
+		}
+		void NormalisedSampleChannelBatch(int channel, const float* fx, const float* fy, int count, float* out) const {
+			SampleChannelBatchScaled(channel, fx, fy, count, N - 1.f, out);
+		}
+
+		// Texture upload: N x N texels of GetDXGIFormat(), rows RowPitch() bytes apart
+		DXGI_FORMAT GetDXGIFormat() const {
+			switch (m_Format.Storage) {
+			case NoiseStorage::Float32: {
+				const DXGI_FORMAT formats[4] = { DXGI_FORMAT_R32_FLOAT, DXGI_FORMAT_R32G32_FLOAT, DXGI_FORMAT_R32G32B32_FLOAT, DXGI_FORMAT_R32G32B32A32_FLOAT };
+				return formats[m_StoredChannels - 1];
+			}
+			case NoiseStorage::Float16: {
+				const DXGI_FORMAT formats[4] = { DXGI_FORMAT_R16_FLOAT, DXGI_FORMAT_R16G16_FLOAT, DXGI_FORMAT_UNKNOWN, DXGI_FORMAT_R16G16B16A16_FLOAT };
+				return formats[m_StoredChannels - 1];
+			}
+			case NoiseStorage::UNorm16: {
+				const DXGI_FORMAT formats[4] = { DXGI_FORMAT_R16_UNORM, DXGI_FORMAT_R16G16_UNORM, DXGI_FORMAT_UNKNOWN, DXGI_FORMAT_R16G16B16A16_UNORM };
+				return formats[m_StoredChannels - 1];
+			}
+			}
+			return DXGI_FORMAT_UNKNOWN;
+		}
+		const void* Data() const { return m_Data.get(); }
+		uint32_t RowPitch() const { return static_cast<uint32_t>(N * m_TexelBytes); }
+		size_t TexelBytes() const { return m_TexelBytes; }
+		size_t ByteSize() const { return static_cast<size_t>(N) * N * m_TexelBytes; }
+		static size_t ByteSize(NoiseMapFormat format) { return static_cast<size_t>(N) * N * StoredChannels(format) * ComponentBytes(format.Storage); }
+
+		NoiseMapFormat GetFormat() const { return m_Format; }
+		// UNorm16 decode is RangeMin + stored * RangeScale per channel, identity for the float formats
+		Vector4 GetRangeMin() const { return m_RangeMin; }
+		Vector4 GetRangeScale() const { return m_RangeScale; }
+
+		// Raw restore, e.g. from a spill file. Data must hold ByteSize(format) bytes.
+		void Assign(NoiseMapFormat format, const Vector4& rangeMin, const Vector4& rangeScale, const void* data) {
+			SetFormat(format);
+			m_RangeMin = rangeMin;
+			m_RangeScale = rangeScale;
+			std::memcpy(m_Data.get(), data, ByteSize());
+		}
+
+	private:
+		// 16 bit formats have no 3 channel DXGI format, xyz is stored as xyz0
+		static int StoredChannels(NoiseMapFormat format) {
+			int channels = std::clamp(format.Channels, 1, 4);
+			return (format.Storage != NoiseStorage::Float32 && channels == 3) ? 4 : channels;
+		}
+		static size_t ComponentBytes(NoiseStorage storage) { return storage == NoiseStorage::Float32 ? 4 : 2; }
+
+		void SetFormat(NoiseMapFormat format) {
+			format.Channels = std::clamp(format.Channels, 1, 4);
+			size_t previousBytes = m_Data ? ByteSize() : 0;
+			m_Format = format;
+			m_StoredChannels = StoredChannels(format);
+			m_TexelBytes = m_StoredChannels * ComponentBytes(format.Storage);
+			if (!m_Data || previousBytes != ByteSize()) m_Data = std::make_unique<uint8_t[]>(ByteSize());
+
+			alignas(16) int mask[4];
+			for (int c = 0; c < 4; ++c) mask[c] = c < format.Channels ? -1 : 0;
+			m_ChannelMask = _mm_castsi128_ps(_mm_load_si128(reinterpret_cast<const __m128i*>(mask)));
+		}
+
+		template <typename T>
+		void PackTerm(const T& term, NoiseMapFormat format) {
+			static_assert(T::Size == N, "NoiseMap sizes must match");
+			SetFormat(format);
+			m_RangeMin = Vector4(0.f, 0.f, 0.f, 0.f);
+			m_RangeScale = Vector4(1.f, 1.f, 1.f, 1.f);
+			__m128 encodeScale = _mm_set1_ps(1.f);
+
+			if (m_Format.Storage == NoiseStorage::UNorm16) {
+				// fit the range first so the full 16 bits cover what the map actually holds
+				__m128 low = _mm_set1_ps(FLT_MAX);
+				__m128 high = _mm_set1_ps(-FLT_MAX);
+				for (int i = 0; i < N * N; ++i) {
+					__m128 v = term.Eval(i);
+					low = _mm_min_ps(low, v);
+					high = _mm_max_ps(high, v);
+				}
+				low = _mm_and_ps(low, m_ChannelMask);
+				__m128 range = _mm_and_ps(_mm_sub_ps(high, low), m_ChannelMask);
+				__m128 hasRange = _mm_cmpgt_ps(range, _mm_setzero_ps());
+				encodeScale = _mm_and_ps(_mm_div_ps(_mm_set1_ps(65535.f), range), hasRange);
+				XMStoreFloat4(&m_RangeMin, low);
+				XMStoreFloat4(&m_RangeScale, _mm_mul_ps(range, _mm_set1_ps(1.f / 65535.f)));
+			}
+
+			uint8_t* out = m_Data.get();
+			for (int i = 0; i < N * N; ++i, out += m_TexelBytes) {
+				EncodeTexel(_mm_and_ps(term.Eval(i), m_ChannelMask), encodeScale, out);
+			}
+		}
+
+		void EncodeTexel(__m128 v, __m128 encodeScale, uint8_t* out) const {
+			if (m_Format.Storage == NoiseStorage::Float32) {
+				if (m_StoredChannels == 4) {
+					_mm_storeu_ps(reinterpret_cast<float*>(out), v);
+				}
+				else {
+					alignas(16) float values[4];
+					_mm_store_ps(values, v);
+					std::memcpy(out, values, m_TexelBytes);
+				}
+				return;
+			}
+
+			__m128i packed;
+			if (m_Format.Storage == NoiseStorage::Float16) {
+				packed = NoiseFloatToHalf4(v);
+			}
+			else {
+				__m128 q = _mm_mul_ps(_mm_sub_ps(v, XMLoadFloat4(&m_RangeMin)), encodeScale);
+				q = _mm_min_ps(_mm_max_ps(q, _mm_setzero_ps()), _mm_set1_ps(65535.f));
+				// SSE2 only has a signed 32 -> 16 pack, bias into signed range and flip the top bit back
+				__m128i biased = _mm_sub_epi32(_mm_cvtps_epi32(q), _mm_set1_epi32(32768));
+				packed = _mm_xor_si128(_mm_packs_epi32(biased, biased), _mm_set1_epi16(static_cast<short>(0x8000)));
+			}
+			if (m_StoredChannels == 4) {
+				_mm_storel_epi64(reinterpret_cast<__m128i*>(out), packed);
+			}
+			else {
+				uint32_t bits = static_cast<uint32_t>(_mm_cvtsi128_si32(packed));
+				std::memcpy(out, &bits, m_TexelBytes);
+			}
+		}
+
+		__m128 DecodeTexel(const uint8_t* texel) const {
+			if (m_Format.Storage == NoiseStorage::Float32) {
+				if (m_StoredChannels == 4) return _mm_loadu_ps(reinterpret_cast<const float*>(texel));
+				alignas(16) float values[4] = { 0.f, 0.f, 0.f, 0.f };
+				std::memcpy(values, texel, m_TexelBytes);
+				return _mm_load_ps(values);
+			}
+
+			__m128i packed;
+			if (m_StoredChannels == 4) {
+				packed = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(texel));
+			}
+			else {
+				uint32_t bits = 0;
+				std::memcpy(&bits, texel, m_TexelBytes);
+				packed = _mm_cvtsi32_si128(static_cast<int>(bits));
+			}
+			if (m_Format.Storage == NoiseStorage::Float16) return NoiseHalfToFloat4(packed);
+
+			__m128 q = _mm_cvtepi32_ps(_mm_unpacklo_epi16(packed, _mm_setzero_si128()));
+			return _mm_add_ps(XMLoadFloat4(&m_RangeMin), _mm_mul_ps(q, XMLoadFloat4(&m_RangeScale)));
+		}
+
+		// One channel for 4 texels
+		__m128 GatherChannel(const int* index, int channel) const {
+			if (channel >= m_Format.Channels) return _mm_setzero_ps();
+			const int stride = m_StoredChannels;
+			if (m_Format.Storage == NoiseStorage::Float32) {
+				const float* texels = reinterpret_cast<const float*>(m_Data.get()) + channel;
+				return _mm_setr_ps(texels[stride * index[0]], texels[stride * index[1]], texels[stride * index[2]], texels[stride * index[3]]);
+			}
+
+			const uint16_t* texels = reinterpret_cast<const uint16_t*>(m_Data.get()) + channel;
+			__m128i packed = _mm_setr_epi16(static_cast<short>(texels[stride * index[0]]), static_cast<short>(texels[stride * index[1]]),
+				static_cast<short>(texels[stride * index[2]]), static_cast<short>(texels[stride * index[3]]), 0, 0, 0, 0);
+			if (m_Format.Storage == NoiseStorage::Float16) return NoiseHalfToFloat4(packed);
+
+			__m128 q = _mm_cvtepi32_ps(_mm_unpacklo_epi16(packed, _mm_setzero_si128()));
+			return _mm_add_ps(_mm_set1_ps((&m_RangeMin.x)[channel]), _mm_mul_ps(q, _mm_set1_ps((&m_RangeScale.x)[channel])));
+		}
+
+		static __m128 Blend(__m128 A, __m128 B, __m128 C, __m128 D, __m128 sx, __m128 sy) {
+			__m128 AB = _mm_add_ps(A, _mm_mul_ps(_mm_sub_ps(B, A), sx));
+			__m128 CD = _mm_add_ps(C, _mm_mul_ps(_mm_sub_ps(D, C), sx));
+			return _mm_add_ps(AB, _mm_mul_ps(_mm_sub_ps(CD, AB), sy));
+		}
+
+		void SampleBatchScaled(const float* fx, const float* fy, int count, float scale, float* outX, float* outY, float* outZ, float* outW) const {
+			int i = 0;
+			for (; i + 4 <= count; i += 4) {
+				NoiseSampleQuad quad;
+				PrepareNoiseSampleQuad<N>(fx + i, fy + i, scale, quad);
+				alignas(16) float sx[4];
+				alignas(16) float sy[4];
+				_mm_store_ps(sx, quad.SX);
+				_mm_store_ps(sy, quad.SY);
+
+				__m128 result[4];
+				for (int l = 0; l < 4; ++l) {
+					result[l] = Blend(Eval(quad.Index[0][l]), Eval(quad.Index[1][l]), Eval(quad.Index[2][l]), Eval(quad.Index[3][l]),
+						_mm_set1_ps(sx[l]), _mm_set1_ps(sy[l]));
+				}
+				_MM_TRANSPOSE4_PS(result[0], result[1], result[2], result[3]);
+				if (outX) _mm_storeu_ps(outX + i, result[0]);
+				if (outY) _mm_storeu_ps(outY + i, result[1]);
+				if (outZ) _mm_storeu_ps(outZ + i, result[2]);
+				if (outW) _mm_storeu_ps(outW + i, result[3]);
+			}
+			for (; i < count; ++i) {
+				Vector4 s = Sample(fx[i] * scale, fy[i] * scale);
+				if (outX) outX[i] = s.x;
+				if (outY) outY[i] = s.y;
+				if (outZ) outZ[i] = s.z;
+				if (outW) outW[i] = s.w;
+			}
+		}
+
+		void SampleChannelBatchScaled(int channel, const float* fx, const float* fy, int count, float scale, float* out) const {
+			int i = 0;
+			for (; i + 4 <= count; i += 4) {
+				NoiseSampleQuad quad;
+				PrepareNoiseSampleQuad<N>(fx + i, fy + i, scale, quad);
+				__m128 result = Blend(GatherChannel(quad.Index[0], channel), GatherChannel(quad.Index[1], channel),
+					GatherChannel(quad.Index[2], channel), GatherChannel(quad.Index[3], channel), quad.SX, quad.SY);
+				_mm_storeu_ps(out + i, result);
+			}
+			for (; i < count; ++i) {
+				Vector4 s = Sample(fx[i] * scale, fy[i] * scale);
+				out[i] = (&s.x)[channel];
+			}
+		}
+
+		NoiseMapFormat m_Format;
+		int m_StoredChannels = 4;
+		size_t m_TexelBytes = 0;
+		__m128 m_ChannelMask = _mm_setzero_ps();
+		Vector4 m_RangeMin = Vector4(0.f, 0.f, 0.f, 0.f);
+		Vector4 m_RangeScale = Vector4(1.f, 1.f, 1.f, 1.f);
+		std::unique_ptr<uint8_t[]> m_Data;
+	};
+
+	// Packed maps are referenced by pointer like NoiseMap
+	template <int N>
+	struct PackedNoiseMapTerm : NoiseOperandTag {
+		static constexpr int Size = N;
+		const PackedNoiseMap<N>* Map;
+		XMVECTOR Eval(int i) const { return Map->Eval(i); }
+	};
+	template <int N>
+	PackedNoiseMapTerm<N> AsNoiseTerm(const PackedNoiseMap<N>& map) { return PackedNoiseMapTerm<N>{ {}, &map }; }
+}
@@ -0,0 +1,423 @@
+#include "pch.h"
+#include "Maths/PoissonScatter.h"
+#include <chrono>
+#include <queue>
+
+namespace DXE {
+
+	namespace {
+
+		constexpr float TwoPi = 6.28318530718f;
+
+		float HashFloat(uint32_t hash) { return (hash >> 8) * (1.f / 16777216.f); }
+
+		// Squared distance on the pattern torus
+		float TorusDistanceSq(float ax, float ay, float bx, float by, float period) {
+			float dx = fabsf(ax - bx);
+			float dy = fabsf(ay - by);
+			dx = (std::min)(dx, period - dx);
+			dy = (std::min)(dy, period - dy);
+			return dx * dx + dy * dy;
+		}
+
+		// Square cells over the torus holding point indices
+		struct TorusGrid {
+			int Cells = 1;
+			float CellSize = 1.f;
+			std::vector<std::vector<int>> Items;
+
+			TorusGrid(float period, float minCellSize) {
+				Cells = (std::max)(1, static_cast<int>(period / minCellSize));
+				CellSize = period / Cells;
+				Items.resize(static_cast<size_t>(Cells) * Cells);
+			}
+			int Cell(float v) const { return (std::min)(static_cast<int>(v / CellSize), Cells - 1); }
+			std::vector<int>& At(int cx, int cy) {
+				cx = ((cx % Cells) + Cells) % Cells;
+				cy = ((cy % Cells) + Cells) % Cells;
+				return Items[cx + static_cast<size_t>(Cells) * cy];
+			}
+		};
+
+		// Uniform grid over a generated region for ExcludeRadius lookups
+		struct RegionGrid {
+			float X0 = 0.f, Y0 = 0.f;
+			float InvCell = 1.f;
+			int Width = 0, Height = 0;
+			std::vector<uint32_t> Start; // Width * Height + 1 offsets into Points
+			std::vector<DXM::Vector2> Points;
+
+			void Build(const std::vector<ScatterPoint>& points, float x0, float y0, float x1, float y1, float cellSize) {
+				X0 = x0;
+				Y0 = y0;
+				InvCell = 1.f / cellSize;
+				Width = (std::max)(1, static_cast<int>(ceilf((x1 - x0) * InvCell)));
+				Height = (std::max)(1, static_cast<int>(ceilf((y1 - y0) * InvCell)));
+				Start.assign(static_cast<size_t>(Width) * Height + 1, 0);
+				Points.resize(points.size());
+				for (const ScatterPoint& p : points) ++Start[CellIndex(p.Position.x, p.Position.y) + 1];
+				for (size_t i = 1; i < Start.size(); ++i) Start[i] += Start[i - 1];
+				std::vector<uint32_t> fill(Start.begin(), Start.end() - 1);
+				for (const ScatterPoint& p : points) Points[fill[CellIndex(p.Position.x, p.Position.y)]++] = DXM::Vector2(p.Position.x, p.Position.y);
+			}
+			size_t CellIndex(float x, float y) const {
+				int cx = std::clamp(static_cast<int>((x - X0) * InvCell), 0, Width - 1);
+				int cy = std::clamp(static_cast<int>((y - Y0) * InvCell), 0, Height - 1);
+				return cx + static_cast<size_t>(Width) * cy;
+			}
+			bool AnyWithin(float x, float y, float radius) const {
+				const float radiusSq = radius * radius;
+				int cx0 = (std::max)(static_cast<int>(floorf((x - radius - X0) * InvCell)), 0);
+				int cy0 = (std::max)(static_cast<int>(floorf((y - radius - Y0) * InvCell)), 0);
+				int cx1 = (std::min)(static_cast<int>(floorf((x + radius - X0) * InvCell)), Width - 1);
+				int cy1 = (std::min)(static_cast<int>(floorf((y + radius - Y0) * InvCell)), Height - 1);
+				for (int cy = cy0; cy <= cy1; ++cy) {
+					for (int cx = cx0; cx <= cx1; ++cx) {
+						size_t cell = cx + static_cast<size_t>(Width) * cy;
+						for (uint32_t i = Start[cell]; i < Start[cell + 1]; ++i) {
+							float dx = Points[i].x - x;
+							float dy = Points[i].y - y;
+							if (dx * dx + dy * dy < radiusSq) return true;
+						}
+					}
+				}
+				return false;
+			}
+		};
+
+		struct ScatterCandidate {
+			float X;
+			float Y;
+			float Rank;
+			uint32_t Hash;
+		};
+	}
+
+	DXM::Matrix ScatterPoint::Transform() const {
+		DXM::Matrix transform = DXM::Matrix::CreateScale(Scale) * DXM::Matrix::CreateRotationZ(Yaw);
+		DXM::Vector3 axis(-Normal.y, Normal.x, 0.f); // up x Normal
+		float axisLength = axis.Length();
+		if (axisLength > 1e-5f) {
+			transform *= DXM::Matrix::CreateFromAxisAngle(axis / axisLength, atan2f(axisLength, Normal.z));
+		}
+		transform *= DXM::Matrix::CreateTranslation(Position);
+		return transform;
+	}
+
+	// Maximal Poisson disk set with radius 1 on the PatternPeriod torus (Bridson), ranked progressively by
+	// weighted sample elimination: every stage halves the live set, removing the most crowded point first with
+	// the elimination radius of the stage's target count, the last survivors get the lowest ranks.
+	std::vector<PoissonScatter::PatternPoint> PoissonScatter::BuildPattern(uint32_t seed) {
+		const float period = PatternPeriod;
+		uint32_t counter = 0;
+		auto next = [&]() { return HashFloat(DXM::Squirrel1D(static_cast<int>(counter++), seed)); };
+
+		std::vector<PatternPoint> points;
+		{
+			TorusGrid grid(period, 1.f / sqrtf(2.f)); // at most one point per cell
+			std::vector<int> active;
+			auto insert = [&](float x, float y) {
+				grid.At(grid.Cell(x), grid.Cell(y)).push_back(static_cast<int>(points.size()));
+				active.push_back(static_cast<int>(points.size()));
+				points.push_back({ x, y, 0.f, 0u });
+			};
+			insert(next() * period, next() * period);
+
+			constexpr int Attempts = 30;
+			while (!active.empty()) {
+				size_t slot = (std::min)(static_cast<size_t>(next() * active.size()), active.size() - 1);
+				const PatternPoint origin = points[active[slot]];
+				bool placed = false;
+				for (int a = 0; a < Attempts && !placed; ++a) {
+					float angle = next() * TwoPi;
+					float distance = sqrtf(1.f + 3.f * next()); // uniform over the [1, 2] annulus
+					float x = fmodf(origin.X + cosf(angle) * distance + period, period);
+					float y = fmodf(origin.Y + sinf(angle) * distance + period, period);
+					int cx = grid.Cell(x), cy = grid.Cell(y);
+					bool clear = true;
+					for (int oy = -2; oy <= 2 && clear; ++oy) {
+						for (int ox = -2; ox <= 2 && clear; ++ox) {
+							for (int i : grid.At(cx + ox, cy + oy)) {
+								if (TorusDistanceSq(x, y, points[i].X, points[i].Y, period) < 1.f) {
+									clear = false;
+									break;
+								}
+							}
+						}
+					}
+					if (clear) {
+						insert(x, y);
+						placed = true;
+					}
+				}
+				if (!placed) {
+					active[slot] = active.back();
+					active.pop_back();
+				}
+			}
+		}
+
+		const int count = static_cast<int>(points.size());
+		std::vector<int> removed; // removal order, most crowded first
+		removed.reserve(count);
+		std::vector<char> alive(count, 1);
+		int remaining = count;
+		while (remaining > 1) {
+			const int target = remaining / 2;
+			const float eliminationRadius = 2.f * sqrtf(period * period / (2.f * sqrtf(3.f) * target));
+			TorusGrid grid(period, (std::min)(eliminationRadius, period));
+			for (int i = 0; i < count; ++i) {
+				if (alive[i]) grid.At(grid.Cell(points[i].X), grid.Cell(points[i].Y)).push_back(i);
+			}
+			// cells are at least the elimination radius wide, so one ring is enough; tiny grids visit every cell once
+			const bool allCells = grid.Cells < 3;
+			auto forNeighbours = [&](int i, auto&& fn) {
+				int cx = grid.Cell(points[i].X), cy = grid.Cell(points[i].Y);
+				int first = allCells ? 0 : -1;
+				int last = allCells ? grid.Cells - 1 : 1;
+				for (int oy = first; oy <= last; ++oy) {
+					for (int ox = first; ox <= last; ++ox) {
+						for (int j : grid.At(allCells ? ox : cx + ox, allCells ? oy : cy + oy)) {
+							if (j == i || !alive[j]) continue;
+							float d = sqrtf(TorusDistanceSq(points[i].X, points[i].Y, points[j].X, points[j].Y, period));
+							if (d < eliminationRadius) {
+								float w = 1.f - d / eliminationRadius;
+								w *= w; w *= w; w *= w;
+								fn(j, w);
+							}
+						}
+					}
+				}
+			};
+
+			std::vector<float> weight(count, 0.f);
+			std::priority_queue<std::pair<float, int>> heap; // stale entries are skipped on pop
+			for (int i = 0; i < count; ++i) {
+				if (!alive[i]) continue;
+				forNeighbours(i, [&](int, float w) { weight[i] += w; });
+				heap.push({ weight[i], i });
+			}
+			while (remaining > target) {
+				auto [w, i] = heap.top();
+				heap.pop();
+				if (!alive[i] || w != weight[i]) continue;
+				alive[i] = 0;
+				removed.push_back(i);
+				--remaining;
+				forNeighbours(i, [&](int j, float wj) {
+					weight[j] -= wj;
+					heap.push({ weight[j], j });
+				});
+			}
+		}
+		for (int i = 0; i < count; ++i) {
+			if (alive[i]) removed.push_back(i);
+		}
+
+		for (int r = 0; r < count; ++r) {
+			PatternPoint& p = points[removed[count - 1 - r]];
+			p.Rank = (r + 0.5f) / count;
+		}
+		for (int i = 0; i < count; ++i) {
+			points[i].Hash = DXM::Squirrel1D(i, seed ^ 0x5ca77e4u);
+		}
+		std::sort(points.begin(), points.end(), [](const PatternPoint& a, const PatternPoint& b) { return a.Y < b.Y; });
+		return points;
+	}
+
+	PoissonScatter::PoissonScatter(const std::vector<ScatterLayer>& layers, float tileSize, uint32_t seed)
+		: m_Layers(layers), m_TileSize(tileSize), m_Seed(seed) {
+		m_Patterns.resize(m_Layers.size());
+		for (size_t l = 0; l < m_Layers.size(); ++l) {
+			m_Layers[l].Radius = (std::max)(m_Layers[l].Radius, 1e-3f);
+			m_Patterns[l] = BuildPattern(DXM::Squirrel1D(static_cast<int>(l), seed));
+		}
+
+		// A layer's points are exact wherever the earlier layers they avoid are, so each layer is generated
+		// far enough past the tile to cover the margins and exclusion radii of every later layer
+		m_Margins.assign(m_Layers.size(), 0.f);
+		for (int l = static_cast<int>(m_Layers.size()) - 2; l >= 0; --l) {
+			for (size_t later = l + 1; later < m_Layers.size(); ++later) {
+				if (m_Layers[later].ExcludeRadius > 0.f) {
+					m_Margins[l] = (std::max)(m_Margins[l], m_Margins[later] + m_Layers[later].ExcludeRadius);
+				}
+			}
+		}
+	}
+
+	void PoissonScatter::GenerateTile(const ScatterTile& tile, const Surface& surface, std::vector<std::vector<ScatterPoint>>& points, ScatterStats* stats) const {
+		const size_t layerCount = m_Layers.size();
+		points.assign(layerCount, {});
+
+		const float tileX0 = tile.X * m_TileSize, tileY0 = tile.Y * m_TileSize;
+		const float tileX1 = (tile.X + 1) * m_TileSize, tileY1 = (tile.Y + 1) * m_TileSize;
+
+		std::vector<std::vector<ScatterPoint>> regionPoints(layerCount);
+		std::vector<RegionGrid> grids(layerCount);
+		std::vector<ScatterCandidate> candidates;
+		std::vector<float> xs, ys, height, dx, dy, mask;
+
+		for (size_t l = 0; l < layerCount; ++l) {
+			const ScatterLayer& layer = m_Layers[l];
+			const std::vector<PatternPoint>& pattern = m_Patterns[l];
+			const float margin = m_Margins[l];
+			const float x0 = tileX0 - margin, y0 = tileY0 - margin;
+			const float x1 = tileX1 + margin, y1 = tileY1 + margin;
+			const float r = layer.Radius;
+			const float period = PatternPeriod * r;
+
+			// Pattern repeats overlapping the region, ranks at or above Density can never pass the mask
+			candidates.clear();
+			const int ry0 = static_cast<int>(floorf(y0 / period)), ry1 = static_cast<int>(floorf(y1 / period));
+			const int rx0 = static_cast<int>(floorf(x0 / period)), rx1 = static_cast<int>(floorf(x1 / period));
+			for (int ry = ry0; ry <= ry1; ++ry) {
+				const float localY0 = (y0 - ry * period) / r;
+				const float localY1 = (y1 - ry * period) / r;
+				auto first = std::lower_bound(pattern.begin(), pattern.end(), localY0, [](const PatternPoint& p, float y) { return p.Y < y; });
+				for (auto it = first; it != pattern.end() && it->Y < localY1; ++it) {
+					if (it->Rank >= layer.Density) continue;
+					const float wy = ry * period + it->Y * r;
+					if (wy < y0 || wy >= y1) continue;
+					for (int rx = rx0; rx <= rx1; ++rx) {
+						const float wx = rx * period + it->X * r;
+						if (wx < x0 || wx >= x1) continue;
+						// the rank thresholds the mask, the hash picks scale and yaw
+						candidates.push_back({ wx, wy, it->Rank, DXM::Squirrel2D(rx, ry, it->Hash) });
+					}
+				}
+			}
+			if (stats) stats->Candidates += candidates.size();
+			if (candidates.empty()) continue;
+
+			const int count = static_cast<int>(candidates.size());
+			xs.resize(count); ys.resize(count);
+			height.resize(count); dx.resize(count); dy.resize(count); mask.resize(count);
+			for (int i = 0; i < count; ++i) {
+				xs[i] = candidates[i].X;
+				ys[i] = candidates[i].Y;
+			}
+			surface(xs.data(), ys.data(), count, height.data(), dx.data(), dy.data(), mask.data());
+			const float* channels[4] = { height.data(), dx.data(), dy.data(), mask.data() };
+
+			const float maskScale = layer.MaskHigh > layer.MaskLow ? 1.f / (layer.MaskHigh - layer.MaskLow) : 0.f;
+			const float minSlopeSq = layer.MinSlope * layer.MinSlope;
+			const float maxSlopeSq = layer.MaxSlope < FLT_MAX ? layer.MaxSlope * layer.MaxSlope : FLT_MAX;
+
+			std::vector<ScatterPoint>& accepted = regionPoints[l];
+			accepted.reserve(count);
+			for (int i = 0; i < count; ++i) {
+				float density = layer.Density;
+				if (layer.MaskChannel >= 0 && layer.MaskChannel < 4) {
+					float value = channels[layer.MaskChannel][i];
+					float m = maskScale > 0.f ? (value - layer.MaskLow) * maskScale : (value >= layer.MaskLow ? 1.f : 0.f);
+					density *= std::clamp(m, 0.f, 1.f);
+				}
+				const ScatterCandidate& candidate = candidates[i];
+				if (candidate.Rank >= density) continue;
+				if (height[i] < layer.MinHeight || height[i] > layer.MaxHeight) continue;
+				const float slopeSq = dx[i] * dx[i] + dy[i] * dy[i];
+				if (slopeSq < minSlopeSq || slopeSq > maxSlopeSq) continue;
+
+				if (layer.ExcludeRadius > 0.f) {
+					bool blocked = false;
+					for (size_t earlier = 0; earlier < l && !blocked; ++earlier) {
+						blocked = grids[earlier].AnyWithin(candidate.X, candidate.Y, layer.ExcludeRadius);
+					}
+					if (blocked) continue;
+				}
+
+				ScatterPoint point;
+				point.Position = DXM::Vector3(candidate.X, candidate.Y, height[i]);
+				DXM::Vector3 normal(-dx[i], -dy[i], 1.f);
+				normal.Normalize();
+				point.Normal = DXM::Vector3::Lerp(DXM::Vector3(0.f, 0.f, 1.f), normal, std::clamp(layer.AlignToNormal, 0.f, 1.f));
+				point.Normal.Normalize();
+				point.Scale = layer.MinScale + (layer.MaxScale - layer.MinScale) * HashFloat(DXM::Squirrel1D(1, candidate.Hash));
+				point.Yaw = layer.RandomYaw ? HashFloat(DXM::Squirrel1D(2, candidate.Hash)) * TwoPi : 0.f;
+				accepted.push_back(point);
+			}
+
+			// Later layers that keep clear of this one look it up on a grid over the whole region
+			float cellSize = 0.f;
+			for (size_t later = l + 1; later < layerCount; ++later) {
+				cellSize = (std::max)(cellSize, m_Layers[later].ExcludeRadius);
+			}
+			if (cellSize > 0.f) grids[l].Build(accepted, x0, y0, x1, y1, cellSize);
+
+			std::vector<ScatterPoint>& output = points[l];
+			if (margin == 0.f) {
+				output = std::move(accepted);
+			}
+			else {
+				for (const ScatterPoint& p : accepted) {
+					if (p.Position.x >= tileX0 && p.Position.x < tileX1 && p.Position.y >= tileY0 && p.Position.y < tileY1) output.push_back(p);
+				}
+			}
+			if (stats) stats->Points += output.size();
+		}
+		if (stats) ++stats->Tiles;
+	}
+
+	ScatterStats PoissonScatter::GenerateTiles(const std::vector<ScatterTile>& tiles, const Surface& surface, ThreadPool& pool,
+		std::vector<std::vector<std::vector<ScatterPoint>>>& points) const {
+		auto start = std::chrono::high_resolution_clock::now();
+		points.resize(tiles.size());
+		std::vector<ScatterStats> tileStats(tiles.size());
+		pool.ParallelFor(static_cast<int>(tiles.size()), 1, [&](int begin, int end) {
+			for (int t = begin; t < end; ++t) {
+				GenerateTile(tiles[t], surface, points[t], &tileStats[t]);
+			}
+		});
+
+		ScatterStats stats;
+		for (const ScatterStats& s : tileStats) {
+			stats.Tiles += s.Tiles;
+			stats.Candidates += s.Candidates;
+			stats.Points += s.Points;
+		}
+		stats.Seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+		return stats;
+	}
+
+	ScatterStats PoissonScatter::Benchmark(uint64_t points, unsigned threadCount, uint32_t seed) {
+		ScatterLayer layer;
+		layer.Radius = 0.5f;
+		layer.MaskLow = -0.5f;
+		layer.MaskHigh = 0.5f;
+		layer.MinScale = 0.8f;
+		layer.MaxScale = 1.2f;
+		const float tileSize = 64.f;
+		PoissonScatter scatter({ layer }, tileSize, seed);
+
+		// Enough tiles for the requested count at the mask's average density of about one half
+		const double pointsPerTile = 0.5 * scatter.GetPatternSize(0) * (tileSize * tileSize) / (PatternPeriod * layer.Radius * PatternPeriod * layer.Radius);
+		const int side = (std::max)(1, static_cast<int>(ceil(sqrt(points / pointsPerTile))));
+		std::vector<ScatterTile> tiles;
+		for (int y = 0; y < side; ++y) {
+			for (int x = 0; x < side; ++x) tiles.push_back({ x, y });
+		}
+
+		DXM::NoiseFractal fractal;
+		fractal.Octaves = 3;
+		fractal.Frequency = 1.f / 256.f;
+		fractal.Seed = seed;
+		Surface surface = [&fractal](const float* x, const float* y, int count, float* height, float* dx, float* dy, float* mask) {
+			std::fill(height, height + count, 0.f);
+			std::fill(dx, dx + count, 0.f);
+			std::fill(dy, dy + count, 0.f);
+			DXM::NoiseBatch<2> batch;
+			batch.Coords[0] = x;
+			batch.Coords[1] = y;
+			batch.Values = mask;
+			batch.Count = count;
+			DXM::FBmBatch<2>(batch, fractal);
+		};
+
+		ThreadPool pool(threadCount);
+		std::vector<std::vector<std::vector<ScatterPoint>>> result;
+		ScatterStats stats = scatter.GenerateTiles(tiles, surface, pool, result);
+		DXE_INFO("Scatter benchmark ", stats.Tiles, " tiles on ", pool.ThreadCount(), " threads: ", stats.Points, " points from ",
+			stats.Candidates, " candidates in ", stats.Seconds, "s");
+		return stats;
+	}
+}
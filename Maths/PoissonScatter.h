@@ -0,0 +1,119 @@
+#pragma once
+#include "DXE.h"
+#include "Maths.h"
+#include "ThreadPool.h"
+#include <cfloat>
+#include <functional>
+#include <vector>
+
+namespace DXE
+{
+	// Placement rules for one set of points, usually one mesh
+	struct ScatterLayer {
+		float Radius = 1.f;   // minimum world distance between points of this layer
+		float Density = 1.f;  // fraction of the full Poisson disk set kept where the mask is 1
+		int MaskChannel = 3;  // surface channel scaling the density (0 height, 1 dx, 2 dy, 3 mask), -1 for none
+		float MaskLow = 0.f;  // mask values remapped from [MaskLow, MaskHigh] to [0, 1]
+		float MaskHigh = 1.f;
+		float MinHeight = -FLT_MAX;
+		float MaxHeight = FLT_MAX;
+		float MinSlope = 0.f; // gradient length, rise over run
+		float MaxSlope = FLT_MAX;
+		float ExcludeRadius = 0.f; // > 0 keeps this far from the points of every earlier layer
+		float MinScale = 1.f;
+		float MaxScale = 1.f;
+		bool RandomYaw = true;
+		float AlignToNormal = 0.f; // 0 stays upright, 1 follows the surface normal
+	};
+
+	struct ScatterPoint {
+		DXM::Vector3 Position;
+		DXM::Vector3 Normal; // the up axis after AlignToNormal
+		float Scale = 1.f;
+		float Yaw = 0.f;
+
+		// Scale, yaw about the up axis, then Normal tilt and translation, Z up
+		DXM::Matrix Transform() const;
+	};
+
+	struct ScatterTile {
+		int X = 0;
+		int Y = 0;
+		bool operator==(const ScatterTile& other) const = default;
+	};
+
+	struct ScatterStats {
+		int Tiles = 0;
+		uint64_t Candidates = 0; // pattern points that reached the surface test, margins included
+		uint64_t Points = 0;
+		double Seconds = 0.0;
+	};
+
+	// Blue noise scattering over a height / mask surface.
+	// Every layer tiles the world with one toroidal Poisson disk pattern built at construction. Pattern points
+	// carry a progressive rank, any prefix of the ranking is blue noise as well, so a point survives when its
+	// rank is below the local density and thinned areas keep an even spread. Points depend only on their world
+	// position, the seed and the rules: any tile can be generated alone, in any order, and always matches its
+	// neighbours across the border. Layers with an ExcludeRadius look at earlier layers' points in a margin
+	// around the tile, which is regenerated the same way.
+	class DXE_API PoissonScatter {
+	public:
+		// Fills the surface channels for count world positions: height, height gradient x / y and a free mask.
+		// Must be continuous across tiles, a tile's margin is sampled outside the tile.
+		using Surface = std::function<void(const float* x, const float* y, int count, float* height, float* dx, float* dy, float* mask)>;
+
+		static constexpr float PatternPeriod = 48.f; // pattern side in layer radii
+
+		PoissonScatter(const std::vector<ScatterLayer>& layers, float tileSize, uint32_t seed);
+
+		// points[layer] receives the tile's points
+		void GenerateTile(const ScatterTile& tile, const Surface& surface, std::vector<std::vector<ScatterPoint>>& points, ScatterStats* stats = nullptr) const;
+		// Generates every tile on the pool, points[tile][layer]
+		ScatterStats GenerateTiles(const std::vector<ScatterTile>& tiles, const Surface& surface, ThreadPool& pool,
+			std::vector<std::vector<std::vector<ScatterPoint>>>& points) const;
+
+		const std::vector<ScatterLayer>& GetLayers() const { return m_Layers; }
+		float GetTileSize() const { return m_TileSize; }
+		uint32_t GetSeed() const { return m_Seed; }
+		size_t GetPatternSize(int layer) const { return m_Patterns[layer].size(); }
+
+		// Surface over a single NoiseMap covering [origin, origin + size], sampled with clamping.
+		// gradientScale turns the stored derivatives into world units.
+		template<int N>
+		static Surface NoiseMapSurface(const DXM::NoiseMap<N>& map, DXM::Vector2 origin, float size, float heightScale = 1.f, float gradientScale = 1.f) {
+			return [&map, origin, size, heightScale, gradientScale](const float* x, const float* y, int count, float* height, float* dx, float* dy, float* mask) {
+				std::vector<float> fx(count), fy(count);
+				const float invSize = 1.f / size;
+				for (int i = 0; i < count; ++i) {
+					fx[i] = (x[i] - origin.x) * invSize;
+					fy[i] = (y[i] - origin.y) * invSize;
+				}
+				map.NormalisedSampleBatch(fx.data(), fy.data(), count, height, dx, dy, mask);
+				for (int i = 0; i < count; ++i) {
+					height[i] *= heightScale;
+					dx[i] *= gradientScale;
+					dy[i] *= gradientScale;
+				}
+			};
+		}
+
+		// Scatters 1M points over a flat surface with a noise mask and logs the timings
+		static ScatterStats Benchmark(uint64_t points = 1000000, unsigned threadCount = 0, uint32_t seed = 0);
+
+	private:
+		struct PatternPoint {
+			float X; // in layer radii, [0, PatternPeriod)
+			float Y;
+			float Rank; // [0, 1), lower ranks survive thinner densities
+			uint32_t Hash;
+		};
+
+		static std::vector<PatternPoint> BuildPattern(uint32_t seed);
+
+		std::vector<ScatterLayer> m_Layers;
+		std::vector<std::vector<PatternPoint>> m_Patterns; // sorted by Y
+		std::vector<float> m_Margins; // world distance each layer is generated beyond the tile
+		float m_TileSize;
+		uint32_t m_Seed;
+	};
+}
@@ -0,0 +1,165 @@
+#include "pch.h"
+#include "ShadowCascades.h"
+#include "Logger.h"
+#include <chrono>
+
+namespace DXE
+{
+	void ComputeCascadeSplits(float nearPlane, float farPlane, int count, float lambda, float* splits) {
+		nearPlane = (std::max)(nearPlane, 1e-3f);
+		farPlane = (std::max)(farPlane, nearPlane);
+		const float ratio = farPlane / nearPlane;
+		for (int i = 0; i <= count; ++i) {
+			const float t = static_cast<float>(i) / count;
+			const float logSplit = nearPlane * powf(ratio, t);
+			const float uniformSplit = nearPlane + (farPlane - nearPlane) * t;
+			splits[i] = lambda * logSplit + (1.f - lambda) * uniformSplit;
+		}
+		splits[0] = nearPlane;
+		splits[count] = farPlane;
+	}
+
+	void GetFrustumDistances(const DX::BoundingFrustum& frustum, float& nearDistance, float& farDistance) {
+		if (frustum.Near < 0.f) {
+			nearDistance = -frustum.Far;
+			farDistance = -frustum.Near;
+		}
+		else {
+			nearDistance = frustum.Near;
+			farDistance = frustum.Far;
+		}
+	}
+
+	DX::BoundingFrustum SliceFrustum(const DX::BoundingFrustum& frustum, float nearDistance, float farDistance) {
+		DX::BoundingFrustum slice = frustum;
+		if (frustum.Near < 0.f) {
+			slice.Near = -farDistance;
+			slice.Far = -nearDistance;
+		}
+		else {
+			slice.Near = nearDistance;
+			slice.Far = farDistance;
+		}
+		return slice;
+	}
+
+	ShadowCascade FitShadowCascade(const DX::BoundingFrustum& slice, const DXM::Vector3& lightDirection, int resolution,
+		float casterDistance, float padding) {
+		ShadowCascade cascade;
+		GetFrustumDistances(slice, cascade.SplitNear, cascade.SplitFar);
+
+		DXM::Vector3 corners[DX::BoundingFrustum::CORNER_COUNT];
+		slice.GetCorners(corners);
+		DXM::Vector3 centre;
+		for (const auto& corner : corners) centre += corner;
+		centre /= static_cast<float>(DX::BoundingFrustum::CORNER_COUNT);
+		float radius = 0.f;
+		for (const auto& corner : corners) radius = (std::max)(radius, DXM::Vector3::Distance(corner, centre));
+		// Rounded so float noise in the corners doesn't change the texel size from frame to frame
+		radius = ceilf(radius * padding * 16.f) / 16.f;
+
+		DXM::Vector3 direction = lightDirection;
+		direction.Normalize();
+		DXM::Vector3 worldUp(0, 0, 1);
+		DXM::Vector3 up = fabs(direction.Dot(worldUp)) > 0.99f ? DXM::Vector3(0, 1, 0) : worldUp;
+
+		// Snap in a light space anchored at the world origin, the view below only adds a translation along the light
+		const float texelSize = 2.f * radius / static_cast<float>(resolution);
+		DXM::Matrix rotation = DXM::Matrix::CreateLookAt(DXM::Vector3::Zero, direction, up);
+		DXM::Vector3 centreLS = DXM::Vector3::Transform(centre, rotation);
+		centreLS.x = floorf(centreLS.x / texelSize) * texelSize;
+		centreLS.y = floorf(centreLS.y / texelSize) * texelSize;
+		centre = DXM::Vector3::Transform(centreLS, rotation.Invert());
+
+		const float depth = 2.f * radius + casterDistance;
+		cascade.Centre = centre;
+		cascade.Radius = radius;
+		cascade.TexelSize = texelSize;
+		cascade.LightPosition = centre - direction * (radius + casterDistance);
+		cascade.View = DXM::Matrix::CreateLookAt(cascade.LightPosition, centre, up);
+		cascade.Projection = DXM::Matrix::CreateOrthographic(2.f * radius, 2.f * radius, 0.f, depth);
+		cascade.ViewProjection = cascade.View * cascade.Projection;
+
+		cascade.Box.Center = cascade.LightPosition + direction * (depth * 0.5f);
+		cascade.Box.Extents = DXM::Vector3(radius, radius, depth * 0.5f);
+		cascade.Box.Orientation = DXM::Quaternion::CreateFromRotationMatrix(cascade.View.Invert());
+		return cascade;
+	}
+
+	bool BenchmarkShadowCascades(int resolution, int frames) {
+		uint32_t errors = 0;
+
+		const float lambdas[] = { 0.f, 0.5f, 0.75f, 1.f };
+		const float planes[][2] = { { 0.1f, 200.f }, { 0.f, 50.f }, { 1.f, 5000.f }, { 5.f, 5.f }, { 10.f, 2.f } };
+		for (float lambda : lambdas) {
+			for (const auto& plane : planes) {
+				for (int count = 1; count <= 4; ++count) {
+					float splits[5];
+					ComputeCascadeSplits(plane[0], plane[1], count, lambda, splits);
+					const float nearPlane = (std::max)(plane[0], 1e-3f);
+					const float farPlane = (std::max)(plane[1], nearPlane);
+					if (splits[0] != nearPlane || splits[count] != farPlane) ++errors;
+					for (int i = 1; i <= count; ++i) {
+						if (farPlane > nearPlane ? splits[i] <= splits[i - 1] : splits[i] != nearPlane) ++errors;
+					}
+				}
+			}
+		}
+
+		const int count = 4;
+		const float casterDistance = 100.f;
+		float splits[count + 1];
+		ComputeCascadeSplits(0.1f, 200.f, count, 0.75f, splits);
+		DX::BoundingFrustum camera;
+		DX::BoundingFrustum::CreateFromMatrix(camera, DXM::Matrix::CreatePerspectiveFieldOfView(DX::XM_PI / 3.f, 16.f / 9.f, 0.1f, 200.f), true);
+
+		// A sun straight down takes the other up vector
+		const DXM::Vector3 suns[] = { { 0.3f, 0.2f, -1.f }, { 0.f, 0.f, -1.f }, { 1.f, -0.5f, -0.2f } };
+		double seconds = 0.0;
+		int fits = 0;
+		for (DXM::Vector3 sun : suns) {
+			sun.Normalize();
+			const DXM::Vector3 up = fabs(sun.z) > 0.99f ? DXM::Vector3(0, 1, 0) : DXM::Vector3(0, 0, 1);
+			const DXM::Matrix rotation = DXM::Matrix::CreateLookAt(DXM::Vector3::Zero, sun, up);
+			float radius[count] = {};
+			for (int f = 0; f < frames; ++f) {
+				// Slides a fraction of a texel per frame and turns slowly
+				const float yaw = f * 0.01f;
+				const DXM::Vector3 eye(f * 0.037f, f * 0.011f, 2.f);
+				DX::BoundingFrustum frustum;
+				camera.Transform(frustum, DXM::Matrix::CreateLookAt(eye, eye + DXM::Vector3(cosf(yaw), sinf(yaw), -0.1f), DXM::Vector3(0, 0, 1)).Invert());
+
+				for (int c = 0; c < count; ++c) {
+					const DX::BoundingFrustum slice = SliceFrustum(frustum, splits[c], splits[c + 1]);
+					auto start = std::chrono::high_resolution_clock::now();
+					const ShadowCascade cascade = FitShadowCascade(slice, sun, resolution, casterDistance);
+					seconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+					++fits;
+
+					if (fabs(cascade.SplitNear - splits[c]) > 1e-4f * splits[c + 1] || fabs(cascade.SplitFar - splits[c + 1]) > 1e-4f * splits[c + 1]) ++errors;
+					if (f == 0) radius[c] = cascade.Radius;
+					else if (cascade.Radius != radius[c]) ++errors;
+					if (cascade.TexelSize != 2.f * cascade.Radius / resolution) ++errors;
+
+					// On the texel grid of the origin anchored light space
+					const DXM::Vector3 centre = DXM::Vector3::Transform(cascade.Centre, rotation) / cascade.TexelSize;
+					if (fabs(centre.x - roundf(centre.x)) > 0.05f || fabs(centre.y - roundf(centre.y)) > 0.05f) ++errors;
+
+					// Snapping moves the centre less than a texel per axis
+					DXM::Vector3 corners[DX::BoundingFrustum::CORNER_COUNT];
+					slice.GetCorners(corners);
+					const float extent = cascade.Radius + cascade.TexelSize * 1.01f;
+					for (const auto& corner : corners) {
+						const DXM::Vector3 light = DXM::Vector3::Transform(corner, cascade.View);
+						if (fabs(light.x) > extent || fabs(light.y) > extent) ++errors;
+						if (light.z > 1e-3f || -light.z > 2.f * cascade.Radius + casterDistance + 1e-3f) ++errors;
+					}
+				}
+			}
+		}
+
+		DXE_INFO("Shadow cascade benchmark: ", fits, " fits, ", fits ? seconds * 1e6 / fits : 0.0, "us each");
+		if (errors) DXE_ERROR("Shadow cascade benchmark: ", errors, " checks failed");
+		return errors == 0;
+	}
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include "DXE.h"
+#include "Maths.h"
+
+// Split and fitting maths for cascaded shadow maps. Plain DirectXMath, no device needed.
+namespace DXE
+{
+	struct ShadowCascade {
+		float SplitNear = 0.f; // view distances covered by the cascade
+		float SplitFar = 0.f;
+		DXM::Vector3 Centre;   // texel snapped centre of the bounding sphere
+		float Radius = 0.f;
+		float TexelSize = 0.f; // world size of one shadow map texel
+		DXM::Vector3 LightPosition;
+		DXM::Matrix View;
+		DXM::Matrix Projection;
+		DXM::Matrix ViewProjection;
+		DX::BoundingOrientedBox Box; // the ortho volume in world space
+	};
+
+	// Practical split scheme: lambda blends logarithmic (1) and uniform (0) splits over [nearPlane, farPlane].
+	// Writes count + 1 distances, splits[0] = nearPlane and splits[count] = farPlane.
+	void ComputeCascadeSplits(float nearPlane, float farPlane, int count, float lambda, float* splits);
+
+	// View distance range of a frustum. Frustums built by BoundingFrustum::CreateFromMatrix with rhcoords
+	// store negative Near / Far, both conventions are handled.
+	void GetFrustumDistances(const DX::BoundingFrustum& frustum, float& nearDistance, float& farDistance);
+	// The part of frustum between two view distances
+	DX::BoundingFrustum SliceFrustum(const DX::BoundingFrustum& frustum, float nearDistance, float farDistance);
+
+	// Fits an ortho cascade around the bounding sphere of slice, looking along lightDirection. A sphere keeps the
+	// size fixed as the camera turns and the centre is snapped to whole texels in light space, so shadow edges
+	// don't shimmer while the camera moves. casterDistance extends the volume towards the light for casters
+	// outside the slice, padding scales the sphere, e.g. to let a cached cascade cover a moving camera.
+	ShadowCascade FitShadowCascade(const DX::BoundingFrustum& slice, const DXM::Vector3& lightDirection, int resolution,
+		float casterDistance, float padding = 1.f);
+
+	// Checks the splits for a range of planes and lambdas (they start and end at the planes and never decrease),
+	// then fits every cascade of a camera sliding and turning over frames under a few suns: the size must stay
+	// fixed, the centre must sit on the texel grid and the volume must hold the slice. Needs no device.
+	// Returns false when a check fails.
+	bool BenchmarkShadowCascades(int resolution = 2048, int frames = 1000);
+}
@@ -2,9 +2,52 @@
 #include "Buffer.h"
 #include "Renderer.h"
 #include <iostream>
+#include <iterator>
 
 namespace DXE
 {
+    namespace {
+        struct BoundVertexBuffer {
+            ID3D11Buffer* Buffer = nullptr;
+            UINT Stride = 0;
+            UINT Offset = 0;
+        };
+        // Bound buffers cannot be released, the context holds a reference, so a pointer is never stale here
+        BoundVertexBuffer s_BoundVertexBuffers[2];
+        ID3D11Buffer* s_BoundIndexBuffer = nullptr;
+        BufferBindStats s_BindStats;
+    }
+
+    void SetVertexBuffer(UINT slot, ID3D11Buffer* buffer, UINT stride, UINT offset) {
+        if (slot < std::size(s_BoundVertexBuffers)) {
+            BoundVertexBuffer& bound = s_BoundVertexBuffers[slot];
+            if (bound.Buffer == buffer && bound.Stride == stride && bound.Offset == offset) {
+                ++s_BindStats.Skipped;
+                return;
+            }
+            bound = { buffer, stride, offset };
+        }
+        ++s_BindStats.Issued;
+        Renderer::Context()->IASetVertexBuffers(slot, 1, &buffer, &stride, &offset);
+    }
+
+    void SetIndexBuffer(ID3D11Buffer* buffer) {
+        if (buffer == s_BoundIndexBuffer) {
+            ++s_BindStats.Skipped;
+            return;
+        }
+        s_BoundIndexBuffer = buffer;
+        ++s_BindStats.Issued;
+        Renderer::Context()->IASetIndexBuffer(buffer, DXGI_FORMAT_R32_UINT, 0);
+    }
+
+    void ResetBufferBindings() {
+        for (BoundVertexBuffer& bound : s_BoundVertexBuffers) bound = BoundVertexBuffer();
+        s_BoundIndexBuffer = nullptr;
+        s_BindStats = BufferBindStats();
+    }
+
+    const BufferBindStats& GetBufferBindStats() { return s_BindStats; }
 
     VertexBuffer::VertexBuffer() {}
     VertexBuffer::~VertexBuffer() = default;
@@ -64,11 +107,12 @@ namespace DXE
     }
 
     void VertexBuffer::Bind(int slot) {
-        ID3D11Buffer* buffers[] = { m_VertexBuffer.Get() };
-        uint32_t stride = sizeof(Vertex);
-        uint32_t offset = 0;
-        Renderer::Context()->IASetIndexBuffer(m_IndexBuffer.Get(), DXGI_FORMAT_R32_UINT, 0);
-        Renderer::Context()->IASetVertexBuffers(slot, 1, buffers, &stride, &offset);
+        SetIndexBuffer(m_IndexBuffer.Get());
+        SetVertexBuffer(slot, m_VertexBuffer.Get(), sizeof(Vertex));
+    }
+
+    void VertexBuffer::BindIndices() {
+        SetIndexBuffer(m_IndexBuffer.Get());
     }
 
     void VertexBuffer::SetTopology(D3D11_PRIMITIVE_TOPOLOGY topology)
@@ -78,6 +122,62 @@ namespace DXE
 
 
 
+    UINT GetVertexStreamStride(VertexStream stream) {
+        switch (stream) {
+        case VertexStream::Position:   return sizeof(DXM::Vector3);
+        case VertexStream::PositionUV: return sizeof(DXM::Vector3) + sizeof(DXM::Vector2);
+        default:                       return sizeof(Vertex);
+        }
+    }
+
+    DepthVertexBuffer::DepthVertexBuffer(const std::vector<Vertex>& vertices, VertexStream stream)
+        : m_Stream(stream)
+    {
+        UpdateVertices(vertices);
+    }
+
+    void DepthVertexBuffer::UpdateVertices(const std::vector<Vertex>& vertices) {
+        if (vertices.empty()) return;
+
+        const bool uv = m_Stream == VertexStream::PositionUV;
+        const size_t floats = GetVertexStreamStride(m_Stream) / sizeof(float);
+        std::vector<float> packed(vertices.size() * floats);
+        float* out = packed.data();
+        for (const Vertex& vertex : vertices) {
+            out[0] = vertex.Position.x;
+            out[1] = vertex.Position.y;
+            out[2] = vertex.Position.z;
+            if (uv) {
+                out[3] = vertex.UV.x;
+                out[4] = vertex.UV.y;
+            }
+            out += floats;
+        }
+
+        if (vertices.size() == m_VertexCount) {
+            Renderer::Context()->UpdateSubresource(m_VertexBuffer.Get(), 0, nullptr, packed.data(), 0, 0);
+        }
+        else {
+            m_VertexCount = vertices.size();
+            D3D11_BUFFER_DESC bufferDesc = {};
+            bufferDesc.Usage = D3D11_USAGE_DEFAULT;
+            bufferDesc.ByteWidth = GetVertexStreamStride(m_Stream) * m_VertexCount;
+            bufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+
+            D3D11_SUBRESOURCE_DATA initData = {};
+            initData.pSysMem = packed.data();
+
+            HRESULT hr = Renderer::Device()->CreateBuffer(&bufferDesc, &initData, m_VertexBuffer.ReleaseAndGetAddressOf());
+            assert(SUCCEEDED(hr));
+        }
+    }
+
+    void DepthVertexBuffer::Bind(int slot) {
+        SetVertexBuffer(slot, m_VertexBuffer.Get(), GetVertexStreamStride(m_Stream));
+    }
+
+
+
     IndexBuffer::IndexBuffer() {}
     IndexBuffer::IndexBuffer(const std::vector<uint32_t>& indices) {
 
@@ -104,12 +204,9 @@ namespace DXE
             assert(SUCCEEDED(hr));
         }
     }
+    // Index buffer only, slot is unused
     void IndexBuffer::Bind(int slot) {
-        ID3D11Buffer* buffers[] = { m_IndexBuffer.Get() };
-        uint32_t stride = sizeof(Vertex);
-        uint32_t offset = 0;
-        Renderer::Context()->IASetIndexBuffer(m_IndexBuffer.Get(), DXGI_FORMAT_R32_UINT, 0);
-        Renderer::Context()->IASetVertexBuffers(slot, 1, buffers, &stride, &offset);
+        SetIndexBuffer(m_IndexBuffer.Get());
     }
 
 
@@ -138,10 +235,7 @@ namespace DXE
 
 
     void InstanceBuffer::Bind(int slot) {
-        ID3D11Buffer* buffers[] = { m_InstanceBuffer.Get() };
-        uint32_t stride = sizeof(InstanceData);
-        uint32_t offset = 0;
-        Renderer::Context()->IASetVertexBuffers(slot, 1, buffers, &stride, &offset);
+        SetVertexBuffer(slot, m_InstanceBuffer.Get(), sizeof(InstanceData));
     }
     void InstanceBuffer::UpdateInstances(const std::vector<InstanceData>& instances) {
         if (instances.empty()) {
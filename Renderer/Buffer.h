@@ -19,6 +19,26 @@ namespace DXE
         DXM::Vector2 UV;
         DXM::Vector4 Color;
     };
+    // Vertex data a vertex shader reads. The smaller streams are packed copies of Vertex for depth only passes.
+    enum class VertexStream : uint8_t {
+        Full,       // Vertex, 60 bytes
+        Position,   // float3, 12 bytes
+        PositionUV  // float3 float2, 20 bytes, for alpha tested shadows
+    };
+    UINT GetVertexStreamStride(VertexStream stream);
+
+    // Input assembler binds go through these, they skip a buffer already bound to vertex slot 0 or 1 or as the
+    // index buffer. Call ResetBufferBindings once per frame and after anything outside these changed the bindings.
+    struct BufferBindStats {
+        uint32_t Issued = 0;
+        uint32_t Skipped = 0;
+    };
+    void SetVertexBuffer(UINT slot, ID3D11Buffer* buffer, UINT stride, UINT offset = 0);
+    void SetIndexBuffer(ID3D11Buffer* buffer);
+    void ResetBufferBindings();
+    // Since the last ResetBufferBindings
+    const BufferBindStats& GetBufferBindStats();
+
     struct InstanceData {
         InstanceData() = default;
         InstanceData(const InstanceData&) = default;
@@ -41,6 +61,7 @@ namespace DXE
         void UpdateVertices(const std::vector<Vertex>& vertices);
         void UpdateIndices(const std::vector<uint32_t>& indices);
         void Bind(int slot);
+        void BindIndices();
 
         uint32_t m_VertexCount = 0;
         uint32_t m_IndexCount = 0;
@@ -54,6 +75,22 @@ namespace DXE
     };
 
 
+    // Position or position and UV of every vertex, no index buffer, see MeshBase::SetDepthStream
+    class DXE_API DepthVertexBuffer
+    {
+    public:
+        DepthVertexBuffer(const std::vector<Vertex>& vertices, VertexStream stream);
+        void UpdateVertices(const std::vector<Vertex>& vertices);
+        void Bind(int slot);
+        VertexStream GetStream() const { return m_Stream; }
+
+        uint32_t m_VertexCount = 0;
+    private:
+        Microsoft::WRL::ComPtr<ID3D11Buffer> m_VertexBuffer;
+        VertexStream m_Stream;
+    };
+
+
     class IndexBuffer {
     public:
 
@@ -0,0 +1,239 @@
+#include "pch.h"
+#include "CascadedShadowMap.h"
+#include "RenderManager.h"
+#include "Mesh.h"
+#include "Shader.h"
+#include "Logger.h"
+#include <algorithm>
+
+namespace DXE
+{
+	static_assert(CascadedShadowMap::MaxCascades == 4, "CascadeCBuffer packs one float4 of values per cascade");
+
+	CascadedShadowMap::CascadedShadowMap(UINT resolution, int cascadeCount, Shader* shader)
+		: m_Resolution(resolution), m_CascadeCount((std::clamp)(cascadeCount, 1, MaxCascades)), m_Shader(shader)
+	{
+		CreateResources();
+
+		m_Viewport.TopLeftX = 0.0f;
+		m_Viewport.TopLeftY = 0.0f;
+		m_Viewport.Width = static_cast<FLOAT>(resolution);
+		m_Viewport.Height = static_cast<FLOAT>(resolution);
+		m_Viewport.MinDepth = 0.0f;
+		m_Viewport.MaxDepth = 1.0f;
+	}
+
+	void CascadedShadowMap::CreateResources() {
+		D3D11_TEXTURE2D_DESC textureDesc = {};
+		textureDesc.Width = m_Resolution;
+		textureDesc.Height = m_Resolution;
+		textureDesc.MipLevels = 1;
+		textureDesc.ArraySize = m_CascadeCount;
+		textureDesc.Format = DXGI_FORMAT_R24G8_TYPELESS;
+		textureDesc.SampleDesc.Count = 1;
+		textureDesc.Usage = D3D11_USAGE_DEFAULT;
+		textureDesc.BindFlags = D3D11_BIND_DEPTH_STENCIL | D3D11_BIND_SHADER_RESOURCE;
+		if (FAILED(Renderer::Device()->CreateTexture2D(&textureDesc, nullptr, &m_Texture))) {
+			DXE_ERROR("Failed to create cascaded shadow map texture");
+			return;
+		}
+
+		for (int i = 0; i < m_CascadeCount; ++i) {
+			D3D11_DEPTH_STENCIL_VIEW_DESC dsvDesc = {};
+			dsvDesc.Format = DXGI_FORMAT_D24_UNORM_S8_UINT;
+			dsvDesc.ViewDimension = D3D11_DSV_DIMENSION_TEXTURE2DARRAY;
+			dsvDesc.Texture2DArray.MipSlice = 0;
+			dsvDesc.Texture2DArray.FirstArraySlice = i;
+			dsvDesc.Texture2DArray.ArraySize = 1;
+			Renderer::Device()->CreateDepthStencilView(m_Texture.Get(), &dsvDesc, &m_DSVs[i]);
+		}
+
+		D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+		srvDesc.Format = DXGI_FORMAT_R24_UNORM_X8_TYPELESS;
+		srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2DARRAY;
+		srvDesc.Texture2DArray.MipLevels = 1;
+		srvDesc.Texture2DArray.ArraySize = m_CascadeCount;
+		Renderer::Device()->CreateShaderResourceView(m_Texture.Get(), &srvDesc, &m_SRV);
+
+		// Comparison sampler for hardware PCF, outside the map is lit
+		D3D11_SAMPLER_DESC samplerDesc = {};
+		samplerDesc.Filter = D3D11_FILTER_COMPARISON_MIN_MAG_MIP_LINEAR;
+		samplerDesc.AddressU = D3D11_TEXTURE_ADDRESS_BORDER;
+		samplerDesc.AddressV = D3D11_TEXTURE_ADDRESS_BORDER;
+		samplerDesc.AddressW = D3D11_TEXTURE_ADDRESS_BORDER;
+		samplerDesc.BorderColor[0] = 1.0f;
+		samplerDesc.BorderColor[1] = 1.0f;
+		samplerDesc.BorderColor[2] = 1.0f;
+		samplerDesc.BorderColor[3] = 1.0f;
+		samplerDesc.ComparisonFunc = D3D11_COMPARISON_LESS_EQUAL;
+		samplerDesc.MinLOD = 0;
+		samplerDesc.MaxLOD = D3D11_FLOAT32_MAX;
+		Renderer::Device()->CreateSamplerState(&samplerDesc, &m_Sampler);
+
+		D3D11_BUFFER_DESC bufferDesc = {};
+		bufferDesc.Usage = D3D11_USAGE_DYNAMIC;
+		bufferDesc.ByteWidth = sizeof(CascadeCBuffer);
+		bufferDesc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+		bufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+		if (FAILED(Renderer::Device()->CreateBuffer(&bufferDesc, nullptr, &m_CascadeBuffer))) {
+			DXE_ERROR("Failed to create cascade buffer");
+		}
+	}
+
+	void CascadedShadowMap::Update(const DX::BoundingFrustum& cameraFrustum, DXM::Vector3 sunDirection) {
+		sunDirection.Normalize();
+		m_LightDirection = sunDirection;
+
+		float nearDistance, farDistance;
+		GetFrustumDistances(cameraFrustum, nearDistance, farDistance);
+		ComputeCascadeSplits(nearDistance, (std::min)(farDistance, ShadowDistance), m_CascadeCount, SplitLambda, m_Splits.data());
+		m_StaticSignature = RenderManager::GetShadowCasterSignature(true);
+
+		for (int i = 0; i < m_CascadeCount; ++i) {
+			DX::BoundingFrustum slice = SliceFrustum(cameraFrustum, m_Splits[i], m_Splits[i + 1]);
+
+			if (!IsStatic(i)) {
+				m_Cascades[i] = FitShadowCascade(slice, sunDirection, m_Resolution, CasterDistance);
+				m_Volumes[i] = ShadowCasterVolume(slice, m_Cascades[i].Box, sunDirection);
+				m_Due[i] = true;
+				continue;
+			}
+
+			// A cached cascade stays valid while the slice's sphere is still inside it
+			ShadowCascade fit = FitShadowCascade(slice, sunDirection, m_Resolution, CasterDistance);
+			const ShadowCascade& cached = m_Drawn[i];
+			bool covered = DXM::Vector3::Distance(fit.Centre, cached.Centre) + fit.Radius + fit.TexelSize <= cached.Radius;
+			bool lightMoved = 1.f - sunDirection.Dot(m_CascadeDirections[i]) > LightMoveThreshold;
+			bool expired = StaticRefreshInterval > 0 && m_Stats[i].FramesSinceRender + 1 >= static_cast<uint32_t>(StaticRefreshInterval);
+
+			bool castersChanged = m_Signatures[i] != m_StaticSignature;
+
+			m_Due[i] = m_Deferred[i] || !m_Valid[i] || !covered || lightMoved || expired || castersChanged;
+			if (m_Due[i]) {
+				m_Cascades[i] = FitShadowCascade(slice, sunDirection, m_Resolution, CasterDistance, StaticPadding);
+			}
+		}
+	}
+
+	int CascadedShadowMap::AppendCullViews(std::vector<CullView>& views) {
+		const int first = static_cast<int>(views.size());
+		m_Views.fill(-1);
+		// Cascades deferred last frame go first, so they can't miss out on a view twice in a row
+		for (int pass = 0; pass < 2; ++pass) {
+			for (int i = 0; i < m_CascadeCount; ++i) {
+				if (!m_Due[i] || m_Deferred[i] != (pass == 0)) continue;
+				m_Views[i] = static_cast<int>(views.size()) - first;
+				if (IsStatic(i)) {
+					// Kept for many frames, so everything static in the cascade goes in, not only what the camera sees now
+					CullView view(m_Cascades[i].Box, true);
+					view.StaticOnly = true;
+					views.push_back(view);
+				}
+				else {
+					views.emplace_back(m_Volumes[i], true);
+				}
+			}
+		}
+		if (views.size() > MaxCullViews) {
+			DXE_WARN("CascadedShadowMap: more than ", MaxCullViews, " cull views, some cascades are deferred to the next frame");
+		}
+		return first;
+	}
+
+	void CascadedShadowMap::Render(RenderManager& renderManager, int firstView) {
+		GlobalCBuffer& global = renderManager.GetGlobalBuffer<GlobalCBuffer>();
+		const DXM::Matrix savedView = global.LightViewMatrix;
+		const DXM::Matrix savedProjection = global.LightProjectionMatrix;
+		const DXM::Matrix savedViewProjection = global.LightViewProjectionMatrix;
+
+		bool rendered = false;
+		for (int i = 0; i < m_CascadeCount; ++i) {
+			ShadowCascadeStats& stats = m_Stats[i];
+			stats.Rendered = false;
+			const int view = firstView + m_Views[i];
+			if (!m_Due[i]) {
+				++stats.FramesSinceRender;
+				++stats.Skipped;
+				continue;
+			}
+			if (m_Views[i] < 0 || view >= MaxCullViews) {
+				// The map keeps the last drawn fit, Update marks the cascade due again
+				++stats.FramesSinceRender;
+				++stats.Deferred;
+				m_Deferred[i] = true;
+				continue;
+			}
+
+			const ShadowCascade& cascade = m_Cascades[i];
+			global.LightViewMatrix = cascade.View.Transpose();
+			global.LightProjectionMatrix = cascade.Projection.Transpose();
+			global.LightViewProjectionMatrix = cascade.ViewProjection.Transpose();
+			renderManager.UpdateGlobalBuffer();
+
+			m_Shader->Bind();
+			Renderer::Context()->OMSetRenderTargets(0, nullptr, m_DSVs[i].Get());
+			Renderer::Context()->RSSetViewports(1, &m_Viewport);
+			Renderer::Context()->ClearDepthStencilView(m_DSVs[i].Get(), D3D11_CLEAR_DEPTH, 1.0f, 0);
+			renderManager.m_DepthShader = m_Shader;
+			renderManager.RenderShadowPass(view);
+			renderManager.m_DepthShader = nullptr;
+
+			stats.Casters = 0;
+			stats.Meshes = 0;
+			for (MeshBase* mesh : Mesh::GetMeshes()) {
+				if (!mesh->GetMaterial() || !mesh->m_CastsShadow) continue;
+				uint32_t casters = mesh->GetViewInstanceCount(view);
+				stats.Casters += casters;
+				if (casters) ++stats.Meshes;
+			}
+			stats.FramesSinceRender = 0;
+			stats.Rendered = true;
+			m_Drawn[i] = cascade;
+			m_Deferred[i] = false;
+			m_CascadeDirections[i] = m_LightDirection;
+			m_Signatures[i] = m_StaticSignature;
+			m_Valid[i] = true;
+			rendered = true;
+		}
+
+		if (rendered) {
+			Renderer::Context()->OMSetRenderTargets(0, nullptr, nullptr);
+			global.LightViewMatrix = savedView;
+			global.LightProjectionMatrix = savedProjection;
+			global.LightViewProjectionMatrix = savedViewProjection;
+			renderManager.UpdateGlobalBuffer();
+		}
+		UploadCascadeBuffer();
+	}
+
+	void CascadedShadowMap::UploadCascadeBuffer() {
+		if (!m_CascadeBuffer) return;
+		CascadeCBuffer data = {};
+		float splitFar[MaxCascades] = {};
+		float texelSize[MaxCascades] = {};
+		for (int i = 0; i < m_CascadeCount; ++i) {
+			// the fit the map holds, which is not this frame's for a deferred cascade
+			data.LightViewProjection[i] = m_Drawn[i].ViewProjection.Transpose();
+			splitFar[i] = m_Splits[i + 1];
+			texelSize[i] = m_Drawn[i].TexelSize;
+		}
+		data.SplitFar = DXM::Vector4(splitFar[0], splitFar[1], splitFar[2], splitFar[3]);
+		data.TexelSize = DXM::Vector4(texelSize[0], texelSize[1], texelSize[2], texelSize[3]);
+		data.CascadeCount = m_CascadeCount;
+
+		D3D11_MAPPED_SUBRESOURCE mapped;
+		if (FAILED(Renderer::Context()->Map(m_CascadeBuffer.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped))) return;
+		memcpy(mapped.pData, &data, sizeof(data));
+		Renderer::Context()->Unmap(m_CascadeBuffer.Get(), 0);
+	}
+
+	void CascadedShadowMap::Bind(UINT textureSlot, UINT samplerSlot, UINT bufferSlot) {
+		Renderer::Context()->PSSetShaderResources(textureSlot, 1, m_SRV.GetAddressOf());
+		Renderer::Context()->PSSetSamplers(samplerSlot, 1, m_Sampler.GetAddressOf());
+		Renderer::Context()->PSSetConstantBuffers(bufferSlot, 1, m_CascadeBuffer.GetAddressOf());
+	}
+
+	void CascadedShadowMap::Invalidate() {
+		m_Valid.fill(false);
+	}
+}
@@ -0,0 +1,118 @@
+#pragma once
+#include "DXE.h"
+#include "Renderer/Renderer.h"
+#include "Maths/Maths.h"
+#include "Maths/ShadowCascades.h"
+#include "Renderer/MeshBase.h"
+#include "Renderer/ShadowCasterVolume.h"
+#include <array>
+
+namespace DXE
+{
+	class RenderManager;
+	class Shader;
+
+	struct ShadowCascadeStats {
+		uint32_t Casters = 0; // instances drawn into the cascade the last time it was rendered
+		uint32_t Meshes = 0;  // meshes with at least one of them
+		uint32_t FramesSinceRender = 0;
+		uint32_t Skipped = 0;  // frames the cached map was reused
+		uint32_t Deferred = 0; // frames it was due without a cull view left (MaxCullViews), drawn first the next frame
+		bool Rendered = false; // this frame
+	};
+
+	// Cascade data for the receiving shaders, matrices transposed like the global buffer
+	struct CascadeCBuffer {
+		DXM::Matrix LightViewProjection[4];
+		DXM::Vector4 SplitFar;  // view distance each cascade ends at
+		DXM::Vector4 TexelSize; // world size of a texel per cascade, for filter and bias scaling
+		int CascadeCount;
+		DXM::Vector3 Padding;
+	};
+
+	// Cascaded sun shadows in one Texture2DArray, a slice per cascade.
+	// Near cascades follow the camera and are redrawn every frame, each culled against its own caster volume.
+	// Cascades from FirstStaticCascade on only hold meshes with m_Static set and are kept between frames: they
+	// are fitted StaticPadding larger and redrawn every StaticRefreshInterval frames, when the sun turns past
+	// LightMoveThreshold, when the camera leaves the area they cover or when a static caster changes
+	// (RenderManager::GetShadowCasterSignature, as of the last CalculateInstanceBounds).
+	// A due cascade that finds no cull view left keeps sampling the map it last drew, with that map's matrices,
+	// and takes the first view the next frame.
+	//
+	// Per frame:
+	//   shadows.Update(cameraFrustum, sunDirection);
+	//   std::vector<CullView> views = { cameraFrustum };
+	//   int first = shadows.AppendCullViews(views);
+	//   renderManager->CullMeshes(views);
+	//   shadows.Render(*renderManager, first);
+	//   ... shadows.Bind(textureSlot, samplerSlot, bufferSlot) for the lit passes
+	class DXE_API CascadedShadowMap {
+	public:
+		static constexpr int MaxCascades = 4;
+
+		float ShadowDistance = 200.f; // shadows end here or at the camera far plane
+		float SplitLambda = 0.75f;    // 1 logarithmic, 0 uniform splits
+		float CasterDistance = 100.f; // how far towards the sun casters are picked up beyond a cascade
+		int FirstStaticCascade = 2;   // MaxCascades or more keeps every cascade dynamic
+		int StaticRefreshInterval = 60; // frames, 0 only redraws on light or camera movement
+		float LightMoveThreshold = 1e-4f; // 1 - cos of the sun turn that redraws cached cascades
+		float StaticPadding = 1.25f;
+
+		CascadedShadowMap(UINT resolution, int cascadeCount, Shader* shader);
+		~CascadedShadowMap() = default;
+
+		// Splits the camera frustum and fits every cascade that is due this frame
+		void Update(const DX::BoundingFrustum& cameraFrustum, DXM::Vector3 sunDirection);
+		// Adds a caster view for every cascade due this frame and returns the index of the first one.
+		// The views reference this object's caster volumes until the next Update.
+		int AppendCullViews(std::vector<CullView>& views);
+		// Draws the due cascades from the views culled by RenderManager::CullMeshes, firstView as returned by
+		// AppendCullViews. Writes each cascade's light matrices into the global buffer, which must start
+		// with GlobalCBuffer's layout, and restores them afterwards.
+		void Render(RenderManager& renderManager, int firstView);
+		// Binds the cascade array, the comparison sampler and the CascadeCBuffer to the pixel shader
+		void Bind(UINT textureSlot, UINT samplerSlot, UINT bufferSlot);
+
+		int GetCascadeCount() const { return m_CascadeCount; }
+		const ShadowCascade& GetCascade(int cascade) const { return m_Cascades[cascade]; }
+		const ShadowCascadeStats& GetStats(int cascade) const { return m_Stats[cascade]; }
+		bool IsDue(int cascade) const { return m_Due[cascade]; }
+		bool IsStatic(int cascade) const { return cascade >= FirstStaticCascade; }
+		float GetSplit(int index) const { return m_Splits[index]; } // index 0 to GetCascadeCount()
+		// Forces every cached cascade to redraw
+		void Invalidate();
+
+		ID3D11ShaderResourceView* GetSRV() const { return m_SRV.Get(); }
+		ID3D11SamplerState* GetSampler() const { return m_Sampler.Get(); }
+		UINT GetResolution() const { return m_Resolution; }
+
+	private:
+		void CreateResources();
+		void UploadCascadeBuffer();
+
+		UINT m_Resolution;
+		int m_CascadeCount;
+		Shader* m_Shader = nullptr;
+
+		std::array<ShadowCascade, MaxCascades> m_Cascades{};
+		std::array<ShadowCascade, MaxCascades> m_Drawn{}; // the fit each slice of the map was last drawn with
+		std::array<ShadowCasterVolume, MaxCascades> m_Volumes;
+		std::array<DXM::Vector3, MaxCascades> m_CascadeDirections{}; // sun direction each cascade was drawn with
+		std::array<ShadowCascadeStats, MaxCascades> m_Stats{};
+		std::array<bool, MaxCascades> m_Due{};
+		std::array<bool, MaxCascades> m_Valid{}; // holds a usable cached map
+		std::array<bool, MaxCascades> m_Deferred{}; // was due last frame but got no cull view
+		std::array<uint64_t, MaxCascades> m_Signatures{}; // static caster signature each cascade was drawn with
+		uint64_t m_StaticSignature = 0;
+		std::array<int, MaxCascades> m_Views{};  // cull view index when due
+		std::array<float, MaxCascades + 1> m_Splits{};
+		DXM::Vector3 m_LightDirection;
+
+		Microsoft::WRL::ComPtr<ID3D11Texture2D> m_Texture;
+		std::array<Microsoft::WRL::ComPtr<ID3D11DepthStencilView>, MaxCascades> m_DSVs;
+		Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> m_SRV;
+		Microsoft::WRL::ComPtr<ID3D11SamplerState> m_Sampler;
+		Microsoft::WRL::ComPtr<ID3D11Buffer> m_CascadeBuffer;
+		D3D11_VIEWPORT m_Viewport;
+	};
+}
@@ -29,6 +29,23 @@ namespace DXE
 		 }
 	 }
 
+	 std::vector<MeshInstance> Mesh::CreateMeshInstances(MeshBase* mesh, std::span<const InstanceData> instanceData) {
+		 return mesh->CreateInstances(instanceData);
+	 }
+
+	 void Mesh::RemoveMeshInstances(std::span<const MeshInstance> instances) {
+		 // runs of handles from the same mesh go through one bulk destroy each
+		 size_t first = 0;
+		 while (first < instances.size()) {
+			 MeshBase* mesh = instances[first].Base();
+			 size_t last = first + 1;
+			 while (last < instances.size() && instances[last].Base() == mesh) ++last;
+			 if (mesh) mesh->DestroyInstances(instances.subspan(first, last - first));
+			 first = last;
+		 }
+	 }
+
+
 	 std::unordered_map<std::string, MeshBase*>& Mesh::Map() {
 		return MeshManager::Get()->Map();
 	}
@@ -21,6 +21,9 @@ namespace DXE {
 	static std::shared_ptr<MeshInstance> CreateMeshInstance(MeshBase* mesh, InstanceData instanceData = InstanceData());
 	static std::shared_ptr<MeshInstance> CreateMeshInstance(const std::string& name, InstanceData instanceData = InstanceData());
 	static void RemoveMeshInstance(std::shared_ptr<MeshInstance> instance);
+	static std::vector<MeshInstance> CreateMeshInstances(MeshBase* mesh, std::span<const InstanceData> instanceData);
+	// Handles may belong to different meshes
+	static void RemoveMeshInstances(std::span<const MeshInstance> instances);
 
 
 	};
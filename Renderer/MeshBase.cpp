@@ -1,13 +1,94 @@
 #include "pch.h"
 #include "MeshInstance.h"
 #include "MeshBase.h"
+#include "MeshManager.h"
+#include <bit>
+#include <cfloat>
+#include <chrono>
+#include <cstring>
+#include <random>
 namespace DXE
 {
 
+	namespace {
+		MeshBufferPool& BufferPool() { return MeshManager::Get()->GetBufferPool(); }
+
+		// Sphere first as the cheap early out, the box decides when it is the tighter bound
+		template<typename Volume>
+		bool Overlaps(const Volume& volume, const VisibilityData& visibility) {
+			if (volume.Contains(DX::BoundingSphere(visibility.Centre, visibility.Radius)) == DX::DISJOINT) return false;
+			return !visibility.UseBox || volume.Contains(visibility.Box) != DX::DISJOINT;
+		}
+
+		// Transposed inverse of the upper 3x3, the way the shaders want it for normals
+		DXM::Matrix NormalMatrix(const DXM::Matrix& world) {
+			float m00 = world._11, m01 = world._12, m02 = world._13;
+			float m10 = world._21, m11 = world._22, m12 = world._23;
+			float m20 = world._31, m21 = world._32, m22 = world._33;
+
+			float det = m00 * (m11 * m22 - m12 * m21) - m01 * (m10 * m22 - m12 * m20) + m02 * (m10 * m21 - m11 * m20);
+			if (fabs(det) < 1e-6f) det = 1.f; // avoid div by zero
+			float invDet = 1.f / det;
+
+			float i00 = (m11 * m22 - m12 * m21) * invDet;
+			float i01 = -(m01 * m22 - m02 * m21) * invDet;
+			float i02 = (m01 * m12 - m02 * m11) * invDet;
+			float i10 = -(m10 * m22 - m12 * m20) * invDet;
+			float i11 = (m00 * m22 - m02 * m20) * invDet;
+			float i12 = -(m00 * m12 - m02 * m10) * invDet;
+			float i20 = (m10 * m21 - m11 * m20) * invDet;
+			float i21 = -(m00 * m21 - m01 * m20) * invDet;
+			float i22 = (m00 * m11 - m01 * m10) * invDet;
+
+			return DXM::Matrix(
+				i00, i10, i20, 0.f,
+				i01, i11, i21, 0.f,
+				i02, i12, i22, 0.f,
+				0.f, 0.f, 0.f, 1.f);
+		}
+
+		// Distance to the nearest point of the bounding sphere
+		float InstanceDepth(const VisibilityData& visibility, const DXM::Vector3& origin) {
+			return (std::max)(0.f, DXM::Vector3::Distance(visibility.Centre, origin) - visibility.Radius);
+		}
+
+		uint32_t TransformHash(const DXM::Matrix& world) {
+			uint32_t bits[16];
+			memcpy(bits, &world, sizeof(bits));
+			uint32_t hash = 2166136261u;
+			for (uint32_t b : bits) hash = (hash ^ b) * 16777619u;
+			return hash;
+		}
+
+		// One triangle, the geometry of the benchmarks' scratch meshes
+		std::vector<Vertex> ScratchTriangle() {
+			std::vector<Vertex> vertices(3, Vertex{});
+			vertices[0].Position = DXM::Vector3(0.f, 0.f, 0.f);
+			vertices[1].Position = DXM::Vector3(1.f, 0.f, 0.f);
+			vertices[2].Position = DXM::Vector3(0.f, 1.f, 0.f);
+			for (Vertex& v : vertices) {
+				v.Normal = DXM::Vector3(0.f, 0.f, -1.f);
+				v.Color = DXM::Vector4(1.f, 1.f, 1.f, 1.f);
+			}
+			return vertices;
+		}
+
+		// count instances on a 1024 wide grid
+		std::vector<InstanceData> GridInstances(int count) {
+			std::vector<InstanceData> data(count);
+			for (int i = 0; i < count; ++i) {
+				data[i] = InstanceData(DXM::Matrix::CreateTranslation(static_cast<float>(i % 1024), static_cast<float>(i / 1024), 0.f), DXM::Vector4(1.f, 1.f, 1.f, 1.f));
+			}
+			return data;
+		}
+	}
+
+
 	std::shared_ptr<MeshInstance> MeshBase::CreateInstance(const InstanceData& data) {
 			entt::entity e = m_Instances.create();
 			m_Instances.emplace<InstanceData>(e,data); // default transform
-			m_Instances.emplace<VisibilityData>(e);	// radius
+			m_Instances.emplace<VisibilityData>(e, CalculateVisibility(data));
+			++m_Version;
 			// Wrap in shared_ptr
 			return std::make_shared<MeshInstance>(this, e);
 	}
@@ -16,6 +97,92 @@ namespace DXE
 		if (instance) { instance->Destroy(); }
 	}
 
+	std::vector<MeshInstance> MeshBase::CreateInstances(std::span<const InstanceData> data) {
+		std::vector<entt::entity> entities(data.size());
+		CreateInstances(data, entities);
+
+		std::vector<MeshInstance> instances;
+		instances.reserve(entities.size());
+		for (entt::entity e : entities) instances.emplace_back(this, e);
+		return instances;
+	}
+
+	void MeshBase::CreateInstances(std::span<const InstanceData> data, std::span<entt::entity> entities) {
+		const size_t count = (std::min)(data.size(), entities.size());
+		if (!count) return;
+		auto& instanceStorage = m_Instances.storage<InstanceData>();
+		auto& visibilityStorage = m_Instances.storage<VisibilityData>();
+		instanceStorage.reserve(instanceStorage.size() + count);
+		visibilityStorage.reserve(visibilityStorage.size() + count);
+
+		m_Instances.create(entities.begin(), entities.begin() + count);
+		m_Instances.insert<InstanceData>(entities.begin(), entities.begin() + count, data.begin());
+		std::vector<VisibilityData> visibility(count);
+		for (size_t i = 0; i < count; ++i) visibility[i] = CalculateVisibility(data[i]);
+		m_Instances.insert<VisibilityData>(entities.begin(), entities.begin() + count, visibility.begin());
+		++m_Version;
+	}
+
+	void MeshBase::DestroyInstances(std::span<const MeshInstance> instances) {
+		std::vector<entt::entity> entities;
+		entities.reserve(instances.size());
+		for (const MeshInstance& instance : instances) {
+			if (instance.Base() == this && instance.IsValid()) entities.push_back(instance);
+		}
+		std::sort(entities.begin(), entities.end());
+		entities.erase(std::unique(entities.begin(), entities.end()), entities.end());
+		DestroyInstances(std::span<const entt::entity>(entities));
+	}
+
+	void MeshBase::DestroyInstances(std::span<const entt::entity> entities) {
+		if (entities.empty()) return;
+		m_Instances.destroy(entities.begin(), entities.end());
+		++m_Version;
+	}
+
+	void MeshBase::ClearInstances() {
+		m_Instances.clear();
+		++m_Version;
+	}
+
+	bool MeshBase::BenchmarkInstances(int count) {
+		using Clock = std::chrono::high_resolution_clock;
+		auto seconds = [](Clock::time_point from, Clock::time_point to) { return std::chrono::duration<double>(to - from).count(); };
+
+		MeshBase mesh("InstanceBenchmark", ScratchTriangle(), { 0, 1, 2 });
+		const std::vector<InstanceData> data = GridInstances(count);
+		int errors = 0;
+
+		auto start = Clock::now();
+		std::vector<std::shared_ptr<MeshInstance>> shared;
+		shared.reserve(count);
+		for (const InstanceData& instance : data) shared.push_back(mesh.CreateInstance(instance));
+		auto created = Clock::now();
+		if (mesh.GetInstanceCount() != count) ++errors;
+		for (auto& instance : shared) mesh.DestroyInstance(instance);
+		shared.clear();
+		auto destroyed = Clock::now();
+		if (mesh.GetInstanceCount() != 0) ++errors;
+
+		std::vector<MeshInstance> handles = mesh.CreateInstances(data);
+		auto bulkCreated = Clock::now();
+		if (mesh.GetInstanceCount() != count) ++errors;
+		for (size_t i = 0; i < handles.size(); ++i) {
+			if (!handles[i].IsValid() || mesh.m_Instances.get<InstanceData>(handles[i]).Transform != data[i].Transform) {
+				++errors;
+				break;
+			}
+		}
+		mesh.DestroyInstances(handles);
+		auto bulkDestroyed = Clock::now();
+		if (mesh.GetInstanceCount() != 0) ++errors;
+
+		DXE_INFO("Instance benchmark ", count, " instances: CreateInstance ", seconds(start, created), "s, DestroyInstance ",
+			seconds(created, destroyed), "s, CreateInstances ", seconds(destroyed, bulkCreated), "s, DestroyInstances ", seconds(bulkCreated, bulkDestroyed), "s");
+		if (errors) DXE_ERROR("Instance benchmark: ", errors, " checks failed");
+		return errors == 0;
+	}
+
 
 
 	// Mesh Base
@@ -29,12 +196,64 @@ namespace DXE
 	void MeshBase::UpdateMeshData(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices) {
 
 		m_Vertices = vertices;
-		CalculateBoundingRadius();
+		CalculateBounds();
 
 		m_Indices = indices;
 
-		m_VertexBuffer->UpdateVertices(m_Vertices);
-		m_VertexBuffer->UpdateIndices(m_Indices);
+		if (m_BufferHandle == MeshBufferPool::InvalidHandle) {
+			AllocateBuffers();
+		}
+		else {
+			BufferPool().UpdateVertices(m_BufferHandle, m_Vertices);
+			BufferPool().UpdateIndices(m_BufferHandle, m_Indices);
+		}
+		if (m_DepthVertexBuffer) m_DepthVertexBuffer->UpdateVertices(m_Vertices);
+		if (m_ClusterCulling) BuildMeshlets();
+		MarkGeometryChanged();
+	}
+	void MeshBase::UpdateVertices(std::vector<Vertex>&& vertices) {
+		m_Vertices = std::move(vertices);
+		CalculateBounds();
+		if (m_BufferHandle != MeshBufferPool::InvalidHandle) BufferPool().UpdateVertices(m_BufferHandle, m_Vertices);
+		if (m_DepthVertexBuffer) m_DepthVertexBuffer->UpdateVertices(m_Vertices);
+		if (m_ClusterCulling) BuildMeshlets();
+		++m_Version;
+	}
+
+	void MeshBase::SetDepthStream(VertexStream stream) {
+		if (stream == VertexStream::Full) {
+			m_DepthVertexBuffer.reset();
+		}
+		else if (GetDepthStream() != stream) {
+			m_DepthVertexBuffer = std::make_shared<DepthVertexBuffer>(m_Vertices, stream);
+		}
+	}
+
+	void MeshBase::SetClusterCulling(bool enable) {
+		m_ClusterCulling = enable;
+		m_ClusterDrawsActive = false;
+		if (enable) BuildMeshlets();
+		else m_Meshlets.Clear();
+	}
+
+	void MeshBase::BuildMeshlets() {
+		m_Meshlets.Clear();
+		if (m_HasShadowIndices) {
+			DXE_ERROR("MeshBase ", m_Name, ": no cluster culling for meshes with shadow indices");
+			return;
+		}
+		m_Meshlets.Build(m_Vertices, m_Indices);
+		if (m_Meshlets.IsEmpty()) return;
+		// Same triangles in meshlet order, so every meshlet is one range of the index buffer
+		m_Indices = m_Meshlets.GetIndices();
+		if (m_BufferHandle != MeshBufferPool::InvalidHandle) BufferPool().UpdateIndices(m_BufferHandle, m_Indices);
+	}
+	void MeshBase::AllocateBuffers() {
+		// meshes built before MeshManager::Init, like the benchmarks' scratch meshes, keep an invalid handle
+		if (MeshManager::Get()) m_BufferHandle = BufferPool().Allocate(m_Vertices, m_Indices);
+	}
+	MeshBase::~MeshBase() {
+		if (MeshManager::Get()) BufferPool().Free(m_BufferHandle);
 	}
 	void MeshBase::UpdateInstances() {
 		//m_InstanceBuffer->UpdateInstances(m_InstanceData);
@@ -83,60 +302,280 @@ namespace DXE
 
 	}
 	void MeshBase::BindVertexBuffer(int slot) {
-		m_VertexBuffer->Bind(slot);
+		if (m_BufferHandle != MeshBufferPool::InvalidHandle) BufferPool().Bind(m_BufferHandle, slot);
+	}
+	UINT MeshBase::GetFirstIndex() const {
+		return m_BufferHandle != MeshBufferPool::InvalidHandle ? BufferPool().GetRange(m_BufferHandle).FirstIndex : 0;
+	}
+	INT MeshBase::GetBaseVertex() const {
+		return m_BufferHandle != MeshBufferPool::InvalidHandle ? static_cast<INT>(BufferPool().GetRange(m_BufferHandle).BaseVertex) : 0;
+	}
+	void MeshBase::BindShadowIndexBuffer() {
+		if (!m_IndexBuffer) m_IndexBuffer = std::make_shared<IndexBuffer>();
+		if (m_ShadowIndicesVersion != m_GeometryVersion || m_IndexBuffer->m_IndexCount != m_ShadowIndices.size()) {
+			m_IndexBuffer->UpdateIndices(m_ShadowIndices);
+			m_ShadowIndicesVersion = m_GeometryVersion;
+		}
+		m_IndexBuffer->Bind(0);
 	}
 	void MeshBase::BindInstanceBuffer(int slot) {
 		m_InstanceBuffer->Bind(slot);
 	}
+	void MeshBase::BindDepthVertexBuffer(int slot) {
+		if (m_BufferHandle != MeshBufferPool::InvalidHandle) BufferPool().BindIndices(m_BufferHandle);
+		m_DepthVertexBuffer->Bind(slot);
+	}
+
+	// Ritter's sphere refined by a second growing pass, kept when it beats the sphere around the AABB centre
+	void MeshBase::CalculateBounds() {
+		m_InstanceBoundsStale = true;
+		m_OriginRadius = 0.f;
+		if (m_Vertices.empty()) {
+			m_LocalBounds = DX::BoundingBox();
+			m_BoundingCentre = DXM::Vector3::Zero;
+			m_BoundingRadius = 0.f;
+			return;
+		}
 
-	void MeshBase::CalculateBoundingRadius() {
-		float maxRadiusSq = 0.0f;
-		for (const auto& v : m_Vertices)
-		{
-			float lengthSq = v.Position.LengthSquared();  // squared distance from origin
-			if (lengthSq > maxRadiusSq) {
-				maxRadiusSq = lengthSq;
+		DXM::Vector3 lo = m_Vertices[0].Position, hi = m_Vertices[0].Position;
+		float originRadiusSq = 0.f;
+		for (const Vertex& v : m_Vertices) {
+			lo = DXM::Vector3::Min(lo, v.Position);
+			hi = DXM::Vector3::Max(hi, v.Position);
+			originRadiusSq = (std::max)(originRadiusSq, v.Position.LengthSquared());
+		}
+		m_OriginRadius = sqrtf(originRadiusSq);
+		m_LocalBounds = DX::BoundingBox((lo + hi) * 0.5f, (hi - lo) * 0.5f);
+
+		auto farthest = [&](const DXM::Vector3& from) {
+			const DXM::Vector3* best = &m_Vertices[0].Position;
+			float bestSq = -1.f;
+			for (const Vertex& v : m_Vertices) {
+				float d = DXM::Vector3::DistanceSquared(from, v.Position);
+				if (d > bestSq) {
+					bestSq = d;
+					best = &v.Position;
+				}
+			}
+			return *best;
+		};
+		DXM::Vector3 a = farthest(m_Vertices[0].Position);
+		DXM::Vector3 b = farthest(a);
+		DXM::Vector3 centre = (a + b) * 0.5f;
+		float radius = DXM::Vector3::Distance(a, b) * 0.5f;
+		for (int pass = 0; pass < 2; ++pass) {
+			for (const Vertex& v : m_Vertices) {
+				float d = DXM::Vector3::Distance(centre, v.Position);
+				if (d > radius) {
+					float grown = (radius + d) * 0.5f;
+					centre += (v.Position - centre) * ((grown - radius) / d);
+					radius = grown;
+				}
 			}
 		}
-		m_BoundingRadius = sqrt(maxRadiusSq);
 
+		float boxRadiusSq = 0.f;
+		for (const Vertex& v : m_Vertices) {
+			boxRadiusSq = (std::max)(boxRadiusSq, DXM::Vector3::DistanceSquared(m_LocalBounds.Center, v.Position));
+		}
+		if (boxRadiusSq < radius * radius) {
+			centre = m_LocalBounds.Center;
+			radius = sqrtf(boxRadiusSq);
+		}
+		m_BoundingCentre = centre;
+		m_BoundingRadius = radius;
+	}
+
+	void MeshBase::SetLocalBounds(const DX::BoundingBox& bounds) {
+		m_LocalBounds = bounds;
+		m_BoundingCentre = bounds.Center;
+		m_BoundingRadius = DXM::Vector3(bounds.Extents).Length();
+		DXM::Vector3 farCorner(fabsf(bounds.Center.x) + bounds.Extents.x, fabsf(bounds.Center.y) + bounds.Extents.y, fabsf(bounds.Center.z) + bounds.Extents.z);
+		m_OriginRadius = farCorner.Length();
+		m_InstanceBoundsStale = true;
+		++m_Version;
+	}
+
+	VisibilityData MeshBase::CalculateVisibility(const InstanceData& instance) const {
+		const DXM::Matrix& world = instance.Transform;
+		VisibilityData visibility;
+
+		// rows are the transformed local axes, the longest bounds how far the sphere stretches
+		visibility.Centre = DXM::Vector3::Transform(m_BoundingCentre, world);
+		visibility.Radius = m_BoundingRadius * DXM::MaxAxisScale(world);
+
+		// AABB of the transformed local box, each world extent sums the absolute axis contributions
+		const DXM::Vector3 e = m_LocalBounds.Extents;
+		visibility.Box.Center = DXM::Vector3::Transform(m_LocalBounds.Center, world);
+		visibility.Box.Extents = DXM::Vector3(
+			fabsf(world._11) * e.x + fabsf(world._21) * e.y + fabsf(world._31) * e.z,
+			fabsf(world._12) * e.x + fabsf(world._22) * e.y + fabsf(world._32) * e.z,
+			fabsf(world._13) * e.x + fabsf(world._23) * e.y + fabsf(world._33) * e.z);
+		const DXM::Vector3 be = visibility.Box.Extents;
+		visibility.UseBox = 8.f * be.x * be.y * be.z < 4.18879f * visibility.Radius * visibility.Radius * visibility.Radius;
+		visibility.TransformHash = TransformHash(world);
+		return visibility;
 	}
-	void MeshBase::CalculateInstanceBoundingRadius() {
+
+	void MeshBase::CalculateInstanceBounds() {
+		// The transform hash is far cheaper than the bounds, only moved instances are recomputed unless the
+		// mesh bounds changed under every instance
+		const bool all = m_InstanceBoundsStale;
+		m_InstanceBoundsStale = false;
 		auto view = m_Instances.view<InstanceData, VisibilityData>();
+		bool moved = false;
 		view.each([&](auto entity, auto& instanceData, auto& visibility) {
+			const uint32_t hash = TransformHash(instanceData.Transform);
+			if (!all && hash == visibility.TransformHash) return;
+			moved |= hash != visibility.TransformHash;
+			VisibilityData bounds = CalculateVisibility(instanceData);
+			visibility.Centre = bounds.Centre;
+			visibility.Radius = bounds.Radius;
+			visibility.Box = bounds.Box;
+			visibility.UseBox = bounds.UseBox;
+			visibility.TransformHash = bounds.TransformHash;
+		});
+		if (moved) ++m_Version;
+	}
+
 
-			DXM::Vector3 ScaleX(
-				instanceData.Transform._11,
-				instanceData.Transform._21,
-				instanceData.Transform._31
-			);
-			DXM::Vector3 ScaleY(
-				instanceData.Transform._12,
-				instanceData.Transform._22,
-				instanceData.Transform._32
-			);
-			DXM::Vector3 ScaleZ(
-				instanceData.Transform._13,
-				instanceData.Transform._23,
-				instanceData.Transform._33
-			);
-			// Compare squared lengths to avoid unnecessary sqrt
-			float lenSq0 = ScaleX.LengthSquared();
-			float lenSq1 = ScaleY.LengthSquared();
-			float lenSq2 = ScaleZ.LengthSquared();
 
-			float maxLenSq = std::max(lenSq0, std::max(lenSq1, lenSq2));
-			float maxScale = sqrtf(maxLenSq); // Only one sqrt
 
-			visibility.Radius = m_BoundingRadius * maxScale;
+	void MeshBase::SetOccluderGeometry(std::vector<DXM::Vector3> vertices, std::vector<uint32_t> indices) {
+		m_OccluderVertices = std::move(vertices);
+		m_OccluderIndices = std::move(indices);
+	}
+
+	void MeshBase::AddOccluders(OcclusionBuffer& occlusion, const DX::BoundingFrustum& frustum) {
+		std::vector<DXM::Vector3> positions;
+		const std::vector<DXM::Vector3>* vertices = &m_OccluderVertices;
+		const std::vector<uint32_t>* indices = &m_OccluderIndices;
+		if (m_OccluderIndices.empty()) {
+			positions.reserve(m_Vertices.size());
+			for (const Vertex& vertex : m_Vertices) positions.push_back(vertex.Position);
+			vertices = &positions;
+			indices = m_HasShadowIndices ? &m_ShadowIndices : &m_Indices; // triangles even for patch meshes
+		}
+		if (indices->empty()) return;
+
+		auto view = m_Instances.view<InstanceData, VisibilityData>();
+		view.each([&](auto entity, auto& instanceData, auto& visibility) {
+			if (!Overlaps(frustum, visibility)) return;
+			occlusion.AddOccluder(*vertices, *indices, instanceData.Transform);
+		});
+	}
+
+	void MeshBase::SortInstancesSpatially() {
+		auto group = m_Instances.group<InstanceData, VisibilityData>();
+		m_CullsSinceSort = 0;
+		m_SortedVersion = m_Version;
+		m_InstanceBlocks.clear();
+		if (group.size() == 0) return;
+
+		DXM::Vector3 lo(FLT_MAX, FLT_MAX, FLT_MAX), hi(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		for (auto e : group) {
+			const DXM::Matrix& transform = group.get<InstanceData>(e).Transform;
+			DXM::Vector3 position(transform._41, transform._42, transform._43);
+			lo = DXM::Vector3::Min(lo, position);
+			hi = DXM::Vector3::Max(hi, position);
+		}
+		DXM::Vector3 extent = hi - lo;
+		DXM::Vector3 scale(1023.f / (std::max)(extent.x, 1e-6f), 1023.f / (std::max)(extent.y, 1e-6f), 1023.f / (std::max)(extent.z, 1e-6f));
+		for (auto e : group) {
+			auto [instanceData, visibility] = group.get<InstanceData, VisibilityData>(e);
+			DXM::Vector3 cell = (DXM::Vector3(instanceData.Transform._41, instanceData.Transform._42, instanceData.Transform._43) - lo) * scale;
+			visibility.SortKey = DXM::MortonCode(static_cast<uint32_t>(cell.x), static_cast<uint32_t>(cell.y), static_cast<uint32_t>(cell.z));
+		}
+		// only dense arrays move, entities and so MeshInstance handles stay the same
+		group.sort<VisibilityData>([](const VisibilityData& a, const VisibilityData& b) { return a.SortKey < b.SortKey; });
+
+		const size_t count = group.size();
+		auto first = group.begin();
+		m_InstanceBlocks.resize((count + InstanceBlockSize - 1) / InstanceBlockSize);
+		for (size_t b = 0; b < m_InstanceBlocks.size(); ++b) {
+			const size_t begin = b * InstanceBlockSize;
+			const size_t end = (std::min)(begin + InstanceBlockSize, count);
+			DXM::Vector3 blockLo(FLT_MAX, FLT_MAX, FLT_MAX), blockHi(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+			for (size_t i = begin; i < end; ++i) {
+				const VisibilityData& visibility = group.get<VisibilityData>(first[i]);
+				DXM::Vector3 radius(visibility.Radius, visibility.Radius, visibility.Radius);
+				blockLo = DXM::Vector3::Min(blockLo, visibility.Centre - radius);
+				blockHi = DXM::Vector3::Max(blockHi, visibility.Centre + radius);
+			}
+			InstanceBlock& block = m_InstanceBlocks[b];
+			block.Centre = (blockLo + blockHi) * 0.5f;
+			block.Radius = 0.f;
+			for (size_t i = begin; i < end; ++i) {
+				const VisibilityData& visibility = group.get<VisibilityData>(first[i]);
+				block.Radius = (std::max)(block.Radius, DXM::Vector3::Distance(block.Centre, visibility.Centre) + visibility.Radius);
+			}
+		}
+	}
 
-			});
+	void MeshBase::RefreshSpatialOrder() {
+		if (m_SpatialOrder && (m_SortedVersion != m_Version || ++m_CullsSinceSort >= m_SpatialSortInterval)) {
+			SortInstancesSpatially();
+		}
 	}
 
+	// Calls fn(entity, instanceData, visibility, inside) for every instance in storage order until it returns false.
+	// In spatial order blocks outside the volume only clear their instances' ViewMask, fn isn't called for them
+	// and they don't count as tested. Blocks inside it are taken without testing, only blocks crossing the
+	// boundary test every instance. Blocks are ignored once m_Version moves past the sort.
+	template<typename Volume, typename Fn>
+	void MeshBase::CullInstances(const Volume& volume, Fn&& fn) {
+		auto group = m_Instances.group<InstanceData, VisibilityData>();
+		m_BlocksRejected = 0;
+		m_BlocksAccepted = 0;
+
+		m_CullingStats = CullingStats();
+		auto testInstance = [&](entt::entity e, int blockContainment) {
+			auto [instanceData, visibility] = group.get<InstanceData, VisibilityData>(e);
+			bool inside = blockContainment == DX::CONTAINS || (blockContainment == DX::INTERSECTS && Overlaps(volume, visibility));
+			++m_CullingStats.Tested;
+			if (inside) ++m_CullingStats.Visible;
+			if (m_TrackCullingGain) {
+				const DXM::Matrix& world = instanceData.Transform;
+				DX::BoundingSphere originSphere(DXM::Vector3(world._41, world._42, world._43), m_OriginRadius * DXM::MaxAxisScale(world));
+				if (volume.Contains(originSphere) != DX::DISJOINT) ++m_CullingStats.OriginSphereVisible;
+			}
+			return fn(e, instanceData, visibility, inside);
+		};
+
+		if (!m_SpatialOrder || m_InstanceBlocks.empty() || m_SortedVersion != m_Version) {
+			for (auto e : group) {
+				if (!testInstance(e, DX::INTERSECTS)) return;
+			}
+			return;
+		}
+
+		const size_t count = group.size();
+		auto first = group.begin();
+		for (size_t b = 0; b < m_InstanceBlocks.size(); ++b) {
+			const InstanceBlock& block = m_InstanceBlocks[b];
+			const int containment = volume.Contains(DX::BoundingSphere(block.Centre, block.Radius));
+			const size_t end = (std::min)((b + 1) * InstanceBlockSize, count);
+			if (containment == DX::DISJOINT) {
+				++m_BlocksRejected;
+				for (size_t i = b * InstanceBlockSize; i < end; ++i) group.get<VisibilityData>(first[i]).ViewMask = 0;
+				continue;
+			}
+			if (containment == DX::CONTAINS) ++m_BlocksAccepted;
 
+			for (size_t i = b * InstanceBlockSize; i < end; ++i) {
+				if (!testInstance(first[i], containment)) return;
+			}
+		}
+	}
 
+	void MeshBase::UpdateVisibleInstances(const DX::BoundingFrustum& frustum, const OcclusionBuffer* occlusion, DepthOrder order) {
+		m_ViewNearest[0] = FLT_MAX;
+		m_ClusterDrawsActive = false;
+		m_ClusterDraws.clear();
+		m_ClusterInstances.clear();
+		m_ClusterStats = MeshletCullStats();
 
-	void MeshBase::UpdateVisibleInstances(const DX::BoundingFrustum& frustum) {
+		RefreshSpatialOrder();
 
 		auto instanceCount = GetInstanceCount();
 		if (!instanceCount)
@@ -151,24 +590,29 @@ namespace DXE
 
 		UINT visibleCount = 0;
 		auto maxSize = m_InstanceBuffer->Size();
-		// Count visible instances first
-		auto group = m_Instances.group<InstanceData, VisibilityData>();
-		for (auto e : group) {
-			auto& instanceData = group.get<InstanceData>(e);
-			auto& visibility = group.get<VisibilityData>(e);
-
-			DXM::Vector3 position(
-				instanceData.Transform._41,
-				instanceData.Transform._42,
-				instanceData.Transform._43);
-
-
-			if (DXM::IsInsideFrustum(frustum, position, visibility.Radius)) {
+		const bool sorted = order != DepthOrder::None;
+		const bool clustered = m_ClusterCulling && !m_Meshlets.IsEmpty();
+		m_SortedInstances.clear();
+		m_SortedDepths.clear();
+		CullInstances(frustum, [&](entt::entity e, InstanceData& instanceData, VisibilityData& visibility, bool inside) {
+			if (inside && occlusion && !occlusion->IsVisible(visibility.Box)) {
+				--m_CullingStats.Visible;
+				inside = false;
+			}
+			if (inside) {
 				if (visibleCount >= maxSize) {
 					DXE_LOG("InstanceBuffer size exceeded");
-					return;
+					return false;
 				}
-
+				if (sorted) {
+					// written below once the order is known
+					m_SortedInstances.push_back(e);
+					m_SortedDepths.push_back(InstanceDepth(visibility, frustum.Origin));
+					++visibleCount;
+					visibility.ViewMask = 1;
+					return true;
+				}
+				if (clustered && m_ClusterInstances.size() <= m_ClusterInstanceLimit) m_ClusterInstances.push_back(e);
 
 				gpuData[visibleCount].Transform = instanceData.Transform.Transpose();
 				gpuData[visibleCount].Color = instanceData.Color;
@@ -181,20 +625,42 @@ namespace DXE
 
 				++visibleCount;
 
-				visibility.VisibleCamera = true;
+				visibility.ViewMask = 1;
 			}
 			else {
-				visibility.VisibleCamera = false;
+				visibility.ViewMask = 0;
+			}
+			return true;
+		});
+
+		if (sorted && !m_SortedInstances.empty()) {
+			m_ViewNearest[0] = SortByDepth(m_SortedInstances, m_SortedDepths, order);
+			InstanceData* out = gpuData;
+			for (entt::entity e : m_SortedInstances) {
+				const InstanceData& instanceData = m_Instances.get<InstanceData>(e);
+				out->Transform = instanceData.Transform.Transpose();
+				out->Color = instanceData.Color;
+				out->InvTransform = DXM::Matrix::Identity - DXM::Matrix::Identity;
+				++out;
 			}
-
 		}
 
 
 		m_InstanceBuffer->Unmap();
 		m_VisibleInstanceCount = visibleCount;
+
+		if (clustered && visibleCount && visibleCount <= m_ClusterInstanceLimit) {
+			const std::vector<entt::entity>& instances = sorted ? m_SortedInstances : m_ClusterInstances;
+			for (uint32_t i = 0; i < visibleCount; ++i) {
+				m_Meshlets.Cull(frustum, m_Instances.get<InstanceData>(instances[i]).Transform, i, m_MaxClusterDraws, m_ClusterDraws, m_ClusterStats);
+			}
+			m_ClusterDrawsActive = true;
+		}
 	}
 
-	void MeshBase::UpdateVisibleInstances(const DX::BoundingOrientedBox& cullBox) {
+	template<typename Volume>
+	void MeshBase::UpdateShadowInstances(const Volume& volume) {
+		m_ClusterDrawsActive = false;
 
 		auto instanceCount = GetInstanceCount();
 		if (!instanceCount)
@@ -209,22 +675,11 @@ namespace DXE
 
 		UINT visibleCount = 0;
 		auto maxSize = m_InstanceBuffer->Size();
-		// Count visible instances first
-		auto group = m_Instances.group<InstanceData, VisibilityData>();
-		for (auto e : group) {
-			auto& instanceData = group.get<InstanceData>(e);
-			auto& visibility = group.get<VisibilityData>(e);
-
-			DXM::Vector3 position(
-				instanceData.Transform._41,
-				instanceData.Transform._42,
-				instanceData.Transform._43);
-
-
-			if ( DXM::IsInsideOrientedBox(cullBox, position, visibility.Radius)) {
+		CullInstances(volume, [&](entt::entity, InstanceData& instanceData, VisibilityData& visibility, bool inside) {
+			if (inside) {
 				if (visibleCount >= maxSize) {
 					DXE_LOG("InstanceBuffer size exceeded");
-					return;
+					return false;
 				}
 	
 				// Transpose directly into GPU buffer
@@ -233,49 +688,228 @@ namespace DXE
 				// Copy any other fields if necessary
 				gpuData[visibleCount].Color = instanceData.Color;
 				
-				DXM::Matrix& world = instanceData.Transform;
-				// Extract rotation+scale
-				float m00 = world._11, m01 = world._12, m02 = world._13;
-				float m10 = world._21, m11 = world._22, m12 = world._23;
-				float m20 = world._31, m21 = world._32, m22 = world._33;
-
-				// Compute 3x3 determinant
-				float det = m00 * (m11 * m22 - m12 * m21) - m01 * (m10 * m22 - m12 * m20) + m02 * (m10 * m21 - m11 * m20);
-				if (fabs(det) < 1e-6f) det = 1.f; // avoid div by zero
-
-				float invDet = 1.f / det;
-
-				// Compute inverse 3x3
-				float i00 = (m11 * m22 - m12 * m21) * invDet;
-				float i01 = -(m01 * m22 - m02 * m21) * invDet;
-				float i02 = (m01 * m12 - m02 * m11) * invDet;
-
-				float i10 = -(m10 * m22 - m12 * m20) * invDet;
-				float i11 = (m00 * m22 - m02 * m20) * invDet;
-				float i12 = -(m00 * m12 - m02 * m10) * invDet;
-
-				float i20 = (m10 * m21 - m11 * m20) * invDet;
-				float i21 = -(m00 * m21 - m01 * m20) * invDet;
-				float i22 = (m00 * m11 - m01 * m10) * invDet;
-
-				// Transpose -> normal matrix
-				gpuData[visibleCount].InvTransform = DXM::Matrix(
-					i00, i10, i20, 0.f,
-					i01, i11, i21, 0.f,
-					i02, i12, i22, 0.f,
-					0.f, 0.f, 0.f, 1.f
-				);
+				gpuData[visibleCount].InvTransform = NormalMatrix(instanceData.Transform);
 
 				++visibleCount;
-				visibility.VisibleLight = true;
+				visibility.ViewMask = 1;
 			}
 			else {
-				visibility.VisibleLight = false;
+				visibility.ViewMask = 0;
 			}
+			return true;
+		});
 
+		m_InstanceBuffer->Unmap();
+		m_VisibleInstanceCount = visibleCount;
+	}
+
+	void MeshBase::UpdateVisibleInstances(const DX::BoundingOrientedBox& cullBox) {
+		UpdateShadowInstances(cullBox);
+	}
+
+	void MeshBase::UpdateVisibleInstances(const ShadowCasterVolume& casters) {
+		UpdateShadowInstances(casters);
+	}
+
+	void MeshBase::UpdateVisibleInstances(std::span<const CullView> views) {
+		m_ClusterDrawsActive = false;
+		const int viewCount = static_cast<int>((std::min)(views.size(), static_cast<size_t>(MaxCullViews)));
+		uint32_t activeViews = 0;
+		for (int v = 0; v < viewCount; ++v) {
+			if ((!views[v].CastersOnly || m_CastsShadow) && (!views[v].StaticOnly || m_Static)) activeViews |= 1u << v;
+		}
+		uint32_t occludedViews = 0, orderedViews = 0;
+		for (int v = 0; v < viewCount; ++v) {
+			if (views[v].Occlusion) occludedViews |= 1u << v;
+			if (views[v].Order != DepthOrder::None) orderedViews |= 1u << v;
+		}
+		for (auto& list : m_ViewInstances) list.clear();
+		for (auto& depths : m_ViewDepths) depths.clear();
+		m_ViewNearest.fill(FLT_MAX);
+		m_ViewCounts.fill(0);
+		m_ViewOffsets.fill(0);
+		m_VisibleInstanceCount = 0;
+		m_CullingStats = CullingStats();
+		m_BlocksRejected = 0;
+		m_BlocksAccepted = 0;
+
+		RefreshSpatialOrder();
+
+		auto group = m_Instances.group<InstanceData, VisibilityData>();
+		const size_t count = group.size();
+		if (!count) return;
+
+		// inside: views that take the instance without a test, test: views that test it
+		auto cullInstance = [&](entt::entity e, uint32_t inside, uint32_t test) {
+			auto [instanceData, visibility] = group.get<InstanceData, VisibilityData>(e);
+			uint32_t mask = inside;
+			for (uint32_t bits = test; bits; bits &= bits - 1) {
+				int v = std::countr_zero(bits);
+				if (Overlaps(views[v], visibility)) mask |= 1u << v;
+			}
+			for (uint32_t bits = mask & occludedViews; bits; bits &= bits - 1) {
+				int v = std::countr_zero(bits);
+				if (!views[v].Occlusion->IsVisible(visibility.Box)) mask &= ~(1u << v);
+			}
+			visibility.ViewMask = static_cast<uint8_t>(mask);
+			for (uint32_t bits = mask; bits; bits &= bits - 1) {
+				int v = std::countr_zero(bits);
+				m_ViewInstances[v].push_back(e);
+				if (orderedViews & (1u << v)) m_ViewDepths[v].push_back(InstanceDepth(visibility, views[v].SortOrigin));
+			}
+
+			++m_CullingStats.Tested;
+			if (mask & 1u) ++m_CullingStats.Visible;
+			if (m_TrackCullingGain && (activeViews & 1u)) {
+				const DXM::Matrix& world = instanceData.Transform;
+				DX::BoundingSphere originSphere(DXM::Vector3(world._41, world._42, world._43), m_OriginRadius * DXM::MaxAxisScale(world));
+				if (views[0].Contains(originSphere) != DX::DISJOINT) ++m_CullingStats.OriginSphereVisible;
+			}
+		};
+
+		if (!m_SpatialOrder || m_InstanceBlocks.empty() || m_SortedVersion != m_Version) {
+			for (auto e : group) cullInstance(e, 0u, activeViews);
+		}
+		else {
+			auto first = group.begin();
+			for (size_t b = 0; b < m_InstanceBlocks.size(); ++b) {
+				const InstanceBlock& block = m_InstanceBlocks[b];
+				const DX::BoundingSphere sphere(block.Centre, block.Radius);
+				uint32_t inside = 0, test = 0;
+				for (uint32_t bits = activeViews; bits; bits &= bits - 1) {
+					int v = std::countr_zero(bits);
+					DX::ContainmentType containment = views[v].Contains(sphere);
+					if (containment == DX::CONTAINS) inside |= 1u << v;
+					else if (containment == DX::INTERSECTS) test |= 1u << v;
+				}
+				if (!((inside | test) & 1u)) ++m_BlocksRejected;
+				else if (inside & 1u) ++m_BlocksAccepted;
+
+				const size_t end = (std::min)((b + 1) * InstanceBlockSize, count);
+				if (!(inside | test)) {
+					// outside every view
+					for (size_t i = b * InstanceBlockSize; i < end; ++i) group.get<VisibilityData>(first[i]).ViewMask = 0;
+					continue;
+				}
+				for (size_t i = b * InstanceBlockSize; i < end; ++i) cullInstance(first[i], inside, test);
+			}
 		}
 
+		for (int v = 0; v < viewCount; ++v) {
+			if (views[v].Order != DepthOrder::None && !m_ViewInstances[v].empty()) {
+				m_ViewNearest[v] = SortByDepth(m_ViewInstances[v], m_ViewDepths[v], views[v].Order);
+			}
+		}
+
+		// Every view's list back to back in the instance buffer, one Map for all of them
+		uint32_t total = 0;
+		for (int v = 0; v < viewCount; ++v) {
+			m_ViewOffsets[v] = total;
+			m_ViewCounts[v] = static_cast<uint32_t>(m_ViewInstances[v].size());
+			total += m_ViewCounts[v];
+		}
+		if (!total) return;
+		if (m_InstanceBuffer->Size() < total) {
+			m_InstanceBuffer->Resize(total);
+			DXE_LOG("InstanceBuffer resized");
+		}
+		InstanceData* gpuData = m_InstanceBuffer->Map();
+		if (!gpuData) {
+			m_ViewCounts.fill(0);
+			return;
+		}
+		for (int v = 0; v < viewCount; ++v) {
+			InstanceData* out = gpuData + m_ViewOffsets[v];
+			for (entt::entity e : m_ViewInstances[v]) {
+				const InstanceData& instanceData = group.get<InstanceData>(e);
+				out->Transform = instanceData.Transform.Transpose();
+				out->Color = instanceData.Color;
+				out->InvTransform = NormalMatrix(instanceData.Transform);
+				++out;
+			}
+		}
 		m_InstanceBuffer->Unmap();
-		m_VisibleInstanceCount = visibleCount;
+		m_VisibleInstanceCount = total;
+	}
+
+	// One counting pass over DepthBuckets buckets spread across the distance range of the list, coarse but
+	// enough for early Z and a single scatter keeps it cheap
+	float MeshBase::SortByDepth(std::vector<entt::entity>& entities, const std::vector<float>& depths, DepthOrder order) {
+		const size_t count = entities.size();
+		float nearest = FLT_MAX, farthest = 0.f;
+		for (float depth : depths) {
+			nearest = (std::min)(nearest, depth);
+			farthest = (std::max)(farthest, depth);
+		}
+
+		m_DepthKeys.resize(count);
+		m_DepthSortScratch.resize(count);
+		const float scale = farthest > nearest ? (DepthBuckets - 1) / (farthest - nearest) : 0.f;
+		const uint32_t flip = order == DepthOrder::BackToFront ? DepthBuckets - 1 : 0u;
+		std::array<uint32_t, DepthBuckets> histogram{};
+		for (size_t i = 0; i < count; ++i) {
+			uint16_t key = static_cast<uint16_t>(static_cast<uint32_t>((depths[i] - nearest) * scale) ^ flip);
+			m_DepthKeys[i] = key;
+			++histogram[key];
+		}
+		uint32_t sum = 0;
+		for (uint32_t& bucket : histogram) {
+			uint32_t n = bucket;
+			bucket = sum;
+			sum += n;
+		}
+		for (size_t i = 0; i < count; ++i) m_DepthSortScratch[histogram[m_DepthKeys[i]]++] = entities[i];
+		entities.swap(m_DepthSortScratch);
+		return nearest;
+	}
+
+	bool MeshBase::BenchmarkDepthSort(int count, double budgetMs) {
+		count = (std::max)(count, 1);
+		MeshBase mesh("DepthSortBenchmark", ScratchTriangle(), { 0, 1, 2 });
+		const std::vector<InstanceData> data = GridInstances(count);
+		std::vector<entt::entity> entities(count);
+		mesh.CreateInstances(data, entities);
+		std::shuffle(entities.begin(), entities.end(), std::mt19937(7));
+		const DXM::Vector3 origin(512.f, -50.f, 10.f);
+		std::vector<float> depths(count);
+		for (int i = 0; i < count; ++i) depths[i] = InstanceDepth(mesh.m_Instances.get<VisibilityData>(entities[i]), origin);
+
+		auto start = std::chrono::high_resolution_clock::now();
+		const float nearest = mesh.SortByDepth(entities, depths, DepthOrder::FrontToBack);
+		const double ms = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count() * 1000.0;
+
+		// Buckets are coarse, each depth may sit up to one bucket below the one before it
+		int errors = 0;
+		const auto [minDepth, maxDepth] = std::minmax_element(depths.begin(), depths.end());
+		const float bucket = (*maxDepth - *minDepth) / (DepthBuckets - 1);
+		if (nearest != *minDepth) ++errors;
+		float previous = -FLT_MAX;
+		for (entt::entity e : entities) {
+			const float depth = InstanceDepth(mesh.m_Instances.get<VisibilityData>(e), origin);
+			if (depth < previous - bucket) {
+				++errors;
+				break;
+			}
+			previous = (std::max)(previous, depth);
+		}
+		if (static_cast<int>(entities.size()) != count) ++errors;
+
+		DXE_INFO("Depth sort of ", count, " instances: ", ms, "ms, budget ", budgetMs, "ms");
+		if (errors) DXE_ERROR("Depth sort benchmark: ", errors, " ordering checks failed");
+		if (ms > budgetMs) DXE_WARN("Depth sort benchmark: ", ms, "ms is over the ", budgetMs, "ms budget");
+		return errors == 0 && ms <= budgetMs;
+	}
+
+	bool MeshBase::GetViewDepthRange(int view, const DXM::Vector3& origin, const DXM::Vector3& direction, float& nearest, float& farthest) const {
+		if (m_ViewInstances[view].empty()) return false;
+		nearest = FLT_MAX;
+		farthest = -FLT_MAX;
+		for (entt::entity e : m_ViewInstances[view]) {
+			const VisibilityData& visibility = m_Instances.get<VisibilityData>(e);
+			float depth = (visibility.Centre - origin).Dot(direction);
+			nearest = (std::min)(nearest, depth - visibility.Radius);
+			farthest = (std::max)(farthest, depth + visibility.Radius);
+		}
+		return true;
 	}
-}
\ No newline at end of file
+}
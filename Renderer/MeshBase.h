@@ -2,9 +2,15 @@
 #include "DXE.h"
 
 #include "Material.h"
+#include <array>
 #include <memory>
+#include <span>
 #include "Scene/entt.hpp"
 #include "Buffer.h"	   // contains FULL DEFINITION OF InstanceData
+#include "MeshBufferPool.h"
+#include "ShadowCasterVolume.h"
+#include "OcclusionBuffer.h"
+#include "Meshlets.h"
 //#include "Maths/Maths.h"
 namespace DXE
 {
@@ -17,9 +23,68 @@ namespace DXE
 		VisibilityData& operator=(const VisibilityData&) = default;
 		VisibilityData(float radius)
 			: Radius(radius){}
+		// World space bounds, kept by MeshBase::CalculateInstanceBounds
+		DXM::Vector3 Centre;
+		float Radius = 0.f;
+		DX::BoundingBox Box;
+		bool UseBox = false; // the box encloses less volume than the sphere
+		uint8_t ViewMask = 0; // bit per view of the last cull, single view culls use bit 0
+		uint32_t SortKey = 0; // Morton code of the position when spatially ordered
+		uint32_t TransformHash = 0; // of the transform the bounds came from, to notice moved instances
+	};
+
+	// Optional order of a view's visible instances. Front to back lets early Z reject hidden pixels of opaque
+	// passes, back to front suits transparent ones.
+	enum class DepthOrder : uint8_t {
+		None,
+		FrontToBack,
+		BackToFront
+	};
+
+	// A camera frustum, an ortho shadow box or a shadow caster volume for MeshBase::UpdateVisibleInstances(views)
+	struct CullView {
+		CullView() = default;
+		CullView(const DX::BoundingFrustum& frustum, bool castersOnly = false) : Frustum(frustum), IsBox(false), CastersOnly(castersOnly), SortOrigin(frustum.Origin) {}
+		CullView(const DX::BoundingOrientedBox& box, bool castersOnly = true) : Box(box), IsBox(true), CastersOnly(castersOnly) {}
+		// The volume is referenced, it has to outlive the cull
+		CullView(const ShadowCasterVolume& casters, bool castersOnly = true) : Casters(&casters), CastersOnly(castersOnly) {}
+
+		template<typename Bounds>
+		DX::ContainmentType Contains(const Bounds& bounds) const {
+			if (Casters) return Casters->Contains(bounds);
+			return IsBox ? Box.Contains(bounds) : Frustum.Contains(bounds);
+		}
+
+		DX::BoundingFrustum Frustum;
+		DX::BoundingOrientedBox Box;
+		const ShadowCasterVolume* Casters = nullptr;
+		bool IsBox = false;
+		bool CastersOnly = false; // meshes with m_CastsShadow off leave this view empty
+		bool StaticOnly = false;  // meshes with m_Static off leave this view empty
+		const OcclusionBuffer* Occlusion = nullptr; // rasterised for this view, instances it hides are dropped
+		DepthOrder Order = DepthOrder::None;
+		DXM::Vector3 SortOrigin; // the frustum origin for frustum views
+	};
+	static constexpr int MaxCullViews = 8;
+
+	struct CullingStats {
+		uint32_t Tested = 0; // instances culled one by one, those in rejected spatial blocks aren't counted
+		uint32_t Visible = 0;
+		// instances a sphere around the mesh origin would have let through, counted with m_TrackCullingGain
+		uint32_t OriginSphereVisible = 0;
+
+		CullingStats& operator+=(const CullingStats& other) {
+			Tested += other.Tested;
+			Visible += other.Visible;
+			OriginSphereVisible += other.OriginSphereVisible;
+			return *this;
+		}
+	};
+
+	// Bounding sphere around InstanceBlockSize consecutive instances in spatial order
+	struct InstanceBlock {
+		DXM::Vector3 Centre;
 		float Radius = 0.f;
-		bool VisibleCamera = false;
-		bool VisibleLight = false;
 	};
 
 
@@ -30,14 +95,28 @@ namespace DXE
 			m_Name(name),
 			m_Vertices(vertices),
 			m_Indices(indices),
-			m_VertexBuffer(std::make_shared<VertexBuffer>(vertices, indices)),
-			m_IndexBuffer(std::make_shared<IndexBuffer>(indices)),
 			m_InstanceBuffer(std::make_shared<InstanceBuffer>()) {
-			CalculateBoundingRadius();
+			CalculateBounds();
+			AllocateBuffers();
 		}
+		~MeshBase();
 
 		std::shared_ptr<MeshInstance> CreateInstance(const InstanceData& data = InstanceData());
 		void DestroyInstance(std::shared_ptr<MeshInstance> instance);
+		// Bulk versions: storage is reserved once and every component is inserted as one range, the returned
+		// MeshInstance handles are plain values in data order
+		std::vector<MeshInstance> CreateInstances(std::span<const InstanceData> data);
+		void CreateInstances(std::span<const InstanceData> data, std::span<entt::entity> entities);
+		// Handles of other meshes, stale and repeated handles are skipped
+		void DestroyInstances(std::span<const MeshInstance> instances);
+		// Entities must be live instances of this mesh
+		void DestroyInstances(std::span<const entt::entity> entities);
+		// Destroys every instance, handles to them go stale
+		void ClearInstances();
+
+		// Creates and destroys count instances of a scratch mesh through CreateInstance / DestroyInstance and
+		// the bulk functions, logs both timings. Returns whether the instance counts and handles checked out.
+		static bool BenchmarkInstances(int count = 100000);
 
 
 		std::string m_Name;
@@ -48,7 +127,9 @@ namespace DXE
 
 		std::vector<uint32_t> m_ShadowIndices;
 
-		std::shared_ptr<VertexBuffer> m_VertexBuffer;
+		// Range of the shared mesh buffers holding m_Vertices and m_Indices, see MeshBufferPool
+		uint32_t m_BufferHandle = MeshBufferPool::InvalidHandle;
+		// m_ShadowIndices of patch meshes, uploaded by BindShadowIndexBuffer after m_GeometryVersion or their count change
 		std::shared_ptr<IndexBuffer> m_IndexBuffer;
 		std::shared_ptr<InstanceBuffer> m_InstanceBuffer;
 
@@ -60,9 +141,37 @@ namespace DXE
 		bool m_HasShadowIndices = false;
 
 		bool m_CastsShadow = true;
+		bool m_Static = false; // neither the mesh nor its instances move, drawn into cached shadow cascades
+		bool m_Batched = false; // set by StaticBatcher, camera passes draw its batches instead of this mesh
+
+		// Instances of occluder meshes are rasterised by RenderManager::BuildOcclusion. Low poly stand ins
+		// from SetOccluderGeometry are used when given, the render geometry otherwise.
+		bool m_Occluder = false;
+		std::vector<DXM::Vector3> m_OccluderVertices;
+		std::vector<uint32_t> m_OccluderIndices;
+		void SetOccluderGeometry(std::vector<DXM::Vector3> vertices, std::vector<uint32_t> indices);
+		void AddOccluders(OcclusionBuffer& occlusion, const DX::BoundingFrustum& frustum);
+
+		// Bumped when the geometry, the instance set or an instance transform changes, cached shadow maps
+		// compare it to skip redraws. Transforms written through MeshInstance are noticed by the next
+		// CalculateInstanceBounds, MarkChanged covers anything else that moves the shadow.
+		uint64_t m_Version = 0;
+		void MarkChanged() { ++m_Version; }
+		// Bumped by UpdateMeshData only, instance changes leave it alone. Call MarkGeometryChanged after writing
+		// m_ShadowIndices directly so BindShadowIndexBuffer uploads them again.
+		uint64_t m_GeometryVersion = 0;
+		void MarkGeometryChanged() { ++m_GeometryVersion; ++m_Version; }
 		bool m_CullOutsideFrustrum = true;
 		uint32_t m_VisibleInstanceCount = 0;
+
+		// Mesh space bounds: the vertex AABB and a near minimal sphere around m_BoundingCentre
+		DX::BoundingBox m_LocalBounds;
+		DXM::Vector3 m_BoundingCentre;
 		float m_BoundingRadius = 0.0f;
+		float m_OriginRadius = 0.0f; // farthest vertex from the mesh origin
+
+		bool m_TrackCullingGain = false;
+		CullingStats m_CullingStats; // last cull
 
 		int GetInstanceCount();
 		int GetVisibleInstanceCount();
@@ -71,16 +180,119 @@ namespace DXE
 		void SetMaterial(std::shared_ptr<Material> material);
 		std::shared_ptr<Material> GetMaterial() const;
 		void UpdateMeshData(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices);
+		// Replaces vertices only, the index buffer is left as is
+		void UpdateVertices(std::vector<Vertex>&& vertices);
 
+		// Binds the pool arena holding the mesh, draws start at GetFirstIndex and GetBaseVertex
 		void BindVertexBuffer(int slot);
 		void BindInstanceBuffer(int slot);
+		UINT GetFirstIndex() const;
+		INT GetBaseVertex() const;
+		// Binds m_ShadowIndices as the index buffer, draw them from index 0 with GetBaseVertex
+		void BindShadowIndexBuffer();
+
+		// Packed position only or position and UV copy of m_Vertices for shadow and depth passes, rebuilt by
+		// UpdateMeshData and UpdateVertices. Full removes it. The shadow path binds it whenever the depth shader
+		// reads no more than it holds (Shader::GetVertexStream).
+		void SetDepthStream(VertexStream stream);
+		VertexStream GetDepthStream() const { return m_DepthVertexBuffer ? m_DepthVertexBuffer->GetStream() : VertexStream::Full; }
+		// Whether the depth stream holds every input of a shader reading stream
+		bool HasDepthStream(VertexStream stream) const { return stream != VertexStream::Full && GetDepthStream() >= stream; }
+		// Binds the depth stream to slot and the index buffer, draw it with a base vertex of 0
+		void BindDepthVertexBuffer(int slot);
+		std::shared_ptr<DepthVertexBuffer> m_DepthVertexBuffer;
 
-		void CalculateBoundingRadius();
-		void CalculateInstanceBoundingRadius();
+		void CalculateBounds();
+		// For meshes displaced in the vertex shader, replaces the bounds taken from the vertices
+		void SetLocalBounds(const DX::BoundingBox& bounds);
+		// Refreshes the world bounds of instances whose transform changed since the last call
+		void CalculateInstanceBounds();
+		VisibilityData CalculateVisibility(const InstanceData& instance) const;
 
 		void UpdateInstances();
 		void UpdateVisibleInstances(const DX::BoundingOrientedBox& cullBox);
-		void UpdateVisibleInstances(const DX::BoundingFrustum& frustum);
+		void UpdateVisibleInstances(const ShadowCasterVolume& casters);
+		// Instances hidden in occlusion are dropped as well, its stats count the tests. order sorts the
+		// visible instances by distance from the frustum origin before upload.
+		void UpdateVisibleInstances(const DX::BoundingFrustum& frustum, const OcclusionBuffer* occlusion = nullptr, DepthOrder order = DepthOrder::None);
+		// Tests every instance against up to MaxCullViews views in one walk over the storage, sets
+		// VisibilityData::ViewMask and fills one compacted entity list per view. The lists are uploaded
+		// back to back with a single Map, draw view v with GetViewInstanceCount(v) instances starting at
+		// GetViewInstanceOffset(v). The cull statistics and spatial order follow view 0.
+		void UpdateVisibleInstances(std::span<const CullView> views);
+		uint32_t GetViewInstanceCount(int view) const { return m_ViewCounts[view]; }
+		uint32_t GetViewInstanceOffset(int view) const { return m_ViewOffsets[view]; }
+		const std::vector<entt::entity>& GetViewInstances(int view) const { return m_ViewInstances[view]; }
+		// Distance to the nearest visible instance of a depth ordered view, FLT_MAX when unordered or empty.
+		// The single frustum cull uses view 0.
+		float GetViewNearestDepth(int view) const { return m_ViewNearest[view]; }
+		// Depth orders count shuffled instances of a scratch mesh and logs the time. Returns whether the order
+		// checked out and the sort fit in budgetMs.
+		static bool BenchmarkDepthSort(int count = 100000, double budgetMs = 0.2);
+		// Extent of the instances of the last cull of view along direction, measured from origin. False when none.
+		bool GetViewDepthRange(int view, const DXM::Vector3& origin, const DXM::Vector3& direction, float& nearest, float& farthest) const;
+
+		// Cluster culling splits the mesh into meshlets and rewrites m_Indices in meshlet order. The frustum cull
+		// then also culls the meshlets of each visible instance when there are at most m_ClusterInstanceLimit of
+		// them, and the camera draws the surviving index ranges, at most m_MaxClusterDraws per instance.
+		// For big triangle list meshes with few instances, meshes with shadow indices are left whole.
+		uint32_t m_ClusterInstanceLimit = 4;
+		uint32_t m_MaxClusterDraws = 32;
+		MeshletCullStats m_ClusterStats; // last frustum cull
+		void SetClusterCulling(bool enable);
+		bool GetClusterCulling() const { return m_ClusterCulling; }
+		const MeshletSet& GetMeshlets() const { return m_Meshlets; }
+		// Set by the last frustum cull when it culled meshlets, draw these ranges instead of whole instances
+		bool HasClusterDraws() const { return m_ClusterDrawsActive; }
+		const std::vector<MeshletDraw>& GetClusterDraws() const { return m_ClusterDraws; }
+
+		// Spatial order keeps instance storage sorted by the Morton code of each position, so culling walks
+		// memory in order and visible neighbours land next to each other in the instance buffer. Handles stay
+		// valid. The frustum cull re-sorts every m_SpatialSortInterval calls or when m_Version changed since the
+		// sort, and tests one sphere per block first: blocks outside are skipped, blocks inside are taken whole.
+		// Other culls test every instance while the blocks are out of date.
+		static constexpr size_t InstanceBlockSize = 64;
+		bool m_SpatialOrder = false;
+		int m_SpatialSortInterval = 120;
+		std::vector<InstanceBlock> m_InstanceBlocks;
+		uint32_t m_BlocksRejected = 0; // during the last cull
+		uint32_t m_BlocksAccepted = 0;
+		void SortInstancesSpatially();
+
+	private:
+		template<typename Volume, typename Fn>
+		void CullInstances(const Volume& volume, Fn&& fn);
+		template<typename Volume>
+		void UpdateShadowInstances(const Volume& volume);
+		// Reorders entities by their depths, taken during the cull, returns the nearest depth
+		static constexpr uint32_t DepthBuckets = 4096;
+		float SortByDepth(std::vector<entt::entity>& entities, const std::vector<float>& depths, DepthOrder order);
+
+		std::vector<uint16_t> m_DepthKeys;
+		std::vector<entt::entity> m_DepthSortScratch;
+		std::vector<entt::entity> m_SortedInstances; // single frustum cull
+		std::vector<float> m_SortedDepths;
+		std::array<std::vector<float>, MaxCullViews> m_ViewDepths;
+		std::array<float, MaxCullViews> m_ViewNearest{};
+
+		void BuildMeshlets();
+		void AllocateBuffers();
+		bool m_InstanceBoundsStale = true; // the mesh bounds changed, every instance's bounds are recomputed
+		uint64_t m_ShadowIndicesVersion = UINT64_MAX; // m_GeometryVersion of the last upload
+
+		bool m_ClusterCulling = false;
+		MeshletSet m_Meshlets;
+		std::vector<entt::entity> m_ClusterInstances; // visible in buffer order, while within the limit
+		std::vector<MeshletDraw> m_ClusterDraws;
+		bool m_ClusterDrawsActive = false;
+
+		void RefreshSpatialOrder();
+		int m_CullsSinceSort = 0;
+		uint64_t m_SortedVersion = UINT64_MAX; // m_Version the blocks were built for
+
+		std::array<std::vector<entt::entity>, MaxCullViews> m_ViewInstances;
+		std::array<uint32_t, MaxCullViews> m_ViewCounts{};
+		std::array<uint32_t, MaxCullViews> m_ViewOffsets{};
 
 	};
 
@@ -0,0 +1,446 @@
+#include "pch.h"
+#include "MeshBufferPool.h"
+#include "Renderer.h"
+#include "Logger.h"
+#include <algorithm>
+#include <chrono>
+#include <iterator>
+#include <random>
+
+namespace DXE
+{
+	RangeAllocator::RangeAllocator(uint32_t capacity)
+		: m_Capacity(capacity), m_Free(capacity)
+	{
+		if (capacity) Insert(0, capacity);
+	}
+
+	void RangeAllocator::Insert(uint32_t offset, uint32_t size) {
+		m_ByOffset.emplace(offset, size);
+		m_BySize.emplace(size, offset);
+	}
+
+	void RangeAllocator::EraseSize(uint32_t offset, uint32_t size) {
+		auto [it, end] = m_BySize.equal_range(size);
+		for (; it != end; ++it) {
+			if (it->second == offset) {
+				m_BySize.erase(it);
+				return;
+			}
+		}
+	}
+
+	uint32_t RangeAllocator::Allocate(uint32_t count) {
+		if (!count) return 0;
+		auto it = m_BySize.lower_bound(count);
+		if (it == m_BySize.end()) return InvalidOffset;
+		const uint32_t size = it->first, offset = it->second;
+		m_BySize.erase(it);
+		m_ByOffset.erase(offset);
+		if (size > count) Insert(offset + count, size - count);
+		m_Free -= count;
+		return offset;
+	}
+
+	uint32_t RangeAllocator::AllocateBelow(uint32_t count, uint32_t limit) {
+		if (!count) return 0;
+		// A free block never overlaps an allocated range, so one starting below limit ends below it as well
+		for (auto it = m_ByOffset.begin(); it != m_ByOffset.end() && it->first < limit; ++it) {
+			if (it->second < count) continue;
+			const uint32_t offset = it->first, size = it->second;
+			EraseSize(offset, size);
+			m_ByOffset.erase(it);
+			if (size > count) Insert(offset + count, size - count);
+			m_Free -= count;
+			return offset;
+		}
+		return InvalidOffset;
+	}
+
+	void RangeAllocator::Free(uint32_t offset, uint32_t count) {
+		if (!count) return;
+		m_Free += count;
+		auto next = m_ByOffset.lower_bound(offset);
+		if (next != m_ByOffset.end() && offset + count == next->first) {
+			count += next->second;
+			EraseSize(next->first, next->second);
+			next = m_ByOffset.erase(next);
+		}
+		if (next != m_ByOffset.begin()) {
+			auto previous = std::prev(next);
+			if (previous->first + previous->second == offset) {
+				offset = previous->first;
+				count += previous->second;
+				EraseSize(previous->first, previous->second);
+				m_ByOffset.erase(previous);
+			}
+		}
+		Insert(offset, count);
+	}
+
+	bool RangeAllocator::Benchmark(int operations) {
+		constexpr uint32_t capacity = 1u << 24;
+		RangeAllocator allocator(capacity);
+		std::mt19937 rng(7);
+		std::uniform_int_distribution<uint32_t> sizes(64, 16384);
+		std::vector<std::pair<uint32_t, uint32_t>> live;
+		int failed = 0;
+
+		auto start = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < operations; ++i) {
+			// Mostly allocating until the allocator is about three quarters full, then churning
+			const bool allocate = live.empty() || (rng() % 100) < (allocator.GetFree() > capacity / 4 ? 60u : 45u);
+			if (allocate) {
+				const uint32_t count = sizes(rng);
+				const uint32_t offset = allocator.Allocate(count);
+				if (offset == InvalidOffset) ++failed;
+				else live.emplace_back(offset, count);
+			}
+			else {
+				const size_t index = rng() % live.size();
+				allocator.Free(live[index].first, live[index].second);
+				live[index] = live.back();
+				live.pop_back();
+			}
+		}
+		const double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+		int errors = 0;
+		std::sort(live.begin(), live.end());
+		uint32_t used = 0;
+		for (size_t i = 0; i < live.size(); ++i) {
+			used += live[i].second;
+			if (live[i].first + live[i].second > capacity) ++errors;
+			if (i && live[i - 1].first + live[i - 1].second > live[i].first) ++errors;
+		}
+		if (used + allocator.GetFree() != capacity) ++errors;
+		const uint32_t freeBlocks = allocator.GetFreeBlockCount();
+		const float fragmentation = allocator.GetFree() ? 1.f - static_cast<float>(allocator.GetLargestFree()) / allocator.GetFree() : 0.f;
+
+		for (const auto& range : live) allocator.Free(range.first, range.second);
+		if (allocator.GetFreeBlockCount() != 1 || allocator.GetLargestFree() != capacity) ++errors;
+
+		DXE_INFO("RangeAllocator benchmark: ", operations, " operations in ", seconds * 1000.0, "ms, ", live.size(), " ranges live using ",
+			100.f * used / capacity, "%, ", freeBlocks, " free blocks, ", 100.f * fragmentation, "% fragmented, ", failed, " allocations failed");
+		if (errors) DXE_ERROR("RangeAllocator benchmark: ", errors, " errors");
+		return errors == 0;
+	}
+
+
+	MeshBufferPool::MeshBufferPool(const MeshBufferPoolSettings& settings)
+		: m_Settings(settings)
+	{
+	}
+
+	uint32_t MeshBufferPool::Reserve(uint32_t count) const {
+		if (!count) return 0;
+		const uint32_t granularity = (std::max)(m_Settings.Granularity, 1u);
+		const uint32_t capacity = count + static_cast<uint32_t>(count * m_Settings.Slack);
+		return (capacity + granularity - 1) / granularity * granularity;
+	}
+
+	uint32_t MeshBufferPool::CreateArena(uint32_t vertices, uint32_t indices) {
+		Arena arena;
+		D3D11_BUFFER_DESC bufferDesc = {};
+		bufferDesc.Usage = D3D11_USAGE_DEFAULT;
+		bufferDesc.ByteWidth = sizeof(Vertex) * vertices;
+		bufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+		HRESULT hr = Renderer::Device()->CreateBuffer(&bufferDesc, nullptr, arena.Vertices.GetAddressOf());
+		if (FAILED(hr)) {
+			DXE_ERROR("MeshBufferPool: failed to create a vertex arena of ", vertices, " vertices");
+			return UINT32_MAX;
+		}
+		bufferDesc.ByteWidth = sizeof(uint32_t) * indices;
+		bufferDesc.BindFlags = D3D11_BIND_INDEX_BUFFER;
+		hr = Renderer::Device()->CreateBuffer(&bufferDesc, nullptr, arena.Indices.GetAddressOf());
+		if (FAILED(hr)) {
+			DXE_ERROR("MeshBufferPool: failed to create an index arena of ", indices, " indices");
+			return UINT32_MAX;
+		}
+		m_BuffersCreated += 2;
+		arena.VertexAllocator = RangeAllocator(vertices);
+		arena.IndexAllocator = RangeAllocator(indices);
+
+		// A released slot has no ranges left pointing at it
+		auto released = std::find_if(m_Arenas.begin(), m_Arenas.end(), [](const Arena& a) { return !a.Vertices; });
+		const uint32_t slot = static_cast<uint32_t>(released - m_Arenas.begin());
+		if (released == m_Arenas.end()) m_Arenas.push_back(std::move(arena));
+		else *released = std::move(arena);
+		DXE_INFO("MeshBufferPool: arena ", slot, " created, ", vertices, " vertices, ", indices, " indices");
+		return slot;
+	}
+
+	bool MeshBufferPool::Place(uint32_t vertexCapacity, uint32_t indexCapacity, uint32_t arenaEnd, bool create, uint32_t& arena, uint32_t& baseVertex, uint32_t& firstIndex) {
+		for (uint32_t a = 0; a < (std::min)(arenaEnd, static_cast<uint32_t>(m_Arenas.size())); ++a) {
+			Arena& candidate = m_Arenas[a];
+			if (!candidate.Vertices) continue;
+			const uint32_t vertexOffset = candidate.VertexAllocator.Allocate(vertexCapacity);
+			if (vertexOffset == RangeAllocator::InvalidOffset) continue;
+			const uint32_t indexOffset = candidate.IndexAllocator.Allocate(indexCapacity);
+			if (indexOffset == RangeAllocator::InvalidOffset) {
+				candidate.VertexAllocator.Free(vertexOffset, vertexCapacity);
+				continue;
+			}
+			arena = a;
+			baseVertex = vertexOffset;
+			firstIndex = indexOffset;
+			return true;
+		}
+		if (!create) return false;
+		// Geometry larger than an arena gets one of its own size
+		const uint32_t created = CreateArena((std::max)(m_Settings.ArenaVertices, vertexCapacity), (std::max)(m_Settings.ArenaIndices, indexCapacity));
+		if (created == UINT32_MAX) return false;
+		arena = created;
+		baseVertex = m_Arenas[created].VertexAllocator.Allocate(vertexCapacity);
+		firstIndex = m_Arenas[created].IndexAllocator.Allocate(indexCapacity);
+		return true;
+	}
+
+	bool MeshBufferPool::Copy(ID3D11Buffer* source, uint32_t sourceOffset, ID3D11Buffer* destination, uint32_t destinationOffset, uint32_t bytes) {
+		if (!bytes) return true;
+		if (source == destination) {
+			// Copies inside one buffer go through the scratch buffer
+			if (m_ScratchBytes < bytes) {
+				D3D11_BUFFER_DESC bufferDesc = {};
+				bufferDesc.Usage = D3D11_USAGE_DEFAULT;
+				bufferDesc.ByteWidth = bytes;
+				bufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+				HRESULT hr = Renderer::Device()->CreateBuffer(&bufferDesc, nullptr, m_Scratch.ReleaseAndGetAddressOf());
+				if (FAILED(hr)) {
+					m_ScratchBytes = 0;
+					DXE_ERROR("MeshBufferPool: failed to create a scratch buffer of ", bytes, " bytes");
+					return false;
+				}
+				m_ScratchBytes = bytes;
+				++m_BuffersCreated;
+			}
+			Copy(source, sourceOffset, m_Scratch.Get(), 0, bytes);
+			source = m_Scratch.Get();
+			sourceOffset = 0;
+		}
+		D3D11_BOX box = { sourceOffset, 0, 0, sourceOffset + bytes, 1, 1 };
+		Renderer::Context()->CopySubresourceRegion(destination, 0, destinationOffset, 0, 0, source, 0, &box);
+		return true;
+	}
+
+	bool MeshBufferPool::Transfer(MeshBufferRange& range, uint32_t arena, uint32_t baseVertex, uint32_t firstIndex, uint32_t vertexCapacity, uint32_t indexCapacity) {
+		Arena& source = m_Arenas[range.Arena];
+		Arena& destination = m_Arenas[arena];
+		if (!Copy(source.Vertices.Get(), range.BaseVertex * sizeof(Vertex), destination.Vertices.Get(), baseVertex * sizeof(Vertex), range.VertexCount * sizeof(Vertex)) ||
+			!Copy(source.Indices.Get(), range.FirstIndex * sizeof(uint32_t), destination.Indices.Get(), firstIndex * sizeof(uint32_t), range.IndexCount * sizeof(uint32_t))) {
+			destination.VertexAllocator.Free(baseVertex, vertexCapacity);
+			destination.IndexAllocator.Free(firstIndex, indexCapacity);
+			return false;
+		}
+		source.VertexAllocator.Free(range.BaseVertex, range.VertexCapacity);
+		source.IndexAllocator.Free(range.FirstIndex, range.IndexCapacity);
+		range.Arena = arena;
+		range.BaseVertex = baseVertex;
+		range.FirstIndex = firstIndex;
+		range.VertexCapacity = vertexCapacity;
+		range.IndexCapacity = indexCapacity;
+		return true;
+	}
+
+	uint32_t MeshBufferPool::Allocate(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices) {
+		MeshBufferRange range;
+		range.VertexCapacity = Reserve(static_cast<uint32_t>(vertices.size()));
+		range.IndexCapacity = Reserve(static_cast<uint32_t>(indices.size()));
+		if (!Place(range.VertexCapacity, range.IndexCapacity, UINT32_MAX, true, range.Arena, range.BaseVertex, range.FirstIndex)) return InvalidHandle;
+		range.Live = true;
+
+		uint32_t handle;
+		if (m_FreeHandles.empty()) {
+			handle = static_cast<uint32_t>(m_Ranges.size());
+			m_Ranges.push_back(range);
+		}
+		else {
+			handle = m_FreeHandles.back();
+			m_FreeHandles.pop_back();
+			m_Ranges[handle] = range;
+		}
+		UpdateVertices(handle, vertices);
+		UpdateIndices(handle, indices);
+		return handle;
+	}
+
+	void MeshBufferPool::Free(uint32_t handle) {
+		if (handle >= m_Ranges.size() || !m_Ranges[handle].Live) return;
+		MeshBufferRange& range = m_Ranges[handle];
+		Arena& arena = m_Arenas[range.Arena];
+		arena.VertexAllocator.Free(range.BaseVertex, range.VertexCapacity);
+		arena.IndexAllocator.Free(range.FirstIndex, range.IndexCapacity);
+		range = MeshBufferRange();
+		m_FreeHandles.push_back(handle);
+	}
+
+	void MeshBufferPool::UpdateVertices(uint32_t handle, const std::vector<Vertex>& vertices) {
+		MeshBufferRange& range = m_Ranges[handle];
+		const uint32_t count = static_cast<uint32_t>(vertices.size());
+		if (count > range.VertexCapacity) {
+			// The old vertices are replaced, only the indices have to come along when the range leaves its arena
+			const uint32_t capacity = Reserve(count);
+			Arena& arena = m_Arenas[range.Arena];
+			const uint32_t offset = arena.VertexAllocator.Allocate(capacity);
+			if (offset != RangeAllocator::InvalidOffset) {
+				arena.VertexAllocator.Free(range.BaseVertex, range.VertexCapacity);
+				range.BaseVertex = offset;
+				range.VertexCapacity = capacity;
+			}
+			else {
+				uint32_t target, baseVertex, firstIndex;
+				if (!Place(capacity, range.IndexCapacity, UINT32_MAX, true, target, baseVertex, firstIndex)) return;
+				const uint32_t vertexCount = range.VertexCount;
+				range.VertexCount = 0;
+				const bool moved = Transfer(range, target, baseVertex, firstIndex, capacity, range.IndexCapacity);
+				if (!moved) {
+					range.VertexCount = vertexCount;
+					return;
+				}
+			}
+			++m_Reallocations;
+		}
+		else if (range.VertexCount) {
+			++m_InPlaceUpdates;
+		}
+		range.VertexCount = count;
+		if (!count) return;
+
+		const uint32_t offset = range.BaseVertex * sizeof(Vertex);
+		D3D11_BOX box = { offset, 0, 0, offset + count * static_cast<uint32_t>(sizeof(Vertex)), 1, 1 };
+		Renderer::Context()->UpdateSubresource(m_Arenas[range.Arena].Vertices.Get(), 0, &box, vertices.data(), 0, 0);
+	}
+
+	void MeshBufferPool::UpdateIndices(uint32_t handle, const std::vector<uint32_t>& indices) {
+		MeshBufferRange& range = m_Ranges[handle];
+		const uint32_t count = static_cast<uint32_t>(indices.size());
+		if (count > range.IndexCapacity) {
+			const uint32_t capacity = Reserve(count);
+			Arena& arena = m_Arenas[range.Arena];
+			const uint32_t offset = arena.IndexAllocator.Allocate(capacity);
+			if (offset != RangeAllocator::InvalidOffset) {
+				arena.IndexAllocator.Free(range.FirstIndex, range.IndexCapacity);
+				range.FirstIndex = offset;
+				range.IndexCapacity = capacity;
+			}
+			else {
+				uint32_t target, baseVertex, firstIndex;
+				if (!Place(range.VertexCapacity, capacity, UINT32_MAX, true, target, baseVertex, firstIndex)) return;
+				const uint32_t indexCount = range.IndexCount;
+				range.IndexCount = 0;
+				const bool moved = Transfer(range, target, baseVertex, firstIndex, range.VertexCapacity, capacity);
+				if (!moved) {
+					range.IndexCount = indexCount;
+					return;
+				}
+			}
+			++m_Reallocations;
+		}
+		else if (range.IndexCount) {
+			++m_InPlaceUpdates;
+		}
+		range.IndexCount = count;
+		if (!count) return;
+
+		const uint32_t offset = range.FirstIndex * sizeof(uint32_t);
+		D3D11_BOX box = { offset, 0, 0, offset + count * static_cast<uint32_t>(sizeof(uint32_t)), 1, 1 };
+		Renderer::Context()->UpdateSubresource(m_Arenas[range.Arena].Indices.Get(), 0, &box, indices.data(), 0, 0);
+	}
+
+	void MeshBufferPool::Bind(uint32_t handle, int slot) {
+		const Arena& arena = m_Arenas[m_Ranges[handle].Arena];
+		SetIndexBuffer(arena.Indices.Get());
+		SetVertexBuffer(slot, arena.Vertices.Get(), sizeof(Vertex));
+	}
+
+	void MeshBufferPool::BindIndices(uint32_t handle) {
+		SetIndexBuffer(m_Arenas[m_Ranges[handle].Arena].Indices.Get());
+	}
+
+	uint32_t MeshBufferPool::Defragment(uint32_t maxMoves) {
+		uint32_t moves = 0;
+
+		// Out of the newest arenas into older ones with room, so they can empty and be released
+		for (uint32_t a = static_cast<uint32_t>(m_Arenas.size()); a-- > 1 && moves < maxMoves;) {
+			if (!m_Arenas[a].Vertices) continue;
+			for (MeshBufferRange& range : m_Ranges) {
+				if (moves >= maxMoves) break;
+				if (!range.Live || range.Arena != a) continue;
+				uint32_t target, baseVertex, firstIndex;
+				if (!Place(range.VertexCapacity, range.IndexCapacity, a, false, target, baseVertex, firstIndex)) continue;
+				if (!Transfer(range, target, baseVertex, firstIndex, range.VertexCapacity, range.IndexCapacity)) continue;
+				++moves;
+			}
+		}
+
+		// Then down into the holes of each arena, highest ranges first so the free space gathers at the end
+		std::vector<uint32_t> order;
+		for (uint32_t handle = 0; handle < m_Ranges.size(); ++handle) {
+			if (m_Ranges[handle].Live) order.push_back(handle);
+		}
+		std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return m_Ranges[a].BaseVertex > m_Ranges[b].BaseVertex; });
+		for (uint32_t handle : order) {
+			if (moves >= maxMoves) break;
+			MeshBufferRange& range = m_Ranges[handle];
+			Arena& arena = m_Arenas[range.Arena];
+			if (!range.VertexCapacity) continue;
+			const uint32_t offset = arena.VertexAllocator.AllocateBelow(range.VertexCapacity, range.BaseVertex);
+			if (offset == RangeAllocator::InvalidOffset) continue;
+			if (!Copy(arena.Vertices.Get(), range.BaseVertex * sizeof(Vertex), arena.Vertices.Get(), offset * sizeof(Vertex), range.VertexCount * sizeof(Vertex))) {
+				arena.VertexAllocator.Free(offset, range.VertexCapacity);
+				continue;
+			}
+			arena.VertexAllocator.Free(range.BaseVertex, range.VertexCapacity);
+			range.BaseVertex = offset;
+			++moves;
+		}
+		std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return m_Ranges[a].FirstIndex > m_Ranges[b].FirstIndex; });
+		for (uint32_t handle : order) {
+			if (moves >= maxMoves) break;
+			MeshBufferRange& range = m_Ranges[handle];
+			Arena& arena = m_Arenas[range.Arena];
+			if (!range.IndexCapacity) continue;
+			const uint32_t offset = arena.IndexAllocator.AllocateBelow(range.IndexCapacity, range.FirstIndex);
+			if (offset == RangeAllocator::InvalidOffset) continue;
+			if (!Copy(arena.Indices.Get(), range.FirstIndex * sizeof(uint32_t), arena.Indices.Get(), offset * sizeof(uint32_t), range.IndexCount * sizeof(uint32_t))) {
+				arena.IndexAllocator.Free(offset, range.IndexCapacity);
+				continue;
+			}
+			arena.IndexAllocator.Free(range.FirstIndex, range.IndexCapacity);
+			range.FirstIndex = offset;
+			++moves;
+		}
+
+		// The first arena stays, so the next mesh does not recreate it
+		for (uint32_t a = 1; a < m_Arenas.size(); ++a) {
+			Arena& arena = m_Arenas[a];
+			if (!arena.Vertices || !arena.VertexAllocator.IsEmpty() || !arena.IndexAllocator.IsEmpty()) continue;
+			arena = Arena();
+			DXE_INFO("MeshBufferPool: arena ", a, " released");
+		}
+
+		m_DefragMoves += moves;
+		return moves;
+	}
+
+	MeshBufferPoolStats MeshBufferPool::GetStats() const {
+		MeshBufferPoolStats stats;
+		for (const Arena& arena : m_Arenas) {
+			if (!arena.Vertices) continue;
+			++stats.Arenas;
+			stats.VertexCapacity += arena.VertexAllocator.GetCapacity();
+			stats.IndexCapacity += arena.IndexAllocator.GetCapacity();
+		}
+		for (const MeshBufferRange& range : m_Ranges) {
+			if (!range.Live) continue;
+			++stats.Allocations;
+			stats.VerticesUsed += range.VertexCount;
+			stats.IndicesUsed += range.IndexCount;
+		}
+		stats.BuffersCreated = m_BuffersCreated;
+		stats.InPlaceUpdates = m_InPlaceUpdates;
+		stats.Reallocations = m_Reallocations;
+		stats.DefragMoves = m_DefragMoves;
+		return stats;
+	}
+}
@@ -0,0 +1,144 @@
+#pragma once
+#include "DXE.h"
+#include "Buffer.h"
+#include <map>
+#include <vector>
+
+namespace DXE
+{
+	// Best fit free list over [0, capacity) elements. Free blocks are kept by offset, to merge with their
+	// neighbours on Free, and by size, to find the smallest block that fits in log time.
+	class DXE_API RangeAllocator {
+	public:
+		static constexpr uint32_t InvalidOffset = UINT32_MAX;
+
+		explicit RangeAllocator(uint32_t capacity = 0);
+
+		// Offset of count elements, InvalidOffset when no free block is large enough. Zero counts take nothing.
+		uint32_t Allocate(uint32_t count);
+		// Lowest free block that starts below limit and fits, used to move a range down while defragmenting
+		uint32_t AllocateBelow(uint32_t count, uint32_t limit);
+		void Free(uint32_t offset, uint32_t count);
+
+		uint32_t GetCapacity() const { return m_Capacity; }
+		uint32_t GetFree() const { return m_Free; }
+		uint32_t GetLargestFree() const { return m_BySize.empty() ? 0 : m_BySize.rbegin()->first; }
+		uint32_t GetFreeBlockCount() const { return static_cast<uint32_t>(m_ByOffset.size()); }
+		bool IsEmpty() const { return m_Free == m_Capacity; }
+
+		// Allocates and frees random sizes, checks that no two ranges overlap and that freeing everything leaves
+		// one block, logs the timing and the fragmentation left behind. Returns whether every check held.
+		static bool Benchmark(int operations = 200000);
+
+	private:
+		void Insert(uint32_t offset, uint32_t size);
+		void EraseSize(uint32_t offset, uint32_t size);
+
+		uint32_t m_Capacity = 0;
+		uint32_t m_Free = 0;
+		std::map<uint32_t, uint32_t> m_ByOffset;     // offset, size
+		std::multimap<uint32_t, uint32_t> m_BySize; // size, offset
+	};
+
+	struct MeshBufferPoolSettings {
+		uint32_t ArenaVertices = 1u << 20; // 60MB of Vertex per arena
+		uint32_t ArenaIndices = 1u << 22;  // 16MB
+		// Capacity reserved above what a mesh asks for, so geometry that grows a little updates in place
+		float Slack = 0.125f;
+		uint32_t Granularity = 64; // capacities are rounded up to this many elements
+	};
+
+	struct MeshBufferPoolStats {
+		uint32_t Arenas = 0;
+		uint32_t Allocations = 0;
+		uint64_t BuffersCreated = 0; // D3D buffers, two per arena
+		uint64_t InPlaceUpdates = 0;
+		uint64_t Reallocations = 0;  // geometry outgrew its range and moved inside the pool
+		uint64_t DefragMoves = 0;
+		uint64_t VerticesUsed = 0;
+		uint64_t VertexCapacity = 0;
+		uint64_t IndicesUsed = 0;
+		uint64_t IndexCapacity = 0;
+	};
+
+	// Where a mesh's geometry lives, draw with DrawIndexedInstanced(IndexCount, n, FirstIndex, BaseVertex, ...).
+	// Indices stay relative to the mesh's own vertices.
+	struct MeshBufferRange {
+		uint32_t Arena = 0;
+		uint32_t BaseVertex = 0;
+		uint32_t VertexCount = 0;
+		uint32_t VertexCapacity = 0;
+		uint32_t FirstIndex = 0;
+		uint32_t IndexCount = 0;
+		uint32_t IndexCapacity = 0;
+		bool Live = false;
+	};
+
+	// Shared vertex and index buffers for every MeshBase. Geometry is sub-allocated from a few large arenas,
+	// each one vertex buffer and one index buffer, so meshes in the same arena draw without rebinding and
+	// streaming geometry in and out creates no D3D buffers once the arenas exist. A mesh's vertices and indices
+	// always share an arena. Meshes hold a handle, the range behind it may move when geometry outgrows its
+	// capacity or Defragment() compacts the arenas, so look the range up when drawing.
+	class DXE_API MeshBufferPool {
+	public:
+		static constexpr uint32_t InvalidHandle = UINT32_MAX;
+
+		explicit MeshBufferPool(const MeshBufferPoolSettings& settings = MeshBufferPoolSettings());
+
+		MeshBufferPool(const MeshBufferPool&) = delete;
+		MeshBufferPool& operator=(const MeshBufferPool&) = delete;
+
+		// Reserves a range and uploads the geometry, InvalidHandle when no arena could be created
+		uint32_t Allocate(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices);
+		void Free(uint32_t handle);
+		// In place while the data fits the range's capacity, otherwise the range moves inside the pool
+		void UpdateVertices(uint32_t handle, const std::vector<Vertex>& vertices);
+		void UpdateIndices(uint32_t handle, const std::vector<uint32_t>& indices);
+
+		const MeshBufferRange& GetRange(uint32_t handle) const { return m_Ranges[handle]; }
+		// Binds the arena's vertex buffer to slot and its index buffer, repeated binds are skipped (SetVertexBuffer)
+		void Bind(uint32_t handle, int slot);
+		void BindIndices(uint32_t handle);
+
+		// Moves ranges down into holes and out of the newest arenas into older ones with room, copying on the
+		// GPU, and releases arenas left empty. Meant for loading screens or quiet frames, not every frame.
+		// Returns the number of ranges moved, at most maxMoves.
+		uint32_t Defragment(uint32_t maxMoves = UINT32_MAX);
+
+		const MeshBufferPoolSettings& GetSettings() const { return m_Settings; }
+		MeshBufferPoolStats GetStats() const;
+
+	private:
+		struct Arena {
+			Microsoft::WRL::ComPtr<ID3D11Buffer> Vertices;
+			Microsoft::WRL::ComPtr<ID3D11Buffer> Indices;
+			RangeAllocator VertexAllocator;
+			RangeAllocator IndexAllocator;
+		};
+
+		// Capacity for count elements with the slack, rounded to the granularity
+		uint32_t Reserve(uint32_t count) const;
+		// Slot of the new arena, UINT32_MAX when a buffer could not be created
+		uint32_t CreateArena(uint32_t vertices, uint32_t indices);
+		// Room for both parts in the first of the arenas below arenaEnd that has it, or in a new arena when create is set
+		bool Place(uint32_t vertexCapacity, uint32_t indexCapacity, uint32_t arenaEnd, bool create, uint32_t& arena, uint32_t& baseVertex, uint32_t& firstIndex);
+		// False when the scratch buffer for a copy inside one buffer could not be created
+		bool Copy(ID3D11Buffer* source, uint32_t sourceOffset, ID3D11Buffer* destination, uint32_t destinationOffset, uint32_t bytes);
+		// Copies the range's contents to the space placed for it and frees the old space. When a copy fails the
+		// placed space is freed instead and the range stays where it was.
+		bool Transfer(MeshBufferRange& range, uint32_t arena, uint32_t baseVertex, uint32_t firstIndex, uint32_t vertexCapacity, uint32_t indexCapacity);
+
+		MeshBufferPoolSettings m_Settings;
+		std::vector<Arena> m_Arenas; // released arenas keep their slot with null buffers, ranges index into it
+		std::vector<MeshBufferRange> m_Ranges;
+		std::vector<uint32_t> m_FreeHandles;
+		// Copies inside one buffer are staged here, the source and destination of CopySubresourceRegion differ
+		Microsoft::WRL::ComPtr<ID3D11Buffer> m_Scratch;
+		uint32_t m_ScratchBytes = 0;
+
+		uint64_t m_BuffersCreated = 0;
+		uint64_t m_InPlaceUpdates = 0;
+		uint64_t m_Reallocations = 0;
+		uint64_t m_DefragMoves = 0;
+	};
+}
@@ -8,6 +8,8 @@
 
 namespace DXE {
 
+	// Value handle to one instance: the mesh and its generational entt id, a destroyed instance's
+	// handle stays invalid even after the id is reused
 	class DXE_API MeshInstance {
 	public:
 		friend class MeshBase;
@@ -21,7 +23,7 @@ namespace DXE {
 		void Invalidate() { m_ID = entt::null; m_Mesh = nullptr; }
 		void Destroy() {
 			if (IsValid()) {
-				m_Mesh->m_Instances.destroy(m_ID); // Remove entity from registry
+				m_Mesh->DestroyInstances(std::span<const entt::entity>(&m_ID, 1)); // through the mesh, so m_Version changes
 				Invalidate();                      // Reset the handle
 			}
 		}
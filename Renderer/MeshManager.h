@@ -5,6 +5,7 @@
 #include "MeshBase.h"
 #include "MeshInstance.h"
 #include "Material.h"
+#include "MeshBufferPool.h"
 
 namespace DXE
 {
@@ -25,6 +26,9 @@ namespace DXE
 		void DestroyMeshBase(const std::string& name);
 		MeshBase* CreateMeshBase(const std::string& name, const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices);
 
+		// Vertex and index arenas every MeshBase allocates its geometry from
+		MeshBufferPool& GetBufferPool() { return m_BufferPool; }
+
 
 
 
@@ -32,6 +36,7 @@ namespace DXE
 
 		std::vector<MeshBase*> m_Meshes;
 		std::unordered_map<std::string, MeshBase*> m_MeshMap;
+		MeshBufferPool m_BufferPool;
 
 	};
 
@@ -0,0 +1,387 @@
+#include "pch.h"
+#include "Meshlets.h"
+#include "Logger.h"
+#include <algorithm>
+#include <array>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <tuple>
+
+namespace DXE
+{
+	namespace {
+		constexpr uint32_t NoTriangle = UINT32_MAX;
+
+		// Front face normal of a clockwise triangle, zero when degenerate
+		DXM::Vector3 FrontNormal(const DXM::Vector3& a, const DXM::Vector3& b, const DXM::Vector3& c) {
+			DXM::Vector3 normal = (c - a).Cross(b - a);
+			float length = normal.Length();
+			return length > 0.f ? normal / length : DXM::Vector3::Zero;
+		}
+	}
+
+	void MeshletSet::Clear() {
+		m_Meshlets.clear();
+		m_Indices.clear();
+	}
+
+	void MeshletSet::Build(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, float coneWeight) {
+		Clear();
+		const uint32_t triangleCount = static_cast<uint32_t>(indices.size() / 3);
+		const uint32_t vertexCount = static_cast<uint32_t>(vertices.size());
+		if (!triangleCount) return;
+		for (uint32_t index : indices) {
+			if (index >= vertexCount) {
+				DXE_ERROR("MeshletSet: index ", index, " past the ", vertexCount, " vertices");
+				return;
+			}
+		}
+
+		std::vector<DXM::Vector3> normals(triangleCount);
+		for (uint32_t t = 0; t < triangleCount; ++t) {
+			normals[t] = FrontNormal(vertices[indices[t * 3]].Position, vertices[indices[t * 3 + 1]].Position, vertices[indices[t * 3 + 2]].Position);
+		}
+
+		// Triangles around every vertex, compressed rows
+		std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+		std::vector<uint32_t> adjacency(triangleCount * 3);
+		for (size_t i = 0; i < triangleCount * 3; ++i) ++adjacencyOffsets[indices[i] + 1];
+		for (uint32_t v = 0; v < vertexCount; ++v) adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+		{
+			std::vector<uint32_t> cursor(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+			for (uint32_t i = 0; i < triangleCount * 3; ++i) adjacency[cursor[indices[i]]++] = i / 3;
+		}
+
+		std::vector<uint8_t> used(triangleCount, 0);
+		std::vector<uint32_t> stamp(vertexCount, UINT32_MAX); // meshlet that last took the vertex
+		std::vector<uint32_t> meshletVertices;
+		meshletVertices.reserve(MaxVertices);
+		std::array<DXM::Vector3, MaxVertices> positions;
+		m_Indices.reserve(triangleCount * 3);
+
+		uint32_t scan = 0;
+		uint32_t emitted = 0;
+		while (emitted < triangleCount) {
+			const uint32_t id = static_cast<uint32_t>(m_Meshlets.size());
+			Meshlet meshlet;
+			meshlet.FirstIndex = static_cast<uint32_t>(m_Indices.size());
+			meshletVertices.clear();
+			DXM::Vector3 normalSum;
+
+			auto newVertices = [&](uint32_t t) {
+				uint32_t a = indices[t * 3], b = indices[t * 3 + 1], c = indices[t * 3 + 2];
+				return (stamp[a] != id) + (stamp[b] != id && b != a) + (stamp[c] != id && c != a && c != b);
+			};
+			uint32_t best = NoTriangle;
+			float bestCost = FLT_MAX;
+			auto consider = [&](uint32_t v, const DXM::Vector3& axis) {
+				for (uint32_t k = adjacencyOffsets[v]; k < adjacencyOffsets[v + 1]; ++k) {
+					uint32_t t = adjacency[k];
+					if (used[t]) continue;
+					uint32_t added = newVertices(t);
+					if (meshletVertices.size() + added > MaxVertices) continue;
+					float cost = static_cast<float>(added) + coneWeight * (1.f - normals[t].Dot(axis));
+					if (cost < bestCost) {
+						bestCost = cost;
+						best = t;
+					}
+				}
+			};
+
+			while (used[scan]) ++scan;
+			uint32_t triangle = scan;
+			while (triangle != NoTriangle) {
+				used[triangle] = 1;
+				++emitted;
+				for (int k = 0; k < 3; ++k) {
+					uint32_t v = indices[triangle * 3 + k];
+					if (stamp[v] != id) {
+						stamp[v] = id;
+						meshletVertices.push_back(v);
+					}
+					m_Indices.push_back(v);
+				}
+				normalSum += normals[triangle];
+				if (++meshlet.TriangleCount == MaxTriangles || emitted == triangleCount) break;
+
+				DXM::Vector3 axis = normalSum;
+				float length = axis.Length();
+				axis = length > 0.f ? axis / length : DXM::Vector3::Zero;
+
+				// Neighbours of the last triangle first, then of the whole meshlet
+				best = NoTriangle;
+				bestCost = FLT_MAX;
+				for (int k = 0; k < 3; ++k) consider(indices[triangle * 3 + k], axis);
+				if (best == NoTriangle) {
+					for (uint32_t v : meshletVertices) consider(v, axis);
+				}
+				if (best == NoTriangle && meshletVertices.size() + 3 <= MaxVertices) {
+					// A separate piece, carry on with the next triangle in index order, usually nearby
+					while (used[scan]) ++scan;
+					best = scan;
+				}
+				triangle = best;
+			}
+
+			meshlet.VertexCount = static_cast<uint32_t>(meshletVertices.size());
+			for (size_t i = 0; i < meshletVertices.size(); ++i) positions[i] = vertices[meshletVertices[i]].Position;
+			DX::BoundingSphere sphere;
+			DX::BoundingSphere::CreateFromPoints(sphere, meshletVertices.size(), positions.data(), sizeof(DXM::Vector3));
+			meshlet.Centre = sphere.Center;
+			meshlet.Radius = sphere.Radius;
+
+			// Cone around the average normal, wide ones can't cull anything
+			const uint32_t first = meshlet.FirstIndex / 3;
+			DXM::Vector3 axis = normalSum;
+			float axisLength = axis.Length();
+			float minDot = 1.f;
+			if (axisLength > 0.f) {
+				axis /= axisLength;
+				for (uint32_t t = first; t < first + meshlet.TriangleCount; ++t) {
+					DXM::Vector3 normal = FrontNormal(vertices[m_Indices[t * 3]].Position, vertices[m_Indices[t * 3 + 1]].Position, vertices[m_Indices[t * 3 + 2]].Position);
+					if (normal != DXM::Vector3::Zero) minDot = (std::min)(minDot, normal.Dot(axis));
+				}
+			}
+			if (axisLength > 0.f && minDot > 0.f) {
+				// Apex far enough behind the centre that the cone holds every triangle's plane
+				float apexDistance = 0.f;
+				for (uint32_t t = first; t < first + meshlet.TriangleCount; ++t) {
+					const DXM::Vector3& p = vertices[m_Indices[t * 3]].Position;
+					DXM::Vector3 normal = FrontNormal(p, vertices[m_Indices[t * 3 + 1]].Position, vertices[m_Indices[t * 3 + 2]].Position);
+					float alignment = normal.Dot(axis);
+					if (alignment > 0.f) apexDistance = (std::max)(apexDistance, (meshlet.Centre - p).Dot(normal) / alignment);
+				}
+				meshlet.ConeApex = meshlet.Centre - axis * apexDistance;
+				meshlet.ConeAxis = axis;
+				meshlet.ConeCutoff = sqrtf(1.f - minDot * minDot);
+			}
+			else {
+				meshlet.ConeApex = meshlet.Centre;
+				meshlet.ConeAxis = DXM::Vector3::Zero;
+				meshlet.ConeCutoff = 1.f;
+			}
+			m_Meshlets.push_back(meshlet);
+		}
+
+		// Meshlets in Morton order of their centres, so the survivors of a cull sit next to each other and merge into few ranges
+		DXM::Vector3 lo(FLT_MAX, FLT_MAX, FLT_MAX), hi(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		for (const Meshlet& meshlet : m_Meshlets) {
+			lo = DXM::Vector3::Min(lo, meshlet.Centre);
+			hi = DXM::Vector3::Max(hi, meshlet.Centre);
+		}
+		DXM::Vector3 extent = hi - lo;
+		const float scale = 1023.f / (std::max)({ extent.x, extent.y, extent.z, 1e-6f });
+		std::vector<std::pair<uint32_t, uint32_t>> keys(m_Meshlets.size());
+		for (uint32_t i = 0; i < m_Meshlets.size(); ++i) {
+			DXM::Vector3 cell = (m_Meshlets[i].Centre - lo) * scale;
+			keys[i] = { DXM::MortonCode(static_cast<uint32_t>(cell.x), static_cast<uint32_t>(cell.y), static_cast<uint32_t>(cell.z)), i };
+		}
+		std::sort(keys.begin(), keys.end());
+		std::vector<Meshlet> sorted;
+		std::vector<uint32_t> sortedIndices;
+		sorted.reserve(m_Meshlets.size());
+		sortedIndices.reserve(m_Indices.size());
+		for (const auto& key : keys) {
+			Meshlet meshlet = m_Meshlets[key.second];
+			auto begin = m_Indices.begin() + meshlet.FirstIndex;
+			meshlet.FirstIndex = static_cast<uint32_t>(sortedIndices.size());
+			sortedIndices.insert(sortedIndices.end(), begin, begin + meshlet.TriangleCount * 3);
+			sorted.push_back(meshlet);
+		}
+		m_Meshlets.swap(sorted);
+		m_Indices.swap(sortedIndices);
+	}
+
+	uint32_t MeshletSet::Cull(const DX::BoundingFrustum& frustum, const DXM::Matrix& world, uint32_t instance, uint32_t maxDraws,
+		std::vector<MeshletDraw>& draws, MeshletCullStats& stats) const {
+		stats.Triangles += static_cast<uint32_t>(m_Indices.size() / 3);
+		stats.Meshlets += static_cast<uint32_t>(m_Meshlets.size());
+
+		// Cones are tested in mesh space, a mirroring transform turns the faces around so it skips them
+		const DXM::Vector3 camera = DXM::Vector3::Transform(frustum.Origin, world.Invert());
+		const bool cones = world.Determinant() > 0.f;
+		const float scale = DXM::MaxAxisScale(world);
+
+		m_Runs.clear();
+		for (const Meshlet& meshlet : m_Meshlets) {
+			DX::BoundingSphere sphere(DXM::Vector3::Transform(meshlet.Centre, world), meshlet.Radius * scale);
+			if (frustum.Contains(sphere) == DX::DISJOINT) {
+				++stats.FrustumCulled;
+				continue;
+			}
+			if (cones && meshlet.ConeCutoff < 1.f) {
+				DXM::Vector3 toApex = meshlet.ConeApex - camera;
+				if (toApex.Dot(meshlet.ConeAxis) >= meshlet.ConeCutoff * toApex.Length()) {
+					++stats.BackfaceCulled;
+					continue;
+				}
+			}
+			// Meshlets are back to back in m_Indices, runs of survivors become one range
+			stats.TrianglesVisible += meshlet.TriangleCount;
+			const uint32_t indexCount = meshlet.TriangleCount * 3;
+			if (!m_Runs.empty() && m_Runs.back().FirstIndex + m_Runs.back().IndexCount == meshlet.FirstIndex) {
+				m_Runs.back().IndexCount += indexCount;
+			}
+			else {
+				m_Runs.push_back({ meshlet.FirstIndex, indexCount, instance });
+			}
+		}
+		if (m_Runs.empty()) return 0;
+
+		// Too many ranges: bridge the smallest gaps, drawing the culled triangles in them
+		maxDraws = (std::max)(maxDraws, 1u);
+		uint32_t threshold = 0, equalAllowed = 0;
+		if (m_Runs.size() > maxDraws) {
+			m_Gaps.resize(m_Runs.size() - 1);
+			for (size_t i = 0; i + 1 < m_Runs.size(); ++i) {
+				m_Gaps[i] = m_Runs[i + 1].FirstIndex - (m_Runs[i].FirstIndex + m_Runs[i].IndexCount);
+			}
+			const size_t merges = m_Runs.size() - maxDraws;
+			std::nth_element(m_Gaps.begin(), m_Gaps.begin() + (merges - 1), m_Gaps.end());
+			threshold = m_Gaps[merges - 1];
+			size_t smaller = 0;
+			for (uint32_t gap : m_Gaps) smaller += gap < threshold;
+			equalAllowed = static_cast<uint32_t>(merges - smaller);
+		}
+
+		const size_t firstDraw = draws.size();
+		draws.push_back(m_Runs[0]);
+		for (size_t i = 1; i < m_Runs.size(); ++i) {
+			MeshletDraw& last = draws.back();
+			const uint32_t end = last.FirstIndex + last.IndexCount;
+			const uint32_t gap = m_Runs[i].FirstIndex - end;
+			bool bridge = m_Runs.size() > maxDraws && (gap < threshold || (gap == threshold && equalAllowed > 0));
+			if (bridge) {
+				if (gap == threshold) --equalAllowed;
+				last.IndexCount = m_Runs[i].FirstIndex + m_Runs[i].IndexCount - last.FirstIndex;
+			}
+			else {
+				draws.push_back(m_Runs[i]);
+			}
+		}
+
+		const uint32_t added = static_cast<uint32_t>(draws.size() - firstDraw);
+		for (size_t i = firstDraw; i < draws.size(); ++i) stats.TrianglesDrawn += draws[i].IndexCount / 3;
+		stats.Draws += added;
+		return added;
+	}
+
+	bool MeshletSet::Benchmark(int rings, int segments, uint32_t maxDraws) {
+		// Sphere of radius 10 at the origin, wound so the front faces point out
+		const float radius = 10.f;
+		std::vector<Vertex> vertices;
+		vertices.reserve(static_cast<size_t>(rings + 1) * (segments + 1));
+		for (int r = 0; r <= rings; ++r) {
+			float theta = DX::XM_PI * r / rings;
+			for (int s = 0; s <= segments; ++s) {
+				float phi = DX::XM_2PI * s / segments;
+				Vertex v = {};
+				v.Normal = DXM::Vector3(sinf(theta) * cosf(phi), sinf(theta) * sinf(phi), cosf(theta));
+				v.Position = v.Normal * radius;
+				v.UV = DXM::Vector2(static_cast<float>(s) / segments, static_cast<float>(r) / rings);
+				v.Color = DXM::Vector4(1.f, 1.f, 1.f, 1.f);
+				vertices.push_back(v);
+			}
+		}
+		std::vector<uint32_t> indices;
+		indices.reserve(static_cast<size_t>(rings) * segments * 6);
+		for (int r = 0; r < rings; ++r) {
+			for (int s = 0; s < segments; ++s) {
+				uint32_t a = r * (segments + 1) + s;
+				uint32_t b = a + 1;
+				uint32_t c = a + segments + 1;
+				uint32_t d = c + 1;
+				for (std::array<uint32_t, 3> t : { std::array<uint32_t, 3>{ a, b, c }, std::array<uint32_t, 3>{ b, d, c } }) {
+					DXM::Vector3 normal = FrontNormal(vertices[t[0]].Position, vertices[t[1]].Position, vertices[t[2]].Position);
+					if (normal.Dot(vertices[t[0]].Position + vertices[t[1]].Position + vertices[t[2]].Position) < 0.f) std::swap(t[1], t[2]);
+					indices.insert(indices.end(), t.begin(), t.end());
+				}
+			}
+		}
+
+		MeshletSet set;
+		auto start = std::chrono::high_resolution_clock::now();
+		set.Build(vertices, indices);
+		double buildSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+		// Limits, bounds and cones
+		uint32_t errors = 0;
+		uint32_t vertexTotal = 0;
+		for (const Meshlet& meshlet : set.m_Meshlets) {
+			vertexTotal += meshlet.VertexCount;
+			if (meshlet.VertexCount > MaxVertices || meshlet.TriangleCount > MaxTriangles || !meshlet.TriangleCount) ++errors;
+			const float minDot = meshlet.ConeCutoff < 1.f ? sqrtf(1.f - meshlet.ConeCutoff * meshlet.ConeCutoff) : -1.f;
+			for (uint32_t i = meshlet.FirstIndex; i < meshlet.FirstIndex + meshlet.TriangleCount * 3; i += 3) {
+				const DXM::Vector3& a = vertices[set.m_Indices[i]].Position;
+				for (int k = 0; k < 3; ++k) {
+					if (DXM::Vector3::Distance(vertices[set.m_Indices[i + k]].Position, meshlet.Centre) > meshlet.Radius * 1.001f + 1e-4f) ++errors;
+				}
+				DXM::Vector3 normal = FrontNormal(a, vertices[set.m_Indices[i + 1]].Position, vertices[set.m_Indices[i + 2]].Position);
+				if (normal != DXM::Vector3::Zero && normal.Dot(meshlet.ConeAxis) < minDot - 1e-4f) ++errors;
+			}
+		}
+		// Every triangle once, with its winding
+		auto triangles = [](const std::vector<uint32_t>& list) {
+			std::vector<std::tuple<uint32_t, uint32_t, uint32_t>> sorted;
+			sorted.reserve(list.size() / 3);
+			for (size_t i = 0; i + 2 < list.size(); i += 3) {
+				uint32_t a = list[i], b = list[i + 1], c = list[i + 2];
+				// rotated so the smallest index leads, which keeps the winding
+				if (b < a && b < c) sorted.emplace_back(b, c, a);
+				else if (c < a && c < b) sorted.emplace_back(c, a, b);
+				else sorted.emplace_back(a, b, c);
+			}
+			std::sort(sorted.begin(), sorted.end());
+			return sorted;
+		};
+		if (triangles(indices) != triangles(set.m_Indices)) ++errors;
+
+		// Cameras outside the sphere, close up and far away, and one grazing the surface
+		struct View { DXM::Vector3 Eye; DXM::Vector3 Target; };
+		const View views[] = {
+			{ { 0.f, -40.f, 0.f }, { 0.f, 0.f, 0.f } },
+			{ { 25.f, -25.f, 10.f }, { 0.f, 0.f, 0.f } },
+			{ { 0.f, -14.f, 0.f }, { 0.f, 0.f, 0.f } },
+			{ { -12.f, -6.f, 2.f }, { 0.f, 10.f, 0.f } },
+		};
+		MeshletCullStats total;
+		double cullSeconds = 0.0;
+		std::vector<MeshletDraw> draws;
+		for (const View& view : views) {
+			DX::BoundingFrustum frustum;
+			DX::BoundingFrustum::CreateFromMatrix(frustum, DXM::Matrix::CreatePerspectiveFieldOfView(DX::XM_PI / 3.f, 16.f / 9.f, 0.1f, 1000.f), true);
+			frustum.Transform(frustum, DXM::Matrix::CreateLookAt(view.Eye, view.Target, DXM::Vector3(0.f, 0.f, 1.f)).Invert());
+
+			MeshletCullStats stats;
+			draws.clear();
+			start = std::chrono::high_resolution_clock::now();
+			set.Cull(frustum, DXM::Matrix::Identity, 0, maxDraws, draws, stats);
+			cullSeconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+			// A culled meshlet must not hold a triangle facing the camera
+			std::vector<uint8_t> drawn(set.m_Indices.size() / 3, 0);
+			for (const MeshletDraw& draw : draws) std::fill(drawn.begin() + draw.FirstIndex / 3, drawn.begin() + (draw.FirstIndex + draw.IndexCount) / 3, 1);
+			for (size_t t = 0; t < drawn.size(); ++t) {
+				if (drawn[t]) continue;
+				const DXM::Vector3& a = vertices[set.m_Indices[t * 3]].Position;
+				DXM::Vector3 normal = FrontNormal(a, vertices[set.m_Indices[t * 3 + 1]].Position, vertices[set.m_Indices[t * 3 + 2]].Position);
+				DX::BoundingSphere triangle;
+				DXM::Vector3 corners[3] = { a, vertices[set.m_Indices[t * 3 + 1]].Position, vertices[set.m_Indices[t * 3 + 2]].Position };
+				DX::BoundingSphere::CreateFromPoints(triangle, 3, corners, sizeof(DXM::Vector3));
+				if (normal.Dot(a - view.Eye) < -1e-3f && frustum.Contains(triangle) != DX::DISJOINT) ++errors;
+			}
+
+			DXE_INFO("Meshlet cull from (", view.Eye.x, ", ", view.Eye.y, ", ", view.Eye.z, "): ", stats.TrianglesVisible, " of ", stats.Triangles,
+				" triangles visible, ", stats.TrianglesDrawn, " drawn in ", stats.Draws, " draws, ", stats.FrustumCulled, " meshlets outside the frustum, ", stats.BackfaceCulled, " facing away");
+			total += stats;
+		}
+
+		DXE_INFO("Meshlet benchmark: ", indices.size() / 3, " triangles into ", set.m_Meshlets.size(), " meshlets, ",
+			set.m_Meshlets.empty() ? 0.f : static_cast<float>(vertexTotal) / set.m_Meshlets.size(), " vertices each, built in ", buildSeconds * 1000.0,
+			"ms, culled in ", cullSeconds * 1000.0 / std::size(views), "ms per view, ",
+			total.Triangles ? 100.f * (1.f - static_cast<float>(total.TrianglesDrawn) / total.Triangles) : 0.f, "% fewer triangles");
+		if (errors) DXE_ERROR("Meshlet benchmark: ", errors, " checks failed");
+		return errors == 0;
+	}
+}
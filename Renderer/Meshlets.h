@@ -0,0 +1,89 @@
+#pragma once
+#include "DXE.h"
+#include "Maths/Maths.h"
+#include "Buffer.h"
+#include <vector>
+
+namespace DXE
+{
+	// A cluster of neighbouring triangles, FirstIndex into MeshletSet::GetIndices()
+	struct Meshlet {
+		uint32_t FirstIndex = 0;
+		uint32_t TriangleCount = 0;
+		uint32_t VertexCount = 0;
+		// Mesh space bounding sphere
+		DXM::Vector3 Centre;
+		float Radius = 0.f;
+		// Normal cone: every triangle faces away from cameras where dot(normalize(ConeApex - camera), ConeAxis) >= ConeCutoff.
+		// Cutoff 1 with a zero axis when the normals spread too far to ever cull.
+		DXM::Vector3 ConeApex;
+		DXM::Vector3 ConeAxis;
+		float ConeCutoff = 1.f;
+	};
+
+	// Index range of surviving meshlets for one instance, drawn with DrawIndexedInstanced(IndexCount, 1, FirstIndex, 0, Instance)
+	// with the mesh's first index and base vertex in the buffer pool added
+	struct MeshletDraw {
+		uint32_t FirstIndex = 0;
+		uint32_t IndexCount = 0;
+		uint32_t Instance = 0; // into the visible instance buffer
+	};
+
+	struct MeshletCullStats {
+		uint32_t Meshlets = 0;       // tested
+		uint32_t FrustumCulled = 0;
+		uint32_t BackfaceCulled = 0;
+		uint32_t Triangles = 0;        // the whole mesh would have drawn
+		uint32_t TrianglesVisible = 0; // in meshlets that survived
+		uint32_t TrianglesDrawn = 0;   // adds the culled ones bridged to save draws
+		uint32_t Draws = 0;
+
+		MeshletCullStats& operator+=(const MeshletCullStats& other) {
+			Meshlets += other.Meshlets;
+			FrustumCulled += other.FrustumCulled;
+			BackfaceCulled += other.BackfaceCulled;
+			Triangles += other.Triangles;
+			TrianglesVisible += other.TrianglesVisible;
+			TrianglesDrawn += other.TrianglesDrawn;
+			Draws += other.Draws;
+			return *this;
+		}
+	};
+
+	// Splits a triangle list into meshlets of at most MaxVertices vertices and MaxTriangles triangles and culls
+	// them per instance on the CPU. Build() grows each meshlet from a seed triangle through shared vertices,
+	// preferring triangles that add few new vertices and keep the normals together, and rewrites the indices so
+	// every meshlet is one contiguous range. Cull() drops meshlets outside the frustum or facing away from the
+	// camera and merges what is left into at most maxDraws ranges, bridging the smallest gaps.
+	// Front faces are clockwise, the way the engine's meshes are wound.
+	class DXE_API MeshletSet {
+	public:
+		static constexpr uint32_t MaxVertices = 64;
+		static constexpr uint32_t MaxTriangles = 124;
+
+		// coneWeight trades vertex reuse for tighter normal cones. Indices outside vertices leave the set empty.
+		void Build(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, float coneWeight = 0.5f);
+		void Clear();
+		bool IsEmpty() const { return m_Meshlets.empty(); }
+
+		// Appends the draws for one instance with the world transform, returns how many were added
+		uint32_t Cull(const DX::BoundingFrustum& frustum, const DXM::Matrix& world, uint32_t instance, uint32_t maxDraws,
+			std::vector<MeshletDraw>& draws, MeshletCullStats& stats) const;
+
+		// Same triangles as the indices given to Build, in meshlet order
+		const std::vector<uint32_t>& GetIndices() const { return m_Indices; }
+		const std::vector<Meshlet>& GetMeshlets() const { return m_Meshlets; }
+
+		// Builds meshlets for a sphere, checks the limits, that every triangle survives and that the bounds and
+		// cones hold their triangles, then culls it from a few cameras into at most maxDraws draws and logs the
+		// triangle reduction. Returns false when a check fails.
+		static bool Benchmark(int rings = 256, int segments = 512, uint32_t maxDraws = 32);
+
+	private:
+		std::vector<Meshlet> m_Meshlets;
+		std::vector<uint32_t> m_Indices;
+		// Scratch for Cull
+		mutable std::vector<MeshletDraw> m_Runs;
+		mutable std::vector<uint32_t> m_Gaps;
+	};
+}
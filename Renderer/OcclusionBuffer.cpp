@@ -0,0 +1,284 @@
+#include "pch.h"
+#include "OcclusionBuffer.h"
+#include "Logger.h"
+#include <chrono>
+#include <cfloat>
+#include <cmath>
+#include <immintrin.h>
+
+namespace DXE
+{
+	namespace {
+		DXM::Vector4 ToClip(const DXM::Vector3& p, const DXM::Matrix& m) {
+			return DXM::Vector4(
+				p.x * m._11 + p.y * m._21 + p.z * m._31 + m._41,
+				p.x * m._12 + p.y * m._22 + p.z * m._32 + m._42,
+				p.x * m._13 + p.y * m._23 + p.z * m._33 + m._43,
+				p.x * m._14 + p.y * m._24 + p.z * m._34 + m._44);
+		}
+
+		DXM::Vector4 Lerp(const DXM::Vector4& a, const DXM::Vector4& b, float t) {
+			return DXM::Vector4(a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t, a.z + (b.z - a.z) * t, a.w + (b.w - a.w) * t);
+		}
+	}
+
+	OcclusionBuffer::OcclusionBuffer(int width, int height)
+		: m_Width(width), m_Height(height), m_TilesX(width / TileSize), m_TilesY(height / TileSize),
+		m_Depth(static_cast<size_t>(width) * height, 1.f), m_TileMax(static_cast<size_t>(m_TilesX) * m_TilesY, 1.f), m_Bands(m_TilesY)
+	{
+		if (width % TileSize || height % TileSize) {
+			DXE_ERROR("OcclusionBuffer size ", width, "x", height, " is not a multiple of ", TileSize);
+		}
+	}
+
+	void OcclusionBuffer::Begin(const DXM::Matrix& viewProjection) {
+		m_ViewProjection = viewProjection;
+		m_Triangles.clear();
+		for (auto& band : m_Bands) band.clear();
+		std::fill(m_Depth.begin(), m_Depth.end(), 1.f);
+		std::fill(m_TileMax.begin(), m_TileMax.end(), 1.f);
+		m_Stats = OcclusionStats();
+	}
+
+	void OcclusionBuffer::AddOccluder(const DXM::Vector3* positions, const uint32_t* indices, size_t indexCount, const DXM::Matrix& world) {
+		const DXM::Matrix worldViewProjection = world * m_ViewProjection;
+		for (size_t i = 0; i + 2 < indexCount; i += 3) {
+			DXM::Vector4 v[3] = {
+				ToClip(positions[indices[i]], worldViewProjection),
+				ToClip(positions[indices[i + 1]], worldViewProjection),
+				ToClip(positions[indices[i + 2]], worldViewProjection) };
+
+			int behind = (v[0].z < 0.f) + (v[1].z < 0.f) + (v[2].z < 0.f);
+			if (behind == 3) continue;
+			if (behind == 0) {
+				AddTriangle(v[0], v[1], v[2]);
+				continue;
+			}
+
+			// Clip against the near plane z = 0, leaving one or two triangles
+			DXM::Vector4 polygon[4];
+			int count = 0;
+			for (int e = 0; e < 3; ++e) {
+				const DXM::Vector4& a = v[e];
+				const DXM::Vector4& b = v[(e + 1) % 3];
+				if (a.z >= 0.f) polygon[count++] = a;
+				if ((a.z >= 0.f) != (b.z >= 0.f)) polygon[count++] = Lerp(a, b, a.z / (a.z - b.z));
+			}
+			for (int t = 1; t + 1 < count; ++t) AddTriangle(polygon[0], polygon[t], polygon[t + 1]);
+		}
+	}
+
+	void OcclusionBuffer::AddTriangle(const DXM::Vector4& a, const DXM::Vector4& b, const DXM::Vector4& c) {
+		const DXM::Vector4* v[3] = { &a, &b, &c };
+		Triangle triangle;
+		float minX = FLT_MAX, maxX = -FLT_MAX, minY = FLT_MAX, maxY = -FLT_MAX;
+		for (int i = 0; i < 3; ++i) {
+			if (v[i]->w <= 1e-6f) return;
+			const float invW = 1.f / v[i]->w;
+			triangle.X[i] = (v[i]->x * invW * 0.5f + 0.5f) * m_Width;
+			triangle.Y[i] = (0.5f - v[i]->y * invW * 0.5f) * m_Height;
+			triangle.Z[i] = v[i]->z * invW;
+			minX = (std::min)(minX, triangle.X[i]);
+			maxX = (std::max)(maxX, triangle.X[i]);
+			minY = (std::min)(minY, triangle.Y[i]);
+			maxY = (std::max)(maxY, triangle.Y[i]);
+		}
+		if (maxX < 0.f || minX >= m_Width || maxY < 0.f || minY >= m_Height) return;
+		if (fabsf((triangle.X[1] - triangle.X[0]) * (triangle.Y[2] - triangle.Y[0]) - (triangle.X[2] - triangle.X[0]) * (triangle.Y[1] - triangle.Y[0])) < 1e-6f) return;
+
+		const uint32_t index = static_cast<uint32_t>(m_Triangles.size());
+		m_Triangles.push_back(triangle);
+		const int firstBand = (std::max)(0, static_cast<int>(minY) / TileSize);
+		const int lastBand = (std::min)(m_TilesY - 1, static_cast<int>(maxY) / TileSize);
+		for (int band = firstBand; band <= lastBand; ++band) m_Bands[band].push_back(index);
+	}
+
+	void OcclusionBuffer::Rasterise(ThreadPool* pool) {
+		auto start = std::chrono::high_resolution_clock::now();
+		if (pool) {
+			pool->ParallelFor(m_TilesY, 1, [this](int begin, int end) {
+				for (int band = begin; band < end; ++band) RasteriseBand(band);
+			});
+		}
+		else {
+			for (int band = 0; band < m_TilesY; ++band) RasteriseBand(band);
+		}
+		m_Stats.Triangles = static_cast<uint32_t>(m_Triangles.size());
+		m_Stats.RasteriseSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+
+	void OcclusionBuffer::RasteriseBand(int band) {
+		const int bandTop = band * TileSize;
+		const int bandBottom = bandTop + TileSize; // exclusive
+		const __m128 lane = _mm_setr_ps(0.f, 1.f, 2.f, 3.f);
+
+		for (uint32_t index : m_Bands[band]) {
+			const Triangle& t = m_Triangles[index];
+			float area = (t.X[1] - t.X[0]) * (t.Y[2] - t.Y[0]) - (t.X[2] - t.X[0]) * (t.Y[1] - t.Y[0]);
+			// Edge i is opposite vertex i, its function is the barycentric weight of vertex i times the area
+			const int e1[3] = { 1, 2, 0 }, e2[3] = { 2, 0, 1 };
+			float stepX[3], stepY[3], offset[3];
+			const float sign = area > 0.f ? 1.f : -1.f;
+			const float invArea = 1.f / fabsf(area);
+			for (int i = 0; i < 3; ++i) {
+				const float ax = t.X[e1[i]], ay = t.Y[e1[i]], bx = t.X[e2[i]], by = t.Y[e2[i]];
+				// (b - a) x (p - a), scaled so every weight is positive inside whatever the winding
+				stepX[i] = -(by - ay) * sign;
+				stepY[i] = (bx - ax) * sign;
+				offset[i] = ((bx - ax) * -ay - (by - ay) * -ax) * sign;
+			}
+			// Depth as a plane over the screen
+			const float zStepX = (stepX[0] * t.Z[0] + stepX[1] * t.Z[1] + stepX[2] * t.Z[2]) * invArea;
+			const float zStepY = (stepY[0] * t.Z[0] + stepY[1] * t.Z[1] + stepY[2] * t.Z[2]) * invArea;
+			const float zOffset = (offset[0] * t.Z[0] + offset[1] * t.Z[1] + offset[2] * t.Z[2]) * invArea;
+
+			const float minX = (std::min)({ t.X[0], t.X[1], t.X[2] });
+			const float maxX = (std::max)({ t.X[0], t.X[1], t.X[2] });
+			const float minY = (std::min)({ t.Y[0], t.Y[1], t.Y[2] });
+			const float maxY = (std::max)({ t.Y[0], t.Y[1], t.Y[2] });
+			const int x0 = (std::max)(0, static_cast<int>(floorf(minX))) & ~3;
+			const int x1 = (std::min)(m_Width - 1, static_cast<int>(ceilf(maxX)));
+			const int y0 = (std::max)(bandTop, static_cast<int>(floorf(minY)));
+			const int y1 = (std::min)(bandBottom - 1, static_cast<int>(ceilf(maxY)));
+
+			const __m128 stepX4[3] = { _mm_set1_ps(stepX[0] * 4.f), _mm_set1_ps(stepX[1] * 4.f), _mm_set1_ps(stepX[2] * 4.f) };
+			const __m128 zStep4 = _mm_set1_ps(zStepX * 4.f);
+			const __m128 zero = _mm_setzero_ps();
+			for (int y = y0; y <= y1; ++y) {
+				const float py = y + 0.5f;
+				const __m128 px = _mm_add_ps(_mm_set1_ps(x0 + 0.5f), lane);
+				__m128 w[3];
+				for (int i = 0; i < 3; ++i) {
+					w[i] = _mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(stepX[i])), _mm_set1_ps(stepY[i] * py + offset[i]));
+				}
+				__m128 z = _mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(zStepX)), _mm_set1_ps(zStepY * py + zOffset));
+
+				float* row = m_Depth.data() + static_cast<size_t>(y) * m_Width;
+				for (int x = x0; x <= x1; x += 4) {
+					__m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(w[0], zero), _mm_cmpge_ps(w[1], zero)), _mm_cmpge_ps(w[2], zero));
+					if (_mm_movemask_ps(inside)) {
+						__m128 depth = _mm_loadu_ps(row + x);
+						__m128 nearer = _mm_min_ps(depth, _mm_max_ps(z, zero));
+						_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, depth)));
+					}
+					for (int i = 0; i < 3; ++i) w[i] = _mm_add_ps(w[i], stepX4[i]);
+					z = _mm_add_ps(z, zStep4);
+				}
+			}
+		}
+
+		// Farthest depth per tile of the band
+		for (int tx = 0; tx < m_TilesX; ++tx) {
+			__m128 farthest = _mm_setzero_ps();
+			for (int y = bandTop; y < bandBottom; ++y) {
+				const float* row = m_Depth.data() + static_cast<size_t>(y) * m_Width + tx * TileSize;
+				for (int x = 0; x < TileSize; x += 4) farthest = _mm_max_ps(farthest, _mm_loadu_ps(row + x));
+			}
+			farthest = _mm_max_ps(farthest, _mm_shuffle_ps(farthest, farthest, _MM_SHUFFLE(1, 0, 3, 2)));
+			farthest = _mm_max_ps(farthest, _mm_shuffle_ps(farthest, farthest, _MM_SHUFFLE(2, 3, 0, 1)));
+			m_TileMax[static_cast<size_t>(band) * m_TilesX + tx] = _mm_cvtss_f32(farthest);
+		}
+	}
+
+	bool OcclusionBuffer::IsVisible(const DX::BoundingBox& box) const {
+		++m_Stats.Tested;
+		float minX = FLT_MAX, maxX = -FLT_MAX, minY = FLT_MAX, maxY = -FLT_MAX, minZ = FLT_MAX;
+		for (int i = 0; i < 8; ++i) {
+			DXM::Vector3 corner(
+				box.Center.x + ((i & 1) ? box.Extents.x : -box.Extents.x),
+				box.Center.y + ((i & 2) ? box.Extents.y : -box.Extents.y),
+				box.Center.z + ((i & 4) ? box.Extents.z : -box.Extents.z));
+			DXM::Vector4 clip = ToClip(corner, m_ViewProjection);
+			if (clip.z < 0.f || clip.w <= 1e-6f) return true;
+			const float invW = 1.f / clip.w;
+			const float x = (clip.x * invW * 0.5f + 0.5f) * m_Width;
+			const float y = (0.5f - clip.y * invW * 0.5f) * m_Height;
+			minX = (std::min)(minX, x);
+			maxX = (std::max)(maxX, x);
+			minY = (std::min)(minY, y);
+			maxY = (std::max)(maxY, y);
+			minZ = (std::min)(minZ, clip.z * invW);
+		}
+		// Off screen parts can't be seen anyway, boxes entirely off screen are left to the frustum
+		if (maxX < 0.f || maxY < 0.f || minX >= m_Width || minY >= m_Height) return true;
+		const int x0 = (std::max)(0, static_cast<int>(minX)), x1 = (std::min)(m_Width - 1, static_cast<int>(maxX));
+		const int y0 = (std::max)(0, static_cast<int>(minY)), y1 = (std::min)(m_Height - 1, static_cast<int>(maxY));
+		for (int ty = y0 / TileSize; ty <= y1 / TileSize; ++ty) {
+			for (int tx = x0 / TileSize; tx <= x1 / TileSize; ++tx) {
+				if (m_TileMax[static_cast<size_t>(ty) * m_TilesX + tx] <= minZ) continue;
+
+				// Some of the tile is farther than the box, look at the covered pixels
+				const int px0 = (std::max)(x0, tx * TileSize), px1 = (std::min)(x1, tx * TileSize + TileSize - 1);
+				const int py0 = (std::max)(y0, ty * TileSize), py1 = (std::min)(y1, ty * TileSize + TileSize - 1);
+				for (int y = py0; y <= py1; ++y) {
+					const float* row = m_Depth.data() + static_cast<size_t>(y) * m_Width;
+					for (int x = px0; x <= px1; ++x) {
+						if (row[x] > minZ) return true;
+					}
+				}
+			}
+		}
+		++m_Stats.Occluded;
+		return false;
+	}
+
+	bool OcclusionBuffer::Benchmark(int occluders, int instances, unsigned threadCount) {
+		ThreadPool pool(threadCount);
+		OcclusionBuffer buffer;
+
+		// Camera at the origin looking down +Y over a wall of boxes, instances on a grid behind and beside them
+		DXM::Matrix view = DXM::Matrix::CreateLookAt(DXM::Vector3(0.f, 0.f, 2.f), DXM::Vector3(0.f, 100.f, 2.f), DXM::Vector3(0.f, 0.f, 1.f));
+		DXM::Matrix projection = DXM::Matrix::CreatePerspectiveFieldOfView(DX::XM_PI / 3.f, 2.f, 0.1f, 1000.f);
+
+		const std::vector<DXM::Vector3> cube = {
+			{ -1, -1, -1 }, { 1, -1, -1 }, { 1, 1, -1 }, { -1, 1, -1 },
+			{ -1, -1, 1 }, { 1, -1, 1 }, { 1, 1, 1 }, { -1, 1, 1 } };
+		const std::vector<uint32_t> cubeIndices = {
+			0, 2, 1, 0, 3, 2, 4, 5, 6, 4, 6, 7, 0, 1, 5, 0, 5, 4,
+			1, 2, 6, 1, 6, 5, 2, 3, 7, 2, 7, 6, 3, 0, 4, 3, 4, 7 };
+
+		buffer.Begin(view * projection);
+		for (int i = 0; i < occluders; ++i) {
+			float x = (i % 20 - 10) * 6.f;
+			float y = 20.f + (i / 20) * 8.f;
+			buffer.AddOccluder(cube, cubeIndices, DXM::Matrix::CreateScale(3.f, 1.f, 6.f) * DXM::Matrix::CreateTranslation(x, y, 5.f));
+		}
+		buffer.Rasterise(&pool);
+
+		const int side = static_cast<int>(sqrtf(static_cast<float>(instances)));
+		for (int i = 0; i < side * side; ++i) {
+			DX::BoundingBox box(DXM::Vector3((i % side - side / 2) * 1.5f, 25.f + (i / side) * 1.5f, 0.5f), DXM::Vector3(0.5f, 0.5f, 0.5f));
+			buffer.IsVisible(box);
+		}
+
+		OcclusionStats stats = buffer.GetStats();
+		DXE_INFO("Occlusion benchmark ", buffer.GetWidth(), "x", buffer.GetHeight(), " on ", pool.ThreadCount() + 1, " threads: ",
+			stats.Triangles, " triangles in ", stats.RasteriseSeconds * 1000.0, "ms, ", stats.Occluded, " of ", stats.Tested, " boxes occluded");
+
+		// The first row of the wall spans x -63..57, y 19..21 and z -1..11
+		uint32_t errors = 0;
+		if (occluders >= 20) {
+			const DX::BoundingBox hidden[] = {
+				{ { 0.f, 25.f, 2.f }, { 0.5f, 0.5f, 0.5f } },
+				{ { -24.f, 40.f, 4.f }, { 0.5f, 0.5f, 0.5f } },
+				{ { 36.f, 60.f, 0.5f }, { 0.5f, 0.5f, 0.5f } } };
+			for (const DX::BoundingBox& box : hidden) {
+				if (buffer.IsVisible(box)) ++errors;
+			}
+		}
+		const DX::BoundingBox visible[] = {
+			// in front of the wall
+			{ { 0.f, 10.f, 2.f }, { 0.5f, 0.5f, 0.5f } },
+			{ { -5.f, 12.f, 3.f }, { 0.5f, 0.5f, 0.5f } },
+			{ { 4.f, 15.f, 1.f }, { 0.5f, 0.5f, 0.5f } },
+			// crossing the near plane, the last one reaching into the wall
+			{ { 0.f, 0.f, 2.f }, { 0.5f, 0.5f, 0.5f } },
+			{ { 0.2f, 0.05f, 2.1f }, { 0.1f, 0.1f, 0.1f } },
+			{ { 0.f, 10.f, 2.f }, { 0.5f, 10.f, 0.5f } } };
+		for (const DX::BoundingBox& box : visible) {
+			if (!buffer.IsVisible(box)) ++errors;
+		}
+		if (errors) DXE_ERROR("Occlusion benchmark: ", errors, " checks failed");
+		return errors == 0;
+	}
+}
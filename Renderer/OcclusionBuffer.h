@@ -0,0 +1,73 @@
+#pragma once
+#include "DXE.h"
+#include "Maths/Maths.h"
+#include "ThreadPool.h"
+#include <vector>
+
+namespace DXE
+{
+	struct OcclusionStats {
+		uint32_t Triangles = 0; // occluder triangles rasterised, after near clipping
+		double RasteriseSeconds = 0.0;
+		uint32_t Tested = 0;   // boxes tested since Begin
+		uint32_t Occluded = 0;
+	};
+
+	// Low resolution CPU depth buffer for occlusion culling.
+	// Occluder triangles are transformed and near clipped on AddOccluder, Rasterise() then fills the buffer in
+	// bands of TileSize rows spread over a ThreadPool, four pixels at a time with SSE, and keeps the farthest
+	// depth of every TileSize square tile. IsVisible() projects a box to a screen rectangle at its nearest depth
+	// and reports it hidden only when every pixel under the rectangle holds a nearer occluder, most boxes are
+	// settled by the tile depths alone. Depth is D3D clip z / w, 0 near, 1 far, with SimpleMath's row vectors.
+	class DXE_API OcclusionBuffer {
+	public:
+		static constexpr int TileSize = 8;
+
+		// width a multiple of 4 and both multiples of TileSize
+		OcclusionBuffer(int width = 256, int height = 128);
+
+		// Clears the buffer and the queued occluders
+		void Begin(const DXM::Matrix& viewProjection);
+		void AddOccluder(const DXM::Vector3* positions, const uint32_t* indices, size_t indexCount, const DXM::Matrix& world);
+		void AddOccluder(const std::vector<DXM::Vector3>& positions, const std::vector<uint32_t>& indices, const DXM::Matrix& world) {
+			AddOccluder(positions.data(), indices.data(), indices.size(), world);
+		}
+		// Single threaded without a pool
+		void Rasterise(ThreadPool* pool = nullptr);
+
+		// World space box, conservative: boxes crossing the near plane or entirely off screen count as visible.
+		// Counts into GetStats(), call from one thread at a time.
+		bool IsVisible(const DX::BoundingBox& box) const;
+
+		int GetWidth() const { return m_Width; }
+		int GetHeight() const { return m_Height; }
+		const std::vector<float>& GetDepth() const { return m_Depth; } // row major, top row first
+		const OcclusionStats& GetStats() const { return m_Stats; }
+
+		// Rasterises a field of boxes in front of a grid of instances and logs the raster time and cull rate.
+		// Returns whether boxes behind the wall were occluded and boxes in front of it or crossing the near
+		// plane stayed visible.
+		static bool Benchmark(int occluders = 200, int instances = 100000, unsigned threadCount = 0);
+
+	private:
+		struct Triangle {
+			float X[3];
+			float Y[3];
+			float Z[3];
+		};
+
+		void AddTriangle(const DXM::Vector4& a, const DXM::Vector4& b, const DXM::Vector4& c);
+		void RasteriseBand(int band);
+
+		int m_Width;
+		int m_Height;
+		int m_TilesX;
+		int m_TilesY;
+		DXM::Matrix m_ViewProjection;
+		std::vector<float> m_Depth;
+		std::vector<float> m_TileMax; // farthest depth per tile
+		std::vector<Triangle> m_Triangles;
+		std::vector<std::vector<uint32_t>> m_Bands; // triangles touching each band of TileSize rows
+		mutable OcclusionStats m_Stats;
+	};
+}
@@ -6,7 +6,11 @@
 #include "Logger.h"
 #include "Renderer/ShadowMap.h"
 #include "ShaderManager.h"
+#include "Shader.h"
+#include "StaticBatcher.h"
 #include "Shaders/EmbeddedEngineShaders.h"
+#include <algorithm>
+#include <cfloat>
 
 namespace DXE
 {
@@ -41,6 +45,7 @@ namespace DXE
 
 
     void RenderManager::BeginScene() {
+        ResetBufferBindings();
 
         UpdateGlobalBuffer();
         BindGlobalBuffer();
@@ -88,47 +93,70 @@ namespace DXE
     }
 
 
+    // The single view entry points refresh the cached instance bounds themselves, they may run before any
+    // other pass has this frame. Only moved instances are recomputed, see MeshBase::CalculateInstanceBounds.
     void RenderManager::DrawMesh(MeshBase* mesh, const DX::BoundingFrustum& frustrum) {
 
-   
-        mesh->UpdateVisibleInstances(frustrum);
-        int instanceCount = mesh->GetVisibleInstanceCount();
-
-        int indexCount = mesh->GetIndexCount();
-        mesh->BindVertexBuffer(0);
-        if (instanceCount) {
-            mesh->BindInstanceBuffer(1);
-            Renderer::Context()->DrawIndexedInstanced(indexCount, instanceCount, 0, 0, 0);
-
-        }
+        mesh->CalculateInstanceBounds();
+        mesh->UpdateVisibleInstances(frustrum, m_Occlusion);
+        DrawMeshVisible(mesh);
 
 
     }
     void RenderManager::DrawMeshShadow(MeshBase* mesh, const DX::BoundingOrientedBox& cullBox) {
 
+        mesh->CalculateInstanceBounds();
         mesh->UpdateVisibleInstances(cullBox);
-        int instanceCount = mesh->GetVisibleInstanceCount();
+        DrawShadowInstances(mesh, mesh->GetVisibleInstanceCount(), 0);
+    }
+    void RenderManager::DrawMeshShadow(MeshBase* mesh, const ShadowCasterVolume& casters) {
+        mesh->CalculateInstanceBounds();
+        mesh->UpdateVisibleInstances(casters);
+        DrawShadowInstances(mesh, mesh->GetVisibleInstanceCount(), 0);
+    }
+    void RenderManager::DrawMeshShadowView(MeshBase* mesh, int view) {
+        DrawShadowInstances(mesh, mesh->GetViewInstanceCount(view), mesh->GetViewInstanceOffset(view));
+    }
+    void RenderManager::DrawShadowInstances(MeshBase* mesh, UINT instanceCount, UINT firstInstance) {
+
+        // The packed depth stream when the mesh has one the shadow shader can read, a fifth of the fetch of Vertex
+        const VertexStream stream = m_DepthShader ? m_DepthShader->GetVertexStream() : VertexStream::Full;
+        const bool depthStream = mesh->HasDepthStream(stream);
+        if (depthStream) {
+            m_DepthShader->BindInputLayout(stream);
+            mesh->BindDepthVertexBuffer(0);
+        }
+        else {
+            if (m_DepthShader) m_DepthShader->BindInputLayout(VertexStream::Full);
+            mesh->BindVertexBuffer(0);
+        }
 
         // some meshes have tesselation shaders which expects quads as inputs
         // so the shadow shader wont be correct.
-        // temporarily swap the index buffer to the 'shadow indices' to render normal triangles
-        // during shadow pass.
-        int indexCount = mesh->GetIndexCount();
+        // bind the 'shadow indices' instead to render normal triangles during shadow pass.
+        UINT indexCount = mesh->GetIndexCount();
+        UINT firstIndex = mesh->GetFirstIndex();
         if (mesh->m_HasShadowIndices) {
-            mesh->m_VertexBuffer->UpdateIndices(mesh->m_ShadowIndices);
-            indexCount = mesh->m_ShadowIndices.size();
+            mesh->BindShadowIndexBuffer();
+            indexCount = static_cast<UINT>(mesh->m_ShadowIndices.size());
+            firstIndex = 0;
         }
+        // the depth stream is not pooled, its vertices start at 0
+        const INT baseVertex = depthStream ? 0 : mesh->GetBaseVertex();
 
- 
-
-        mesh->BindVertexBuffer(0);
         if (instanceCount) {
             mesh->BindInstanceBuffer(1);
-            Renderer::Context()->DrawIndexedInstanced(indexCount, instanceCount, 0, 0, 0);
+            Renderer::Context()->DrawIndexedInstanced(indexCount, instanceCount, firstIndex, baseVertex, firstInstance);
         }
+    }
+    void RenderManager::DrawMeshView(MeshBase* mesh, int view) {
 
-        if (mesh->m_HasShadowIndices) {
-            mesh->m_VertexBuffer->UpdateIndices(mesh->m_Indices);
+        UINT instanceCount = mesh->GetViewInstanceCount(view);
+        int indexCount = mesh->GetIndexCount();
+        mesh->BindVertexBuffer(0);
+        if (instanceCount) {
+            mesh->BindInstanceBuffer(1);
+            Renderer::Context()->DrawIndexedInstanced(indexCount, instanceCount, mesh->GetFirstIndex(), mesh->GetBaseVertex(), mesh->GetViewInstanceOffset(view));
         }
     }
     void RenderManager::DrawMeshVisible(MeshBase* mesh) {
@@ -138,7 +166,17 @@ namespace DXE
         mesh->BindVertexBuffer(0);
         if (instanceCount) {
             mesh->BindInstanceBuffer(1);
-            Renderer::Context()->DrawIndexedInstanced(indexCount, instanceCount, 0, 0, 0);
+            if (mesh->HasClusterDraws()) {
+                // surviving meshlet ranges, one instance each
+                const UINT firstIndex = mesh->GetFirstIndex();
+                const INT baseVertex = mesh->GetBaseVertex();
+                for (const MeshletDraw& draw : mesh->GetClusterDraws()) {
+                    Renderer::Context()->DrawIndexedInstanced(draw.IndexCount, 1, firstIndex + draw.FirstIndex, baseVertex, draw.Instance);
+                }
+            }
+            else {
+                Renderer::Context()->DrawIndexedInstanced(indexCount, instanceCount, mesh->GetFirstIndex(), mesh->GetBaseVertex(), 0);
+            }
         }
 
     }
@@ -150,11 +188,31 @@ namespace DXE
         mesh->BindVertexBuffer(0);
         if (instanceCount) {
             mesh->BindInstanceBuffer(1);
-            Renderer::Context()->DrawIndexedInstanced(indexCount, instanceCount, 0, 0, 0);
+            Renderer::Context()->DrawIndexedInstanced(indexCount, instanceCount, mesh->GetFirstIndex(), mesh->GetBaseVertex(), 0);
         }
 
     }
-    void RenderManager::RenderShadowPass(const DX::BoundingOrientedBox& cullBox) {
+    void RenderManager::BuildOcclusion(OcclusionBuffer& occlusion, const DX::BoundingFrustum& frustum, const DXM::Matrix& viewProjection, ThreadPool* pool) {
+        occlusion.Begin(viewProjection);
+        for (MeshBase* mesh : Mesh::GetMeshes()) {
+            if (!mesh->m_Occluder) continue;
+            mesh->CalculateInstanceBounds();
+            mesh->AddOccluders(occlusion, frustum);
+        }
+        occlusion.Rasterise(pool);
+    }
+    void RenderManager::CullMeshes(std::span<const CullView> views) {
+        m_CameraCullingStats = CullingStats();
+        m_CulledViews.assign(views.begin(), views.end());
+        for (MeshBase* mesh : Mesh::GetMeshes()) {
+            if (!mesh->GetMaterial()) continue;
+            mesh->CalculateInstanceBounds();
+            mesh->UpdateVisibleInstances(views);
+            m_CameraCullingStats += mesh->m_CullingStats;
+        }
+    }
+    template<typename Draw>
+    void RenderManager::RenderShadowCasters(Draw&& draw) {
 
         
         Microsoft::WRL::ComPtr<ID3D11RasterizerState> cullFrontState;
@@ -174,7 +232,7 @@ namespace DXE
         auto& meshes = Mesh::GetMeshes();
         for (auto& mesh : meshes) {
             if (mesh->GetMaterial() && mesh->m_CastsShadow) {
-                DrawMeshShadow(mesh, cullBox);
+                draw(mesh);
             }
         }
 
@@ -187,7 +245,60 @@ namespace DXE
   
 
     }
-    void RenderManager::RenderMeshesByMaterial(const DX::BoundingFrustum& cullFrustum) {
+    void RenderManager::RenderShadowPass(const DX::BoundingOrientedBox& cullBox) {
+        RenderShadowCasters([&](MeshBase* mesh) { DrawMeshShadow(mesh, cullBox); });
+    }
+    void RenderManager::RenderShadowPass(const ShadowCasterVolume& casters) {
+        if (casters.IsEmpty()) return;
+        RenderShadowCasters([&](MeshBase* mesh) { DrawMeshShadow(mesh, casters); });
+    }
+    void RenderManager::RenderShadowPass(int view) {
+        RenderShadowCasters([&](MeshBase* mesh) { DrawMeshShadowView(mesh, view); });
+    }
+    bool RenderManager::RenderShadowMap(ShadowMap& shadowMap) {
+        // Bounds refresh also picks up transforms written since the last frame
+        for (MeshBase* mesh : Mesh::GetMeshes()) {
+            if (mesh->GetMaterial() && mesh->m_CastsShadow) mesh->CalculateInstanceBounds();
+        }
+        uint64_t signature = GetShadowCasterSignature();
+        if (shadowMap.incremental && !shadowMap.IsDirty(signature)) {
+            ++shadowMap.passesSkipped;
+            return false;
+        }
+
+        shadowMap.BeginRender();
+        m_DepthShader = shadowMap.GetShader();
+        RenderShadowPass(shadowMap.GetLightBoxWorldSpace());
+        m_DepthShader = nullptr;
+        shadowMap.EndRender();
+        shadowMap.MarkRendered(signature);
+        ++shadowMap.passesRendered;
+        return true;
+    }
+    uint64_t RenderManager::GetShadowCasterSignature(bool staticOnly) {
+        DXM::Fnv1a signature;
+        for (MeshBase* mesh : Mesh::GetMeshes()) {
+            if (!mesh->GetMaterial() || !mesh->m_CastsShadow) continue;
+            if (staticOnly && !mesh->m_Static) continue;
+            signature.Mix(reinterpret_cast<uintptr_t>(mesh));
+            signature.Mix(mesh->m_Version);
+        }
+        return signature.Hash;
+    }
+    bool RenderManager::GetCasterDepthRange(int view, const DXM::Vector3& origin, const DXM::Vector3& direction, float& nearest, float& farthest) const {
+        bool found = false;
+        for (MeshBase* mesh : Mesh::GetMeshes()) {
+            float meshNearest, meshFarthest;
+            if (!mesh->GetMaterial() || !mesh->m_CastsShadow) continue;
+            if (!mesh->GetViewDepthRange(view, origin, direction, meshNearest, meshFarthest)) continue;
+            nearest = found ? (std::min)(nearest, meshNearest) : meshNearest;
+            farthest = found ? (std::max)(farthest, meshFarthest) : meshFarthest;
+            found = true;
+        }
+        return found;
+    }
+    template<typename Draw, typename DrawVisible>
+    void RenderManager::RenderByMaterial(Draw&& draw, DrawVisible&& drawVisible, DepthOrder order, int depthView) {
         // Use a map to group meshes by their material
         std::unordered_map<std::shared_ptr<Material>, std::vector<MeshBase*>> materialGroups;
 
@@ -197,6 +308,7 @@ namespace DXE
         for (auto& mesh : meshes) {
             auto material = mesh->GetMaterial();
             if (material != nullptr) {
+                if (IsBatched(mesh)) continue;
                 materialGroups[material].push_back(mesh);
                 //std::cout << material->GetName() << std::endl;
             }
@@ -205,9 +317,21 @@ namespace DXE
             }
         }
 
+        std::vector<std::pair<std::shared_ptr<Material>, std::vector<MeshBase*>>> groups(materialGroups.begin(), materialGroups.end());
+        if (order != DepthOrder::None) {
+            // Nearest meshes first inside each group and groups by their nearest mesh, reversed for back to front.
+            // Meshes without a depth ordered cull report FLT_MAX and go last.
+            const bool reverse = order == DepthOrder::BackToFront;
+            auto before = [&](float a, float b) { return reverse ? (a != FLT_MAX && (b == FLT_MAX || a > b)) : a < b; };
+            auto nearest = [&](MeshBase* mesh) { return mesh->GetViewNearestDepth(depthView); };
+            for (auto& group : groups) {
+                std::stable_sort(group.second.begin(), group.second.end(), [&](MeshBase* a, MeshBase* b) { return before(nearest(a), nearest(b)); });
+            }
+            std::stable_sort(groups.begin(), groups.end(), [&](const auto& a, const auto& b) { return before(nearest(a.second.front()), nearest(b.second.front())); });
+        }
+
         // Render the groups (this will minimize shader switching)
-        // should this be ordered? Probabaly... (for transparency, shadows, etc)
-        for (auto& group : materialGroups) {
+        for (auto& group : groups) {
             auto& material = group.first;
             auto& meshList = group.second;
 
@@ -223,8 +347,7 @@ namespace DXE
                 // Render all meshes in the group
                 for (MeshBase* mesh : meshList) {
                     // render(mesh); // render the mesh
-                    mesh->CalculateInstanceBoundingRadius();
-                    DrawMesh(mesh, cullFrustum);
+                    draw(mesh);
 
                 }
 
@@ -232,7 +355,7 @@ namespace DXE
                 if (m_DebugNormals) {
                     m_DebugNormalShader->Bind();
                     for (MeshBase* mesh : meshList) {
-                        DrawMeshVisible(mesh);
+                        drawVisible(mesh);
                     }
                 }
             }
@@ -241,4 +364,40 @@ namespace DXE
         }
 
     }
-}
\ No newline at end of file
+    void RenderManager::RenderMeshesByMaterial(const DX::BoundingFrustum& cullFrustum, DepthOrder order) {
+        m_CameraCullingStats = CullingStats();
+        m_CameraClusterStats = MeshletCullStats();
+        if (order == DepthOrder::None) {
+            RenderByMaterial(
+                [&](MeshBase* mesh) {
+                    DrawMesh(mesh, cullFrustum);
+                    m_CameraCullingStats += mesh->m_CullingStats;
+                    m_CameraClusterStats += mesh->m_ClusterStats;
+                },
+                [&](MeshBase* mesh) { DrawMeshVisible(mesh); });
+            if (m_StaticBatcher) m_StaticBatcher->Render(CullView(cullFrustum));
+            return;
+        }
+
+        // Every mesh is culled up front so the groups can be ordered by their nearest instance
+        for (MeshBase* mesh : Mesh::GetMeshes()) {
+            if (!mesh->GetMaterial() || IsBatched(mesh)) continue;
+            mesh->CalculateInstanceBounds();
+            mesh->UpdateVisibleInstances(cullFrustum, m_Occlusion, order);
+            m_CameraCullingStats += mesh->m_CullingStats;
+            m_CameraClusterStats += mesh->m_ClusterStats;
+        }
+        auto draw = [&](MeshBase* mesh) { DrawMeshVisible(mesh); };
+        RenderByMaterial(draw, draw, order, 0);
+        // Batches are drawn after the ordered meshes, their clusters carry no depth order
+        if (m_StaticBatcher) m_StaticBatcher->Render(CullView(cullFrustum));
+    }
+    void RenderManager::RenderMeshesByMaterial(int view, DepthOrder order) {
+        auto draw = [&](MeshBase* mesh) { DrawMeshView(mesh, view); };
+        RenderByMaterial(draw, draw, order, view);
+        if (m_StaticBatcher && view >= 0 && view < static_cast<int>(m_CulledViews.size())) m_StaticBatcher->Render(m_CulledViews[view]);
+    }
+    bool RenderManager::IsBatched(const MeshBase* mesh) const {
+        return m_StaticBatcher && mesh->m_Batched;
+    }
+}
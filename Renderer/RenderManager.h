@@ -2,6 +2,7 @@
 #include "DXE.h"
 #include "Renderer.h"
 #include "Maths/Maths.h"
+#include "MeshBase.h"
 
 namespace DXE
 {
@@ -37,6 +38,7 @@ namespace DXE
     class MeshBase;
     class ShadowMap;
     class Shader;
+    class StaticBatcher;
     class DXE_API RenderManager
     {
     public:
@@ -94,13 +96,39 @@ namespace DXE
 
 
         void BeginScene();
-        void RenderMeshesByMaterial(const DX::BoundingFrustum& cullFrustum);
+        // order sorts instances and meshes by distance from the camera: FrontToBack for opaque passes to
+        // help early Z, BackToFront for transparent ones
+        void RenderMeshesByMaterial(const DX::BoundingFrustum& cullFrustum, DepthOrder order = DepthOrder::None);
         void RenderShadowPass(const DX::BoundingOrientedBox& cullBox);
-
+        // Draws only the casters that can shadow what the camera sees, see ShadowMap::BuildCasterVolume
+        void RenderShadowPass(const ShadowCasterVolume& casters);
+
+        // Culls every mesh against all views in one pass, the view overloads below then draw the
+        // precomputed instance ranges without culling again, e.g. CullMeshes({ camera, shadowBox }),
+        // RenderShadowPass(1), RenderMeshesByMaterial(0)
+        void CullMeshes(std::span<const CullView> views);
+        // Meshes are ordered when the view was culled with a CullView::Order, pass the same order
+        void RenderMeshesByMaterial(int view, DepthOrder order = DepthOrder::None);
+        void RenderShadowPass(int view);
+        // Redraws the shadow map from its light box only when the light matrix or a caster changed,
+        // otherwise counts a skipped pass on it. Returns whether it was redrawn.
+        bool RenderShadowMap(ShadowMap& shadowMap);
+        // Changes whenever a shadow casting mesh, its instance set or an instance transform changes
+        static uint64_t GetShadowCasterSignature(bool staticOnly = false);
+        // Depth extent along direction of the shadow casters kept by the last CullMeshes for view, for ShadowMap::FitDepthRange
+        bool GetCasterDepthRange(int view, const DXM::Vector3& origin, const DXM::Vector3& direction, float& nearest, float& farthest) const;
+
+
+        // Rasterises the instances of every m_Occluder mesh inside frustum, spread over pool when given.
+        // Camera culls then skip what it hides through CullView::Occlusion or m_Occlusion.
+        void BuildOcclusion(OcclusionBuffer& occlusion, const DX::BoundingFrustum& frustum, const DXM::Matrix& viewProjection, ThreadPool* pool = nullptr);
 
         void DrawMesh(MeshBase* mesh, const DX::BoundingFrustum& frustrum);
 
         void DrawMeshShadow(MeshBase* mesh, const DX::BoundingOrientedBox& cullBox);
+        void DrawMeshShadow(MeshBase* mesh, const ShadowCasterVolume& casters);
+        void DrawMeshView(MeshBase* mesh, int view);
+        void DrawMeshShadowView(MeshBase* mesh, int view);
         void DrawMeshVisible(MeshBase* mesh);
         void DrawMesh(MeshBase* mesh);
 
@@ -115,9 +143,29 @@ namespace DXE
 
         GlobalCBuffer GlobalBuffer;
         bool m_DebugNormals = false;
+        // Tested by RenderMeshesByMaterial(frustum) when set
+        const OcclusionBuffer* m_Occlusion = nullptr;
+        // Shader bound for the shadow pass being drawn, when set meshes with a depth stream it can read bind that
+        // instead of the full vertices (MeshBase::SetDepthStream). RenderShadowMap and CascadedShadowMap set it.
+        Shader* m_DepthShader = nullptr;
+        // Camera passes draw its batches in place of the meshes it batched, see StaticBatcher. Shadow passes
+        // keep drawing the meshes.
+        StaticBatcher* m_StaticBatcher = nullptr;
+
+        // Camera pass totals of the last frame, set MeshBase::m_TrackCullingGain to compare against origin spheres
+        const CullingStats& GetCameraCullingStats() const { return m_CameraCullingStats; }
+        // Meshlet totals of the meshes drawn with cluster culling, see MeshBase::SetClusterCulling
+        const MeshletCullStats& GetCameraClusterStats() const { return m_CameraClusterStats; }
 
 
     private:
+         template<typename Draw, typename DrawVisible>
+         void RenderByMaterial(Draw&& draw, DrawVisible&& drawVisible, DepthOrder order = DepthOrder::None, int depthView = 0);
+         template<typename Draw>
+         void RenderShadowCasters(Draw&& draw);
+         void DrawShadowInstances(MeshBase* mesh, UINT instanceCount, UINT firstInstance);
+         bool IsBatched(const MeshBase* mesh) const;
+
          Microsoft::WRL::ComPtr<ID3D11Buffer> m_GlobalConstantBuffer;
 
 
@@ -127,6 +175,10 @@ namespace DXE
 
          Shader* m_DebugNormalShader = nullptr;
 
+         CullingStats m_CameraCullingStats;
+         MeshletCullStats m_CameraClusterStats;
+         std::vector<CullView> m_CulledViews; // of the last CullMeshes, for the static batches
+
 
 
     };
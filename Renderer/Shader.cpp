@@ -1,5 +1,6 @@
 #include "pch.h"
 #include "Shader.h"
+#include <cstddef>
 
 
 
@@ -59,6 +60,7 @@ namespace DXE
                     m_InputLayout.GetAddressOf()
                 );
                 assert(SUCCEEDED(hr));
+                CreateStreamInputLayout(shaderStruct.vs->data, shaderStruct.vs->length);
 
                 if (rawReflection) rawReflection->Release();
             }
@@ -148,6 +150,7 @@ namespace DXE
 
             hResult = Renderer::Device()->CreateInputLayout(m_InputLayoutDesc.data(), static_cast<uint32_t>(m_InputLayoutDesc.size()), vsBlob->GetBufferPointer(), vsBlob->GetBufferSize(), m_InputLayout.GetAddressOf());
             assert(SUCCEEDED(hResult));
+            CreateStreamInputLayout(vsBlob->GetBufferPointer(), vsBlob->GetBufferSize());
         }
         else {
             DXE_WARN("Vertex shader not compiled (maybe not used in this shader).");
@@ -284,8 +287,37 @@ namespace DXE
 
     }
 
+    void Shader::BindInputLayout(VertexStream stream) {
+        if (stream != VertexStream::Full && m_StreamInputLayout && stream >= m_VertexStream) {
+            Renderer::Context()->IASetInputLayout(m_StreamInputLayout.Get());
+        }
+        else {
+            Renderer::Context()->IASetInputLayout(m_InputLayout.Get());
+        }
+    }
+
+    void Shader::CreateStreamInputLayout(const void* bytecode, size_t length) {
+        m_StreamInputLayout.Reset();
+        if (m_VertexStream == VertexStream::Full) return;
+
+        // Same elements, the per vertex ones packed: position first, then the UV
+        std::vector<D3D11_INPUT_ELEMENT_DESC> desc = m_InputLayoutDesc;
+        for (D3D11_INPUT_ELEMENT_DESC& element : desc) {
+            if (element.InputSlotClass != D3D11_INPUT_PER_VERTEX_DATA) continue;
+            element.AlignedByteOffset = strcmp(element.SemanticName, "POSITION") == 0 ? 0 : sizeof(DXM::Vector3);
+        }
+        HRESULT hr = Renderer::Device()->CreateInputLayout(desc.data(), static_cast<uint32_t>(desc.size()), bytecode, length, m_StreamInputLayout.GetAddressOf());
+        if (FAILED(hr)) {
+            DXE_WARN("Shader ", m_Name, ": no packed vertex stream input layout");
+            m_VertexStream = VertexStream::Full;
+        }
+    }
+
     void Shader::ReflectInputLayout(ID3D11ShaderReflection* rawReflection) {
         m_InputLayoutDesc.clear();
+        m_VertexStream = VertexStream::Full;
+        bool packable = true;
+        bool readsPosition = false, readsUV = false;
 
         
         Microsoft::WRL::ComPtr<ID3D11ShaderReflection> reflection;
@@ -328,6 +360,17 @@ namespace DXE
             }
             elementDesc.AlignedByteOffset = D3D11_APPEND_ALIGNED_ELEMENT;
 
+            // Vertex members by semantic, so shaders reading only some of them still find them in the full stream
+            if (elementDesc.InputSlotClass == D3D11_INPUT_PER_VERTEX_DATA) {
+                const bool first = paramDesc.SemanticIndex == 0;
+                if (first && strcmp(paramDesc.SemanticName, "POSITION") == 0) { elementDesc.AlignedByteOffset = offsetof(Vertex, Position); readsPosition = true; }
+                else if (first && strcmp(paramDesc.SemanticName, "NORMAL") == 0) { elementDesc.AlignedByteOffset = offsetof(Vertex, Normal); packable = false; }
+                else if (first && strcmp(paramDesc.SemanticName, "TANGENT") == 0) { elementDesc.AlignedByteOffset = offsetof(Vertex, Tangent); packable = false; }
+                else if (first && strcmp(paramDesc.SemanticName, "TEXCOORD") == 0) { elementDesc.AlignedByteOffset = offsetof(Vertex, UV); readsUV = true; }
+                else if (first && strcmp(paramDesc.SemanticName, "COLOR") == 0) { elementDesc.AlignedByteOffset = offsetof(Vertex, Color); packable = false; }
+                else packable = false;
+            }
+
             if (paramDesc.Mask == 1) {
                 elementDesc.Format = DXGI_FORMAT_R32_FLOAT;  //float
             }
@@ -355,6 +398,9 @@ namespace DXE
 
             m_InputLayoutDesc.push_back(elementDesc);
         }
+        if (packable && readsPosition) {
+            m_VertexStream = readsUV ? VertexStream::PositionUV : VertexStream::Position;
+        }
 
 
         for (UINT i = 0; i < shaderDesc.ConstantBuffers; ++i) {
@@ -6,6 +6,7 @@
 #include <iostream>
 #include "Maths/Maths.h"
 #include "ShaderByte.h"
+#include "Buffer.h"
 
 namespace DXE
 {
@@ -55,9 +56,18 @@ namespace DXE
         void SetTexture(ID3D11ShaderResourceView* texture);
         ID3D11ComputeShader* GetComputeShader() { return m_ComputeShader.Get(); };
 
+        // Smallest vertex stream holding every per vertex input: Position when the shader only reads POSITION,
+        // PositionUV when it adds TEXCOORD, Full otherwise
+        VertexStream GetVertexStream() const { return m_VertexStream; }
+        // Input layout for vertices from stream, Bind() sets the Full one. Smaller streams than
+        // GetVertexStream() fall back to Full.
+        void BindInputLayout(VertexStream stream);
+
 
     private:
         void ReflectInputLayout(ID3D11ShaderReflection* rawReflection);
+        // Second layout reading the packed stream picked by ReflectInputLayout, needs the reflection still alive
+        void CreateStreamInputLayout(const void* bytecode, size_t length);
         UINT GetDXGIFormatSize(DXGI_FORMAT format) {
             std::cout << "DXGI_FORMAT: " << format << std::endl;  // Debugging line
             switch (format) {
@@ -109,6 +119,8 @@ namespace DXE
 
         Microsoft::WRL::ComPtr<ID3D11InputLayout> m_InputLayout;
         std::vector<D3D11_INPUT_ELEMENT_DESC> m_InputLayoutDesc;
+        VertexStream m_VertexStream = VertexStream::Full;
+        Microsoft::WRL::ComPtr<ID3D11InputLayout> m_StreamInputLayout;
 
 
         Microsoft::WRL::ComPtr<ID3D11Buffer> m_VertexConstantBuffer;
@@ -0,0 +1,181 @@
+#include "pch.h"
+#include "ShadowCasterVolume.h"
+#include <cfloat>
+
+namespace DXE
+{
+	namespace {
+		constexpr float PlaneEpsilon = 1e-3f; // world units, points this close to a plane count as on it
+
+		float Distance(const DXM::Vector4& plane, const DXM::Vector3& p) {
+			return plane.x * p.x + plane.y * p.y + plane.z * p.z + plane.w;
+		}
+
+		DXM::Vector3 Normal(const DXM::Vector4& plane) {
+			return DXM::Vector3(plane.x, plane.y, plane.z);
+		}
+
+		// Normalised plane with its normal pointing away from inside
+		DXM::Vector4 Outward(DXM::Vector4 plane, const DXM::Vector3& inside) {
+			float length = Normal(plane).Length();
+			if (length > 0.f) plane /= length;
+			if (Distance(plane, inside) > 0.f) plane = -plane;
+			return plane;
+		}
+
+		bool Intersect(const DXM::Vector4& a, const DXM::Vector4& b, const DXM::Vector4& c, DXM::Vector3& point) {
+			DXM::Vector3 na = Normal(a), nb = Normal(b), nc = Normal(c);
+			DXM::Vector3 bc = nb.Cross(nc), ca = nc.Cross(na), ab = na.Cross(nb);
+			float det = na.Dot(bc);
+			if (fabs(det) < 1e-6f) return false;
+			point = (bc * -a.w + ca * -b.w + ab * -c.w) / det;
+			return true;
+		}
+
+		bool SamePlane(const DXM::Vector4& a, const DXM::Vector4& b) {
+			return Normal(a).Dot(Normal(b)) > 0.9999f && fabs(a.w - b.w) < PlaneEpsilon;
+		}
+
+		void AddPlane(std::vector<DXM::Vector4>& planes, const DXM::Vector4& plane) {
+			for (const auto& p : planes) {
+				if (SamePlane(p, plane)) return;
+			}
+			planes.push_back(plane);
+		}
+	}
+
+	ShadowCasterVolume::ShadowCasterVolume(const DX::BoundingFrustum& camera, const DX::BoundingOrientedBox& lightBox, const DXM::Vector3& lightDirection) {
+		DXM::Vector3 corners[DX::BoundingFrustum::CORNER_COUNT];
+		camera.GetCorners(corners);
+		DXM::Vector3 centre;
+		for (const auto& corner : corners) centre += corner;
+		centre /= static_cast<float>(DX::BoundingFrustum::CORNER_COUNT);
+
+		DX::XMVECTOR frustumPlanes[6];
+		camera.GetPlanes(&frustumPlanes[0], &frustumPlanes[1], &frustumPlanes[2], &frustumPlanes[3], &frustumPlanes[4], &frustumPlanes[5]);
+		std::vector<DXM::Vector4> receiverPlanes;
+		for (const auto& plane : frustumPlanes) receiverPlanes.push_back(Outward(DXM::Vector4(plane), centre));
+
+		// Box faces from its rotated axes
+		const DXM::Vector3 boxCentre(lightBox.Center);
+		const DXM::Quaternion orientation(lightBox.Orientation);
+		const float extents[3] = { lightBox.Extents.x, lightBox.Extents.y, lightBox.Extents.z };
+		const DXM::Vector3 units[3] = { DXM::Vector3::UnitX, DXM::Vector3::UnitY, DXM::Vector3::UnitZ };
+		std::vector<DXM::Vector4> lightPlanes;
+		for (int axis = 0; axis < 3; ++axis) {
+			DXM::Vector3 n = DXM::Vector3::Transform(units[axis], orientation);
+			for (float sign : { 1.f, -1.f }) {
+				DXM::Vector3 normal = n * sign;
+				lightPlanes.emplace_back(normal.x, normal.y, normal.z, -(normal.Dot(boxCentre) + extents[axis]));
+			}
+		}
+
+		Build(receiverPlanes, lightPlanes, lightDirection);
+	}
+
+	void ShadowCasterVolume::Build(const std::vector<DXM::Vector4>& receiverPlanes, const std::vector<DXM::Vector4>& lightPlanes, const DXM::Vector3& lightDirection) {
+		m_Planes.clear();
+		m_Corners.clear();
+		m_Direction = lightDirection;
+		m_Direction.Normalize();
+
+		std::vector<DXM::Vector4> all(receiverPlanes);
+		all.insert(all.end(), lightPlanes.begin(), lightPlanes.end());
+
+		// Corners of the clipped receiver region, every triple of planes meeting inside all of them
+		const size_t planeCount = all.size();
+		for (size_t i = 0; i < planeCount; ++i) {
+			for (size_t j = i + 1; j < planeCount; ++j) {
+				for (size_t k = j + 1; k < planeCount; ++k) {
+					DXM::Vector3 point;
+					if (!Intersect(all[i], all[j], all[k], point)) continue;
+
+					bool inside = true;
+					for (const auto& plane : all) {
+						if (Distance(plane, point) > PlaneEpsilon) { inside = false; break; }
+					}
+					if (!inside) continue;
+
+					bool duplicate = false;
+					for (const auto& corner : m_Corners) {
+						if (DXM::Vector3::DistanceSquared(corner, point) < PlaneEpsilon * PlaneEpsilon) { duplicate = true; break; }
+					}
+					if (!duplicate) m_Corners.push_back(point);
+				}
+			}
+		}
+		if (m_Corners.size() < 4) {
+			m_Corners.clear();
+			return;
+		}
+
+		// Sweeping towards the light keeps the faces turned away from it
+		for (const auto& plane : all) {
+			if (Normal(plane).Dot(m_Direction) < -1e-4f) continue;
+			int onPlane = 0;
+			for (const auto& corner : m_Corners) {
+				if (fabs(Distance(plane, corner)) <= PlaneEpsilon) ++onPlane;
+			}
+			if (onPlane >= 3) AddPlane(m_Planes, plane);
+		}
+
+		// Sides of the sweep, planes through a silhouette edge parallel to the light with every corner behind them
+		for (size_t i = 0; i < m_Corners.size(); ++i) {
+			for (size_t j = i + 1; j < m_Corners.size(); ++j) {
+				DXM::Vector3 normal = (m_Corners[j] - m_Corners[i]).Cross(m_Direction);
+				if (normal.LengthSquared() < 1e-8f) continue;
+				normal.Normalize();
+				DXM::Vector4 plane(normal.x, normal.y, normal.z, -normal.Dot(m_Corners[i]));
+
+				bool front = false, back = false;
+				for (const auto& corner : m_Corners) {
+					float d = Distance(plane, corner);
+					if (d > PlaneEpsilon) front = true;
+					else if (d < -PlaneEpsilon) back = true;
+				}
+				if (front && back) continue;
+				AddPlane(m_Planes, front ? -plane : plane);
+			}
+		}
+
+		// The sweep stops where the shadow map does
+		for (const auto& plane : lightPlanes) AddPlane(m_Planes, plane);
+	}
+
+	DX::ContainmentType ShadowCasterVolume::Contains(const DX::BoundingSphere& sphere) const {
+		if (m_Planes.empty()) return DX::DISJOINT;
+		const DXM::Vector3 centre(sphere.Center);
+		bool intersects = false;
+		for (const auto& plane : m_Planes) {
+			float d = Distance(plane, centre);
+			if (d > sphere.Radius) return DX::DISJOINT;
+			if (d > -sphere.Radius) intersects = true;
+		}
+		return intersects ? DX::INTERSECTS : DX::CONTAINS;
+	}
+
+	DX::ContainmentType ShadowCasterVolume::Contains(const DX::BoundingBox& box) const {
+		if (m_Planes.empty()) return DX::DISJOINT;
+		const DXM::Vector3 centre(box.Center);
+		bool intersects = false;
+		for (const auto& plane : m_Planes) {
+			float d = Distance(plane, centre);
+			float r = fabs(plane.x) * box.Extents.x + fabs(plane.y) * box.Extents.y + fabs(plane.z) * box.Extents.z;
+			if (d > r) return DX::DISJOINT;
+			if (d > -r) intersects = true;
+		}
+		return intersects ? DX::INTERSECTS : DX::CONTAINS;
+	}
+
+	bool ShadowCasterVolume::GetReceiverDepthRange(const DXM::Vector3& origin, float& nearest, float& farthest) const {
+		if (m_Corners.empty()) return false;
+		nearest = FLT_MAX;
+		farthest = -FLT_MAX;
+		for (const auto& corner : m_Corners) {
+			float depth = (corner - origin).Dot(m_Direction);
+			nearest = (std::min)(nearest, depth);
+			farthest = (std::max)(farthest, depth);
+		}
+		return true;
+	}
+}
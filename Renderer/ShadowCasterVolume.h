@@ -0,0 +1,38 @@
+#pragma once
+#include "DXE.h"
+#include "Maths/Maths.h"
+#include <vector>
+
+namespace DXE
+{
+	// Region whose occluders can throw a shadow onto anything the camera sees.
+	// The camera frustum is clipped to the light's ortho box, giving the visible receivers, and swept back
+	// towards the light; the result is kept inside the light box. Casters outside it either shadow only
+	// off screen ground or never reach the shadow map, so they can be skipped. Planes point outwards,
+	// a point p is outside a plane when dot(Normal, p) + w > 0. Usable as a CullView.
+	class DXE_API ShadowCasterVolume {
+	public:
+		ShadowCasterVolume() = default;
+		// lightDirection is the direction light travels in, the same as the sun direction
+		ShadowCasterVolume(const DX::BoundingFrustum& camera, const DX::BoundingOrientedBox& lightBox, const DXM::Vector3& lightDirection);
+
+		DX::ContainmentType Contains(const DX::BoundingSphere& sphere) const;
+		DX::ContainmentType Contains(const DX::BoundingBox& box) const;
+
+		// True when the camera sees nothing inside the light box
+		bool IsEmpty() const { return m_Planes.empty(); }
+		const std::vector<DXM::Vector4>& GetPlanes() const { return m_Planes; }
+		// Corners of the camera frustum clipped to the light box
+		const std::vector<DXM::Vector3>& GetReceiverCorners() const { return m_Corners; }
+		// Distances of the receiver corners along the light direction from origin, false when empty
+		bool GetReceiverDepthRange(const DXM::Vector3& origin, float& nearest, float& farthest) const;
+
+		// Builds from outward planes of two convex volumes, exposed for callers with their own volumes
+		void Build(const std::vector<DXM::Vector4>& receiverPlanes, const std::vector<DXM::Vector4>& lightPlanes, const DXM::Vector3& lightDirection);
+
+	private:
+		std::vector<DXM::Vector4> m_Planes;
+		std::vector<DXM::Vector3> m_Corners;
+		DXM::Vector3 m_Direction;
+	};
+}
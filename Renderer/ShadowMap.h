@@ -4,6 +4,7 @@
 #include "Maths/Maths.h"
 #include "Renderer/Shader.h"
 #include "Scene/Camera.h"
+#include "Renderer/ShadowCasterVolume.h"
 
 namespace DXE {
     class DXE_API ShadowMap {
@@ -23,6 +24,17 @@ namespace DXE {
         DXM::Matrix lightProj;
         DXM::Matrix lightViewProj;
 
+        // Incremental invalidation, see RenderManager::RenderShadowMap. The map is kept while no light matrix
+        // element moves more than invalidationEpsilon and the caster signature is unchanged.
+        bool incremental = true;
+        float invalidationEpsilon = 1e-5f;
+        uint32_t passesRendered = 0;
+        uint32_t passesSkipped = 0;
+
+        // Set by Update, lightDirection is normalised
+        DXM::Vector3 lightPosition;
+        DXM::Vector3 lightDirection;
+
 
         ShadowMap(UINT width, UINT height, Shader* shader);
         ~ShadowMap() = default;
@@ -42,6 +54,7 @@ namespace DXE {
 
         UINT GetWidth() const { return width; }
         UINT GetHeight() const { return height; }
+        Shader* GetShader() const { return shader; }
 
 
         void Update(DXM::Vector3 focusPos, DXM::Vector3 sunDirection, DXE::Camera& camera) {
@@ -50,6 +63,8 @@ namespace DXE {
              sunDirection.Normalize();
              // Calculate light position (offset from player along -SunDirection)
              DXM::Vector3 lightPos = focusPos - sunDirection * lightDistance;
+             lightPosition = lightPos;
+             lightDirection = sunDirection;
              
              // Choose an up vector for the view matrix
              // Define your world up as +Z axis
@@ -94,9 +109,48 @@ namespace DXE {
         }
 
 
+        // Casters that can shadow something inside the camera frustum, call after Update.
+        // Cull with it through RenderShadowPass(casters) or as a CullView next to the camera.
+        ShadowCasterVolume BuildCasterVolume(const DX::BoundingFrustum& cameraFrustum) {
+            return ShadowCasterVolume(cameraFrustum, GetLightBoxWorldSpace(), lightDirection);
+        }
+
+        // Tightens the projection to [nearest, farthest] along the light from lightPosition, clamped to
+        // nearPlane / farPlane, to spend depth precision on the range in use. Nearest from the culled
+        // casters (RenderManager::GetCasterDepthRange), farthest from the receivers
+        // (ShadowCasterVolume::GetReceiverDepthRange). Update restores the full range.
+        void FitDepthRange(float nearest, float farthest) {
+            float fitNear = (std::max)(nearest, nearPlane);
+            float fitFar = (std::min)(farthest, farPlane);
+            if (fitFar <= fitNear) return;
+            lightProj = DXM::Matrix::CreateOrthographic(orthoWidth, orthoHeight, fitNear, fitFar);
+            lightViewProj = lightView * lightProj;
+        }
+
+        bool IsDirty(uint64_t casterSignature) const {
+            if (!hasRendered || casterSignature != renderedSignature) return true;
+            const float* current = &lightViewProj._11;
+            const float* rendered = &renderedViewProj._11;
+            for (int i = 0; i < 16; ++i) {
+                if (fabs(current[i] - rendered[i]) > invalidationEpsilon) return true;
+            }
+            return false;
+        }
+        void MarkRendered(uint64_t casterSignature) {
+            renderedViewProj = lightViewProj;
+            renderedSignature = casterSignature;
+            hasRendered = true;
+        }
+        // Forces the next RenderShadowMap to redraw
+        void Invalidate() { hasRendered = false; }
+
     private:
         void CreateResources();
 
+        DXM::Matrix renderedViewProj;
+        uint64_t renderedSignature = 0;
+        bool hasRendered = false;
+
         UINT width;
         UINT height;
 
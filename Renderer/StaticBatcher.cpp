@@ -0,0 +1,289 @@
+#include "pch.h"
+#include "StaticBatcher.h"
+#include "Mesh.h"
+#include "Renderer.h"
+#include "Logger.h"
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+
+namespace DXE
+{
+	StaticBatcher::StaticBatcher(const StaticBatchingSettings& settings)
+		: m_Settings(settings), m_Pool(std::make_unique<ThreadPool>((std::max)(1u, settings.ThreadCount)))
+	{
+	}
+
+	StaticBatcher::~StaticBatcher() {
+		m_Pool.reset(); // joins the worker before the result it writes goes away
+		Clear();
+	}
+
+	bool StaticBatcher::IsCandidate(MeshBase* mesh) const {
+		return mesh->m_Static && mesh->GetMaterial() && !mesh->m_HasShadowIndices && !mesh->GetClusterCulling() &&
+			!mesh->m_Vertices.empty() && mesh->m_Vertices.size() <= m_Settings.MaxMeshVertices && mesh->GetInstanceCount() > 0;
+	}
+
+	uint64_t StaticBatcher::ComputeSignature() const {
+		DXM::Fnv1a signature;
+		bool any = false;
+		for (MeshBase* mesh : Mesh::GetMeshes()) {
+			if (!IsCandidate(mesh)) continue;
+			signature.Mix(reinterpret_cast<uintptr_t>(mesh));
+			signature.Mix(reinterpret_cast<uintptr_t>(mesh->GetMaterial().get()));
+			signature.Mix(mesh->m_Version);
+			// m_Instances is public, the count also catches entities added or destroyed without the mesh
+			signature.Mix(static_cast<uint64_t>(mesh->GetInstanceCount()));
+			any = true;
+		}
+		return any ? signature.Hash : 0;
+	}
+
+	void StaticBatcher::Update() {
+		std::unique_ptr<BuildResult> completed;
+		{
+			std::lock_guard<std::mutex> lock(m_CompletedMutex);
+			completed = std::move(m_Completed);
+		}
+		if (completed) {
+			m_Building = false;
+			Apply(*completed);
+		}
+
+		const uint64_t signature = ComputeSignature();
+		if (signature == m_Signature) return;
+		// The batches no longer match the meshes, they draw on their own until the rebuild lands
+		Unbatch();
+		if (signature && !m_Building) StartBuild(signature);
+	}
+
+	void StaticBatcher::StartBuild(uint64_t signature) {
+		// Snapshot on the render thread, the worker never touches a MeshBase
+		std::vector<SourceMesh> sources;
+		for (MeshBase* mesh : Mesh::GetMeshes()) {
+			if (!IsCandidate(mesh)) continue;
+			SourceMesh source;
+			source.Mesh = mesh;
+			source.Material = mesh->GetMaterial();
+			source.Vertices = mesh->m_Vertices;
+			source.Indices = mesh->m_Indices;
+			auto& storage = mesh->m_Instances.storage<InstanceData>();
+			source.Instances.assign(storage.begin(), storage.end());
+			sources.push_back(std::move(source));
+		}
+
+		m_Building = true;
+		++m_Stats.Builds;
+		m_Pool->Submit([this, sources = std::move(sources), settings = m_Settings, signature]() mutable {
+			std::unique_ptr<BuildResult> result = Build(std::move(sources), settings);
+			result->Signature = signature;
+			std::lock_guard<std::mutex> lock(m_CompletedMutex);
+			m_Completed = std::move(result);
+		});
+	}
+
+	std::unique_ptr<StaticBatcher::BuildResult> StaticBatcher::Build(std::vector<SourceMesh> sources, const StaticBatchingSettings& settings) {
+		auto start = std::chrono::high_resolution_clock::now();
+		auto result = std::make_unique<BuildResult>();
+
+		// One piece per instance, keyed by batch and the Morton code of its cell
+		struct Piece {
+			uint32_t Source;
+			uint32_t Instance;
+			uint32_t Batch;
+			uint32_t Cell;
+		};
+		std::vector<Piece> pieces;
+		const float cellScale = 1.f / (std::max)(settings.ClusterSize, 1e-3f);
+		for (uint32_t s = 0; s < sources.size(); ++s) {
+			const SourceMesh& source = sources[s];
+			result->Meshes.push_back(source.Mesh);
+			DXM::Vector3 lo(FLT_MAX, FLT_MAX, FLT_MAX), hi(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+			for (const Vertex& vertex : source.Vertices) {
+				lo = DXM::Vector3::Min(lo, vertex.Position);
+				hi = DXM::Vector3::Max(hi, vertex.Position);
+			}
+			const DXM::Vector3 centre = (lo + hi) * 0.5f;
+
+			for (uint32_t i = 0; i < source.Instances.size(); ++i) {
+				const InstanceData& instance = source.Instances[i];
+				auto batch = std::find_if(result->Batches.begin(), result->Batches.end(), [&](const BatchGeometry& b) {
+					return b.Material == source.Material && b.Colour == instance.Color;
+				});
+				if (batch == result->Batches.end()) {
+					BatchGeometry geometry;
+					geometry.Material = source.Material;
+					geometry.Colour = instance.Color;
+					batch = result->Batches.insert(result->Batches.end(), std::move(geometry));
+				}
+				DXM::Vector3 cell = DXM::Vector3::Transform(centre, instance.Transform) * cellScale;
+				// 10 bits per axis, cells 1024 apart share a code and only cost some cluster tightness
+				uint32_t x = static_cast<uint32_t>(static_cast<int32_t>(floorf(cell.x)) + 512);
+				uint32_t y = static_cast<uint32_t>(static_cast<int32_t>(floorf(cell.y)) + 512);
+				uint32_t z = static_cast<uint32_t>(static_cast<int32_t>(floorf(cell.z)) + 512);
+				pieces.push_back({ s, i, static_cast<uint32_t>(batch - result->Batches.begin()), DXM::MortonCode(x, y, z) });
+			}
+		}
+		result->Instances = static_cast<uint32_t>(pieces.size());
+		std::sort(pieces.begin(), pieces.end(), [](const Piece& a, const Piece& b) {
+			return a.Batch != b.Batch ? a.Batch < b.Batch : a.Cell < b.Cell;
+		});
+
+		// Geometry in world space, one cluster per cell and batch unless it outgrows MaxClusterVertices
+		std::vector<uint32_t> clusterVertices(result->Batches.size(), 0);
+		uint32_t previousBatch = UINT32_MAX, previousCell = 0;
+		DXM::Vector3 lo, hi;
+		for (const Piece& piece : pieces) {
+			const SourceMesh& source = sources[piece.Source];
+			const InstanceData& instance = source.Instances[piece.Instance];
+			BatchGeometry& batch = result->Batches[piece.Batch];
+
+			if (piece.Batch != previousBatch || piece.Cell != previousCell || clusterVertices[piece.Batch] + source.Vertices.size() > settings.MaxClusterVertices) {
+				batch.Clusters.push_back({ DX::BoundingBox(), static_cast<uint32_t>(batch.Indices.size()), 0, static_cast<uint32_t>(batch.ClusterMeshes.size()), 0 });
+				clusterVertices[piece.Batch] = 0;
+				lo = DXM::Vector3(FLT_MAX, FLT_MAX, FLT_MAX);
+				hi = DXM::Vector3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+				previousBatch = piece.Batch;
+				previousCell = piece.Cell;
+			}
+
+			const DXM::Matrix& world = instance.Transform;
+			const DXM::Matrix normalMatrix = world.Invert().Transpose();
+			const uint32_t base = static_cast<uint32_t>(batch.Vertices.size());
+			for (Vertex vertex : source.Vertices) {
+				vertex.Position = DXM::Vector3::Transform(vertex.Position, world);
+				vertex.Normal = DXM::Vector3::TransformNormal(vertex.Normal, normalMatrix);
+				vertex.Normal.Normalize();
+				vertex.Tangent = DXM::Vector3::TransformNormal(vertex.Tangent, world);
+				vertex.Tangent.Normalize();
+				lo = DXM::Vector3::Min(lo, vertex.Position);
+				hi = DXM::Vector3::Max(hi, vertex.Position);
+				batch.Vertices.push_back(vertex);
+			}
+			// A mirroring transform turns the winding around
+			const bool flip = world.Determinant() < 0.f;
+			for (size_t i = 0; i + 2 < source.Indices.size(); i += 3) {
+				batch.Indices.push_back(base + source.Indices[i]);
+				batch.Indices.push_back(base + source.Indices[flip ? i + 2 : i + 1]);
+				batch.Indices.push_back(base + source.Indices[flip ? i + 1 : i + 2]);
+			}
+			clusterVertices[piece.Batch] += static_cast<uint32_t>(source.Vertices.size());
+
+			StaticCluster& cluster = batch.Clusters.back();
+			auto clusterMeshes = batch.ClusterMeshes.begin() + cluster.FirstMesh;
+			if (std::find(clusterMeshes, batch.ClusterMeshes.end(), piece.Source) == batch.ClusterMeshes.end()) {
+				batch.ClusterMeshes.push_back(piece.Source);
+				++cluster.MeshCount;
+			}
+			cluster.IndexCount = static_cast<uint32_t>(batch.Indices.size()) - cluster.FirstIndex;
+			cluster.Bounds.Center = (lo + hi) * 0.5f;
+			cluster.Bounds.Extents = (hi - lo) * 0.5f;
+		}
+
+		// Batches sharing a material next to each other, so Render binds it once
+		std::stable_sort(result->Batches.begin(), result->Batches.end(), [](const BatchGeometry& a, const BatchGeometry& b) {
+			return a.Material.get() < b.Material.get();
+		});
+		result->Seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+		return result;
+	}
+
+	void StaticBatcher::Apply(BuildResult& result) {
+		if (result.Signature != ComputeSignature()) {
+			// the static set changed while building, Update starts another build
+			++m_Stats.Discarded;
+			return;
+		}
+		Unbatch();
+
+		m_Stats.Clusters = 0;
+		for (BatchGeometry& geometry : result.Batches) {
+			if (geometry.Indices.empty()) continue;
+			Batch batch;
+			batch.Material = geometry.Material;
+			batch.Geometry = std::make_shared<VertexBuffer>(geometry.Vertices, geometry.Indices);
+			InstanceData instance(DXM::Matrix::Identity, geometry.Colour);
+			instance.InvTransform = DXM::Matrix::Identity;
+			batch.Instance = std::make_shared<InstanceBuffer>(std::vector<InstanceData>{ instance });
+			batch.Clusters = std::move(geometry.Clusters);
+			batch.ClusterMeshes = std::move(geometry.ClusterMeshes);
+			m_Stats.Clusters += static_cast<uint32_t>(batch.Clusters.size());
+			m_Batches.push_back(std::move(batch));
+		}
+
+		m_BatchedMeshes = std::move(result.Meshes);
+		m_MeshSeen.assign(m_BatchedMeshes.size(), 0);
+		m_RenderCount = 0;
+		for (MeshBase* mesh : m_BatchedMeshes) mesh->m_Batched = true;
+		m_Signature = result.Signature;
+		m_Stats.Batches = static_cast<uint32_t>(m_Batches.size());
+		m_Stats.Meshes = static_cast<uint32_t>(m_BatchedMeshes.size());
+		m_Stats.Instances = result.Instances;
+		m_Stats.BuildSeconds = result.Seconds;
+		DXE_INFO("StaticBatcher: ", m_Stats.Instances, " instances of ", m_Stats.Meshes, " meshes into ", m_Stats.Batches, " batches, ",
+			m_Stats.Clusters, " clusters, built in ", result.Seconds * 1000.0, "ms");
+	}
+
+	void StaticBatcher::Unbatch() {
+		// Only meshes still alive, a destroyed one has left GetMeshes
+		const auto& meshes = Mesh::GetMeshes();
+		for (MeshBase* mesh : m_BatchedMeshes) {
+			if (std::find(meshes.begin(), meshes.end(), mesh) != meshes.end()) mesh->m_Batched = false;
+		}
+		m_BatchedMeshes.clear();
+		m_Batches.clear();
+		m_MeshSeen.clear();
+		m_Signature = 0;
+		m_Stats.Batches = 0;
+		m_Stats.Clusters = 0;
+		m_Stats.Meshes = 0;
+		m_Stats.Instances = 0;
+	}
+
+	void StaticBatcher::Clear() {
+		Unbatch();
+	}
+
+	void StaticBatcher::Render(const CullView& view) {
+		m_Stats.ClustersVisible = 0;
+		m_Stats.Draws = 0;
+		m_Stats.MeshDraws = 0;
+		++m_RenderCount;
+		const Material* bound = nullptr;
+		for (Batch& batch : m_Batches) {
+			// Clusters are in Morton order, visible neighbours merge into one range
+			m_Runs.clear();
+			for (const StaticCluster& cluster : batch.Clusters) {
+				if (view.Contains(cluster.Bounds) == DX::DISJOINT) continue;
+				++m_Stats.ClustersVisible;
+				for (uint32_t i = 0; i < cluster.MeshCount; ++i) {
+					uint32_t& seen = m_MeshSeen[batch.ClusterMeshes[cluster.FirstMesh + i]];
+					if (seen == m_RenderCount) continue;
+					seen = m_RenderCount;
+					++m_Stats.MeshDraws;
+				}
+				if (!m_Runs.empty() && m_Runs.back().first + m_Runs.back().second == cluster.FirstIndex) {
+					m_Runs.back().second += cluster.IndexCount;
+				}
+				else {
+					m_Runs.emplace_back(cluster.FirstIndex, cluster.IndexCount);
+				}
+			}
+			if (m_Runs.empty()) continue;
+
+			if (batch.Material.get() != bound) {
+				bound = nullptr;
+				if (!batch.Material->BindShaders()) continue;
+				batch.Material->UpdateBuffers();
+				batch.Material->BindBuffers();
+				bound = batch.Material.get();
+			}
+			batch.Geometry->Bind(0);
+			batch.Instance->Bind(1);
+			for (const auto& run : m_Runs) {
+				Renderer::Context()->DrawIndexedInstanced(run.second, 1, run.first, 0, 0);
+				++m_Stats.Draws;
+			}
+		}
+	}
+}
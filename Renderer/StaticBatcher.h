@@ -0,0 +1,131 @@
+#pragma once
+#include "DXE.h"
+#include "Maths/Maths.h"
+#include "Buffer.h"
+#include "Material.h"
+#include "MeshBase.h"
+#include "ThreadPool.h"
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace DXE
+{
+	struct StaticBatchingSettings {
+		uint32_t MaxMeshVertices = 4096;     // bigger static meshes are drawn on their own
+		float ClusterSize = 64.f;            // world size of the cells geometry is clustered in for culling
+		uint32_t MaxClusterVertices = 65536; // a crowded cell is split into several clusters
+		unsigned ThreadCount = 1;
+	};
+
+	struct StaticBatchingStats {
+		uint32_t Batches = 0;
+		uint32_t Clusters = 0;
+		uint32_t Meshes = 0;    // replaced by the batches
+		uint32_t Instances = 0;
+		uint64_t Builds = 0;
+		uint64_t Discarded = 0; // builds finished after the static set changed again
+		double BuildSeconds = 0.0; // last build, on the worker
+		// last Render
+		uint32_t ClustersVisible = 0;
+		uint32_t Draws = 0;
+		uint32_t MeshDraws = 0; // the batched meshes with a visible cluster, one instanced draw each without batching
+	};
+
+	// Part of a batch inside one cell, FirstIndex into the batch index buffer
+	struct StaticCluster {
+		DX::BoundingBox Bounds;
+		uint32_t FirstIndex = 0;
+		uint32_t IndexCount = 0;
+		uint32_t FirstMesh = 0; // into the batch's ClusterMeshes, the meshes with instances in this cluster
+		uint32_t MeshCount = 0;
+	};
+
+	// Merges small static meshes into large shared buffers, one batch per material and instance colour.
+	// Meshes with m_Static, a material and at most MaxMeshVertices vertices take part, except patch meshes
+	// (shadow indices) and cluster culled ones. Every instance is baked into world space vertices, grouped by
+	// ClusterSize cells in Morton order, so a batch is culled cluster by cluster and neighbouring visible
+	// clusters draw as one range.
+	// Update() compares a signature of the static set (MeshBase::m_Version) and rebuilds on a worker when it
+	// changes. Until the new batches are uploaded the meshes draw on their own again. Batched meshes have
+	// m_Batched set, camera passes skip them and draw the batches instead, shadow passes keep drawing them.
+	// Static instances are not expected to move, MarkChanged() the mesh after moving one.
+	class DXE_API StaticBatcher {
+	public:
+		explicit StaticBatcher(const StaticBatchingSettings& settings = StaticBatchingSettings());
+		~StaticBatcher();
+
+		StaticBatcher(const StaticBatcher&) = delete;
+		StaticBatcher& operator=(const StaticBatcher&) = delete;
+
+		// Call once per frame from the render thread
+		void Update();
+		// Draws the clusters of every batch inside the view, binding each batch's material
+		void Render(const CullView& view);
+		// Unbatches every mesh
+		void Clear();
+
+		const StaticBatchingSettings& GetSettings() const { return m_Settings; }
+		const StaticBatchingStats& GetStats() const { return m_Stats; }
+		bool IsBuilding() const { return m_Building; }
+
+	private:
+		struct SourceMesh {
+			MeshBase* Mesh = nullptr;
+			std::shared_ptr<Material> Material;
+			std::vector<Vertex> Vertices;
+			std::vector<uint32_t> Indices;
+			std::vector<InstanceData> Instances;
+		};
+
+		struct BatchGeometry {
+			std::shared_ptr<Material> Material;
+			DXM::Vector4 Colour;
+			std::vector<Vertex> Vertices;
+			std::vector<uint32_t> Indices;
+			std::vector<StaticCluster> Clusters;
+			std::vector<uint32_t> ClusterMeshes; // indices into BuildResult::Meshes
+		};
+
+		struct BuildResult {
+			uint64_t Signature = 0;
+			std::vector<BatchGeometry> Batches;
+			std::vector<MeshBase*> Meshes;
+			uint32_t Instances = 0;
+			double Seconds = 0.0;
+		};
+
+		struct Batch {
+			std::shared_ptr<Material> Material;
+			std::shared_ptr<VertexBuffer> Geometry;
+			std::shared_ptr<InstanceBuffer> Instance; // one identity transform carrying the colour
+			std::vector<StaticCluster> Clusters;
+			std::vector<uint32_t> ClusterMeshes; // indices into m_BatchedMeshes
+		};
+
+		bool IsCandidate(MeshBase* mesh) const;
+		uint64_t ComputeSignature() const;
+		void StartBuild(uint64_t signature);
+		void Apply(BuildResult& result);
+		void Unbatch();
+
+		// Runs on a worker
+		static std::unique_ptr<BuildResult> Build(std::vector<SourceMesh> sources, const StaticBatchingSettings& settings);
+
+		StaticBatchingSettings m_Settings;
+		StaticBatchingStats m_Stats;
+		std::vector<Batch> m_Batches;
+		std::vector<MeshBase*> m_BatchedMeshes;
+		uint64_t m_Signature = 0; // of the static set m_Batches were built from, 0 when empty
+		bool m_Building = false;
+		std::vector<std::pair<uint32_t, uint32_t>> m_Runs; // first index and count, scratch for Render
+		std::vector<uint32_t> m_MeshSeen; // per batched mesh, the Render it was last counted in
+		uint32_t m_RenderCount = 0;
+
+		std::mutex m_CompletedMutex;
+		std::unique_ptr<BuildResult> m_Completed;
+
+		// declared last so the worker stops before the result it writes into is destroyed
+		std::unique_ptr<ThreadPool> m_Pool;
+	};
+}
@@ -144,6 +144,39 @@ namespace DXE
         return SUCCEEDED(hr);
     }
 
+    bool Texture::CreateFromData(int width, int height, DXGI_FORMAT format, const void* data, UINT rowPitch) {
+        m_Width = width;
+        m_Height = height;
+        m_Channels = 0;
+        m_PixelData.clear();
+        m_ShaderResourceView.Reset();
+        m_RenderTargetView.Reset();
+        m_Texture.Reset();
+
+        D3D11_TEXTURE2D_DESC desc = {};
+        desc.Width = width;
+        desc.Height = height;
+        desc.MipLevels = 1;
+        desc.ArraySize = 1;
+        desc.Format = format;
+        desc.SampleDesc.Count = 1;
+        desc.SampleDesc.Quality = 0;
+        desc.Usage = D3D11_USAGE_IMMUTABLE;
+        desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+        desc.CPUAccessFlags = 0;
+        desc.MiscFlags = 0;
+
+        D3D11_SUBRESOURCE_DATA initData = {};
+        initData.pSysMem = data;
+        initData.SysMemPitch = rowPitch;
+
+        HRESULT hr = Renderer::Device()->CreateTexture2D(&desc, &initData, m_Texture.GetAddressOf());
+        if (FAILED(hr)) return false;
+
+        hr = Renderer::Device()->CreateShaderResourceView(m_Texture.Get(), nullptr, m_ShaderResourceView.GetAddressOf());
+        return SUCCEEDED(hr);
+    }
+
     void Texture::UpdateTexture() {
         D3D11_MAPPED_SUBRESOURCE mappedResource;
         if (SUCCEEDED(Renderer::Context()->Map(m_Texture.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedResource)))
@@ -31,6 +31,8 @@ namespace DXE
         std::vector<unsigned char*> GetPixel(int x, int y);
 
         bool LoadFromFile(const std::string& filename);
+        // Immutable texture from already packed texels (e.g. PackedNoiseMap), no CPU copy is kept
+        bool CreateFromData(int width, int height, DXGI_FORMAT format, const void* data, UINT rowPitch);
         void UpdateTexture();
 
 
@@ -0,0 +1,201 @@
+#include "pch.h"
+#include "Scene/CDLODTerrain.h"
+#include "Renderer/MeshManager.h"
+#include "Renderer/MeshBase.h"
+#include "Renderer/ShaderManager.h"
+#include "ThreadPool.h"
+#include <algorithm>
+
+namespace DXE {
+
+	static const char* CDLODTerrainShader = "CDLODTerrain";
+
+	CDLODTerrainMaterial::CDLODTerrainMaterial(const std::string& name, const TerrainData& data, std::shared_ptr<Texture> heightMap)
+		: Material(name, CDLODTerrainShader), m_TerrainData(data), m_HeightMap(std::move(heightMap)) {
+		D3D11_BUFFER_DESC bufferDesc = {};
+		bufferDesc.Usage = D3D11_USAGE_DYNAMIC;
+		bufferDesc.ByteWidth = (sizeof(TerrainData) + 15) & ~15u;
+		bufferDesc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+		bufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+		Renderer::Device()->CreateBuffer(&bufferDesc, nullptr, &m_ConstantBuffer);
+
+		D3D11_SAMPLER_DESC samplerDesc = {};
+		samplerDesc.Filter = D3D11_FILTER_MIN_MAG_MIP_LINEAR;
+		samplerDesc.AddressU = D3D11_TEXTURE_ADDRESS_CLAMP;
+		samplerDesc.AddressV = D3D11_TEXTURE_ADDRESS_CLAMP;
+		samplerDesc.AddressW = D3D11_TEXTURE_ADDRESS_CLAMP;
+		samplerDesc.MaxLOD = D3D11_FLOAT32_MAX;
+		samplerDesc.ComparisonFunc = D3D11_COMPARISON_NEVER;
+		Renderer::Device()->CreateSamplerState(&samplerDesc, &m_Sampler);
+	}
+
+	bool CDLODTerrainMaterial::BindShaders() {
+		if (m_Shader == nullptr) { return false; }
+		m_Shader->Bind();
+		return true;
+	}
+
+	void CDLODTerrainMaterial::UpdateBuffers() {
+		D3D11_MAPPED_SUBRESOURCE mappedResource;
+		Renderer::Context()->Map(m_ConstantBuffer.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedResource);
+		memcpy(mappedResource.pData, &m_TerrainData, sizeof(TerrainData));
+		Renderer::Context()->Unmap(m_ConstantBuffer.Get(), 0);
+	}
+
+	void CDLODTerrainMaterial::BindBuffers() {
+		ID3D11ShaderResourceView* heightMap = m_HeightMap ? m_HeightMap->GetShaderResourceView() : nullptr;
+		Renderer::Context()->VSSetConstantBuffers(1, 1, m_ConstantBuffer.GetAddressOf());
+		Renderer::Context()->PSSetConstantBuffers(1, 1, m_ConstantBuffer.GetAddressOf());
+		Renderer::Context()->VSSetShaderResources(0, 1, &heightMap);
+		Renderer::Context()->VSSetSamplers(0, 1, m_Sampler.GetAddressOf());
+	}
+
+	CDLODTerrain::CDLODTerrain(const CDLODTerrainSettings& settings)
+		: m_Settings(settings), m_Quadtree(settings.Quadtree) {
+		m_Settings.TilesPerSide = (std::max)(1, m_Settings.TilesPerSide);
+		m_Settings.Quadtree = m_Quadtree.GetSettings();
+
+		BuildHeightMap();
+		m_Quadtree.BuildBounds(m_Heights.data(), m_Width);
+
+		m_HeightTexture = std::make_shared<Texture>();
+		if (!m_HeightTexture->CreateFromData(m_Width, m_Width, DXGI_FORMAT_R32_FLOAT, m_Heights.data(), m_Width * sizeof(float))) {
+			DXE_ERROR("CDLODTerrain: failed to create the height texture");
+		}
+
+		if (!ShaderManager::Get()->Exists(CDLODTerrainShader)) {
+			auto& shader = ShaderManager::Get()->GetRawShader("CDLODTerrain.hlsl");
+			ShaderManager::Get()->AddShader(CDLODTerrainShader, shader);
+		}
+
+		const CDLODSettings& quadtree = m_Settings.Quadtree;
+		CDLODTerrainMaterial::TerrainData data = {};
+		data.HeightMapOrigin = quadtree.Origin;
+		data.HeightMapInvSize = 1.f / quadtree.RootSize;
+		data.HeightMapTexel = 1.f / m_Width;
+		data.HeightSampleSpacing = quadtree.RootSize / (m_Width - 1);
+		data.Colour = DXM::Vector3(0.42f, 0.5f, 0.3f);
+		m_Material = std::make_shared<CDLODTerrainMaterial>(m_Settings.Name, data, m_HeightTexture);
+
+		m_Grid = CreateGrid(m_Settings.Name + "_Grid", quadtree.GridResolution);
+		m_HalfGrid = CreateGrid(m_Settings.Name + "_HalfGrid", (quadtree.GridResolution - 1) / 2 + 1);
+	}
+
+	CDLODTerrain::~CDLODTerrain() {
+		if (m_Grid) m_Grid->m_Instances.clear();
+		if (m_HalfGrid) m_HalfGrid->m_Instances.clear();
+	}
+
+	MeshBase* CDLODTerrain::CreateGrid(const std::string& name, int resolution) {
+		const float step = 1.f / (resolution - 1);
+
+		std::vector<Vertex> vertices(resolution * resolution);
+		for (int y = 0; y < resolution; ++y) {
+			for (int x = 0; x < resolution; ++x) {
+				Vertex& v = vertices[x + resolution * y];
+				v.Position = DXM::Vector3(x * step, y * step, 0.f);
+				v.Normal = DXM::Vector3(0.f, 0.f, 1.f);
+				v.Tangent = DXM::Vector3(1.f, 0.f, 0.f);
+				v.UV = DXM::Vector2(x * step, y * step);
+				v.Color = DXM::Vector4(1.f, 1.f, 1.f, 1.f);
+			}
+		}
+
+		std::vector<uint32_t> indices;
+		indices.reserve((resolution - 1) * (resolution - 1) * 6);
+		for (int y = 0; y < resolution - 1; ++y) {
+			for (int x = 0; x < resolution - 1; ++x) {
+				uint32_t a = x + resolution * y;
+				uint32_t b = a + 1;
+				uint32_t c = a + resolution;
+				uint32_t d = c + 1;
+				// clockwise seen from +Z
+				indices.insert(indices.end(), { a, c, b, b, c, d });
+			}
+		}
+
+		MeshBase* mesh = MeshManager::Get()->CreateMeshBase(name, vertices, indices);
+		if (!mesh) {
+			DXE_ERROR("CDLODTerrain: mesh ", name, " already exists");
+			return nullptr;
+		}
+		mesh->SetMaterial(m_Material);
+		// heights only exist in the vertex shader, the shadow pass would see a flat grid
+		mesh->m_CastsShadow = false;
+		// instances scale z by the node's half height range around its middle
+		mesh->SetLocalBounds(DX::BoundingBox(DXM::Vector3(0.5f, 0.5f, 0.f), DXM::Vector3(0.5f, 0.5f, 1.f)));
+		return mesh;
+	}
+
+	void CDLODTerrain::BuildHeightMap() {
+		constexpr int N = TileResolution;
+		const int tiles = m_Settings.TilesPerSide;
+		m_Width = tiles * (N - 1) + 1;
+		m_Heights.assign(static_cast<size_t>(m_Width) * m_Width, 0.f);
+
+		// tiles share their edge samples, each writes its first N - 1 rows and columns so no sample is written
+		// twice, the last tiles of a row or column also write the far edge
+		ThreadPool pool(m_Settings.ThreadCount);
+		pool.ParallelFor(tiles * tiles, 1, [&](int begin, int end) {
+			auto tile = std::make_unique<DXM::NoiseMap<N>>();
+			for (int t = begin; t < end; ++t) {
+				int tx = t % tiles;
+				int ty = t / tiles;
+				// GenerateNoiseMap_HeightDXDYMask centres one unit wide tiles on pos
+				tile->GenerateNoiseMap_HeightDXDYMask(DXM::Vector2(tx + 0.5f, ty + 0.5f), m_Settings.Seed);
+				const int columns = tx == tiles - 1 ? N : N - 1;
+				const int rows = ty == tiles - 1 ? N : N - 1;
+				for (int y = 0; y < rows; ++y) {
+					float* row = &m_Heights[(tx * (N - 1)) + static_cast<size_t>(m_Width) * (ty * (N - 1) + y)];
+					for (int x = 0; x < columns; ++x) {
+						row[x] = tile->GetVector(x, y).x * m_Settings.HeightScale;
+					}
+				}
+			}
+		});
+	}
+
+	float CDLODTerrain::GetHeight(float x, float y) const {
+		const CDLODSettings& quadtree = m_Settings.Quadtree;
+		float scale = (m_Width - 1) / quadtree.RootSize;
+		float fx = std::clamp((x - quadtree.Origin.x) * scale, 0.f, static_cast<float>(m_Width - 1));
+		float fy = std::clamp((y - quadtree.Origin.y) * scale, 0.f, static_cast<float>(m_Width - 1));
+		int x0 = (std::min)(static_cast<int>(fx), m_Width - 2);
+		int y0 = (std::min)(static_cast<int>(fy), m_Width - 2);
+		float tx = fx - x0;
+		float ty = fy - y0;
+
+		const float* row0 = &m_Heights[x0 + static_cast<size_t>(m_Width) * y0];
+		const float* row1 = row0 + m_Width;
+		float h0 = row0[0] + (row0[1] - row0[0]) * tx;
+		float h1 = row1[0] + (row1[1] - row1[0]) * tx;
+		return h0 + (h1 - h0) * ty;
+	}
+
+	void CDLODTerrain::Update(const DXM::Vector3& camera, const DX::BoundingFrustum& frustum) {
+		m_Quadtree.Select(camera, frustum, m_Selection, m_Stats);
+		if (!m_Grid || !m_HalfGrid) return;
+
+		// through the instance API so m_Version tells the caches the set changed
+		std::vector<InstanceData> full, half;
+		full.reserve(m_Selection.size());
+		half.reserve(m_Selection.size());
+		const float fullCells = static_cast<float>(m_Settings.Quadtree.GridResolution - 1);
+		for (const CDLODNode& node : m_Selection) {
+			// the grid's local bounds span z -1..1, a z scale of the half height range fits them to the node's box
+			float halfHeight = 0.5f * (node.MaxZ - node.MinZ);
+			DXM::Matrix transform = DXM::Matrix::CreateScale(node.Size, node.Size, (std::max)(halfHeight, 1e-3f))
+				* DXM::Matrix::CreateTranslation(node.Min.x, node.Min.y, node.MinZ + halfHeight);
+			float cells = node.HalfResolution ? fullCells * 0.5f : fullCells;
+			DXM::Vector4 morph(node.MorphStart, node.MorphEnd, cells, node.Size);
+
+			(node.HalfResolution ? half : full).emplace_back(transform, morph);
+		}
+
+		std::vector<entt::entity> entities((std::max)(full.size(), half.size()));
+		m_Grid->ClearInstances();
+		m_Grid->CreateInstances(full, entities);
+		m_HalfGrid->ClearInstances();
+		m_HalfGrid->CreateInstances(half, entities);
+	}
+}
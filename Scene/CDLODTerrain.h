@@ -0,0 +1,90 @@
+#pragma once
+#include "DXE.h"
+#include "Maths/Maths.h"
+#include "Renderer/Material.h"
+#include "Scene/Quadtree.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace DXE
+{
+	class MeshBase;
+
+	struct CDLODTerrainSettings {
+		std::string Name = "CDLODTerrain";
+		CDLODSettings Quadtree;
+		int Seed = 0;
+		int TilesPerSide = 16; // NoiseMap tiles across the root node, each adds 64 height samples per side
+		float HeightScale = 200.f;
+		unsigned ThreadCount = 0;
+	};
+
+	// Height texture and morph parameters for CDLODTerrain.hlsl
+	class DXE_API CDLODTerrainMaterial : public Material {
+	public:
+		struct TerrainData {
+			DXM::Vector2 HeightMapOrigin;
+			float HeightMapInvSize;  // 1 / world size covered by the height map
+			float HeightMapTexel;    // 1 / height map width
+			float HeightSampleSpacing; // world distance between height samples
+			DXM::Vector3 Colour;
+		};
+
+		CDLODTerrainMaterial(const std::string& name, const TerrainData& data, std::shared_ptr<Texture> heightMap);
+
+		bool BindShaders() override;
+		void UpdateBuffers() override;
+		void BindBuffers() override;
+
+	private:
+		TerrainData m_TerrainData;
+		std::shared_ptr<Texture> m_HeightMap;
+		Microsoft::WRL::ComPtr<ID3D11Buffer> m_ConstantBuffer;
+		Microsoft::WRL::ComPtr<ID3D11SamplerState> m_Sampler;
+	};
+
+	// Renders a CDLODQuadtree with two shared grid meshes.
+	// Every selected node is an instance of the full or half resolution grid, the vertex shader places it,
+	// reads heights from a single R32_FLOAT texture and morphs odd vertices towards the next coarser level
+	// so LOD changes never pop. The height map is built once from NoiseMap tiles.
+	class DXE_API CDLODTerrain {
+	public:
+		static constexpr int TileResolution = 65;
+
+		explicit CDLODTerrain(const CDLODTerrainSettings& settings);
+		~CDLODTerrain();
+
+		CDLODTerrain(const CDLODTerrain&) = delete;
+		CDLODTerrain& operator=(const CDLODTerrain&) = delete;
+
+		// Call once per frame before rendering, replaces the grid instances with this frame's selection
+		void Update(const DXM::Vector3& camera, const DX::BoundingFrustum& frustum);
+
+		const CDLODTerrainSettings& GetSettings() const { return m_Settings; }
+		const CDLODQuadtree& GetQuadtree() const { return m_Quadtree; }
+		const CDLODStats& GetStats() const { return m_Stats; }
+		const std::vector<CDLODNode>& GetSelection() const { return m_Selection; }
+
+		// Bilinear height at world (x, y), clamped to the terrain
+		float GetHeight(float x, float y) const;
+		int GetHeightMapWidth() const { return m_Width; }
+
+	private:
+		void BuildHeightMap();
+		MeshBase* CreateGrid(const std::string& name, int resolution);
+
+		CDLODTerrainSettings m_Settings;
+		CDLODQuadtree m_Quadtree;
+		CDLODStats m_Stats;
+		std::vector<CDLODNode> m_Selection;
+
+		std::vector<float> m_Heights;
+		int m_Width = 0;
+
+		std::shared_ptr<Texture> m_HeightTexture;
+		std::shared_ptr<CDLODTerrainMaterial> m_Material;
+		MeshBase* m_Grid = nullptr;
+		MeshBase* m_HalfGrid = nullptr;
+	};
+}
@@ -0,0 +1,84 @@
+#include "pch.h"
+#include "Scene/InstanceScatter.h"
+#include "Renderer/MeshBase.h"
+
+namespace DXE {
+
+	namespace {
+		std::vector<ScatterLayer> ScatterRules(const std::vector<InstanceScatterLayer>& layers) {
+			std::vector<ScatterLayer> rules;
+			rules.reserve(layers.size());
+			for (const InstanceScatterLayer& layer : layers) rules.push_back(layer.Rules);
+			return rules;
+		}
+	}
+
+	InstanceScatter::InstanceScatter(const std::vector<InstanceScatterLayer>& layers, float tileSize, uint32_t seed, unsigned threadCount)
+		: m_Layers(layers), m_Scatter(ScatterRules(layers), tileSize, seed), m_Pool(threadCount) {
+	}
+
+	InstanceScatter::~InstanceScatter() {
+		UnloadAll();
+	}
+
+	ScatterStats InstanceScatter::LoadTiles(const std::vector<ScatterTile>& tiles, const PoissonScatter::Surface& surface) {
+		std::vector<ScatterTile> pending;
+		for (const ScatterTile& tile : tiles) {
+			if (!IsLoaded(tile) && std::find(pending.begin(), pending.end(), tile) == pending.end()) pending.push_back(tile);
+		}
+		if (pending.empty()) return {};
+
+		std::vector<std::vector<std::vector<ScatterPoint>>> points;
+		ScatterStats stats = m_Scatter.GenerateTiles(pending, surface, m_Pool, points);
+
+		// Instance data for every layer across all the new tiles, converted in parallel
+		const size_t layerCount = m_Layers.size();
+		std::vector<std::vector<size_t>> offsets(layerCount, std::vector<size_t>(pending.size() + 1, 0));
+		std::vector<std::vector<InstanceData>> instances(layerCount);
+		for (size_t l = 0; l < layerCount; ++l) {
+			for (size_t t = 0; t < pending.size(); ++t) offsets[l][t + 1] = offsets[l][t] + points[t][l].size();
+			instances[l].resize(offsets[l].back());
+		}
+		m_Pool.ParallelFor(static_cast<int>(pending.size()), 1, [&](int begin, int end) {
+			for (int t = begin; t < end; ++t) {
+				for (size_t l = 0; l < layerCount; ++l) {
+					InstanceData* out = instances[l].data() + offsets[l][t];
+					for (const ScatterPoint& point : points[t][l]) {
+						*out++ = InstanceData(point.Transform(), m_Layers[l].Colour);
+					}
+				}
+			}
+		});
+
+		for (size_t t = 0; t < pending.size(); ++t) m_Tiles[TileKey(pending[t])].resize(layerCount);
+		std::vector<entt::entity> entities;
+		for (size_t l = 0; l < layerCount; ++l) {
+			MeshBase* mesh = m_Layers[l].Mesh;
+			if (!mesh || instances[l].empty()) continue;
+			entities.resize(instances[l].size());
+			mesh->CreateInstances(instances[l], entities);
+			for (size_t t = 0; t < pending.size(); ++t) {
+				m_Tiles[TileKey(pending[t])][l].assign(entities.begin() + offsets[l][t], entities.begin() + offsets[l][t + 1]);
+			}
+		}
+		return stats;
+	}
+
+	void InstanceScatter::UnloadTile(const ScatterTile& tile) {
+		auto it = m_Tiles.find(TileKey(tile));
+		if (it == m_Tiles.end()) return;
+		for (size_t l = 0; l < it->second.size(); ++l) {
+			if (m_Layers[l].Mesh) m_Layers[l].Mesh->DestroyInstances(std::span<const entt::entity>(it->second[l]));
+		}
+		m_Tiles.erase(it);
+	}
+
+	void InstanceScatter::UnloadAll() {
+		for (auto& [key, layers] : m_Tiles) {
+			for (size_t l = 0; l < layers.size(); ++l) {
+				if (m_Layers[l].Mesh) m_Layers[l].Mesh->DestroyInstances(std::span<const entt::entity>(layers[l]));
+			}
+		}
+		m_Tiles.clear();
+	}
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include "DXE.h"
+#include "Maths/Maths.h"
+#include "Maths/PoissonScatter.h"
+#include "Scene/entt.hpp"
+#include "ThreadPool.h"
+#include <unordered_map>
+#include <vector>
+
+namespace DXE
+{
+	class MeshBase;
+
+	struct InstanceScatterLayer {
+		MeshBase* Mesh = nullptr;
+		ScatterLayer Rules;
+		DXM::Vector4 Colour = DXM::Vector4(1.f, 1.f, 1.f, 1.f);
+	};
+
+	// Streams PoissonScatter tiles in and out of mesh instance storage.
+	// Tiles are generated in parallel and every layer's points go into its mesh with a single bulk insert,
+	// unloading destroys the tile's instances together. Tiles regenerate identically on the next load.
+	class DXE_API InstanceScatter {
+	public:
+		InstanceScatter(const std::vector<InstanceScatterLayer>& layers, float tileSize, uint32_t seed, unsigned threadCount = 0);
+		~InstanceScatter();
+
+		InstanceScatter(const InstanceScatter&) = delete;
+		InstanceScatter& operator=(const InstanceScatter&) = delete;
+
+		// Tiles already loaded are skipped
+		ScatterStats LoadTiles(const std::vector<ScatterTile>& tiles, const PoissonScatter::Surface& surface);
+		void UnloadTile(const ScatterTile& tile);
+		void UnloadAll();
+
+		bool IsLoaded(const ScatterTile& tile) const { return m_Tiles.count(TileKey(tile)) != 0; }
+		size_t GetLoadedTileCount() const { return m_Tiles.size(); }
+		const PoissonScatter& GetScatter() const { return m_Scatter; }
+
+	private:
+		static uint64_t TileKey(const ScatterTile& tile) { return (static_cast<uint64_t>(static_cast<uint32_t>(tile.X)) << 32) | static_cast<uint32_t>(tile.Y); }
+
+		std::vector<InstanceScatterLayer> m_Layers;
+		PoissonScatter m_Scatter;
+		ThreadPool m_Pool;
+		std::unordered_map<uint64_t, std::vector<std::vector<entt::entity>>> m_Tiles; // instances per layer
+	};
+}
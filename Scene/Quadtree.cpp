@@ -1,7 +1,150 @@
 #include "pch.h"
 #include "Scene/Quadtree.h"
+#include <algorithm>
+#include <cfloat>
 
 namespace DXE {
 
+	CDLODQuadtree::CDLODQuadtree(const CDLODSettings& settings)
+		: m_Settings(settings) {
+		m_Settings.LodLevels = std::clamp(m_Settings.LodLevels, 1, 16);
+		m_Settings.GridResolution = (std::max)(3, m_Settings.GridResolution | 1);
 
-}
\ No newline at end of file
+		float previous = 0.f;
+		for (int level = 0; level < m_Settings.LodLevels; ++level) {
+			float range = m_Settings.Lod0Distance * static_cast<float>(1 << level);
+			m_Ranges.push_back(range);
+			m_MorphStarts.push_back(previous + (range - previous) * m_Settings.MorphStartRatio);
+			previous = range;
+		}
+
+		m_Bounds.resize(m_Settings.LodLevels);
+		for (int level = 0; level < m_Settings.LodLevels; ++level) {
+			m_Bounds[level].resize(static_cast<size_t>(GetNodeCount(level)) * GetNodeCount(level));
+		}
+		SetHeightRange(0.f, 0.f);
+	}
+
+	void CDLODQuadtree::SetHeightRange(float minZ, float maxZ) {
+		for (auto& level : m_Bounds) {
+			std::fill(level.begin(), level.end(), Bounds{ minZ, maxZ });
+		}
+	}
+
+	void CDLODQuadtree::BuildBounds(const float* heights, int width) {
+		// finest level straight from the samples, nodes share their edge samples
+		int count = GetNodeCount(0);
+		float samplesPerNode = (width - 1) / static_cast<float>(count);
+		for (int y = 0; y < count; ++y) {
+			int y0 = static_cast<int>(floorf(y * samplesPerNode));
+			int y1 = (std::min)(width - 1, static_cast<int>(ceilf((y + 1) * samplesPerNode)));
+			for (int x = 0; x < count; ++x) {
+				int x0 = static_cast<int>(floorf(x * samplesPerNode));
+				int x1 = (std::min)(width - 1, static_cast<int>(ceilf((x + 1) * samplesPerNode)));
+
+				Bounds bounds{ FLT_MAX, -FLT_MAX };
+				for (int sy = y0; sy <= y1; ++sy) {
+					for (int sx = x0; sx <= x1; ++sx) {
+						float h = heights[sx + static_cast<size_t>(width) * sy];
+						bounds.MinZ = (std::min)(bounds.MinZ, h);
+						bounds.MaxZ = (std::max)(bounds.MaxZ, h);
+					}
+				}
+				m_Bounds[0][x + count * y] = bounds;
+			}
+		}
+
+		// coarser levels merge their four children
+		for (int level = 1; level < m_Settings.LodLevels; ++level) {
+			count = GetNodeCount(level);
+			for (int y = 0; y < count; ++y) {
+				for (int x = 0; x < count; ++x) {
+					Bounds bounds{ FLT_MAX, -FLT_MAX };
+					for (int child = 0; child < 4; ++child) {
+						const Bounds& c = NodeBounds(level - 1, 2 * x + (child & 1), 2 * y + (child >> 1));
+						bounds.MinZ = (std::min)(bounds.MinZ, c.MinZ);
+						bounds.MaxZ = (std::max)(bounds.MaxZ, c.MaxZ);
+					}
+					m_Bounds[level][x + count * y] = bounds;
+				}
+			}
+		}
+	}
+
+	uint32_t CDLODQuadtree::GetGridTriangles(bool halfResolution) const {
+		uint32_t cells = m_Settings.GridResolution - 1;
+		if (halfResolution) cells /= 2;
+		return cells * cells * 2;
+	}
+
+	DX::BoundingBox CDLODQuadtree::NodeBox(int level, int x, int y) const {
+		float size = GetNodeSize(level);
+		const Bounds& bounds = NodeBounds(level, x, y);
+		DXM::Vector3 center(m_Settings.Origin.x + (x + 0.5f) * size, m_Settings.Origin.y + (y + 0.5f) * size, 0.5f * (bounds.MinZ + bounds.MaxZ));
+		DXM::Vector3 extents(0.5f * size, 0.5f * size, 0.5f * (bounds.MaxZ - bounds.MinZ));
+		return DX::BoundingBox(center, extents);
+	}
+
+	void CDLODQuadtree::Select(const DXM::Vector3& camera, const DX::BoundingFrustum& frustum, std::vector<CDLODNode>& selection, CDLODStats& stats) const {
+		selection.clear();
+		stats = CDLODStats();
+		SelectNode(m_Settings.LodLevels - 1, 0, 0, camera, frustum, false, selection, stats);
+	}
+
+	bool CDLODQuadtree::SelectNode(int level, int x, int y, const DXM::Vector3& camera, const DX::BoundingFrustum& frustum, bool fullyInside,
+		std::vector<CDLODNode>& selection, CDLODStats& stats) const {
+		++stats.NodesVisited;
+		DX::BoundingBox box = NodeBox(level, x, y);
+
+		if (!box.Intersects(DX::BoundingSphere(camera, m_Ranges[level]))) return false;
+
+		// children of a node fully inside the frustum skip the test
+		if (!fullyInside) {
+			DX::ContainmentType containment = frustum.Contains(box);
+			if (containment == DX::DISJOINT) {
+				++stats.NodesCulled;
+				return true;
+			}
+			fullyInside = containment == DX::CONTAINS;
+		}
+
+		if (level == 0 || !box.Intersects(DX::BoundingSphere(camera, m_Ranges[level - 1]))) {
+			AddNode(level, x, y, level, false, selection, stats);
+			return true;
+		}
+
+		// children out of their own range are drawn as quadrants of this node
+		for (int child = 0; child < 4; ++child) {
+			int cx = 2 * x + (child & 1);
+			int cy = 2 * y + (child >> 1);
+			if (SelectNode(level - 1, cx, cy, camera, frustum, fullyInside, selection, stats)) continue;
+			if (!fullyInside && frustum.Contains(NodeBox(level - 1, cx, cy)) == DX::DISJOINT) {
+				++stats.NodesCulled;
+				continue;
+			}
+			AddNode(level - 1, cx, cy, level, true, selection, stats);
+		}
+		return true;
+	}
+
+	void CDLODQuadtree::AddNode(int level, int x, int y, int drawLevel, bool halfResolution, std::vector<CDLODNode>& selection, CDLODStats& stats) const {
+		float size = GetNodeSize(level);
+		const Bounds& bounds = NodeBounds(level, x, y);
+
+		CDLODNode node;
+		node.Min = DXM::Vector2(m_Settings.Origin.x + x * size, m_Settings.Origin.y + y * size);
+		node.Size = size;
+		node.MinZ = bounds.MinZ;
+		node.MaxZ = bounds.MaxZ;
+		node.Level = drawLevel;
+		node.MorphStart = m_MorphStarts[drawLevel];
+		node.MorphEnd = m_Ranges[drawLevel];
+		node.HalfResolution = halfResolution;
+		selection.push_back(node);
+
+		++stats.NodesSelected;
+		++stats.SelectedPerLevel[drawLevel];
+		stats.TrianglesSubmitted += GetGridTriangles(halfResolution);
+	}
+
+}
@@ -1,7 +1,78 @@
 #pragma once
 #include "DXE.h"
 #include "Maths/Maths.h"
+#include <vector>
+
 namespace DXE {
 
+	struct CDLODSettings {
+		DXM::Vector2 Origin = DXM::Vector2(0.f, 0.f); // min corner of the root node
+		float RootSize = 4096.f;
+		int LodLevels = 6;           // level 0 is the finest, the root is level LodLevels - 1
+		float Lod0Distance = 256.f;  // view range of level 0, every coarser level doubles it. Keep it at least twice the level 0 node size
+		float MorphStartRatio = 0.7f; // nodes morph to the next level over the last 30% of their range
+		int GridResolution = 33;     // vertices per side of the shared grid, (GridResolution - 1) must be even
+	};
+
+	// One grid draw. HalfResolution nodes are a quadrant of a coarser node that didn't split,
+	// drawn with the half resolution grid so they keep that node's vertex density.
+	struct CDLODNode {
+		DXM::Vector2 Min;
+		float Size = 0.f;
+		float MinZ = 0.f;
+		float MaxZ = 0.f;
+		int Level = 0;
+		float MorphStart = 0.f;
+		float MorphEnd = 0.f;
+		bool HalfResolution = false;
+	};
+
+	struct CDLODStats {
+		uint32_t NodesVisited = 0;
+		uint32_t NodesCulled = 0;
+		uint32_t NodesSelected = 0;
+		uint32_t TrianglesSubmitted = 0;
+		uint32_t SelectedPerLevel[16] = {};
+	};
+
+	// Continuous distance-dependent LOD selection over a fixed quadtree (Strugar, CDLOD).
+	// Every level has a view range, a node is drawn when the camera is inside its range but outside
+	// the range of the level below. Pure CPU, rendering lives in CDLODTerrain.
+	class DXE_API CDLODQuadtree {
+	public:
+		explicit CDLODQuadtree(const CDLODSettings& settings);
+
+		// Per node height bounds from width x width samples covering the root, sample (0, 0) at Origin
+		void BuildBounds(const float* heights, int width);
+		// Same bounds for every node, for flat or unknown terrain
+		void SetHeightRange(float minZ, float maxZ);
+
+		void Select(const DXM::Vector3& camera, const DX::BoundingFrustum& frustum, std::vector<CDLODNode>& selection, CDLODStats& stats) const;
+
+		const CDLODSettings& GetSettings() const { return m_Settings; }
+		float GetLodRange(int level) const { return m_Ranges[level]; }
+		float GetMorphStart(int level) const { return m_MorphStarts[level]; }
+		int GetNodeCount(int level) const { return 1 << (m_Settings.LodLevels - 1 - level); } // per side
+		float GetNodeSize(int level) const { return m_Settings.RootSize / GetNodeCount(level); }
+		uint32_t GetGridTriangles(bool halfResolution) const;
+
+	private:
+		struct Bounds {
+			float MinZ;
+			float MaxZ;
+		};
+
+		const Bounds& NodeBounds(int level, int x, int y) const { return m_Bounds[level][x + GetNodeCount(level) * y]; }
+		DX::BoundingBox NodeBox(int level, int x, int y) const;
+		// false when the node is outside its level's range and the parent has to cover it
+		bool SelectNode(int level, int x, int y, const DXM::Vector3& camera, const DX::BoundingFrustum& frustum, bool fullyInside,
+			std::vector<CDLODNode>& selection, CDLODStats& stats) const;
+		void AddNode(int level, int x, int y, int drawLevel, bool halfResolution, std::vector<CDLODNode>& selection, CDLODStats& stats) const;
+
+		CDLODSettings m_Settings;
+		std::vector<float> m_Ranges;
+		std::vector<float> m_MorphStarts;
+		std::vector<std::vector<Bounds>> m_Bounds; // [level][x + count * y]
+	};
 
-}
\ No newline at end of file
+}
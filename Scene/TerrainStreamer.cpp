@@ -0,0 +1,487 @@
+#include "pch.h"
+#include "Scene/TerrainStreamer.h"
+#include "Renderer/MeshManager.h"
+#include "Renderer/MeshBase.h"
+#include "Renderer/MeshInstance.h"
+#include "Renderer/ShaderManager.h"
+#include <algorithm>
+#include <bit>
+#include <unordered_set>
+
+namespace DXE {
+
+	// Noise space frequency of NoiseMap::GenerateNoiseMap_HeightDXDYMask, one tile spans 1 / 8 of a noise cell
+	static constexpr float TerrainNoiseFrequency = 0.125f;
+	static const DXM::NoiseMapFormat TerrainTileFormat = { DXM::NoiseStorage::Float32, 3 };
+	static const char* TerrainChunkShader = "TerrainChunk";
+
+	static uint32_t PackSnorm16(float v) {
+		return static_cast<uint32_t>(static_cast<int32_t>(roundf(std::clamp(v, -1.f, 1.f) * 32767.f))) & 0xFFFFu;
+	}
+
+	TerrainChunkMaterial::TerrainChunkMaterial(const std::string& name, const ChunkData& data, ID3D11ShaderResourceView* heightArray)
+		: Material(name, TerrainChunkShader), m_ChunkData(data), m_HeightArray(heightArray) {
+		D3D11_BUFFER_DESC bufferDesc = {};
+		bufferDesc.Usage = D3D11_USAGE_DYNAMIC;
+		bufferDesc.ByteWidth = sizeof(ChunkData);
+		bufferDesc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+		bufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+		Renderer::Device()->CreateBuffer(&bufferDesc, nullptr, &m_ConstantBuffer);
+	}
+
+	bool TerrainChunkMaterial::BindShaders() {
+		if (m_Shader == nullptr) { return false; }
+		m_Shader->Bind();
+		return true;
+	}
+
+	void TerrainChunkMaterial::UpdateBuffers() {
+		D3D11_MAPPED_SUBRESOURCE mappedResource;
+		Renderer::Context()->Map(m_ConstantBuffer.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedResource);
+		memcpy(mappedResource.pData, &m_ChunkData, sizeof(ChunkData));
+		Renderer::Context()->Unmap(m_ConstantBuffer.Get(), 0);
+	}
+
+	void TerrainChunkMaterial::BindBuffers() {
+		Renderer::Context()->VSSetConstantBuffers(1, 1, m_ConstantBuffer.GetAddressOf());
+		Renderer::Context()->PSSetConstantBuffers(1, 1, m_ConstantBuffer.GetAddressOf());
+		Renderer::Context()->VSSetShaderResources(0, 1, m_HeightArray.GetAddressOf());
+	}
+
+	TerrainStreamer::TerrainStreamer(const TerrainStreamingSettings& settings)
+		: m_Settings(settings) {
+		constexpr int N = Resolution;
+
+		m_Indices.reserve((N - 1) * (N - 1) * 6);
+		for (int y = 0; y < N - 1; ++y) {
+			for (int x = 0; x < N - 1; ++x) {
+				uint32_t a = x + N * y;
+				uint32_t b = a + 1;
+				uint32_t c = a + N;
+				uint32_t d = c + 1;
+				// clockwise seen from +Z
+				m_Indices.insert(m_Indices.end(), { a, c, b, b, c, d });
+			}
+		}
+
+		m_Settings.UnloadRadius = (std::max)(m_Settings.UnloadRadius, m_Settings.LoadRadius);
+		if (m_Settings.GeometryMode == TerrainGeometryMode::HeightTexture) {
+			m_ChunkBytes = 2 * sizeof(uint32_t) * N * N;
+			m_MaxChunks = static_cast<uint32_t>((std::max)(size_t(1), m_Settings.MemoryCapBytes / m_ChunkBytes));
+			// the array is allocated up front, no larger than the unload radius can ever keep resident
+			uint32_t side = 2 * static_cast<uint32_t>(ceilf(m_Settings.UnloadRadius)) + 1;
+			m_MaxChunks = (std::min)({ m_MaxChunks, side * side, static_cast<uint32_t>(D3D11_REQ_TEXTURE2D_ARRAY_AXIS_DIMENSION) });
+		}
+		else {
+			m_ChunkBytes = sizeof(Vertex) * N * N + sizeof(uint32_t) * m_Indices.size();
+			m_MaxChunks = static_cast<uint32_t>((std::max)(size_t(1), m_Settings.MemoryCapBytes / m_ChunkBytes));
+		}
+		m_Settings.MaxInFlight = (std::max)(1, m_Settings.MaxInFlight);
+
+		if (m_Settings.GeometryMode == TerrainGeometryMode::HeightTexture) {
+			CreateHeightArray();
+		}
+
+		size_t tileCacheBytes = DXM::PackedNoiseMap<N>::ByteSize(TerrainTileFormat) * m_MaxChunks;
+		// one budget of threads for both stages, half generate tiles and the rest build chunks
+		unsigned threads = m_Settings.ThreadCount ? m_Settings.ThreadCount : (std::max)(2u, std::thread::hardware_concurrency()) - 1;
+		unsigned tileThreads = (std::max)(1u, threads / 2);
+		unsigned buildThreads = (std::max)(1u, threads - tileThreads);
+		m_BuildPool = std::make_unique<ThreadPool>(buildThreads);
+		m_Tiles = std::make_unique<NoiseTileService<N>>(tileCacheBytes, tileThreads, std::filesystem::path(), TerrainTileFormat);
+	}
+
+	TerrainStreamer::~TerrainStreamer() {
+		m_Tiles.reset(); // joins workers before anything they touch goes away, they submit builds
+		m_BuildPool.reset();
+		Clear();
+	}
+
+	void TerrainStreamer::Update(const DXM::Vector3& focus, const DXM::Vector3& forward) {
+		DXM::Vector2 focus2D(focus.x, focus.y);
+		DXM::Vector2 forward2D(forward.x, forward.y);
+		if (forward2D.LengthSquared() > 0.f) forward2D.Normalize();
+
+		m_Stats.UploadedThisFrame = 0;
+		m_Stats.UploadedBytesThisFrame = 0;
+
+		DrainCompleted();
+		SelectChunks(focus2D, forward2D);
+		Dispatch();
+		Upload();
+
+		m_Stats.Resident = m_Stats.Queued = m_Stats.Building = m_Stats.Ready = m_Stats.Failed = 0;
+		for (auto& [key, chunk] : m_Chunks) {
+			switch (chunk.State) {
+			case ChunkState::Queued: ++m_Stats.Queued; break;
+			case ChunkState::Building: ++m_Stats.Building; break;
+			case ChunkState::Ready: ++m_Stats.Ready; break;
+			case ChunkState::Resident: ++m_Stats.Resident; break;
+			case ChunkState::Failed: ++m_Stats.Failed; break;
+			}
+		}
+
+		// Quiet frame, compact the shared mesh buffers a few ranges at a time until nothing moves
+		const bool quiet = !m_Stats.UploadedThisFrame && !m_Stats.Queued && !m_Stats.Building && !m_Stats.Ready;
+		if (quiet && m_DefragPending && m_Settings.DefragMovesPerFrame && MeshManager::Get()) {
+			uint32_t moves = MeshManager::Get()->GetBufferPool().Defragment(m_Settings.DefragMovesPerFrame);
+			m_Stats.DefragMoves += moves;
+			m_DefragPending = moves == m_Settings.DefragMovesPerFrame;
+		}
+	}
+
+	void TerrainStreamer::Clear() {
+		for (auto& [key, chunk] : m_Chunks) {
+			Evict(chunk);
+		}
+		m_Chunks.clear();
+	}
+
+	bool TerrainStreamer::TryGetHeight(float x, float y, float& height) const {
+		float size = m_Settings.ChunkWorldSize;
+		int cx = static_cast<int>(floorf(x / size + 0.5f));
+		int cy = static_cast<int>(floorf(y / size + 0.5f));
+		auto it = m_Chunks.find(ChunkKey(cx, cy));
+		if (it == m_Chunks.end() || !it->second.Heights) return false;
+
+		float u = (x - cx * size) / size + 0.5f;
+		float v = (y - cy * size) / size + 0.5f;
+		height = it->second.Heights->NormalisedSample(u, v).x * m_Settings.HeightScale;
+		return true;
+	}
+
+	// Distance in chunks, shortened for chunks in front of the focus. Lower loads first.
+	float TerrainStreamer::ChunkPriority(int x, int y, const DXM::Vector2& focus, const DXM::Vector2& forward) const {
+		DXM::Vector2 offset = DXM::Vector2(x * m_Settings.ChunkWorldSize, y * m_Settings.ChunkWorldSize) - focus;
+		float distance = offset.Length() / m_Settings.ChunkWorldSize;
+		if (distance < 1e-4f) return 0.f;
+
+		float facing = (std::max)(0.f, offset.Dot(forward) / (distance * m_Settings.ChunkWorldSize));
+		return distance / (1.f + m_Settings.ViewDirectionWeight * facing);
+	}
+
+	void TerrainStreamer::DrainCompleted() {
+		std::vector<CompletedBuild> completed;
+		{
+			std::lock_guard<std::mutex> lock(m_CompletedMutex);
+			completed.swap(m_Completed);
+		}
+		for (auto& build : completed) {
+			auto it = m_Chunks.find(build.Key);
+			if (it == m_Chunks.end() || it->second.Ticket != build.Ticket || it->second.State != ChunkState::Building) {
+				++m_Stats.Discarded;
+				continue;
+			}
+			if (!build.Geometry) {
+				// tile service was stopping, try again next frame
+				it->second.State = ChunkState::Queued;
+				continue;
+			}
+			it->second.Geometry = std::move(build.Geometry);
+			it->second.State = ChunkState::Ready;
+		}
+	}
+
+	void TerrainStreamer::SelectChunks(const DXM::Vector2& focus, const DXM::Vector2& forward) {
+		float size = m_Settings.ChunkWorldSize;
+		int centerX = static_cast<int>(floorf(focus.x / size + 0.5f));
+		int centerY = static_cast<int>(floorf(focus.y / size + 0.5f));
+		int reach = static_cast<int>(ceilf(m_Settings.LoadRadius));
+
+		struct Candidate { float Priority; int X; int Y; };
+		std::vector<Candidate> candidates;
+		for (int y = centerY - reach; y <= centerY + reach; ++y) {
+			for (int x = centerX - reach; x <= centerX + reach; ++x) {
+				DXM::Vector2 offset = DXM::Vector2(x * size, y * size) - focus;
+				if (offset.Length() > m_Settings.LoadRadius * size) continue;
+				candidates.push_back({ ChunkPriority(x, y, focus, forward), x, y });
+			}
+		}
+		std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) { return a.Priority < b.Priority; });
+		if (candidates.size() > m_MaxChunks) candidates.resize(m_MaxChunks);
+
+		// refresh priorities, drop chunks outside the unload radius
+		for (auto it = m_Chunks.begin(); it != m_Chunks.end();) {
+			Chunk& chunk = it->second;
+			DXM::Vector2 offset = DXM::Vector2(chunk.X * size, chunk.Y * size) - focus;
+			if (offset.Length() > m_Settings.UnloadRadius * size) {
+				Evict(chunk);
+				it = m_Chunks.erase(it);
+				continue;
+			}
+			chunk.Priority = ChunkPriority(chunk.X, chunk.Y, focus, forward);
+			++it;
+		}
+
+		// over the memory cap, the lowest priority chunks that aren't wanted go first
+		if (m_Chunks.size() + candidates.size() > m_MaxChunks) {
+			std::unordered_set<uint64_t> wanted;
+			for (auto& c : candidates) wanted.insert(ChunkKey(c.X, c.Y));
+
+			std::vector<std::pair<float, uint64_t>> unwanted;
+			for (auto& [key, chunk] : m_Chunks) {
+				if (!wanted.count(key)) unwanted.emplace_back(chunk.Priority, key);
+			}
+			std::sort(unwanted.begin(), unwanted.end(), [](auto& a, auto& b) { return a.first > b.first; });
+
+			size_t wantedMissing = 0;
+			for (auto& c : candidates) wantedMissing += m_Chunks.count(ChunkKey(c.X, c.Y)) ? 0 : 1;
+			for (auto& [priority, key] : unwanted) {
+				if (m_Chunks.size() + wantedMissing <= m_MaxChunks) break;
+				auto it = m_Chunks.find(key);
+				Evict(it->second);
+				m_Chunks.erase(it);
+			}
+		}
+
+		for (auto& c : candidates) {
+			if (m_Chunks.size() >= m_MaxChunks) break;
+			uint64_t key = ChunkKey(c.X, c.Y);
+			if (m_Chunks.count(key)) continue;
+			Chunk& chunk = m_Chunks[key];
+			chunk.X = c.X;
+			chunk.Y = c.Y;
+			chunk.Priority = c.Priority;
+		}
+	}
+
+	void TerrainStreamer::Dispatch() {
+		int inFlight = 0;
+		std::vector<Chunk*> queued;
+		for (auto& [key, chunk] : m_Chunks) {
+			if (chunk.State == ChunkState::Building) ++inFlight;
+			else if (chunk.State == ChunkState::Queued) queued.push_back(&chunk);
+		}
+		int slots = m_Settings.MaxInFlight - inFlight;
+		if (slots <= 0 || queued.empty()) return;
+
+		size_t count = (std::min)(queued.size(), static_cast<size_t>(slots));
+		std::partial_sort(queued.begin(), queued.begin() + count, queued.end(), [](Chunk* a, Chunk* b) { return a->Priority < b->Priority; });
+
+		for (size_t i = 0; i < count; ++i) {
+			Chunk& chunk = *queued[i];
+			chunk.State = ChunkState::Building;
+			chunk.Ticket = ++m_NextTicket;
+
+			uint64_t key = ChunkKey(chunk.X, chunk.Y);
+			uint32_t ticket = chunk.Ticket;
+			// Cached tiles call back on this thread, so the build is always posted to m_BuildPool, only the
+			// upload happens on the render thread
+			m_Tiles->Request(chunk.X, chunk.Y, m_Settings.Seed, NoiseGenerator::HeightDXDYMask,
+				[this, key, ticket](const NoiseTileService<Resolution>::Tile& tile) {
+					m_BuildPool->Submit([this, key, ticket, tile]() {
+						CompletedBuild build{ key, ticket, tile ? BuildGeometry(tile) : nullptr };
+						std::lock_guard<std::mutex> lock(m_CompletedMutex);
+						m_Completed.push_back(std::move(build));
+					});
+				});
+		}
+	}
+
+	void TerrainStreamer::Upload() {
+		std::vector<Chunk*> ready;
+		for (auto& [key, chunk] : m_Chunks) {
+			if (chunk.State == ChunkState::Ready) ready.push_back(&chunk);
+		}
+		std::sort(ready.begin(), ready.end(), [](Chunk* a, Chunk* b) { return a->Priority < b->Priority; });
+
+		const bool heightTexture = m_Settings.GeometryMode == TerrainGeometryMode::HeightTexture;
+		const size_t vertexBytes = sizeof(Vertex) * Resolution * Resolution;
+		const float size = m_Settings.ChunkWorldSize;
+		for (Chunk* chunk : ready) {
+			size_t bytes = heightTexture || m_FreeMeshes.empty() ? m_ChunkBytes : vertexBytes;
+			if (m_Stats.UploadedThisFrame > 0 && m_Stats.UploadedBytesThisFrame + bytes > m_Settings.UploadBudgetBytes) break;
+
+			MeshBase* mesh = nullptr;
+			DXM::Matrix transform;
+			if (heightTexture) {
+				if (!m_Grid) return;
+				UploadTexels(*chunk);
+				mesh = m_Grid;
+				transform = DXM::Matrix::CreateScale(size) * DXM::Matrix::CreateTranslation(chunk->X * size, chunk->Y * size, 0.f);
+			}
+			else {
+				mesh = AcquireMesh(*chunk);
+				if (!mesh) {
+					// logged once by AcquireMesh, not retried every frame
+					chunk->State = ChunkState::Failed;
+					chunk->Geometry.reset();
+					continue;
+				}
+				transform = DXM::Matrix::CreateTranslation(chunk->X * size, chunk->Y * size, 0.f);
+			}
+
+			// HeightTexture mode reads the slice from the instance colour
+			DXM::Vector4 colour = heightTexture ? DXM::Vector4(static_cast<float>(chunk->Slice), 0.f, 0.f, 1.f) : DXM::Vector4(1.f, 1.f, 1.f, 1.f);
+			chunk->Instance = mesh->CreateInstance(InstanceData(transform, colour));
+			chunk->Mesh = mesh;
+			chunk->Heights = std::move(chunk->Geometry->Heights);
+			chunk->Geometry.reset();
+			chunk->State = ChunkState::Resident;
+
+			++m_Stats.UploadedThisFrame;
+			++m_Stats.Uploaded;
+			m_DefragPending = true;
+			m_Stats.UploadedBytesThisFrame += bytes;
+		}
+	}
+
+	void TerrainStreamer::Evict(Chunk& chunk) {
+		if (chunk.State == ChunkState::Resident) {
+			if (chunk.Instance) chunk.Instance->Destroy();
+			chunk.Instance.reset();
+			if (m_Settings.GeometryMode == TerrainGeometryMode::HeightTexture) m_FreeSlices.push_back(chunk.Slice);
+			else m_FreeMeshes.push_back(chunk.Mesh);
+			chunk.Mesh = nullptr;
+			chunk.Heights.reset();
+		}
+		chunk.Geometry.reset();
+		++m_Stats.Evicted;
+		m_DefragPending = true;
+	}
+
+	void TerrainStreamer::CreateHeightArray() {
+		constexpr int N = Resolution;
+
+		D3D11_TEXTURE2D_DESC desc = {};
+		desc.Width = N;
+		desc.Height = N;
+		desc.MipLevels = 1;
+		desc.ArraySize = m_MaxChunks;
+		desc.Format = DXGI_FORMAT_R32G32_UINT;
+		desc.SampleDesc.Count = 1;
+		desc.Usage = D3D11_USAGE_DEFAULT;
+		desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+		HRESULT hr = Renderer::Device()->CreateTexture2D(&desc, nullptr, m_HeightArray.GetAddressOf());
+		if (FAILED(hr)) {
+			DXE_ERROR("Terrain height array creation failed");
+			return;
+		}
+
+		D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+		srvDesc.Format = desc.Format;
+		srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2DARRAY;
+		srvDesc.Texture2DArray.MipLevels = 1;
+		srvDesc.Texture2DArray.ArraySize = m_MaxChunks;
+		hr = Renderer::Device()->CreateShaderResourceView(m_HeightArray.Get(), &srvDesc, m_HeightArraySRV.GetAddressOf());
+		if (FAILED(hr)) {
+			DXE_ERROR("Terrain height array SRV creation failed");
+			return;
+		}
+
+		// highest slice on top so the first chunks take the lowest
+		for (uint32_t slice = m_MaxChunks; slice-- > 0;) m_FreeSlices.push_back(slice);
+
+		if (!m_Settings.Material) {
+			if (!ShaderManager::Get()->Exists(TerrainChunkShader)) {
+				auto& shader = ShaderManager::Get()->GetRawShader("TerrainChunk.hlsl");
+				ShaderManager::Get()->AddShader(TerrainChunkShader, shader);
+			}
+			TerrainChunkMaterial::ChunkData data = { DXM::Vector3(0.42f, 0.5f, 0.3f), static_cast<float>(N - 1) };
+			m_Settings.Material = std::make_shared<TerrainChunkMaterial>(m_Settings.Name, data, m_HeightArraySRV.Get());
+		}
+
+		// unit grid centred on the chunk origin, heights only exist in the vertex shader
+		std::vector<Vertex> vertices(N * N);
+		const float step = 1.f / (N - 1.f);
+		for (int y = 0; y < N; ++y) {
+			for (int x = 0; x < N; ++x) {
+				Vertex& v = vertices[x + N * y];
+				v.Position = DXM::Vector3(x * step - 0.5f, y * step - 0.5f, 0.f);
+				v.Normal = DXM::Vector3(0.f, 0.f, 1.f);
+				v.Tangent = DXM::Vector3(1.f, 0.f, 0.f);
+				v.UV = DXM::Vector2(x * step, y * step);
+				v.Color = DXM::Vector4(1.f, 1.f, 1.f, 1.f);
+			}
+		}
+		m_Grid = MeshManager::Get()->CreateMeshBase(m_Settings.Name + "_Grid", vertices, m_Indices);
+		if (!m_Grid) {
+			DXE_ERROR("Terrain grid mesh name already in use: " + m_Settings.Name + "_Grid");
+			return;
+		}
+		m_Grid->SetMaterial(m_Settings.Material);
+		// the shadow pass doesn't read the height array, see the limitation in TerrainStreamer.h
+		m_Grid->m_CastsShadow = false;
+	}
+
+	MeshBase* TerrainStreamer::AcquireMesh(Chunk& chunk) {
+		if (!m_FreeMeshes.empty()) {
+			MeshBase* mesh = m_FreeMeshes.back();
+			m_FreeMeshes.pop_back();
+			mesh->UpdateVertices(std::move(chunk.Geometry->Vertices));
+			return mesh;
+		}
+
+		std::string name = m_Settings.Name + "_Chunk" + std::to_string(m_AllMeshes.size());
+		MeshBase* mesh = MeshManager::Get()->CreateMeshBase(name, chunk.Geometry->Vertices, m_Indices);
+		if (!mesh) {
+			DXE_ERROR("Terrain chunk mesh name already in use: " + name);
+			return nullptr;
+		}
+		mesh->SetMaterial(m_Settings.Material);
+		m_AllMeshes.push_back(mesh);
+		return mesh;
+	}
+
+	void TerrainStreamer::UploadTexels(Chunk& chunk) {
+		chunk.Slice = m_FreeSlices.back();
+		m_FreeSlices.pop_back();
+
+		UINT subresource = D3D11CalcSubresource(0, chunk.Slice, 1);
+		UINT rowPitch = 2 * sizeof(uint32_t) * Resolution;
+		Renderer::Context()->UpdateSubresource(m_HeightArray.Get(), subresource, nullptr, chunk.Geometry->Texels.data(), rowPitch, 0);
+
+		// the grid is flat, its bounds have to reach the highest resident chunk
+		if (chunk.Geometry->MaxAbsHeight > m_GridMaxAbsHeight) {
+			m_GridMaxAbsHeight = chunk.Geometry->MaxAbsHeight;
+			float z = m_GridMaxAbsHeight / m_Settings.ChunkWorldSize;
+			m_Grid->SetLocalBounds(DX::BoundingBox(DXM::Vector3::Zero, DXM::Vector3(0.5f, 0.5f, z)));
+		}
+	}
+
+	std::unique_ptr<TerrainStreamer::ChunkGeometry> TerrainStreamer::BuildGeometry(const NoiseTileService<Resolution>::Tile& tile) const {
+		constexpr int N = Resolution;
+		const float size = m_Settings.ChunkWorldSize;
+		const float heightScale = m_Settings.HeightScale;
+		// tile derivatives are per noise space unit, world slope is per world unit
+		const float slopeScale = heightScale * TerrainNoiseFrequency / size;
+		const float step = 1.f / (N - 1.f);
+
+		auto geometry = std::make_unique<ChunkGeometry>();
+		geometry->Heights = tile;
+
+		if (m_Settings.GeometryMode == TerrainGeometryMode::HeightTexture) {
+			geometry->Texels.resize(2 * N * N);
+			for (int i = 0; i < N * N; ++i) {
+				DXM::Vector4 texel = tile->GetVector(i % N, i / N);
+				float height = texel.x * heightScale;
+				DXM::Vector3 normal(-texel.y * slopeScale, -texel.z * slopeScale, 1.f);
+				normal.Normalize();
+				// z is always positive on a heightfield, the shader rebuilds it
+				geometry->Texels[2 * i] = std::bit_cast<uint32_t>(height);
+				geometry->Texels[2 * i + 1] = PackSnorm16(normal.x) | (PackSnorm16(normal.y) << 16);
+				geometry->MaxAbsHeight = (std::max)(geometry->MaxAbsHeight, fabsf(height));
+			}
+			return geometry;
+		}
+
+		geometry->Vertices.resize(N * N);
+		for (int y = 0; y < N; ++y) {
+			for (int x = 0; x < N; ++x) {
+				DXM::Vector4 texel = tile->GetVector(x, y);
+				float dhdx = texel.y * slopeScale;
+				float dhdy = texel.z * slopeScale;
+
+				Vertex& v = geometry->Vertices[x + N * y];
+				v.Position = DXM::Vector3((x * step - 0.5f) * size, (y * step - 0.5f) * size, texel.x * heightScale);
+				v.Normal = DXM::Vector3(-dhdx, -dhdy, 1.f);
+				v.Normal.Normalize();
+				v.Tangent = DXM::Vector3(1.f, 0.f, dhdx);
+				v.Tangent.Normalize();
+				v.UV = DXM::Vector2(x * step, y * step);
+				v.Color = DXM::Vector4(1.f, 1.f, 1.f, 1.f);
+			}
+		}
+		return geometry;
+	}
+}
@@ -0,0 +1,190 @@
+#pragma once
+#include "DXE.h"
+#include "Maths/Maths.h"
+#include "Maths/NoiseTileService.h"
+#include "Renderer/Buffer.h"
+#include "Renderer/Material.h"
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace DXE
+{
+	class MeshBase;
+	class MeshInstance;
+
+	enum class TerrainGeometryMode : uint8_t {
+		Vertices,     // a full Vertex array and index list per chunk mesh
+		HeightTexture // one shared grid mesh, each chunk is a slice of packed height + normal in a texture array
+	};
+
+	struct TerrainStreamingSettings {
+		std::string Name = "Terrain";
+		// HeightTexture mode creates a TerrainChunkMaterial when left empty, a custom material
+		// has to bind GetHeightArray() to vertex shader slot t0 itself
+		std::shared_ptr<DXE::Material> Material;
+		TerrainGeometryMode GeometryMode = TerrainGeometryMode::Vertices;
+		int Seed = 0;
+
+		float ChunkWorldSize = 64.f;
+		float HeightScale = 20.f;
+
+		// radii in chunks, chunks stay loaded until they leave the unload radius
+		float LoadRadius = 6.f;
+		float UnloadRadius = 8.f;
+		// > 0 loads chunks in front of the focus before chunks behind it
+		float ViewDirectionWeight = 1.f;
+
+		int MaxInFlight = 8;
+		size_t UploadBudgetBytes = 2 << 20; // per Update(), at least one chunk is always uploaded
+		size_t MemoryCapBytes = 64 << 20;   // loaded + pending chunk geometry
+		unsigned ThreadCount = 0; // split between tile generation and chunk builds, 0 uses every core but one
+		// Ranges of the shared MeshBufferPool an Update() with nothing to load or upload may move, 0 never defragments
+		uint32_t DefragMovesPerFrame = 16;
+	};
+
+	struct TerrainStreamingStats {
+		uint32_t Resident = 0;
+		uint32_t Queued = 0;
+		uint32_t Building = 0;
+		uint32_t Ready = 0;
+		uint32_t Failed = 0;
+		uint32_t UploadedThisFrame = 0;
+		size_t UploadedBytesThisFrame = 0;
+		uint64_t Uploaded = 0;
+		uint64_t Evicted = 0;
+		uint64_t Discarded = 0; // finished builds for chunks that were evicted meanwhile
+		uint64_t DefragMoves = 0;
+	};
+
+	// Default material of TerrainGeometryMode::HeightTexture, draws TerrainChunk.hlsl
+	class DXE_API TerrainChunkMaterial : public Material {
+	public:
+		struct ChunkData {
+			DXM::Vector3 Colour;
+			float GridCells; // quads per chunk side
+		};
+
+		TerrainChunkMaterial(const std::string& name, const ChunkData& data, ID3D11ShaderResourceView* heightArray);
+
+		bool BindShaders() override;
+		void UpdateBuffers() override;
+		void BindBuffers() override;
+
+	private:
+		ChunkData m_ChunkData;
+		Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> m_HeightArray;
+		Microsoft::WRL::ComPtr<ID3D11Buffer> m_ConstantBuffer;
+	};
+
+	// Streams terrain chunks around a focus point.
+	// Heights come from NoiseTileService tiles, chunk vertices are built on its worker threads and
+	// Update() uploads finished chunks on the calling (render) thread within a per-frame byte budget.
+	// Evicted chunks hand their MeshBase back to a pool, so steady state streaming never creates buffers.
+	// In HeightTexture mode every chunk is an instance of one grid mesh and only uploads 8 bytes per vertex
+	// (float height, two snorm16 normal components) into its slice of a texture array, the vertex shader
+	// derives positions from the grid.
+	// Limitation: HeightTexture chunks cast no shadows. The shadow pass draws with the renderer's depth shader,
+	// which only reads vertex positions, so the grid mesh is left out of it. Use Vertices mode for terrain
+	// that has to shadow itself or the scene.
+	class DXE_API TerrainStreamer {
+	public:
+		static constexpr int Resolution = 65; // vertices per chunk side
+
+		explicit TerrainStreamer(const TerrainStreamingSettings& settings);
+		~TerrainStreamer();
+
+		TerrainStreamer(const TerrainStreamer&) = delete;
+		TerrainStreamer& operator=(const TerrainStreamer&) = delete;
+
+		// Call once per frame from the render thread, forward is the camera look direction
+		void Update(const DXM::Vector3& focus, const DXM::Vector3& forward);
+		// Evicts every chunk, pooled meshes are kept
+		void Clear();
+
+		const TerrainStreamingSettings& GetSettings() const { return m_Settings; }
+		const TerrainStreamingStats& GetStats() const { return m_Stats; }
+		size_t GetChunkBytes() const { return m_ChunkBytes; }
+		uint32_t GetMaxChunks() const { return m_MaxChunks; }
+		// HeightTexture mode only, Resolution x Resolution x GetMaxChunks() R32G32_UINT
+		ID3D11ShaderResourceView* GetHeightArray() const { return m_HeightArraySRV.Get(); }
+
+		// Terrain height from loaded tiles, false if the chunk under (x, y) isn't built yet
+		bool TryGetHeight(float x, float y, float& height) const;
+
+	private:
+		// Failed: no mesh could be created for it, the chunk stays empty until it is evicted
+		enum class ChunkState : uint8_t { Queued, Building, Ready, Resident, Failed };
+
+		struct ChunkGeometry {
+			std::vector<Vertex> Vertices;
+			std::vector<uint32_t> Texels; // HeightTexture mode, height bits and packed normal per vertex
+			float MaxAbsHeight = 0.f;
+			NoiseTileService<Resolution>::Tile Heights;
+		};
+
+		struct Chunk {
+			int X = 0;
+			int Y = 0;
+			ChunkState State = ChunkState::Queued;
+			float Priority = 0.f;
+			uint32_t Ticket = 0;
+			std::unique_ptr<ChunkGeometry> Geometry;
+			NoiseTileService<Resolution>::Tile Heights;
+			MeshBase* Mesh = nullptr;
+			uint32_t Slice = 0; // HeightTexture mode
+			std::shared_ptr<MeshInstance> Instance;
+		};
+
+		struct CompletedBuild {
+			uint64_t Key = 0;
+			uint32_t Ticket = 0;
+			std::unique_ptr<ChunkGeometry> Geometry;
+		};
+
+		static uint64_t ChunkKey(int x, int y) { return (static_cast<uint64_t>(static_cast<uint32_t>(x)) << 32) | static_cast<uint32_t>(y); }
+
+		float ChunkPriority(int x, int y, const DXM::Vector2& focus, const DXM::Vector2& forward) const;
+		void DrainCompleted();
+		void SelectChunks(const DXM::Vector2& focus, const DXM::Vector2& forward);
+		void Dispatch();
+		void Upload();
+		void Evict(Chunk& chunk);
+
+		void CreateHeightArray();
+		MeshBase* AcquireMesh(Chunk& chunk);
+		void UploadTexels(Chunk& chunk);
+
+		// Runs on m_BuildPool
+		std::unique_ptr<ChunkGeometry> BuildGeometry(const NoiseTileService<Resolution>::Tile& tile) const;
+
+		TerrainStreamingSettings m_Settings;
+		TerrainStreamingStats m_Stats;
+		size_t m_ChunkBytes = 0;
+		uint32_t m_MaxChunks = 0;
+		uint32_t m_NextTicket = 0;
+		bool m_DefragPending = false; // meshes were uploaded or evicted since the pool was last compacted
+
+		std::unordered_map<uint64_t, Chunk> m_Chunks;
+		std::vector<uint32_t> m_Indices; // identical for every chunk
+		std::vector<MeshBase*> m_FreeMeshes;
+		std::vector<MeshBase*> m_AllMeshes;
+
+		// HeightTexture mode
+		MeshBase* m_Grid = nullptr;
+		float m_GridMaxAbsHeight = 0.f;
+		std::vector<uint32_t> m_FreeSlices;
+		Microsoft::WRL::ComPtr<ID3D11Texture2D> m_HeightArray;
+		Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> m_HeightArraySRV;
+
+		std::mutex m_CompletedMutex;
+		std::vector<CompletedBuild> m_Completed;
+
+		// declared last so workers stop before the completed list they write into is destroyed.
+		// BuildGeometry runs here for every tile, cached ones included, tile workers submit into it.
+		std::unique_ptr<ThreadPool> m_BuildPool;
+		std::unique_ptr<NoiseTileService<Resolution>> m_Tiles;
+	};
+}
@@ -112,6 +112,115 @@ float4 ps_main(VS_Output input) : SV_Target
 
     return float4(result, 1.0);
 }
+)" }, 
+        {  "CDLODTerrain.hlsl", R"( 
+cbuffer GlobalBuffer : register(b0)
+{
+    matrix ViewMatrix;
+    matrix ProjectionMatrix;
+    matrix ViewProjectionMatrix;
+
+    matrix LightViewMatrix;
+    matrix LightProjectionMatrix;
+    matrix LightViewProjectionMatrix;
+   
+    float3 CameraPosition;
+    float DeltaTime;
+
+    float3 SunColor;
+    float Time;
+
+    float3 SunDirection;
+    float SunIntensity;
+
+    float3 AmbientLight;
+    int FrameCount;
+
+    float2 ScreenSize;
+    float2 MousePosition;
+    float3 PlayerPos;
+    float padding;
+};
+
+cbuffer Terrain : register(b1)
+{
+    float2 HeightMapOrigin;
+    float HeightMapInvSize; // 1 / world size covered by the height map
+    float HeightMapTexel; // 1 / height map width
+    float HeightSampleSpacing; // world distance between height samples
+    float3 TerrainColour;
+};
+
+Texture2D<float> HeightMap : register(t0);
+SamplerState HeightSampler : register(s0);
+
+struct InstanceInput
+{
+    float4x4 world : INSTANCE_TRANSFORM; // node placement
+    float4 color : INSTANCE_COLOR; // x morph start, y morph end, z grid cells per side, w node size
+};
+
+struct VertexInput
+{
+    float3 pos : POSITION; // grid position in [0, 1]
+    float3 normal : NORMAL;
+    float3 tangent : TANGENT;
+    float2 uv : TEXCOORD;
+    float4 color : COLOR;
+};
+
+struct VertexOutput
+{
+    float4 pos : SV_POSITION;
+    float3 worldPos : POSITION;
+    float3 normal : NORMAL;
+};
+
+float SampleHeight(float2 world)
+{
+    // height samples sit on texel centres, sample 0 at the origin and the last one at the far edge
+    float2 uv = (world - HeightMapOrigin) * HeightMapInvSize;
+    uv = uv * (1.0 - HeightMapTexel) + 0.5 * HeightMapTexel;
+    return HeightMap.SampleLevel(HeightSampler, uv, 0);
+}
+
+VertexOutput vs_main(VertexInput vin, InstanceInput inst)
+{
+    VertexOutput vout;
+
+    float morphStart = inst.color.x;
+    float morphEnd = inst.color.y;
+    float gridCells = inst.color.z;
+    float nodeSize = inst.color.w;
+
+    float2 world = mul(float4(vin.pos, 1.0f), inst.world).xy;
+    float2 nodeMin = world - vin.pos.xy * nodeSize;
+    float distance = length(CameraPosition - float3(world, SampleHeight(world)));
+
+    // odd vertices slide onto the edge between their even neighbours, matching the next coarser grid at k = 1
+    float k = saturate((distance - morphStart) / max(morphEnd - morphStart, 1e-4));
+    float2 gridPos = vin.pos.xy;
+    gridPos -= frac(gridPos * gridCells * 0.5) * 2.0 / gridCells * k;
+    world = nodeMin + gridPos * nodeSize;
+
+    float height = SampleHeight(world);
+    float2 d = float2(HeightSampleSpacing, 0.0);
+    float dhdx = SampleHeight(world + d.xy) - SampleHeight(world - d.xy);
+    float dhdy = SampleHeight(world + d.yx) - SampleHeight(world - d.yx);
+
+    vout.worldPos = float3(world, height);
+    vout.normal = normalize(float3(-dhdx, -dhdy, 2.0 * HeightSampleSpacing));
+    vout.pos = mul(float4(vout.worldPos, 1.0f), ViewProjectionMatrix);
+    return vout;
+}
+
+float4 ps_main(VertexOutput pin) : SV_TARGET
+{
+    float3 normal = normalize(pin.normal);
+    float diffuse = saturate(dot(normal, -normalize(SunDirection))) * SunIntensity;
+    float3 colour = TerrainColour * (AmbientLight + SunColor * diffuse);
+    return float4(colour, 1.0);
+}
 )" }, 
         {  "ColorShader.hlsl", R"( 
 
@@ -331,6 +440,94 @@ float4 ps_main(VertexShaderOutput input) : SV_Target
 {
     return input.color;
 }
+)" }, 
+        {  "TerrainChunk.hlsl", R"( 
+cbuffer GlobalBuffer : register(b0)
+{
+    matrix ViewMatrix;
+    matrix ProjectionMatrix;
+    matrix ViewProjectionMatrix;
+
+    matrix LightViewMatrix;
+    matrix LightProjectionMatrix;
+    matrix LightViewProjectionMatrix;
+   
+    float3 CameraPosition;
+    float DeltaTime;
+
+    float3 SunColor;
+    float Time;
+
+    float3 SunDirection;
+    float SunIntensity;
+
+    float3 AmbientLight;
+    int FrameCount;
+
+    float2 ScreenSize;
+    float2 MousePosition;
+    float3 PlayerPos;
+    float padding;
+};
+
+cbuffer TerrainChunk : register(b1)
+{
+    float3 TerrainColour;
+    float GridCells; // quads per chunk side
+};
+
+// per texel: x height bits, y normal xy as two snorm16
+Texture2DArray<uint2> ChunkHeights : register(t0);
+
+struct InstanceInput
+{
+    float4x4 world : INSTANCE_TRANSFORM; // chunk placement
+    float4 color : INSTANCE_COLOR; // x texture array slice
+};
+
+struct VertexInput
+{
+    float3 pos : POSITION; // unit grid centred on the chunk
+    float3 normal : NORMAL;
+    float3 tangent : TANGENT;
+    float2 uv : TEXCOORD;
+    float4 color : COLOR;
+};
+
+struct VertexOutput
+{
+    float4 pos : SV_POSITION;
+    float3 worldPos : POSITION;
+    float3 normal : NORMAL;
+};
+
+VertexOutput vs_main(VertexInput vin, InstanceInput inst)
+{
+    VertexOutput vout;
+
+    int2 texel = int2(vin.uv * GridCells + 0.5);
+    uint2 packed = ChunkHeights.Load(int4(texel, (int)inst.color.x, 0));
+
+    int2 snorm = int2(packed.y << 16, packed.y) >> 16;
+    float2 nxy = max(float2(snorm) / 32767.0, -1.0);
+    float3 normal = float3(nxy, sqrt(saturate(1.0 - dot(nxy, nxy))));
+
+    float3 worldPos = mul(float4(vin.pos, 1.0f), inst.world).xyz;
+    worldPos.z = asfloat(packed.x);
+
+    vout.worldPos = worldPos;
+    vout.normal = normal;
+    vout.pos = mul(float4(worldPos, 1.0f), ViewProjectionMatrix);
+    return vout;
+}
+
+float4 ps_main(VertexOutput pin) : SV_TARGET
+{
+    float3 normal = normalize(pin.normal);
+    float diffuse = saturate(dot(normal, -normalize(SunDirection))) * SunIntensity;
+    float3 colour = TerrainColour * (AmbientLight + SunColor * diffuse);
+    return float4(colour, 1.0);
+}
 )" }, 
         {  "TestShader.hlsl", R"( 
 
@@ -0,0 +1,86 @@
+cbuffer GlobalBuffer : register(b0)
+{
+    matrix ViewMatrix;
+    matrix ProjectionMatrix;
+    matrix ViewProjectionMatrix;
+
+    matrix LightViewMatrix;
+    matrix LightProjectionMatrix;
+    matrix LightViewProjectionMatrix;
+   
+    float3 CameraPosition;
+    float DeltaTime;
+
+    float3 SunColor;
+    float Time;
+
+    float3 SunDirection;
+    float SunIntensity;
+
+    float3 AmbientLight;
+    int FrameCount;
+
+    float2 ScreenSize;
+    float2 MousePosition;
+    float3 PlayerPos;
+    float padding;
+};
+
+cbuffer TerrainChunk : register(b1)
+{
+    float3 TerrainColour;
+    float GridCells; // quads per chunk side
+};
+
+// per texel: x height bits, y normal xy as two snorm16
+Texture2DArray<uint2> ChunkHeights : register(t0);
+
+struct InstanceInput
+{
+    float4x4 world : INSTANCE_TRANSFORM; // chunk placement
+    float4 color : INSTANCE_COLOR; // x texture array slice
+};
+
+struct VertexInput
+{
+    float3 pos : POSITION; // unit grid centred on the chunk
+    float3 normal : NORMAL;
+    float3 tangent : TANGENT;
+    float2 uv : TEXCOORD;
+    float4 color : COLOR;
+};
+
+struct VertexOutput
+{
+    float4 pos : SV_POSITION;
+    float3 worldPos : POSITION;
+    float3 normal : NORMAL;
+};
+
+VertexOutput vs_main(VertexInput vin, InstanceInput inst)
+{
+    VertexOutput vout;
+
+    int2 texel = int2(vin.uv * GridCells + 0.5);
+    uint2 packed = ChunkHeights.Load(int4(texel, (int)inst.color.x, 0));
+
+    int2 snorm = int2(packed.y << 16, packed.y) >> 16;
+    float2 nxy = max(float2(snorm) / 32767.0, -1.0);
+    float3 normal = float3(nxy, sqrt(saturate(1.0 - dot(nxy, nxy))));
+
+    float3 worldPos = mul(float4(vin.pos, 1.0f), inst.world).xyz;
+    worldPos.z = asfloat(packed.x);
+
+    vout.worldPos = worldPos;
+    vout.normal = normal;
+    vout.pos = mul(float4(worldPos, 1.0f), ViewProjectionMatrix);
+    return vout;
+}
+
+float4 ps_main(VertexOutput pin) : SV_TARGET
+{
+    float3 normal = normalize(pin.normal);
+    float diffuse = saturate(dot(normal, -normalize(SunDirection))) * SunIntensity;
+    float3 colour = TerrainColour * (AmbientLight + SunColor * diffuse);
+    return float4(colour, 1.0);
+}
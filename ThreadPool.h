@@ -0,0 +1,129 @@
+#pragma once
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <memory>
+
+namespace DXE
+{
+	// Fixed set of worker threads pulling jobs from a single FIFO queue.
+	// Jobs must not throw; anything they produce should go through their own promise / callback.
+	class ThreadPool {
+	public:
+		explicit ThreadPool(unsigned threadCount = 0) {
+			if (threadCount == 0) {
+				threadCount = (std::max)(2u, std::thread::hardware_concurrency()) - 1;
+			}
+			m_Workers.reserve(threadCount);
+			for (unsigned i = 0; i < threadCount; ++i) {
+				m_Workers.emplace_back([this]() { WorkerLoop(); });
+			}
+		}
+		~ThreadPool() {
+			{
+				std::lock_guard<std::mutex> lock(m_Mutex);
+				m_Stopping = true;
+			}
+			m_JobAvailable.notify_all();
+			for (auto& worker : m_Workers) {
+				if (worker.joinable()) worker.join();
+			}
+		}
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+
+		void Submit(std::function<void()> job) {
+			{
+				std::lock_guard<std::mutex> lock(m_Mutex);
+				m_Jobs.push_back(std::move(job));
+				++m_Pending;
+			}
+			m_JobAvailable.notify_one();
+		}
+
+		// Blocks until every submitted job has finished
+		void WaitIdle() {
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			m_Idle.wait(lock, [this]() { return m_Pending == 0; });
+		}
+
+		// Splits [0, count) into chunks run across the workers, the calling thread helps too.
+		// fn(begin, end) is called once per chunk. Safe to call from inside a job: the caller
+		// only waits for the chunks, not for the helper jobs to be scheduled.
+		template<typename Fn>
+		void ParallelFor(int count, int chunkSize, Fn&& fn) {
+			if (count <= 0) return;
+			chunkSize = (std::max)(1, chunkSize);
+
+			struct ForState {
+				std::function<void(int, int)> Body;
+				int Count = 0;
+				int ChunkSize = 1;
+				int ChunkCount = 0;
+				std::atomic<int> Next{ 0 };
+				std::atomic<int> Done{ 0 };
+				std::mutex Mutex;
+				std::condition_variable Finished;
+			};
+			auto state = std::make_shared<ForState>();
+			state->Body = std::forward<Fn>(fn);
+			state->Count = count;
+			state->ChunkSize = chunkSize;
+			state->ChunkCount = (count + chunkSize - 1) / chunkSize;
+
+			auto runChunks = [](ForState& s) {
+				for (int c = s.Next.fetch_add(1); c < s.ChunkCount; c = s.Next.fetch_add(1)) {
+					int begin = c * s.ChunkSize;
+					s.Body(begin, (std::min)(s.Count, begin + s.ChunkSize));
+					if (s.Done.fetch_add(1) + 1 == s.ChunkCount) {
+						std::lock_guard<std::mutex> lock(s.Mutex);
+						s.Finished.notify_all();
+					}
+				}
+			};
+
+			int helpers = (std::min)(static_cast<int>(m_Workers.size()), state->ChunkCount - 1);
+			for (int i = 0; i < helpers; ++i) {
+				Submit([state, runChunks]() { runChunks(*state); });
+			}
+			runChunks(*state);
+
+			std::unique_lock<std::mutex> lock(state->Mutex);
+			state->Finished.wait(lock, [&]() { return state->Done.load() == state->ChunkCount; });
+		}
+
+		unsigned ThreadCount() const { return static_cast<unsigned>(m_Workers.size()); }
+
+	private:
+		void WorkerLoop() {
+			while (true) {
+				std::function<void()> job;
+				{
+					std::unique_lock<std::mutex> lock(m_Mutex);
+					m_JobAvailable.wait(lock, [this]() { return m_Stopping || !m_Jobs.empty(); });
+					if (m_Stopping && m_Jobs.empty()) return;
+					job = std::move(m_Jobs.front());
+					m_Jobs.pop_front();
+				}
+				job();
+				{
+					std::lock_guard<std::mutex> lock(m_Mutex);
+					if (--m_Pending == 0) m_Idle.notify_all();
+				}
+			}
+		}
+
+		std::vector<std::thread> m_Workers;
+		std::deque<std::function<void()>> m_Jobs;
+		std::mutex m_Mutex;
+		std::condition_variable m_JobAvailable;
+		std::condition_variable m_Idle;
+		size_t m_Pending = 0;
+		bool m_Stopping = false;
+	};
+}